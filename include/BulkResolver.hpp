@@ -0,0 +1,91 @@
+#pragma once
+#include "DNSResolver.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Offline resolution of large name lists. Each input line holds a name and
+// optionally a record type ("example.com MX" or "example.com,MX"); blank
+// lines and lines starting with '#' are skipped. Regular files are read
+// through mmap, anything else (stdin, pipes) as a stream. Workers resolve
+// the names in batches so that about inFlight lookups are outstanding, and
+// each batch's results are written as soon as it completes, so output
+// order follows completion, not input.
+class BulkResolver
+{
+public:
+    enum class Format
+    {
+        JSONLines, // one JSON object per lookup
+        CSV,       // one row per answer record, with a header row
+    };
+
+    struct Config
+    {
+        size_t inFlight = 256; // lookups outstanding at once
+        size_t batchSize = 16; // lookups sent together upstream
+        Format format = Format::JSONLines;
+        std::vector<DNSRecordType> types{DNSRecordType::A}; // for lines without a type
+        std::chrono::milliseconds progressInterval{1000};   // stderr report, 0 disables
+    };
+
+    struct Summary
+    {
+        uint64_t lookups = 0;
+        uint64_t answered = 0;
+        uint64_t empty = 0;    // NODATA: the name has no records of the type
+        uint64_t nxdomain = 0; // the name does not exist
+        uint64_t failed = 0;   // SERVFAIL, timeouts and other upstream errors
+        uint64_t invalid = 0;  // unparsable lines, bad names or types
+        double seconds = 0;
+    };
+
+    BulkResolver(DNSResolver &resolver, const Config &config);
+
+    // Resolves every name in `path` ("-" for stdin), writing results to
+    // `output`. Throws std::runtime_error when the input can't be opened.
+    Summary run(const std::string &path, std::ostream &output);
+
+private:
+    struct Lookup
+    {
+        std::string name;
+        DNSRecordType type;
+    };
+    using Batch = std::vector<Lookup>;
+
+    DNSResolver &resolver;
+    Config config;
+    std::ostream *output = nullptr;
+    std::mutex outputMutex;
+
+    std::deque<Batch> queue;
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::condition_variable queueSpace;
+    size_t queueCapacity = 0;
+    bool inputDone = false;
+
+    Batch pending;
+    std::atomic<uint64_t> lookups{0};
+    std::atomic<uint64_t> answered{0};
+    std::atomic<uint64_t> empty{0};
+    std::atomic<uint64_t> nxdomain{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> invalid{0};
+
+    void readFile(const std::string &path);
+    void readStream(std::istream &input);
+    void addLine(const char *line, size_t length);
+    void enqueue(Batch batch);
+    void worker();
+    void resolveBatch(Batch &batch);
+    void writeInvalid(const std::string &name, const std::string &type, const std::string &reason);
+    void write(const std::string &text);
+    void report(std::chrono::steady_clock::time_point start, bool final);
+};
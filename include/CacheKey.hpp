@@ -0,0 +1,64 @@
+#pragma once
+#include "DNSRecordTypes.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Cache key: the case-folded wire-format name followed by the big-endian
+// record type, hashed once on construction and compared with memcmp.
+// A key either owns its bytes or borrows a caller's buffer; lookups build
+// borrowed keys over stack storage so a hit allocates nothing, and only
+// keys that get inserted are copied into owning ones.
+class CacheKey
+{
+public:
+    static const size_t MAX_SIZE = 255 + 2; // longest wire name plus type
+    using Buffer = uint8_t[MAX_SIZE];
+
+    // Owning key for a presentation-format name; a trailing dot is ignored.
+    // Throws std::runtime_error for names that can't be wire-encoded.
+    CacheKey(const std::string &domain, DNSRecordType type);
+
+    // Borrowed keys encoded into `buffer`, which must outlive them
+    static CacheKey view(const std::string &domain, DNSRecordType type, Buffer &buffer);
+    static CacheKey fromWire(const uint8_t *name, size_t nameLength, DNSRecordType type, Buffer &buffer);
+
+    // Borrowed key over bytes previously taken from data()
+    static CacheKey fromBytes(const uint8_t *bytes, size_t size);
+
+    CacheKey owned() const;
+
+    const uint8_t *data() const
+    {
+        return owning ? reinterpret_cast<const uint8_t *>(storage.data()) : external;
+    }
+    size_t size() const { return length; }
+    uint64_t hash() const { return hashValue; }
+
+    DNSRecordType type() const;
+    std::string domain() const; // lowercase presentation form
+
+    bool operator==(const CacheKey &other) const
+    {
+        return hashValue == other.hashValue && length == other.length &&
+               std::memcmp(data(), other.data(), length) == 0;
+    }
+
+    struct Hash
+    {
+        size_t operator()(const CacheKey &key) const { return static_cast<size_t>(key.hashValue); }
+    };
+
+private:
+    CacheKey() = default;
+
+    std::string storage;
+    const uint8_t *external = nullptr;
+    uint64_t hashValue = 0;
+    uint16_t length = 0;
+    bool owning = false;
+
+    static size_t encode(const std::string &domain, DNSRecordType type, uint8_t *out);
+    void computeHash();
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include "CacheKey.hpp"
+#include "CompactRecord.hpp"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+
+// Shares cached answers between resolver instances. Every name has one
+// owning peer, picked on a consistent hash ring so adding or removing a
+// peer only moves the names next to it. On a local miss the owner's cache
+// is asked before going upstream, and fresh upstream answers are
+// published to their owner so the next instance to miss finds them.
+//
+// Peers talk DNS messages over UDP on a port of their own: a query asks
+// the owner's cache and is answered NOERROR with the records, TTLs
+// counting down, or REFUSED on a miss (the owner never recurses for a
+// peer); a message with the UPDATE opcode carries a published answer and
+// gets no reply. Questions are only answered for the hosts of `peers`,
+// publishes only taken from their peer sockets, and a publish may only
+// carry records owned by its question's name or that name's CNAME chain.
+// Source addresses are not authenticated, though, so peers must trust
+// each other and the port must not be reachable from elsewhere.
+class CachePeering
+{
+public:
+    struct Config
+    {
+        std::string listen;               // "host:port" of this instance's peer socket; empty disables peering
+        std::vector<std::string> peers;   // "host:port" or "[v6-host]:port" of every instance, this one included
+        size_t timeout = 20;              // milliseconds to wait for a peer's answer
+        size_t virtualNodes = 64;         // ring points per peer
+        size_t retryInterval = 1000;      // milliseconds a peer that timed out is skipped
+    };
+
+    struct Counters
+    {
+        uint64_t queries = 0;        // questions sent to owning peers
+        uint64_t hits = 0;           // answered from a peer's cache
+        uint64_t publishes = 0;      // answers sent to their owner
+        uint64_t served = 0;         // peer questions this instance answered from its cache
+        uint64_t stored = 0;         // published answers this instance took in
+        std::chrono::nanoseconds latency{0}; // spent waiting for peers, hit or miss
+    };
+
+    // Cache access for the serving side: `lookup` fills the records with
+    // their remaining TTLs and returns false on a miss, `store` inserts
+    using Lookup = std::function<bool(const CacheKey &, std::vector<CompactRecord> &)>;
+    using Store = std::function<void(const CacheKey &, const std::vector<CompactRecord> &)>;
+
+    // Binds the peer socket and starts answering peers; throws
+    // std::runtime_error for bad addresses or when the socket can't be bound
+    CachePeering(const Config &config, Lookup lookup, Store store);
+    ~CachePeering();
+
+    CachePeering(const CachePeering &) = delete;
+    CachePeering &operator=(const CachePeering &) = delete;
+
+    // Asks the owners of the questions in one round trip. `found[i]` is
+    // set, with the records in `results[i]`, for answers from a peer's
+    // cache; questions this instance owns, misses and timeouts are left
+    // for upstream.
+    void fetch(const std::vector<std::pair<std::string, DNSRecordType>> &questions,
+               std::vector<std::vector<CompactRecord>> &results,
+               std::vector<bool> &found);
+
+    // Sends a fresh upstream answer to its owner unless that is this
+    // instance; never waits
+    void publish(const std::string &domain, DNSRecordType type, const std::vector<CompactRecord> &records);
+
+    Counters getCounters() const;
+
+private:
+    static constexpr size_t WINDOW = 256; // questions in flight per round trip
+
+    struct Peer
+    {
+        sockaddr_storage address{};
+        socklen_t length = 0;
+        std::string name;
+        std::atomic<int64_t> retryAt{0}; // steady_clock ticks; skipped until then after a timeout
+    };
+
+    Config config;
+    Lookup lookup;
+    Store store;
+    std::vector<std::unique_ptr<Peer>> peers;
+    std::vector<std::pair<uint64_t, size_t>> ring; // sorted points and the peer each belongs to
+    size_t self = 0;                               // index of this instance in peers
+    int fd = -1;
+    std::thread server;
+    std::atomic<bool> running{true};
+
+    std::atomic<uint64_t> queries{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> publishes{0};
+    std::atomic<uint64_t> served{0};
+    std::atomic<uint64_t> stored{0};
+    std::atomic<int64_t> latency{0}; // nanoseconds
+
+    // Index of the owning peer of a key
+    size_t owner(const CacheKey &key) const;
+
+    void serve();
+    void handle(const uint8_t *data, size_t size, const sockaddr_storage &from, socklen_t fromLength);
+
+    // Owned questions from questions[first, first + count), sent and
+    // awaited on `socket`
+    void exchange(int socket, const std::vector<std::pair<std::string, DNSRecordType>> &questions,
+                  size_t first, size_t count, std::vector<std::vector<CompactRecord>> &results,
+                  std::vector<bool> &found);
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include "DNSResolver.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Fills a new instance's cache with the names it is most likely to be
+// asked, so it starts near its steady-state hit rate. The input is either
+// a popularity list, "name [type [count]]" per line as DNSResolver writes
+// to its popularityPath, or a query log: BIND's "query: name IN type" and
+// dnsmasq's "query[type] name" lines are recognized. Repeated names add
+// up. Input is streamed and at most trackedNames distinct questions are
+// counted; past that the less frequent half is dropped, so memory stays
+// bounded however long the log is. The topN most frequent then go through
+// resolveRecordsBatch, paced to `rate` questions a second so a fleet of
+// new instances doesn't flood the upstream servers.
+class CacheWarmer
+{
+public:
+    struct Config
+    {
+        size_t topN = 10000;          // questions resolved
+        size_t rate = 500;            // questions per second, 0 = unlimited
+        size_t batchSize = 50;        // questions per resolveRecordsBatch call
+        size_t trackedNames = 200000; // distinct questions counted while reading
+    };
+
+    struct Entry
+    {
+        std::string name;
+        DNSRecordType type;
+        uint64_t count;
+    };
+
+    struct Summary
+    {
+        uint64_t lines = 0;
+        uint64_t invalid = 0;    // unparsable lines, bad names or types
+        uint64_t questions = 0;  // picked for warming
+        uint64_t answered = 0;
+        uint64_t empty = 0;      // NODATA: the name has no records of the type
+        uint64_t nxdomain = 0;   // the name does not exist
+        uint64_t failed = 0;     // SERVFAIL, timeouts and other upstream errors
+        double seconds = 0;
+    };
+
+    CacheWarmer(DNSResolver &resolver, const Config &config);
+    ~CacheWarmer(); // stops a background run
+
+    CacheWarmer(const CacheWarmer &) = delete;
+    CacheWarmer &operator=(const CacheWarmer &) = delete;
+
+    // The topN most frequent questions in the input, most frequent first;
+    // equal counts keep input order
+    std::vector<Entry> read(std::istream &input, Summary &summary) const;
+
+    // Reads `path` ("-" for stdin) and resolves its top questions, returning
+    // when done. Throws std::runtime_error when the input can't be opened.
+    Summary run(const std::string &path);
+
+    // run() on a background thread, so serving can start right away.
+    // Opening the input still throws here; `done` is called on the
+    // background thread at the end.
+    void start(const std::string &path, std::function<void(const Summary &)> done = nullptr);
+
+    // Ends a background run after the batch in flight
+    void stop();
+
+private:
+    DNSResolver &resolver;
+    Config config;
+    std::thread thread;
+    std::mutex stopMutex;
+    std::condition_variable stopWake;
+    bool stopping = false;
+
+    static std::ifstream open(const std::string &path);
+    Summary warm(std::istream &input);
+};
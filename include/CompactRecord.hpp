@@ -0,0 +1,84 @@
+#pragma once
+#include "DNSRecordTypes.hpp"
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+#include <netinet/in.h>
+
+// Resource record as a type tag plus a binary payload: addresses stay in
+// network form, numbers as numbers and TXT as its wire bytes. Text is only
+// produced when asked for through text() or the DNSRecord adapter.
+struct CompactRecord
+{
+    struct Name // CNAME, NS, PTR
+    {
+        std::string target;
+    };
+
+    struct MX
+    {
+        uint16_t preference;
+        std::string exchange;
+    };
+
+    struct SRV
+    {
+        uint16_t priority;
+        uint16_t weight;
+        uint16_t port;
+        std::string target;
+    };
+
+    struct SOA
+    {
+        std::string mname;
+        std::string rname;
+        uint32_t serial;
+        uint32_t refresh;
+        uint32_t retry;
+        uint32_t expire;
+        uint32_t minimum;
+    };
+
+    struct TXT // length-prefixed character-strings, as on the wire
+    {
+        std::string strings;
+    };
+
+    struct Opaque // any other type, RDATA kept verbatim
+    {
+        std::string rdata;
+    };
+
+    // SOA is large and rare, so it is shared instead of stored inline
+    using Payload = std::variant<Opaque, in_addr, in6_addr, Name, MX, SRV, TXT, std::shared_ptr<const SOA>>;
+
+    DNSRecordType type = DNSRecordType::A;
+    uint32_t ttl = 0;
+    std::string name;
+    Payload payload;
+
+    // Decodes the RDATA at message[offset, offset + length); names may
+    // point elsewhere in the message. Throws std::runtime_error when the
+    // data is malformed for its type.
+    static Payload decodeData(DNSRecordType type, const uint8_t *message, size_t messageSize,
+                              size_t offset, size_t length);
+
+    // Appends the RDATA with uncompressed names
+    void encodeData(std::vector<uint8_t> &buffer) const;
+
+    // Target of a CNAME, NS or PTR record, nullptr for other payloads
+    const std::string *target() const;
+
+    // Presentation form of the data, as in a zone file
+    std::string text() const;
+    std::vector<std::string> textStrings() const; // TXT only
+
+    // DNSRecord compatibility. fromRecord throws std::runtime_error when
+    // the record's text doesn't parse; fromRecords skips such records.
+    DNSRecord toRecord() const;
+    static CompactRecord fromRecord(const DNSRecord &record);
+    static std::vector<DNSRecord> toRecords(const std::vector<CompactRecord> &records);
+    static std::vector<CompactRecord> fromRecords(const std::vector<DNSRecord> &records);
+};
@@ -2,35 +2,200 @@
 #include <Poco/Net/SocketAddress.h>
 #include <Poco/Net/DatagramSocket.h>
 #include "DNSQuery.hpp"
-#include <queue>
-#include <mutex>
-#include <memory>
+#include "DatagramBatch.hpp"
+#include "MPMCRing.hpp"
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+// Upstream transports selectable through DNSResolver::Config
+enum class TransportBackend
+{
+    UDP,     // blocking Poco datagram sockets, works everywhere
+    IOUring, // io_uring with a multishot receive, Linux 6.0+
+    TLS,     // DNS over TLS on persistent, pipelined connections
+    HTTPS,   // DNS over HTTPS, HTTP/1.1 keep-alive with pipelining
+};
+
+// How the HTTPS transport sends queries (RFC 8484)
+enum class DoHMethod
+{
+    POST, // the message as the request body
+    GET,  // the message base64url-encoded in the URI, cacheable by HTTP caches
+};
 
+class TLSContext;
+
+// Thrown when the upstream itself failed (timeout, refused, socket error),
+// as opposed to answering with an error; feeds the pool's circuit breakers
+class UpstreamError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// A connection to one upstream server, handed out by ConnectionPool
 class DNSConnection
 {
 public:
-    DNSConnection(const std::string &nameserver, uint16_t port);
-    bool isValid() const;
-    void query(const std::string &domain, DNSRecordType type);
-    std::vector<DNSRecord> getResponse();
+    virtual ~DNSConnection() = default;
+
+    // Index of the upstream this connection talks to, set by ConnectionPool
+    size_t upstream = 0;
+
+    // How long getResponse() and exchangeBatch() wait for answers
+    std::chrono::milliseconds responseTimeout{5000};
+
+    // Sets the DO bit so answers come with their DNSSEC records
+    bool dnssecOk = false;
+
+    virtual bool isValid() const = 0;
+    virtual void query(const std::string &domain, DNSRecordType type) = 0;
+    virtual std::vector<CompactRecord> getResponse() = 0;
+
+    // Sends every question at once and collects the responses, matched by
+    // transaction ID. Questions unanswered at the timeout, or with
+    // malformed answers, come back as default (SERVFAIL) responses whose
+    // `answered` is false, unlike a SERVFAIL the upstream sent.
+    virtual std::vector<DNSQuery::Response> exchangeBatch(
+        const std::vector<std::pair<std::string, DNSRecordType>> &questions) = 0;
+
+protected:
+    // For the datagram transports: asks the questions whose responses came
+    // back truncated again over TCP to `server` (RFC 7766), pipelined on one
+    // connection. Those still unanswered at the timeout stay SERVFAIL.
+    void retryOverTCP(const sockaddr *server, socklen_t serverLength,
+                      const std::vector<std::pair<std::string, DNSRecordType>> &questions,
+                      std::vector<DNSQuery::Response> &results) const;
+};
+
+class UDPConnection : public DNSConnection
+{
+public:
+    UDPConnection(const std::string &nameserver, uint16_t port);
+    bool isValid() const override;
+    void query(const std::string &domain, DNSRecordType type) override;
+    std::vector<CompactRecord> getResponse() override;
+
+    // Batches go out with one sendmmsg and come back through recvmmsg
+    std::vector<DNSQuery::Response> exchangeBatch(
+        const std::vector<std::pair<std::string, DNSRecordType>> &questions) override;
 
 private:
     std::unique_ptr<Poco::Net::DatagramSocket> socket;
+    std::unique_ptr<DatagramBatch> batch;
     Poco::Net::SocketAddress serverAddress;
     bool valid;
+    uint16_t expectedId = 0;
+    std::pair<std::string, DNSRecordType> pending; // for a TCP retry of a truncated answer
     static const int BUFFER_SIZE = 4096;
 };
 
+// Connections are owned by the pool and handed out as raw handles through
+// lock-free per-upstream rings, so acquire/release cost a CAS instead of a
+// mutex and shared_ptr refcount traffic. Each upstream has a circuit
+// breaker: repeated failures open it and traffic moves to the others until
+// a health probe or a half-open trial query sees the upstream answer again.
+// Sockets that go invalid are recreated rather than dropped.
 class ConnectionPool {
 public:
-    ConnectionPool(size_t poolSize, const std::vector<std::string>& nameservers);
-    std::shared_ptr<DNSConnection> acquire();
-    void release(std::shared_ptr<DNSConnection> conn);
+    struct Config {
+        size_t poolSize = 10;
+        TransportBackend backend = TransportBackend::UDP;
+        std::chrono::milliseconds acquireTimeout{5000};
+        std::chrono::milliseconds responseTimeout{5000};
+        bool dnssecOk = false;                         // queries ask for DNSSEC records
+        size_t failureThreshold = 5;                   // consecutive failures that open a breaker
+        std::chrono::milliseconds openDuration{5000};  // before a half-open trial is allowed
+        std::chrono::milliseconds healthInterval{1000};
+        std::chrono::milliseconds probeTimeout{1000};
+        std::string tlsCaFile;                         // TLS trust store, system default when empty
+        bool tlsVerify = true;                         // check upstream certificates
+        std::chrono::milliseconds tlsIdleTimeout{10000}; // idle TLS connections are reopened before use
+        DoHMethod dohMethod = DoHMethod::POST;
+    };
+
+    // Nameservers are "host", "host:port" or "[v6-host]:port", with TLS
+    // and HTTPS optionally followed by "#name" for the name the certificate
+    // must carry. HTTPS nameservers may also be URLs,
+    // "https://host[:port]/path", the path defaulting to /dns-query. The
+    // port defaults to 53, 853 for TLS and 443 for HTTPS.
+
+    ConnectionPool(const std::vector<std::string>& nameservers, const Config& config);
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // Returns nullptr when no connection to a healthy upstream frees up
+    // within the acquire timeout
+    DNSConnection* acquire();
+
+    // Returns a connection together with the outcome of its query
+    void release(DNSConnection* conn, bool succeeded = true);
+
+    // The backend in use; IOUring falls back to UDP when the kernel lacks support
+    TransportBackend getBackend() const { return backend; }
+
+    // Upstreams whose circuit breaker is currently closed
+    size_t healthyUpstreams() const;
+
+    // TLS handshakes made so far by the TLS or HTTPS transport, and how
+    // many of them resumed a session
+    uint64_t tlsHandshakes() const;
+    uint64_t tlsResumptions() const;
 
 private:
-    std::queue<std::shared_ptr<DNSConnection>> connections;
-    std::mutex poolMutex;
-    std::condition_variable cv;
-    size_t maxSize;
+    enum class BreakerState : uint8_t
+    {
+        Closed,   // normal traffic
+        Open,     // skipped until openDuration has passed
+        HalfOpen, // one trial query decides
+    };
+
+    struct Upstream
+    {
+        Upstream(const std::string& host, uint16_t port, const std::string& serverName,
+                 const std::string& path, size_t capacity)
+            : host(host), port(port), serverName(serverName), path(path), idle(capacity) {}
+
+        std::string host;
+        uint16_t port;
+        std::string serverName; // TLS and HTTPS only
+        std::string path;       // HTTPS only
+        MPMCRing<DNSConnection*> idle;
+        std::atomic<BreakerState> state{BreakerState::Closed};
+        std::atomic<uint32_t> failures{0};
+        std::atomic<int64_t> openedAt{0}; // steady_clock ticks
+        std::atomic<bool> trialInFlight{false};
+
+        // Ownership and repair bookkeeping, guarded by repairMutex
+        std::vector<std::unique_ptr<DNSConnection>> owned;
+        std::vector<size_t> broken; // indices into owned awaiting recreation
+    };
+
+    Config config;
+    std::vector<std::unique_ptr<Upstream>> upstreams;
+    std::atomic<TransportBackend> backend; // connections are built on several threads
+    std::shared_ptr<TLSContext> tlsContext;
+
+    std::mutex repairMutex;
+    std::mutex healthMutex;
+    std::condition_variable healthWake;
+    bool stopping = false;
+    std::thread healthThread;
+
+    std::unique_ptr<DNSConnection> createConnection(const Upstream& upstream);
+    std::unique_ptr<DNSConnection> createEncrypted(const Upstream& upstream) const;
+    bool admit(Upstream& upstream, bool& trial);
+    void recordSuccess(Upstream& upstream);
+    void recordFailure(Upstream& upstream);
+    void openBreaker(Upstream& upstream);
+    void repair(Upstream& upstream, DNSConnection* conn);
+    void healthLoop();
+    bool probe(const Upstream& upstream) const;
 };
\ No newline at end of file
@@ -1,42 +1,140 @@
 // DNSCache.hpp
 #pragma once
+#include "CacheKey.hpp"
+#include "CompactRecord.hpp"
 #include "DNSRecordTypes.hpp"
+#include "FrequencySketch.hpp"
+#include "TimingWheel.hpp"
 #include <unordered_map>
 #include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <list>
+#include <memory>
 #include <string>
+#include <thread>
+
+// How a full cache picks what to drop
+enum class EvictionPolicy
+{
+    LRU,     // least recently used goes first
+    TinyLFU, // W-TinyLFU: small LRU window, frequency-gated main area
+};
 
 class DNSCache
 {
 public:
+    // Encoded response for an entry: header, question and answers as sent
+    // to a client, with the offsets of every TTL field so a hit only has to
+    // patch the ID, the question case and the TTLs
+    struct WireTemplate
+    {
+        std::vector<uint8_t> response;
+        std::vector<uint16_t> ttlOffsets;
+        std::chrono::system_clock::time_point created;
+        std::chrono::system_clock::time_point expiry; // earliest record expiry
+    };
+
     struct CacheEntry
     {
-        std::vector<DNSRecord> records;
+        std::vector<CompactRecord> records;
         std::chrono::system_clock::time_point insertTime;
         std::chrono::system_clock::time_point lastAccess;
+        std::shared_ptr<const WireTemplate> wire;
+        std::chrono::system_clock::time_point expiry; // earliest record expiry
+        std::list<const CacheKey *>::iterator lruPosition;
+        uint8_t segment = 0;
     };
 
-    explicit DNSCache(size_t maxSize = 1000);
+    struct Counters
+    {
+        uint64_t evictions = 0;
+        uint64_t admissionRejections = 0; // new entries TinyLFU turned away
+        uint64_t hits = 0;                // get() and getWire() lookups answered
+        uint64_t misses = 0;              // get() lookups that found nothing fresh
+    };
+
+    explicit DNSCache(size_t maxSize = 1000, EvictionPolicy policy = EvictionPolicy::LRU);
+    ~DNSCache();
 
-    bool get(const std::string &key, std::vector<DNSRecord> &records);
-    void put(const std::string &key, const std::vector<DNSRecord> &records);
+    // Lookups accept borrowed keys; put() copies the key only on insertion.
+    // With `wire`, a hit also hands out the entry's unexpired template,
+    // nullptr if it has none.
+    bool get(const CacheKey &key, std::vector<CompactRecord> &records,
+             std::shared_ptr<const WireTemplate> *wire = nullptr);
+    void put(const CacheKey &key, const std::vector<CompactRecord> &records);
+    std::shared_ptr<const WireTemplate> getWire(const CacheKey &key);
+    void putWire(const CacheKey &key, std::shared_ptr<const WireTemplate> wire);
+    // Removes every entry whose earliest record has expired
     void evictExpired();
+
+    // Removes at most maxBatch expired entries under one short lock hold;
+    // returns true when more are due
+    bool reapExpired(size_t maxBatch);
+
+    // Background thread calling reapExpired every interval, in batches of
+    // batchSize with the lock released in between, so lookups never wait
+    // behind a full sweep
+    void startReaper(std::chrono::milliseconds interval = std::chrono::milliseconds(1000),
+                     size_t batchSize = 256);
+    void stopReaper();
+
     void clear();
     size_t size() const;
 
-    // Static helper to create consistent cache keys
-    static std::string createCacheKey(const std::string &domain, uint16_t type)
-    {
-        return domain + "_" + std::to_string(type);
-    }
+    EvictionPolicy getPolicy() const { return policy; }
+    Counters getCounters() const;
+
+    // Writes every entry, most valuable first, to a versioned binary
+    // snapshot (via a temporary file and rename). Returns the entry count.
+    size_t saveSnapshot(const std::string &path) const;
+
+    // Writes the cached names and types as text, "name type count" per
+    // line, most popular first: by sketch frequency (0-15), then in
+    // snapshot order. Meant for warming another instance; returns the
+    // line count.
+    size_t savePopularity(const std::string &path) const;
+
+    // Loads a snapshot through mmap. Entries keep their original insert
+    // time, so remaining TTLs are rebased on the wall clock and entries
+    // whose earliest record expired meanwhile are skipped. Keys already cached win. Returns
+    // the number of entries loaded, 0 when the file does not exist.
+    size_t loadSnapshot(const std::string &path);
 
 private:
-    std::unordered_map<std::string, CacheEntry> cache;
-    std::list<std::string> lruList;
+    using EntryMap = std::unordered_map<CacheKey, CacheEntry, CacheKey::Hash>;
+
+    // W-TinyLFU segments. New entries enter the window; its overflow must
+    // out-score the probation victim in the sketch to stay. A hit in
+    // probation promotes to protected. Under LRU only the window is used.
+    enum Segment : uint8_t
+    {
+        Window,
+        Probation,
+        Protected,
+    };
+
+    EntryMap cache;
+    std::list<const CacheKey *> segments[3]; // keys live in the map nodes
+    TimingWheel expiryWheel;
     mutable std::mutex cacheMutex;
     const size_t maxCacheSize;
+    const EvictionPolicy policy;
+    size_t windowCapacity;
+    size_t protectedCapacity;
+    FrequencySketch sketch;
+    Counters counters;
+
+    std::thread reaper;
+    std::mutex reaperMutex;
+    std::condition_variable reaperWake;
+    bool reaperStopping = false;
+
+    static const uint32_t SNAPSHOT_VERSION = 3;
 
-    void evictLRU();
-    void updateLRU(const std::string &key);
+    void touch(EntryMap::iterator it, bool count);
+    void admit(EntryMap::iterator it);
+    void moveTo(CacheEntry &entry, Segment segment);
+    void removeEntry(EntryMap::iterator it);
+    void scheduleExpiry(const CacheKey &key, CacheEntry &entry);
 };
\ No newline at end of file
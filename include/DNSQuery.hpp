@@ -1,4 +1,5 @@
 #pragma once
+#include "CompactRecord.hpp"
 #include "DNSRecordTypes.hpp"
 #include <vector>
 #include <string>
@@ -16,16 +17,65 @@ public:
         DNSRecordType type;
     };
 
+    // Question of an incoming query, as seen by the serving side
+    struct Question
+    {
+        uint16_t id;
+        uint16_t flags;
+        std::string domain;
+        DNSRecordType type;
+        uint16_t qclass;
+        size_t length;           // header + question section bytes
+        uint16_t udpPayloadSize; // from the EDNS0 OPT record, 0 if absent
+    };
+
+    // A parsed upstream response. Default-constructed, it stands for a
+    // question that got no usable answer.
+    struct Response
+    {
+        DNSResponseCode rcode = DNSResponseCode::SERVFAIL;
+        std::vector<CompactRecord> answers;
+        std::vector<CompactRecord> authority;
+        uint32_t negativeTtl = 0; // RFC 2308: min(SOA TTL, SOA minimum), 0 without an SOA
+        bool truncated = false;   // TC was set: SERVFAIL without records until asked over TCP
+        bool answered = false;    // a reply came back; false for timeouts and transport failures
+    };
+
     static std::vector<uint8_t> buildQuery(const std::string &domain,
                                            DNSRecordType type);
+    static std::vector<uint8_t> buildQuery(const std::string &domain,
+                                           DNSRecordType type,
+                                           uint16_t id,
+                                           bool dnssecOk = false);
+    static uint16_t generateQueryId();
+    // Whether a response carries the question of a query built above;
+    // the name may come back in another case
+    static bool matchesQuery(const uint8_t *response, size_t size, const std::vector<uint8_t> &query);
+    // Rcode, answer and authority records and negative TTL of a response;
+    // throws on malformed data
+    static Response parseMessage(const uint8_t *data, size_t size);
+    // Answer records of a response, none for NXDOMAIN; throws on other
+    // error rcodes, truncated responses and malformed data
+    static std::vector<CompactRecord> parseRecords(const uint8_t *data, size_t size);
+    static std::vector<CompactRecord> takeAnswers(Response response);
     static std::vector<DNSRecord> parseResponse(const std::vector<uint8_t> &response);
+
+    static bool parseQuestion(const uint8_t *data, size_t size, Question &question);
+    // `ttlOffsets` receives where the answers' TTLs were written;
+    // `authority` fills the authority section, e.g. the SOA of a negative answer
+    static std::vector<uint8_t> buildResponse(const uint8_t *query,
+                                              const Question &question,
+                                              const std::vector<CompactRecord> &records,
+                                              DNSResponseCode rcode,
+                                              size_t maxSize,
+                                              std::vector<uint16_t> *ttlOffsets = nullptr,
+                                              const std::vector<CompactRecord> &authority = {});
+    static void appendOPT(std::vector<uint8_t> &response);
     // static bool validateDNSSEC(const std::string &domain,
     //                            const std::vector<DNSRecord> &records);
 
 private:
     static std::vector<uint8_t> encodeDomainName(const std::string &domain);
-    static std::string decodeDomainName(const std::vector<uint8_t> &response, size_t &offset);
-    static uint16_t generateQueryId();
     static void write16bits(std::vector<uint8_t> &buffer, size_t offset, uint16_t value);
     static uint16_t read16bits(const std::vector<uint8_t> &buffer, size_t &offset);
 };
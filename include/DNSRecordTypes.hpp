@@ -2,6 +2,8 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <optional>
+#include <strings.h>
 
 enum class DNSRecordType : uint16_t
 {
@@ -14,9 +16,64 @@ enum class DNSRecordType : uint16_t
     AAAA = 28,
     SRV = 33,
     SOA = 6,
+    DS = 43,
     RRSIG = 46,
     NSEC = 47,
     DNSKEY = 48,
+    NSEC3 = 50,
+};
+
+struct RecordTypeName
+{
+    DNSRecordType type;
+    const char *name;
+};
+
+inline constexpr RecordTypeName RECORD_TYPE_NAMES[] = {
+    {DNSRecordType::A, "A"}, {DNSRecordType::NS, "NS"}, {DNSRecordType::CNAME, "CNAME"},
+    {DNSRecordType::SOA, "SOA"}, {DNSRecordType::PTR, "PTR"}, {DNSRecordType::MX, "MX"},
+    {DNSRecordType::TXT, "TXT"}, {DNSRecordType::AAAA, "AAAA"}, {DNSRecordType::SRV, "SRV"},
+    {DNSRecordType::DS, "DS"}, {DNSRecordType::RRSIG, "RRSIG"}, {DNSRecordType::NSEC, "NSEC"},
+    {DNSRecordType::DNSKEY, "DNSKEY"}, {DNSRecordType::NSEC3, "NSEC3"},
+};
+
+// Mnemonic of a record type, "TYPE<n>" for types without one (RFC 3597)
+inline std::string recordTypeToString(DNSRecordType type)
+{
+    for (const auto &entry : RECORD_TYPE_NAMES)
+    {
+        if (entry.type == type)
+            return entry.name;
+    }
+    return "TYPE" + std::to_string(static_cast<uint16_t>(type));
+}
+
+// Accepts mnemonics in any case, "TYPE<n>" and plain numbers
+inline std::optional<DNSRecordType> stringToRecordType(const std::string &text)
+{
+    for (const auto &entry : RECORD_TYPE_NAMES)
+    {
+        if (strcasecmp(text.c_str(), entry.name) == 0)
+            return entry.type;
+    }
+
+    std::string digits = strncasecmp(text.c_str(), "TYPE", 4) == 0 ? text.substr(4) : text;
+    if (digits.empty() || digits.size() > 5 || digits.find_first_not_of("0123456789") != std::string::npos)
+        return std::nullopt;
+    unsigned long value = std::stoul(digits);
+    if (value > UINT16_MAX)
+        return std::nullopt;
+    return static_cast<DNSRecordType>(value);
+}
+
+enum class DNSResponseCode : uint8_t
+{
+    NOERROR = 0,
+    FORMERR = 1,
+    SERVFAIL = 2,
+    NXDOMAIN = 3,
+    NOTIMP = 4,
+    REFUSED = 5,
 };
 
 struct DNSRecord
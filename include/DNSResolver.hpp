@@ -1,10 +1,18 @@
 #pragma once
+#include "CachePeering.hpp"
 #include "DNSCache.hpp"
 #include "DNSQuery.hpp"
+#include "DNSSECValidator.hpp"
+#include "HotCache.hpp"
 #include "ConnectionPool.hpp"
+#include "LocalZone.hpp"
 #include "Logger.hpp"
+#include "NegativeCache.hpp"
+#include "RcuCell.hpp"
 #include "Statistics.hpp"  // Added explicit include
+#include <condition_variable>
 #include <future>
+#include <mutex>
 #include <thread>
 
 class DNSResolver {
@@ -15,47 +23,192 @@ public:
         size_t maxRetries = 3;
         size_t connectionPoolSize = 10;
         bool enableDNSSEC = true;
-        bool enableParallelQueries = true;
+        bool enableParallelQueries = true; // see resolve()
+        bool enableWireCache = true;
+        TransportBackend transport = TransportBackend::UDP;
+        std::string tlsCaFile;          // trust store for TLS and HTTPS, system default when empty
+        DoHMethod dohMethod = DoHMethod::POST;
         std::vector<std::string> nameservers;
+        size_t cacheSize = 1000;
+        EvictionPolicy cachePolicy = EvictionPolicy::TinyLFU;
+        size_t hotCacheSize = 256;      // per-thread answers kept in front of the cache, 0 disables
+        std::string cacheSnapshotPath;  // warm restarts; empty disables snapshots
+        size_t snapshotInterval = 0;    // seconds between snapshots, 0 = only on shutdown
+        std::string popularityPath;     // popularity list of the cached names for CacheWarmer; empty disables
+        size_t popularityInterval = 0;  // seconds between popularity lists, 0 = only on shutdown
+        LocalZone::Config localZone;    // hosts, zone and block list files answered before the cache
+        size_t negativeCacheSize = 10000;
+        size_t reverseProbeThreshold = 4; // misses sharing a reverse zone before the zone is asked first
+        DNSSECValidator::Config dnssec;   // trust anchors and validation caches, used with enableDNSSEC
+        CachePeering::Config peering;     // caches shared with other instances, off unless listen is set
+    };
+
+    // One question of a batch or reverse lookup: the response code and the
+    // answer records (none for NODATA, at most a CNAME chain for NXDOMAIN).
+    // Forward lookups also carry the zone's SOA of NXDOMAIN and NODATA
+    // answers in `authority`, when the upstream sent one.
+    struct BatchResult
+    {
+        DNSResponseCode rcode = DNSResponseCode::SERVFAIL;
+        std::vector<CompactRecord> records;
+        std::vector<CompactRecord> authority;
     };
 
     explicit DNSResolver(const Config& config);
+    ~DNSResolver();
 
+    // Answer records for one question, empty for NXDOMAIN and NODATA alike
+    // (resolveRecordsBatch tells them apart). Throws when no upstream
+    // answered, or answered with another error or a bogus answer. With
+    // enableDNSSEC the question goes through the pool like a batch.
+    // Without it, enableParallelQueries asks every nameserver at once and
+    // merges their answers; otherwise the first nameserver is asked and
+    // NS records in its answer are followed.
     std::vector<DNSRecord> resolve(const std::string& domainName,
                                  DNSRecordType type = DNSRecordType::A);
 
+    // resolve() without the conversion to DNSRecord
+    std::vector<CompactRecord> resolveRecords(const std::string& domainName,
+                                              DNSRecordType type = DNSRecordType::A);
+
+    // Resolves many names at once: cache hits are answered directly and the
+    // misses share one upstream connection, sent in sendmmsg batches.
+    // resolveBatch() leaves failed questions empty; resolveRecordsBatch()
+    // tells NODATA, NXDOMAIN and SERVFAIL (timeouts, DNSSEC-bogus) apart.
+    // NXDOMAIN and NODATA are cached for their SOA's negative TTL.
+    std::vector<std::vector<DNSRecord>> resolveBatch(
+        const std::vector<std::pair<std::string, DNSRecordType>>& questions);
+    std::vector<BatchResult> resolveRecordsBatch(
+        const std::vector<std::pair<std::string, DNSRecordType>>& questions);
+
+    // PTR lookups for many addresses, results in input order. Each distinct
+    // address is resolved once and the misses are pipelined across pooled
+    // connections. NXDOMAIN is cached per name and covers everything below
+    // it (RFC 8020); when several misses share a /24 (IPv4) or /64 (IPv6)
+    // reverse zone the zone is asked first, so a dead range costs one query.
+    std::vector<BatchResult> resolveReverse(const std::vector<in_addr>& addresses);
+    std::vector<BatchResult> resolveReverse(const std::vector<in6_addr>& addresses);
+
+    // Answers from the cache only; returns false on a miss without
+    // touching upstream servers or the miss counters
+    bool lookupCache(const std::string& domainName,
+                     DNSRecordType type,
+                     std::vector<DNSRecord>& records);
+
+    // Answers a client query from the cache with an encoded response,
+    // reusing the entry's precompiled wire template when it has one.
+    // Cached NXDOMAIN and NODATA answers come with their SOA.
+    bool lookupWire(const uint8_t* query,
+                    const DNSQuery::Question& question,
+                    size_t maxSize,
+                    std::vector<uint8_t>& response);
+
     std::future<std::vector<DNSRecord>> resolveAsync(
         const std::string& domainName,
         DNSRecordType type = DNSRecordType::A);
 
+    // Rereads the local zone sources; the old data keeps answering until
+    // the new data is ready, and stays if loading fails (which throws)
+    void reloadLocalZone();
+
     Statistics getStatistics() const;
+
+    // Drops every cached positive and negative answer, and what DNSSEC
+    // validation has learned
     void clearCache();
+
+    // Swaps in a new configuration without a restart or losing the cache.
+    // Queries already running finish on the old settings and connections,
+    // later ones use the new. The connection pool is rebuilt when the
+    // nameservers, pool size, transport, TLS trust store, DoH method,
+    // timeout or enableDNSSEC change, and is kept otherwise. Cache sizes,
+    // snapshot and popularity files, local zone, DNSSEC validator and
+    // peering settings are fixed at construction and keep their values.
+    // Throws, leaving the current configuration in place, when the new
+    // pool can't be created.
     void setConfig(const Config& config);
+    Config getConfig() const;
 
 private:
-    Config config;
+    // What setConfig() replaces, immutable once published
+    struct Settings
+    {
+        Config config;
+        std::shared_ptr<ConnectionPool> pool; // carried over while the upstream settings stay the same
+    };
+
+    LocalZone localZone;
     DNSCache cache;
-    ConnectionPool connectionPool;
+    HotCache hotCache;
+    NegativeCache negativeCache;
+    DNSSECValidator validator;
+    RcuCell<Settings> settings;
+    std::mutex configMutex; // serializes setConfig()
     std::shared_ptr<Logger> logger;
     Statistics stats;
+    std::unique_ptr<CachePeering> peering; // declared after the caches it reads and fills
+
+    std::thread snapshotThread;
+    std::mutex snapshotMutex;
+    std::condition_variable snapshotWake;
+    bool stopping = false;
+
+    static ConnectionPool::Config poolConfig(const Config& config);
+
+    // Cache access through the calling thread's hot cache; a put also
+    // invalidates what every thread's hot cache holds for the key
+    bool cacheGet(const CacheKey& key, std::vector<CompactRecord>& records);
+    void cachePut(const CacheKey& key, const std::vector<CompactRecord>& records);
+
+    static std::unique_ptr<const Settings> makeSettings(const Config& config, const Settings* previous);
+    void snapshotLoop();
+    void saveSnapshot();
+    void savePopularity();
+
+    // Each query pins one Settings and hands it down, so it never mixes
+    // two configurations
+    std::vector<CompactRecord> resolveRecords(const Settings& current,
+                                              const std::string& domainName,
+                                              DNSRecordType type);
+
+    template <typename Address>
+    std::vector<BatchResult> resolveReverseAddresses(const std::vector<Address>& addresses,
+                                                       size_t zoneLabels);
+
+    // Sends the questions in batches over as many pooled connections as
+    // they fill; unanswered questions come back as SERVFAIL
+    std::vector<DNSQuery::Response> exchange(
+        const Settings& current,
+        std::vector<std::pair<std::string, DNSRecordType>> questions);
+
+    // With DNSSEC enabled, validates the responses in place: bogus ones
+    // become SERVFAIL without records and RRSIGs are dropped from the rest
+    void validateResponses(
+        const Settings& current,
+        const std::vector<std::pair<std::string, DNSRecordType>>& questions,
+        std::vector<DNSQuery::Response>& responses);
 
-    std::vector<DNSRecord> performRecursiveResolution(
+    std::vector<CompactRecord> performRecursiveResolution(
+        const Settings& current,
         const std::string& domain,
         DNSRecordType type,
         size_t depth,
         const std::string& nameserver);
 
-    std::vector<DNSRecord> queryNameserver(
+    std::vector<CompactRecord> queryNameserver(
+        const Settings& current,
         const std::string& nameserver,
         const std::string& domain,
         DNSRecordType type);
 
-    std::vector<DNSRecord> resolveParallel(
+    std::vector<CompactRecord> resolveParallel(
+        const Settings& current,
         const std::string& domain,
         DNSRecordType type);
 
     bool followCNAMEChain(
-        std::vector<DNSRecord>& records,
+        const Settings& current,
+        std::vector<CompactRecord>& records,
         const std::string& originalDomain,
         size_t depth);
 };
\ No newline at end of file
@@ -0,0 +1,181 @@
+#pragma once
+#include "DNSQuery.hpp"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+// DNSSEC validation (RFC 4033-4035, NSEC3 per RFC 5155) of upstream
+// responses fetched with the DO bit. Validated work is remembered so the
+// chain walk and the crypto are paid once, not per answer:
+// - zone states: validated DNSKEY sets, and delegations proven unsigned
+// - signature results, keyed by a SHA-256 over key, signed data and signature
+// - validated NSEC records, which answer later queries for names and types
+//   they deny without going upstream (RFC 8198)
+// Signature checks of a whole batch are collected first, so repeats are
+// looked up once and the rest are spread over threads when there are enough.
+class DNSSECValidator
+{
+public:
+    enum class Status
+    {
+        Secure,   // signed and verified up to a trust anchor
+        Insecure, // provably unsigned, or carrying nothing to validate
+        Bogus,    // signatures or proofs missing or failing
+    };
+
+    using Question = std::pair<std::string, DNSRecordType>;
+
+    // Sends questions upstream (with the DO bit) and returns the responses
+    // in order; unanswered questions come back as SERVFAIL
+    using Fetch = std::function<std::vector<DNSQuery::Response>(const std::vector<Question> &)>;
+
+    struct Config
+    {
+        // Root DS records in presentation form: key tag, algorithm, digest type, digest
+        std::vector<std::string> trustAnchors = {
+            "20326 8 2 E06D44B80B8F1D39A95C0B0D7C65D08458E880409BBC683457104237C7F8EC8D",
+            "38696 8 2 683D2D0ACB8C9B712A1948B27F741219298D0A450D612C483AF444A4C0FB2B16",
+        };
+        size_t zoneCacheSize = 10000;
+        size_t signatureCacheSize = 100000;
+        size_t nsecCacheSize = 100000;
+        uint32_t maxTtl = 86400;         // caps how long anything validated is trusted
+        uint32_t bogusTtl = 60;          // zones that failed are not retried before this
+        size_t parallelThreshold = 16;   // signature checks before they are spread over threads
+        size_t maxThreads = 4;
+    };
+
+    struct Counters
+    {
+        uint64_t verifications = 0;  // signature verifications run
+        uint64_t digests = 0;        // DS digests and NSEC3 hashes computed
+        uint64_t signatureHits = 0;  // verifications answered from the signature cache
+        uint64_t secure = 0;
+        uint64_t insecure = 0;
+        uint64_t bogus = 0;
+        uint64_t synthesized = 0;    // negative answers made from cached NSEC records
+    };
+
+    // Throws std::runtime_error for malformed trust anchors
+    explicit DNSSECValidator(const Config &config);
+    ~DNSSECValidator();
+
+    DNSSECValidator(const DNSSECValidator &) = delete;
+    DNSSECValidator &operator=(const DNSSECValidator &) = delete;
+
+    // Validates each response against its question, fetching missing keys
+    // and delegation proofs through `fetch`. RRSIG records are removed from
+    // the answers afterwards unless RRSIG was asked for. Responses with
+    // rcodes other than NOERROR and NXDOMAIN come back Insecure.
+    std::vector<Status> validate(const std::vector<Question> &questions,
+                                 std::vector<DNSQuery::Response> &responses,
+                                 const Fetch &fetch);
+
+    // NXDOMAIN when a cached NSEC covers the name and its wildcard,
+    // NOERROR (no data) when the name's NSEC lacks the type; nothing
+    // otherwise. `name` is a wire-format name in any case.
+    std::optional<DNSResponseCode> synthesize(const uint8_t *name, size_t length, DNSRecordType type);
+
+    Counters getCounters() const;
+    void clear();
+
+    // Record sets, keys and pending signature checks; defined in the
+    // source file and only named here
+    struct Key;
+    struct RRset;
+    struct Check;
+
+private:
+    struct DS
+    {
+        uint16_t keyTag;
+        uint8_t algorithm;
+        uint8_t digestType;
+        std::string digest;
+    };
+
+    struct ZoneState
+    {
+        enum class Kind
+        {
+            Secure,   // a signed zone apex; keys hold its validated DNSKEYs
+            Insecure, // an unsigned delegation, everything below is unsigned
+            NotCut,   // a name proven not to be a zone cut
+            Bogus,
+        };
+
+        Kind kind = Kind::Bogus;
+        std::shared_ptr<const std::vector<Key>> keys;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    // Upstream data needed to settle one zone
+    struct Pending
+    {
+        std::string zone;   // wire format, lowercase
+        std::string parent; // zone that signed the DS answer or its denial
+        DNSQuery::Response ds;
+        DNSQuery::Response dnskey;
+    };
+
+    struct CanonicalLess
+    {
+        bool operator()(const std::string &a, const std::string &b) const;
+    };
+
+    struct NsecEntry
+    {
+        std::string next;
+        std::string types; // type bitmap
+        std::chrono::steady_clock::time_point expiry;
+    };
+    using NsecZone = std::map<std::string, NsecEntry, CanonicalLess>;
+
+    Config config;
+    std::vector<DS> anchors;
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, ZoneState> zones;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> signatures;
+    std::unordered_map<std::string, NsecZone> nsecZones;
+    std::atomic<size_t> nsecCount{0};
+
+    std::atomic<uint64_t> verifications{0};
+    std::atomic<uint64_t> digests{0};
+    std::atomic<uint64_t> signatureHits{0};
+    std::atomic<uint64_t> secure{0};
+    std::atomic<uint64_t> insecure{0};
+    std::atomic<uint64_t> bogus{0};
+    std::atomic<uint64_t> synthesized{0};
+
+    // Cached state of the zone, or Insecure when an unsigned delegation
+    // above it is cached
+    std::optional<ZoneState> stateOf(const std::string &zone);
+    void storeZone(const std::string &zone, ZoneState state);
+
+    // Settles every zone that is not cached yet: fetches DS and DNSKEY,
+    // follows the DS signers upward, then validates from the top down
+    void resolveZones(const std::vector<std::string> &wanted, const Fetch &fetch);
+    void establish(std::vector<Pending> &level);
+
+    // Walks the delegations above an unsigned name: Insecure when one of
+    // them is proven unsigned, Secure when the name sits in a signed zone
+    Status zoneStatus(const std::string &name, const Fetch &fetch);
+
+    // Queues a check for every RRSIG by `zone` over the set that one of
+    // the keys could have made
+    void addChecks(RRset &set, const std::string &zone, const std::vector<Key> &keys,
+                   std::vector<Check> &checks);
+    // Marks the sets of valid checks verified, from the signature cache
+    // where possible
+    void runChecks(std::vector<Check> &checks);
+
+    ZoneState::Kind denialOfDS(const std::string &name, const std::vector<RRset> &authority,
+                               const std::string &zone);
+    void learn(const std::string &zone, const std::vector<RRset> &authority);
+};
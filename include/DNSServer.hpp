@@ -0,0 +1,87 @@
+#pragma once
+#include "DNSResolver.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+
+// Forwarding server answering stub clients over UDP and TCP.
+// Every worker owns its own SO_REUSEPORT sockets so the kernel spreads
+// clients across cores; cache hits are answered on the receiving worker,
+// misses are handed to a shared pool of resolver threads.
+class DNSServer
+{
+public:
+    struct Config
+    {
+        std::string listenAddress = "0.0.0.0";
+        uint16_t port = 53;
+        size_t workers = 0;            // 0 = one per core
+        size_t resolverThreads = 16;   // threads resolving cache misses
+        size_t maxPendingMisses = 4096;
+        size_t tcpIdleTimeout = 10000; // milliseconds
+    };
+
+    struct Counters
+    {
+        uint64_t udpQueries = 0;
+        uint64_t tcpQueries = 0;
+        uint64_t cacheAnswers = 0;
+        uint64_t resolvedAnswers = 0;
+        uint64_t failedAnswers = 0;
+        uint64_t droppedQueries = 0;
+    };
+
+    DNSServer(DNSResolver &resolver, const Config &config);
+    ~DNSServer();
+
+    void start();
+    void stop();
+    Counters getCounters() const;
+
+private:
+    struct TcpSession;
+    struct Worker;
+
+    // Where a response has to go: a UDP peer or a TCP session
+    struct ReplyTarget
+    {
+        int udpFd = -1;
+        sockaddr_storage peer{};
+        socklen_t peerLength = 0;
+        std::shared_ptr<TcpSession> tcp;
+    };
+
+    struct PendingQuery
+    {
+        std::vector<uint8_t> query;
+        DNSQuery::Question question;
+        ReplyTarget target;
+        size_t maxSize;
+    };
+
+    DNSResolver &resolver;
+    Config config;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> resolverThreads;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> resolvedAnswers{0};
+    std::atomic<uint64_t> failedAnswers{0};
+
+    std::deque<PendingQuery> pending;
+    std::mutex pendingMutex;
+    std::condition_variable pendingCv;
+
+    void runWorker(Worker &worker);
+    void runResolver();
+    void processQuery(Worker &worker, const uint8_t *data, size_t size, ReplyTarget target);
+    void readTcpSession(Worker &worker, const std::shared_ptr<TcpSession> &session);
+    void reply(Worker &worker, const ReplyTarget &target, const std::vector<uint8_t> &response);
+    static void sendReply(const ReplyTarget &target, const std::vector<uint8_t> &response);
+    int openSocket(int type) const;
+};
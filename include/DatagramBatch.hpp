@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/socket.h>
+
+// Preallocated ring of datagram slots moved with one recvmmsg/sendmmsg
+// call per batch. Buffers, iovecs and message headers are allocated once
+// and reused, so steady-state batches do no allocation.
+class DatagramBatch
+{
+public:
+    explicit DatagramBatch(size_t capacity = 64, size_t bufferSize = 4096);
+
+    DatagramBatch(const DatagramBatch &) = delete;
+    DatagramBatch &operator=(const DatagramBatch &) = delete;
+
+    // Receives up to capacity() datagrams; returns how many arrived
+    size_t receive(int fd, int flags = MSG_DONTWAIT);
+
+    const uint8_t *data(size_t index) const { return &buffers[index * bufferSize]; }
+    size_t size(size_t index) const { return messages[index].msg_len; }
+    const sockaddr_storage &peer(size_t index) const { return peers[index]; }
+    socklen_t peerLength(size_t index) const { return messages[index].msg_hdr.msg_namelen; }
+
+    // Queues a datagram for the next flush(); a null peer uses the
+    // socket's connected address. Returns false when the batch is full.
+    bool add(const uint8_t *data, size_t size, const sockaddr *peer = nullptr, socklen_t peerLength = 0);
+
+    // Sends every queued datagram; returns how many were accepted
+    size_t flush(int fd);
+
+    size_t pending() const { return queued; }
+    size_t capacity() const { return slots; }
+    bool full() const { return queued == slots; }
+
+private:
+    size_t slots;
+    size_t bufferSize;
+    size_t queued = 0;
+    std::vector<uint8_t> buffers;
+    std::vector<sockaddr_storage> peers;
+    std::vector<iovec> iovecs;
+    std::vector<mmsghdr> messages;
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+
+// Domain name routines on the lookup path. Encoding runs one vectorized
+// pass over the name (AVX2 or SSE2 on x86-64, NEON on AArch64, picked at
+// startup, scalar otherwise) that lowercases, checks characters and finds
+// the dots; only the label boundaries are then walked one by one.
+class DomainName
+{
+public:
+    static const size_t MAX_WIRE_SIZE = 255;
+
+    // Encodes a presentation-format name (trailing dot optional) into `out`,
+    // which needs MAX_WIRE_SIZE bytes, and returns the wire length. The
+    // canonical form is lowercased and only allows printable ASCII other
+    // than space. Throws std::runtime_error for empty or overlong labels,
+    // overlong names and, when canonical, rejected characters.
+    static size_t encode(const char *name, size_t length, uint8_t *out, bool canonical = true);
+    static std::vector<uint8_t> encode(const std::string &name, bool canonical = true);
+
+    // Reads a wire-format name at `offset` in a message, following
+    // compression pointers, and moves `offset` past it. Throws
+    // std::runtime_error for truncated, looping or overlong names.
+    static std::string decode(const uint8_t *message, size_t size, size_t &offset);
+
+    // ASCII lowercase of `length` bytes; `in` and `out` may be the same
+    static void foldCase(const uint8_t *in, size_t length, uint8_t *out);
+
+    static uint64_t hash(const uint8_t *data, size_t length);
+
+    // Reverse-lookup names ("4.3.2.1.in-addr.arpa", nibble-wise under
+    // "ip6.arpa") written into `out`, which needs MAX_REVERSE_LENGTH bytes;
+    // returns the length
+    static const size_t MAX_REVERSE_LENGTH = 72;
+    static size_t reverse(const in_addr &address, char *out);
+    static size_t reverse(const in6_addr &address, char *out);
+
+    // Kernel in use: "avx2", "sse2", "neon" or "scalar"
+    static const char *implementation();
+};
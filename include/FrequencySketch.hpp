@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Count-min sketch of 4-bit counters (TinyLFU), sixteen to a 64-bit word.
+// Each key touches four counters; its estimate is the smallest of them.
+// After 10 * capacity increments every counter is halved, so the
+// estimates track recent popularity rather than all-time totals.
+class FrequencySketch
+{
+public:
+    explicit FrequencySketch(size_t capacity);
+
+    void increment(uint64_t hash);
+    uint8_t frequency(uint64_t hash) const;
+
+private:
+    std::vector<uint64_t> table;
+    uint64_t counterMask;
+    size_t additions = 0;
+    size_t sampleSize;
+
+    void age();
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include "TLSStream.hpp"
+#include <optional>
+
+// DNS over HTTPS (RFC 8484) to one upstream, over an HTTP/1.1 keep-alive
+// connection on a TLSStream. A batch is pipelined: every request goes out
+// in one write and the responses, which HTTP/1.1 returns in request
+// order, are read back in turn. Queries carry ID 0 as the RFC suggests,
+// so GET requests are cacheable by HTTP caches on the way.
+//
+// The HTTP freshness of a response bounds its DNS TTLs: they are capped at
+// Cache-Control max-age (zero for no-cache and no-store) and reduced by
+// Age, so the resolver cache never keeps an answer longer than the HTTP
+// layer allows.
+class HTTPSConnection : public DNSConnection
+{
+public:
+    // See TLSStream for `serverName`; `path` is the URI path of the
+    // resolver, e.g. "/dns-query"
+    HTTPSConnection(const std::string &host, uint16_t port, const std::string &serverName,
+                    const std::string &path, DoHMethod method, std::shared_ptr<TLSContext> context,
+                    std::chrono::milliseconds idleTimeout);
+
+    // False only for an unusable address; a dropped session is reopened on demand
+    bool isValid() const override;
+    void query(const std::string &domain, DNSRecordType type) override;
+    std::vector<CompactRecord> getResponse() override;
+    std::vector<DNSQuery::Response> exchangeBatch(
+        const std::vector<std::pair<std::string, DNSRecordType>> &questions) override;
+
+private:
+    static constexpr size_t WINDOW = 64; // requests in flight at once
+
+    // One HTTP response
+    struct Reply
+    {
+        int status = 0;
+        bool keepAlive = true;
+        std::optional<uint32_t> maxAge;
+        uint32_t age = 0;
+        std::vector<uint8_t> body; // the DNS message; empty unless a 200
+    };
+
+    enum class Parse
+    {
+        Complete,
+        Incomplete,
+        Malformed,
+    };
+
+    TLSStream stream;
+    std::string path;
+    std::string authority; // Host header
+    DoHMethod method;
+    std::vector<uint8_t> inbox; // decrypted bytes; those before inboxStart are parsed already
+    size_t inboxStart = 0;
+    std::pair<std::string, DNSRecordType> pending;
+
+    // Parses the response at data[0, size), which may be cut short;
+    // `consumed` is its full length when Complete
+    static Parse parse(const uint8_t *data, size_t size, Reply &reply, size_t &consumed);
+
+    void appendRequest(std::vector<uint8_t> &requests, const std::pair<std::string, DNSRecordType> &question) const;
+
+    // Returns 1 with the next response, or the stream's 0 (deadline) or
+    // -1 (failed, also for malformed responses)
+    int readReply(Reply &reply, TLSStream::Clock::time_point deadline);
+    void close();
+
+    // Replies in question order, with an empty body where none arrived
+    std::vector<Reply> exchangeRaw(const std::vector<std::pair<std::string, DNSRecordType>> &questions);
+
+    static void applyFreshness(const Reply &reply, std::vector<CompactRecord> &records);
+};
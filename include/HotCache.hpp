@@ -0,0 +1,105 @@
+#pragma once
+#include "DNSCache.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Small per-thread cache of recent answers in front of DNSCache. Every
+// thread gets its own four-way set-associative table, so a hit on one of
+// the hottest names takes no lock and writes no memory another core reads. Entries
+// carry an absolute expiry, the earliest of their records, and go stale
+// with an epoch: a global one that clear() advances, and one per stripe
+// of keys that invalidate() advances whenever the shared cache takes a
+// new answer for a key in the stripe.
+class HotCache
+{
+public:
+    // One cached answer; records keep the TTLs they had at `filled`
+    struct Entry
+    {
+        std::vector<CompactRecord> records;
+        std::shared_ptr<const DNSCache::WireTemplate> wire; // may be null
+        std::chrono::system_clock::time_point filled;
+        std::chrono::system_clock::time_point expiry;
+    };
+
+    // Epochs read before the shared cache is consulted. Filling with them
+    // afterwards can't resurrect an answer replaced in between.
+    struct Ticket
+    {
+        uint64_t epoch = 0;
+        uint32_t stripe = 0;
+    };
+
+    struct Counters
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    // `capacity` entries per thread, rounded up to a power of two of at
+    // least WAYS; 0 disables
+    explicit HotCache(size_t capacity);
+
+    HotCache(const HotCache &) = delete;
+    HotCache &operator=(const HotCache &) = delete;
+
+    bool enabled() const { return capacity != 0; }
+
+    // The calling thread's fresh entry for `key`, or nullptr. It stays
+    // valid until the thread's next call on this cache.
+    const Entry *find(const CacheKey &key);
+
+    // find() with the records copied out and their TTLs counted down
+    bool get(const CacheKey &key, std::vector<CompactRecord> &records);
+    static void countDown(const Entry &entry, std::vector<CompactRecord> &records);
+
+    Ticket ticket(const CacheKey &key) const;
+    void fill(const CacheKey &key, const Ticket &ticket, const std::vector<CompactRecord> &records,
+              std::shared_ptr<const DNSCache::WireTemplate> wire = nullptr);
+
+    // Called after the shared cache stored a new answer for `key`
+    void invalidate(const CacheKey &key);
+    void clear();
+
+    // Summed over all threads
+    Counters getCounters() const;
+
+private:
+    static const size_t WAYS = 4;
+    static const size_t STRIPES = 4096;
+
+    struct Slot
+    {
+        std::string key;
+        uint64_t hash = 0;
+        uint64_t epoch = 0;
+        uint32_t stripe = 0;
+        uint64_t used = 0; // the table's clock at the last hit or fill
+        Entry entry;
+    };
+
+    // Written only by the owning thread
+    struct Table
+    {
+        std::vector<Slot> slots; // sets of WAYS slots
+        uint64_t clock = 0;
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    const size_t capacity;
+    const uint64_t id; // tells the thread-local lookup which cache it saw last
+    std::atomic<uint64_t> epoch{0};
+    std::unique_ptr<std::atomic<uint32_t>[]> stripes;
+
+    mutable std::mutex tablesMutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<Table>> tables;
+
+    Table &local();
+    Slot *set(Table &table, const CacheKey &key) const;
+};
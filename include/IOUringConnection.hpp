@@ -0,0 +1,78 @@
+#pragma once
+#include "ConnectionPool.hpp"
+#include <deque>
+#include <linux/io_uring.h>
+
+// Upstream UDP transport driven through io_uring. Queries are sent from
+// preallocated slots, answers arrive through one multishot receive that
+// feeds a provided-buffer ring, and a query/response round trip costs a
+// single io_uring_enter. Construction probes the kernel (6.0+) and leaves
+// the connection invalid when it lacks any of these features, so callers
+// can fall back.
+class IOUringConnection : public DNSConnection
+{
+public:
+    IOUringConnection(const std::string &nameserver, uint16_t port);
+    ~IOUringConnection() override;
+
+    IOUringConnection(const IOUringConnection &) = delete;
+    IOUringConnection &operator=(const IOUringConnection &) = delete;
+
+    bool isValid() const override;
+    void query(const std::string &domain, DNSRecordType type) override;
+    std::vector<CompactRecord> getResponse() override;
+    std::vector<DNSQuery::Response> exchangeBatch(
+        const std::vector<std::pair<std::string, DNSRecordType>> &questions) override;
+
+private:
+    static constexpr unsigned RING_ENTRIES = 128;
+    static constexpr unsigned SEND_SLOTS = 64;
+    static constexpr size_t SEND_SLOT_SIZE = 512;
+    static constexpr unsigned RECEIVE_BUFFERS = 64;
+    static constexpr size_t RECEIVE_BUFFER_SIZE = 4096;
+
+    int ringFd = -1;
+    int socketFd = -1;
+    sockaddr_storage server{};
+    socklen_t serverLength = 0;
+    bool valid = false;
+    bool receiveArmed = false;
+
+    // Rings shared with the kernel
+    void *sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void *cqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+    unsigned unsubmitted = 0;
+
+    // Send slots and the provided receive buffers
+    uint8_t *sendBuffers = nullptr;
+    unsigned nextSendSlot = 0;
+    uint64_t sendBusy = 0; // a bit per slot whose send hasn't completed
+    static_assert(SEND_SLOTS == 64, "sendBusy holds one bit per slot");
+    io_uring_buf *bufferRing = nullptr;
+    uint8_t *receiveBuffers = nullptr;
+    uint16_t bufferRingTail = 0;
+
+    uint16_t expectedId = 0;
+    std::pair<std::string, DNSRecordType> pending; // for a TCP retry of a truncated answer
+    int receiveError = 0;
+    std::deque<std::vector<uint8_t>> received;
+
+    bool setup(const std::string &nameserver, uint16_t port);
+    io_uring_sqe *nextSqe();
+    void submitSend(const std::vector<uint8_t> &queryData);
+    void armReceive();
+    void recycleBuffer(uint16_t bufferId);
+    bool enter(unsigned minComplete, int timeoutMs);
+    void reapCompletions();
+};
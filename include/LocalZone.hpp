@@ -0,0 +1,82 @@
+#pragma once
+#include "CompactRecord.hpp"
+#include "RcuCell.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Names answered locally, ahead of the cache and upstream: records pinned
+// by hosts and zone files, and names blocked by block lists. Everything is
+// frozen into one open-addressing table over case-folded wire names that
+// live in a single byte arena, so a blocked name costs its wire bytes plus
+// an 8-byte slot. reload() builds the new table aside and swaps it in
+// through an RcuCell; lookups pin whichever table they started on and
+// never wait.
+class LocalZone
+{
+public:
+    enum class SourceFormat
+    {
+        Hosts,     // "address name [aliases]"; 0.0.0.0 and :: block the names
+        Zone,      // master-file records: $ORIGIN, $TTL, @, relative names, one record per line
+        Blocklist, // one name per line, blocking it and everything below
+    };
+
+    enum class BlockMode
+    {
+        NXDomain, // blocked names don't exist
+        Sinkhole, // A and AAAA lookups get 0.0.0.0 and ::, other types no data
+    };
+
+    struct Source
+    {
+        std::string path;
+        SourceFormat format;
+    };
+
+    struct Config
+    {
+        std::vector<Source> sources;
+        BlockMode blockMode = BlockMode::NXDomain;
+        uint32_t ttl = 3600; // hosts entries, zone records without a TTL and sinkhole answers
+    };
+
+    struct Answer
+    {
+        DNSResponseCode rcode = DNSResponseCode::NOERROR;
+        std::vector<CompactRecord> records; // empty with NOERROR for names without the type
+    };
+
+    // Loads every source; throws std::runtime_error for unreadable files
+    // and malformed zone files. Malformed hosts and block list lines are
+    // skipped and counted.
+    explicit LocalZone(const Config &config);
+    ~LocalZone();
+
+    LocalZone(const LocalZone &) = delete;
+    LocalZone &operator=(const LocalZone &) = delete;
+
+    // Rereads every source and swaps the result in. On error the current
+    // data stays in place and the error is rethrown.
+    void reload();
+
+    // True and an answer when the name is pinned, wildcarded or blocked;
+    // `name` is a wire-format name in any case
+    bool lookup(const uint8_t *name, size_t length, DNSRecordType type, Answer &answer) const;
+    bool lookup(const std::string &domain, DNSRecordType type, Answer &answer) const;
+
+    size_t size() const;    // names and wildcards held
+    size_t skipped() const; // lines ignored on the last load
+
+private:
+    struct Table;
+
+    Config config;
+    std::atomic<bool> populated{false}; // lets lookups skip everything when there is no data
+    RcuCell<Table> table;
+    std::mutex reloadMutex;
+
+    static std::unique_ptr<const Table> build(const Config &config);
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include "CacheKey.hpp"
+#include "CompactRecord.hpp"
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+// Negative answers (RFC 2308), kept apart from DNSCache because they have
+// no records to expire or replay. NXDOMAIN is stored per name and, as RFC
+// 8020 allows, also covers every name below it; NODATA is stored per name
+// and type. Entries live for their negative TTL and the oldest goes first
+// when the cache is full. Each keeps the zone's SOA, if the answer had one,
+// so a server can relay it with a cached answer.
+class NegativeCache
+{
+public:
+    explicit NegativeCache(size_t maxSize = 10000, uint32_t maxTtl = 3600);
+
+    // `name` is a case-folded wire-format name, e.g. a CacheKey's bytes
+    // without the type; `authority` is the SOA of the answer, if any
+    void putNXDomain(const uint8_t *name, size_t length, uint32_t ttl,
+                     const std::vector<CompactRecord> &authority = {});
+    void putNoData(const uint8_t *name, size_t length, DNSRecordType type, uint32_t ttl,
+                   const std::vector<CompactRecord> &authority = {});
+
+    // NXDOMAIN when the name or one of its ancestors is known not to
+    // exist, NOERROR for a cached NODATA, nothing on a miss. On a hit
+    // `authority` receives the stored SOA, its TTL counted down.
+    std::optional<DNSResponseCode> get(const uint8_t *name, size_t length, DNSRecordType type,
+                                       std::vector<CompactRecord> *authority = nullptr);
+
+    void clear();
+    size_t size() const;
+
+private:
+    // Type 0 is reserved in DNS, so it marks name-wide NXDOMAIN entries
+    static constexpr DNSRecordType ANY_TYPE = static_cast<DNSRecordType>(0);
+
+    struct Entry
+    {
+        std::chrono::steady_clock::time_point expiry;
+        std::list<const CacheKey *>::iterator position;
+        std::vector<CompactRecord> authority;
+    };
+    using EntryMap = std::unordered_map<CacheKey, Entry, CacheKey::Hash>;
+
+    EntryMap entries;
+    std::list<const CacheKey *> order; // newest first, keys live in the map nodes
+    mutable std::mutex mutex;
+    const size_t maxSize;
+    const uint32_t maxTtl;
+
+    void put(const uint8_t *name, size_t length, DNSRecordType type, uint32_t ttl,
+             const std::vector<CompactRecord> &authority);
+    const Entry *find(const CacheKey &key, std::chrono::steady_clock::time_point now);
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Holds an immutable value that readers pin without locks and writers
+// replace read-copy-update style. A reader registers on the slot the
+// version points at and re-checks the version; replace() fills the other
+// slot, bumps the version and waits for the old slot's readers to leave
+// (the grace period) before handing the old value back. Reader counts are
+// striped over cache lines so threads pinning at once don't share one.
+template <typename T>
+class RcuCell
+{
+public:
+    // Keeps one value alive while it exists
+    class Reader
+    {
+    public:
+        Reader(Reader &&other) noexcept : value(other.value), counter(other.counter)
+        {
+            other.counter = nullptr;
+        }
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+        Reader &operator=(Reader &&) = delete;
+
+        ~Reader()
+        {
+            if (counter)
+            {
+                counter->fetch_sub(1);
+            }
+        }
+
+        const T &operator*() const { return *value; }
+        const T *operator->() const { return value; }
+
+    private:
+        friend class RcuCell;
+        Reader(const T *value, std::atomic<uint32_t> *counter) : value(value), counter(counter) {}
+
+        const T *value;
+        std::atomic<uint32_t> *counter;
+    };
+
+    explicit RcuCell(std::unique_ptr<const T> initial)
+    {
+        values[0] = std::move(initial);
+    }
+
+    RcuCell(const RcuCell &) = delete;
+    RcuCell &operator=(const RcuCell &) = delete;
+
+    Reader read() const
+    {
+        size_t stripe = stripeIndex();
+        while (true)
+        {
+            uint64_t current = version.load();
+            auto &counter = readers[current & 1][stripe].count;
+            counter.fetch_add(1);
+            if (version.load() == current)
+            {
+                return Reader(values[current & 1].get(), &counter);
+            }
+            counter.fetch_sub(1);
+        }
+    }
+
+    // Publishes `next` and returns the previous value once no reader can
+    // still see it. New readers get `next` immediately; a thread holding a
+    // Reader of this cell must not call it.
+    std::unique_ptr<const T> replace(std::unique_ptr<const T> next)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+
+        // Nobody reads the spare slot: the last replace() drained it
+        uint64_t current = version.load();
+        values[(current + 1) & 1] = std::move(next);
+        version.store(current + 1);
+
+        // Late readers that still saw the old version back out without
+        // reading, so each stripe only has to reach zero once
+        for (auto &stripe : readers[current & 1])
+        {
+            while (stripe.count.load() != 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+        return std::move(values[current & 1]);
+    }
+
+private:
+    static constexpr size_t STRIPES = 16;
+
+    struct alignas(64) Stripe
+    {
+        std::atomic<uint32_t> count{0};
+    };
+
+    static size_t stripeIndex()
+    {
+        static std::atomic<size_t> next{0};
+        thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+        return index;
+    }
+
+    std::unique_ptr<const T> values[2];
+    std::atomic<uint64_t> version{0};
+    mutable Stripe readers[2][STRIPES];
+    std::mutex writeMutex;
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include <chrono>
 #include <atomic>
+#include <string>
 
 class Statistics {
 public:
@@ -12,7 +13,25 @@ public:
         , cacheHits(other.cacheHits.load())
         , cacheMisses(other.cacheMisses.load())
         , failedQueries(other.failedQueries.load())
-        , totalResolutionTime(other.totalResolutionTime) {}
+        , cacheEvictions(other.cacheEvictions.load())
+        , admissionRejections(other.admissionRejections.load())
+        , dnssecSecure(other.dnssecSecure.load())
+        , dnssecInsecure(other.dnssecInsecure.load())
+        , dnssecBogus(other.dnssecBogus.load())
+        , cryptoOps(other.cryptoOps.load())
+        , signatureCacheHits(other.signatureCacheHits.load())
+        , synthesizedAnswers(other.synthesizedAnswers.load())
+        , hotCacheHits(other.hotCacheHits.load())
+        , hotCacheMisses(other.hotCacheMisses.load())
+        , sharedCacheHits(other.sharedCacheHits.load())
+        , sharedCacheMisses(other.sharedCacheMisses.load())
+        , peerQueries(other.peerQueries.load())
+        , peerHits(other.peerHits.load())
+        , peerPublishes(other.peerPublishes.load())
+        , peerServed(other.peerServed.load())
+        , cachePolicy(other.cachePolicy)
+        , totalResolutionTime(other.totalResolutionTime)
+        , totalPeerLatency(other.totalPeerLatency) {}
 
     // Copy assignment operator
     Statistics& operator=(const Statistics& other) {
@@ -21,7 +40,25 @@ public:
             cacheHits.store(other.cacheHits.load());
             cacheMisses.store(other.cacheMisses.load());
             failedQueries.store(other.failedQueries.load());
+            cacheEvictions.store(other.cacheEvictions.load());
+            admissionRejections.store(other.admissionRejections.load());
+            dnssecSecure.store(other.dnssecSecure.load());
+            dnssecInsecure.store(other.dnssecInsecure.load());
+            dnssecBogus.store(other.dnssecBogus.load());
+            cryptoOps.store(other.cryptoOps.load());
+            signatureCacheHits.store(other.signatureCacheHits.load());
+            synthesizedAnswers.store(other.synthesizedAnswers.load());
+            hotCacheHits.store(other.hotCacheHits.load());
+            hotCacheMisses.store(other.hotCacheMisses.load());
+            sharedCacheHits.store(other.sharedCacheHits.load());
+            sharedCacheMisses.store(other.sharedCacheMisses.load());
+            peerQueries.store(other.peerQueries.load());
+            peerHits.store(other.peerHits.load());
+            peerPublishes.store(other.peerPublishes.load());
+            peerServed.store(other.peerServed.load());
+            cachePolicy = other.cachePolicy;
             totalResolutionTime = other.totalResolutionTime;
+            totalPeerLatency = other.totalPeerLatency;
         }
         return *this;
     }
@@ -37,6 +74,23 @@ public:
     uint64_t getCacheHits() const { return cacheHits.load(); }
     uint64_t getCacheMisses() const { return cacheMisses.load(); }
     uint64_t getFailedQueries() const { return failedQueries.load(); }
+    uint64_t getCacheEvictions() const { return cacheEvictions.load(); }
+    uint64_t getAdmissionRejections() const { return admissionRejections.load(); }
+    uint64_t getDnssecSecure() const { return dnssecSecure.load(); }
+    uint64_t getDnssecInsecure() const { return dnssecInsecure.load(); }
+    uint64_t getDnssecBogus() const { return dnssecBogus.load(); }
+    uint64_t getCryptoOps() const { return cryptoOps.load(); }
+    uint64_t getSignatureCacheHits() const { return signatureCacheHits.load(); }
+    uint64_t getSynthesizedAnswers() const { return synthesizedAnswers.load(); }
+    uint64_t getHotCacheHits() const { return hotCacheHits.load(); }
+    uint64_t getHotCacheMisses() const { return hotCacheMisses.load(); }
+    uint64_t getSharedCacheHits() const { return sharedCacheHits.load(); }
+    uint64_t getSharedCacheMisses() const { return sharedCacheMisses.load(); }
+    uint64_t getPeerQueries() const { return peerQueries.load(); }
+    uint64_t getPeerHits() const { return peerHits.load(); }
+    uint64_t getPeerPublishes() const { return peerPublishes.load(); }
+    uint64_t getPeerServed() const { return peerServed.load(); }
+    const std::string& getCachePolicy() const { return cachePolicy; }
     std::chrono::nanoseconds getResolutionTime() const { return totalResolutionTime; }
 
     void addResolutionTime(std::chrono::nanoseconds time) {
@@ -49,6 +103,40 @@ public:
     return std::chrono::duration<double>(totalResolutionTime).count() / queries;
     }
 
+    // DNSSEC validation cost averaged over all queries, cache hits included
+    double getCryptoOpsPerQuery() const {
+    uint64_t queries = totalQueries.load();
+    if (queries == 0) return 0.0;
+    return static_cast<double>(cryptoOps.load()) / queries;
+    }
+
+    // Hit rates of the two cache levels, each over the lookups it saw
+    double getHotCacheHitRate() const {
+    uint64_t lookups = hotCacheHits.load() + hotCacheMisses.load();
+    if (lookups == 0) return 0.0;
+    return static_cast<double>(hotCacheHits.load()) / lookups;
+    }
+
+    double getSharedCacheHitRate() const {
+    uint64_t lookups = sharedCacheHits.load() + sharedCacheMisses.load();
+    if (lookups == 0) return 0.0;
+    return static_cast<double>(sharedCacheHits.load()) / lookups;
+    }
+
+    // Share of the questions sent to peers that a peer's cache answered
+    double getPeerHitRate() const {
+    uint64_t queries = peerQueries.load();
+    if (queries == 0) return 0.0;
+    return static_cast<double>(peerHits.load()) / queries;
+    }
+
+    // Seconds spent waiting on peers per question asked of them
+    double getAveragePeerLatency() const {
+    uint64_t queries = peerQueries.load();
+    if (queries == 0) return 0.0;
+    return std::chrono::duration<double>(totalPeerLatency).count() / queries;
+    }
+
     double getCacheHitRate() const {
     uint64_t queries = totalQueries.load();
     if (queries == 0) return 0.0;
@@ -60,5 +148,23 @@ public:
     std::atomic<uint64_t> cacheHits{0};
     std::atomic<uint64_t> cacheMisses{0};
     std::atomic<uint64_t> failedQueries{0};
+    std::atomic<uint64_t> cacheEvictions{0};
+    std::atomic<uint64_t> admissionRejections{0}; // new entries the cache policy turned away
+    std::atomic<uint64_t> dnssecSecure{0};        // validated responses by outcome
+    std::atomic<uint64_t> dnssecInsecure{0};
+    std::atomic<uint64_t> dnssecBogus{0};
+    std::atomic<uint64_t> cryptoOps{0};           // signature verifications, DS digests and NSEC3 hashes
+    std::atomic<uint64_t> signatureCacheHits{0};  // verifications skipped thanks to the signature cache
+    std::atomic<uint64_t> synthesizedAnswers{0};  // negative answers made from cached NSEC records
+    std::atomic<uint64_t> hotCacheHits{0};        // per-thread cache lookups by outcome
+    std::atomic<uint64_t> hotCacheMisses{0};
+    std::atomic<uint64_t> sharedCacheHits{0};     // shared cache lookups by outcome
+    std::atomic<uint64_t> sharedCacheMisses{0};
+    std::atomic<uint64_t> peerQueries{0};         // local misses asked of the owning peer
+    std::atomic<uint64_t> peerHits{0};            // of those, answered from the peer's cache
+    std::atomic<uint64_t> peerPublishes{0};       // upstream answers sent to their owning peer
+    std::atomic<uint64_t> peerServed{0};          // peer questions answered from this cache
+    std::string cachePolicy;
     std::chrono::nanoseconds totalResolutionTime{0};
+    std::chrono::nanoseconds totalPeerLatency{0}; // waiting on peers, hits and misses
 };
\ No newline at end of file
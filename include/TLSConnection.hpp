@@ -0,0 +1,38 @@
+#pragma once
+#include "TLSStream.hpp"
+
+// DNS over TLS (RFC 7858) to one upstream. The TLS stream stays open
+// between uses and every batch is pipelined over it: all queries go out
+// in one write, length-prefixed as on TCP, and answers are matched by ID
+// in whatever order the server sends them (RFC 7766).
+class TLSConnection : public DNSConnection
+{
+public:
+    // See TLSStream for `serverName`
+    TLSConnection(const std::string &nameserver, uint16_t port, const std::string &serverName,
+                  std::shared_ptr<TLSContext> context, std::chrono::milliseconds idleTimeout);
+
+    // False only for an unusable address; a dropped session is reopened on demand
+    bool isValid() const override;
+    void query(const std::string &domain, DNSRecordType type) override;
+    std::vector<CompactRecord> getResponse() override;
+    std::vector<DNSQuery::Response> exchangeBatch(
+        const std::vector<std::pair<std::string, DNSRecordType>> &questions) override;
+
+private:
+    static constexpr size_t WINDOW = 256; // queries in flight at once
+
+    TLSStream stream;
+    std::vector<uint8_t> inbox; // decrypted bytes; those before inboxStart are framed already
+    size_t inboxStart = 0;
+    std::pair<std::string, DNSRecordType> pending;
+
+    // Returns 1 with the next length-prefixed message, or the stream's
+    // 0 (deadline) or -1 (failed)
+    int readMessage(std::vector<uint8_t> &message, TLSStream::Clock::time_point deadline);
+    void close();
+
+    // Raw answers in question order, empty where none arrived
+    std::vector<std::vector<uint8_t>> exchangeRaw(
+        const std::vector<std::pair<std::string, DNSRecordType>> &questions);
+};
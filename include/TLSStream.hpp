@@ -0,0 +1,118 @@
+#pragma once
+#include "ConnectionPool.hpp"
+#include <functional>
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+#include <unordered_map>
+
+// State shared by a pool's TLS connections: one SSL_CTX and the latest
+// session ticket of every upstream, so a reconnect resumes the session
+// instead of paying for a full handshake
+class TLSContext
+{
+public:
+    // Throws std::runtime_error when the context or the CA file can't be set up
+    TLSContext(const std::string &caFile, bool verify);
+    ~TLSContext();
+
+    TLSContext(const TLSContext &) = delete;
+    TLSContext &operator=(const TLSContext &) = delete;
+
+    SSL_CTX *get() const { return ctx; }
+
+    // A reference to the cached session for `key`, or nullptr
+    SSL_SESSION *session(const std::string &key);
+    void recordHandshake(bool resumed);
+
+    uint64_t handshakes() const { return handshakeCount.load(std::memory_order_relaxed); }
+    uint64_t resumptions() const { return resumedCount.load(std::memory_order_relaxed); }
+
+    bool verifyPeer() const { return verify; }
+
+private:
+    SSL_CTX *ctx = nullptr;
+    bool verify;
+    std::mutex mutex;
+    std::unordered_map<std::string, SSL_SESSION *> sessions;
+    std::atomic<uint64_t> handshakeCount{0};
+    std::atomic<uint64_t> resumedCount{0};
+
+    static int storeSession(SSL *ssl, SSL_SESSION *session);
+};
+
+// A TLS session to one upstream that stays open between uses, under the
+// DNS-over-TLS and DNS-over-HTTPS connections. It is opened on
+// construction, so the first query doesn't pay for the handshake, and
+// reopened on demand: after the idle timeout, since servers drop idle
+// connections on their side, and after the owner closed it on an error.
+// Failed connects are retried with exponential backoff, during which
+// open() fails fast.
+class TLSStream
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // `serverName` is sent as SNI and checked against the certificate;
+    // when empty the certificate must carry the address instead. `alpn`
+    // is the protocol offered, none when empty.
+    TLSStream(const std::string &host, uint16_t port, const std::string &serverName,
+              std::shared_ptr<TLSContext> context, std::chrono::milliseconds idleTimeout,
+              const std::string &alpn = "");
+    ~TLSStream();
+
+    TLSStream(const TLSStream &) = delete;
+    TLSStream &operator=(const TLSStream &) = delete;
+
+    // False only for an unusable address
+    bool isValid() const { return valid; }
+    bool isOpen() const { return ssl != nullptr; }
+
+    const std::string &server() const { return address; } // host:port
+    const std::string &serverName() const { return name; }
+
+    // Opens the session unless it is open and fresh, returning true when
+    // a new one was opened; throws UpstreamError when that fails or the
+    // backoff isn't over
+    bool open(Clock::time_point deadline);
+    void close();
+
+    // Counts as activity for the idle timeout
+    void markUsed() { lastUsed = Clock::now(); }
+
+    // These return a positive value on success (read: the bytes appended),
+    // 0 at the deadline and -1 when the connection failed
+    int write(const std::vector<uint8_t> &data, Clock::time_point deadline);
+    int read(std::vector<uint8_t> &buffer, Clock::time_point deadline);
+
+private:
+    static constexpr size_t READ_SIZE = 16384;
+
+    sockaddr_storage peer{};
+    socklen_t peerLength = 0;
+    bool valid = false;
+    std::string host;
+    std::string address;
+    std::string name;
+    std::string sessionKey; // host:port#name, as sessions are bound to the name
+    std::string alpn;       // wire form, length-prefixed
+    std::shared_ptr<TLSContext> context;
+    std::chrono::milliseconds idleTimeout;
+
+    int fd = -1;
+    SSL *ssl = nullptr;
+    BIO *incoming = nullptr; // ciphertext from the socket, read by OpenSSL
+    BIO *outgoing = nullptr; // ciphertext written by OpenSSL, sent by us
+    Clock::time_point lastUsed;
+
+    uint32_t failures = 0; // consecutive failed connects
+    Clock::time_point retryAt;
+
+    bool connect(Clock::time_point deadline);
+
+    // The socket is driven by us through memory BIOs, so writes can use
+    // MSG_NOSIGNAL and every wait honours the deadline. Same results as
+    // read(); drive passes on the operation's result.
+    int drive(const std::function<int()> &operation, Clock::time_point deadline);
+    int flush(Clock::time_point deadline);
+    int fill(Clock::time_point deadline);
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Hierarchical timing wheel with one-second ticks: four levels of 64 slots
+// cover about 194 days, later deadlines wait in the top level. Scheduling
+// is O(1). Slots that come due or cascade are queued whole and worked off
+// under a budget, so one advance() does bounded work even when a single
+// slot holds many items. Items are never cancelled; owners check on
+// expiry whether a key is still current.
+class TimingWheel
+{
+public:
+    struct Item
+    {
+        std::string key;
+        uint64_t deadline; // seconds
+    };
+
+    explicit TimingWheel(uint64_t now = 0);
+
+    void schedule(std::string key, uint64_t deadline);
+
+    // Advances the wheel towards `now`, doing at most about `limit` units
+    // of work and moving at most `limit` due items into `due`. Returns true
+    // when another call has work left.
+    bool advance(uint64_t now, std::vector<Item> &due, size_t limit);
+
+    size_t size() const { return count; }
+    void clear();
+
+private:
+    static const unsigned LEVELS = 4;
+    static const unsigned SLOT_BITS = 6;
+    static const uint64_t SLOTS = 1 << SLOT_BITS;
+
+    std::vector<std::vector<Item>> slots; // LEVELS * SLOTS
+    std::deque<std::vector<Item>> ready;     // due items, oldest chunk first
+    std::deque<std::vector<Item>> cascading; // slots waiting to be re-placed
+    size_t readyPosition = 0;
+    size_t cascadePosition = 0;
+    uint64_t current;
+    size_t count = 0;
+
+    void place(Item item);
+    void queue(std::deque<std::vector<Item>> &chunks, std::vector<Item> &slot);
+};
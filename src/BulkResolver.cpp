@@ -0,0 +1,450 @@
+#include "BulkResolver.hpp"
+#include "DomainName.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    std::string jsonString(const std::string &value)
+    {
+        std::string quoted = "\"";
+        for (unsigned char c : value)
+        {
+            if (c == '"' || c == '\\')
+            {
+                quoted += '\\';
+                quoted += static_cast<char>(c);
+            }
+            else if (c < 0x20 || c >= 0x7F)
+            {
+                // Raw bytes from the wire need not be UTF-8
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                quoted += escaped;
+            }
+            else
+            {
+                quoted += static_cast<char>(c);
+            }
+        }
+        return quoted + "\"";
+    }
+
+    std::string csvField(const std::string &value)
+    {
+        if (value.find_first_of(",\"\r\n") == std::string::npos)
+        {
+            return value;
+        }
+
+        std::string quoted = "\"";
+        for (char c : value)
+        {
+            quoted += c;
+            if (c == '"')
+                quoted += '"';
+        }
+        return quoted + "\"";
+    }
+
+    bool isSeparator(char c)
+    {
+        return c == ' ' || c == '\t' || c == ',' || c == '\r';
+    }
+}
+
+BulkResolver::BulkResolver(DNSResolver &resolver, const Config &config)
+    : resolver(resolver), config(config)
+{
+    this->config.batchSize = std::max<size_t>(1, config.batchSize);
+    this->config.inFlight = std::max(this->config.batchSize, config.inFlight);
+    if (this->config.types.empty())
+    {
+        this->config.types.push_back(DNSRecordType::A);
+    }
+}
+
+BulkResolver::Summary BulkResolver::run(const std::string &path, std::ostream &out)
+{
+    output = &out;
+    inputDone = false;
+    auto start = std::chrono::steady_clock::now();
+
+    if (config.format == Format::CSV)
+    {
+        write("name,type,status,answer_name,answer_type,ttl,data\n");
+    }
+
+    // Every worker keeps one batch in flight; the queue holds the next few
+    size_t workers = (config.inFlight + config.batchSize - 1) / config.batchSize;
+    queueCapacity = workers * 2;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; ++i)
+    {
+        threads.emplace_back(&BulkResolver::worker, this);
+    }
+
+    std::mutex progressMutex;
+    std::condition_variable progressWake;
+    bool finished = false;
+    std::thread progress;
+    if (config.progressInterval.count() > 0)
+    {
+        progress = std::thread([&]()
+                               {
+            std::unique_lock<std::mutex> lock(progressMutex);
+            while (!progressWake.wait_for(lock, config.progressInterval, [&]() { return finished; }))
+            {
+                report(start, false);
+            } });
+    }
+
+    auto finish = [&]()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            inputDone = true;
+        }
+        queueReady.notify_all();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(progressMutex);
+            finished = true;
+        }
+        progressWake.notify_all();
+        if (progress.joinable())
+        {
+            progress.join();
+        }
+    };
+
+    try
+    {
+        if (path == "-")
+        {
+            readStream(std::cin);
+        }
+        else
+        {
+            readFile(path);
+        }
+        if (!pending.empty())
+        {
+            enqueue(std::move(pending));
+            pending.clear();
+        }
+    }
+    catch (...)
+    {
+        finish();
+        throw;
+    }
+    finish();
+    out.flush();
+
+    if (config.progressInterval.count() > 0)
+    {
+        report(start, true);
+    }
+
+    Summary summary;
+    summary.lookups = lookups;
+    summary.answered = answered;
+    summary.empty = empty;
+    summary.nxdomain = nxdomain;
+    summary.failed = failed;
+    summary.invalid = invalid;
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return summary;
+}
+
+void BulkResolver::readFile(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+    {
+        // Pipes, FIFOs and the like can't be mapped
+        ::close(fd);
+        std::ifstream input(path);
+        readStream(input);
+        return;
+    }
+
+    size_t size = static_cast<size_t>(info.st_size);
+    void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Cannot map " + path + ": " + strerror(errno));
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    const char *data = static_cast<const char *>(mapping);
+    const char *end = data + size;
+    try
+    {
+        while (data < end)
+        {
+            const char *newline = static_cast<const char *>(std::memchr(data, '\n', end - data));
+            const char *lineEnd = newline ? newline : end;
+            addLine(data, lineEnd - data);
+            data = lineEnd + 1;
+        }
+    }
+    catch (...)
+    {
+        ::munmap(mapping, size);
+        throw;
+    }
+    ::munmap(mapping, size);
+}
+
+void BulkResolver::readStream(std::istream &input)
+{
+    std::string line;
+    while (std::getline(input, line))
+    {
+        addLine(line.data(), line.size());
+    }
+}
+
+void BulkResolver::addLine(const char *line, size_t length)
+{
+    size_t position = 0;
+    while (position < length && isSeparator(line[position]))
+        ++position;
+    if (position == length || line[position] == '#')
+        return;
+
+    size_t nameStart = position;
+    while (position < length && !isSeparator(line[position]))
+        ++position;
+    std::string name(line + nameStart, position - nameStart);
+
+    while (position < length && isSeparator(line[position]))
+        ++position;
+    size_t typeStart = position;
+    while (position < length && !isSeparator(line[position]))
+        ++position;
+    std::string typeText(line + typeStart, position - typeStart);
+
+    uint8_t encoded[DomainName::MAX_WIRE_SIZE];
+    try
+    {
+        DomainName::encode(name.data(), name.size(), encoded);
+    }
+    catch (const std::runtime_error &e)
+    {
+        writeInvalid(name, typeText, e.what());
+        return;
+    }
+
+    if (typeText.empty())
+    {
+        for (DNSRecordType type : config.types)
+        {
+            pending.push_back({name, type});
+        }
+    }
+    else if (auto type = stringToRecordType(typeText))
+    {
+        pending.push_back({std::move(name), *type});
+    }
+    else
+    {
+        writeInvalid(name, typeText, "Unknown record type");
+        return;
+    }
+
+    if (pending.size() >= config.batchSize)
+    {
+        enqueue(std::move(pending));
+        pending.clear();
+    }
+}
+
+void BulkResolver::enqueue(Batch batch)
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueSpace.wait(lock, [this]()
+                    { return queue.size() < queueCapacity; });
+    queue.push_back(std::move(batch));
+    lock.unlock();
+    queueReady.notify_one();
+}
+
+void BulkResolver::worker()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueReady.wait(lock, [this]()
+                        { return !queue.empty() || inputDone; });
+        if (queue.empty())
+        {
+            return;
+        }
+
+        Batch batch = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        queueSpace.notify_one();
+
+        resolveBatch(batch);
+    }
+}
+
+void BulkResolver::resolveBatch(Batch &batch)
+{
+    std::vector<std::pair<std::string, DNSRecordType>> questions;
+    questions.reserve(batch.size());
+    for (auto &lookup : batch)
+    {
+        questions.emplace_back(std::move(lookup.name), lookup.type);
+    }
+
+    std::vector<DNSResolver::BatchResult> answers;
+    std::string error;
+    try
+    {
+        answers = resolver.resolveRecordsBatch(questions);
+    }
+    catch (const std::exception &e)
+    {
+        error = e.what();
+    }
+
+    // Format the whole batch first so the output lock is held only to write
+    std::string text;
+    for (size_t i = 0; i < questions.size(); ++i)
+    {
+        const std::string &name = questions[i].first;
+        std::string type = recordTypeToString(questions[i].second);
+        const std::vector<CompactRecord> *records = nullptr;
+        const char *status = "error";
+        std::string reason; // for "error"
+        ++lookups;
+        if (!error.empty())
+        {
+            reason = error;
+            ++failed;
+        }
+        else if (answers[i].rcode == DNSResponseCode::NOERROR)
+        {
+            records = &answers[i].records;
+            if (records->empty())
+            {
+                status = "empty";
+                ++empty;
+            }
+            else
+            {
+                status = "ok";
+                ++answered;
+            }
+        }
+        else if (answers[i].rcode == DNSResponseCode::NXDOMAIN)
+        {
+            status = "nxdomain";
+            ++nxdomain;
+        }
+        else if (answers[i].rcode == DNSResponseCode::SERVFAIL)
+        {
+            status = "servfail";
+            ++failed;
+        }
+        else
+        {
+            reason = "Response code " + std::to_string(static_cast<int>(answers[i].rcode));
+            ++failed;
+        }
+
+        if (config.format == Format::JSONLines)
+        {
+            text += "{\"name\":" + jsonString(name) + ",\"type\":\"" + type + "\",\"status\":\"" + status + "\"";
+            if (!reason.empty())
+            {
+                text += ",\"error\":" + jsonString(reason);
+            }
+            text += ",\"answers\":[";
+            for (size_t j = 0; records && j < records->size(); ++j)
+            {
+                const auto &record = (*records)[j];
+                text += std::string(j ? "," : "") + "{\"name\":" + jsonString(record.name) +
+                        ",\"type\":\"" + recordTypeToString(record.type) +
+                        "\",\"ttl\":" + std::to_string(record.ttl) +
+                        ",\"data\":" + jsonString(record.text()) + "}";
+            }
+            text += "]}\n";
+        }
+        else if (!records || records->empty())
+        {
+            text += csvField(name) + "," + type + "," + status + ",,,," + csvField(reason) + "\n";
+        }
+        else
+        {
+            for (const auto &record : *records)
+            {
+                text += csvField(name) + "," + type + ",ok," + csvField(record.name) + "," +
+                        recordTypeToString(record.type) + "," + std::to_string(record.ttl) + "," +
+                        csvField(record.text()) + "\n";
+            }
+        }
+    }
+    write(text);
+}
+
+void BulkResolver::writeInvalid(const std::string &name, const std::string &type, const std::string &reason)
+{
+    ++invalid;
+    if (config.format == Format::JSONLines)
+    {
+        write("{\"name\":" + jsonString(name) + ",\"type\":" + jsonString(type) +
+              ",\"status\":\"invalid\",\"error\":" + jsonString(reason) + ",\"answers\":[]}\n");
+    }
+    else
+    {
+        write(csvField(name) + "," + csvField(type) + ",invalid,,,," + csvField(reason) + "\n");
+    }
+}
+
+void BulkResolver::write(const std::string &text)
+{
+    std::lock_guard<std::mutex> lock(outputMutex);
+    output->write(text.data(), static_cast<std::streamsize>(text.size()));
+}
+
+void BulkResolver::report(std::chrono::steady_clock::time_point start, bool final)
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t done = lookups;
+    char line[256];
+    std::snprintf(line, sizeof(line),
+                  "%s%llu lookups in %.1fs (%.0f/s): %llu answered, %llu empty, %llu nxdomain, %llu failed, %llu invalid\n",
+                  final ? "Done: " : "", static_cast<unsigned long long>(done), seconds,
+                  seconds > 0 ? done / seconds : 0.0, static_cast<unsigned long long>(answered.load()),
+                  static_cast<unsigned long long>(empty.load()), static_cast<unsigned long long>(nxdomain.load()),
+                  static_cast<unsigned long long>(failed.load()),
+                  static_cast<unsigned long long>(invalid.load()));
+    std::cerr << line << std::flush;
+}
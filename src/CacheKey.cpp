@@ -0,0 +1,98 @@
+#include "CacheKey.hpp"
+#include "DomainName.hpp"
+#include <stdexcept>
+
+CacheKey::CacheKey(const std::string &domain, DNSRecordType type)
+{
+    Buffer buffer;
+    length = static_cast<uint16_t>(encode(domain, type, buffer));
+    storage.assign(reinterpret_cast<const char *>(buffer), length);
+    owning = true;
+    computeHash();
+}
+
+CacheKey CacheKey::view(const std::string &domain, DNSRecordType type, Buffer &buffer)
+{
+    CacheKey key;
+    key.length = static_cast<uint16_t>(encode(domain, type, buffer));
+    key.external = buffer;
+    key.computeHash();
+    return key;
+}
+
+CacheKey CacheKey::fromWire(const uint8_t *name, size_t nameLength, DNSRecordType type, Buffer &buffer)
+{
+    if (nameLength == 0 || nameLength > MAX_SIZE - 2 || name[nameLength - 1] != 0)
+    {
+        throw std::runtime_error("Invalid wire name");
+    }
+
+    // Length octets are below 64, so folding them is a no-op
+    DomainName::foldCase(name, nameLength, buffer);
+    buffer[nameLength] = static_cast<uint16_t>(type) >> 8;
+    buffer[nameLength + 1] = static_cast<uint16_t>(type) & 0xFF;
+
+    CacheKey key;
+    key.length = static_cast<uint16_t>(nameLength + 2);
+    key.external = buffer;
+    key.computeHash();
+    return key;
+}
+
+CacheKey CacheKey::fromBytes(const uint8_t *bytes, size_t size)
+{
+    CacheKey key;
+    key.length = static_cast<uint16_t>(size);
+    key.external = bytes;
+    key.computeHash();
+    return key;
+}
+
+CacheKey CacheKey::owned() const
+{
+    if (owning)
+    {
+        return *this;
+    }
+
+    CacheKey key;
+    key.storage.assign(reinterpret_cast<const char *>(external), length);
+    key.owning = true;
+    key.length = length;
+    key.hashValue = hashValue;
+    return key;
+}
+
+size_t CacheKey::encode(const std::string &domain, DNSRecordType type, uint8_t *out)
+{
+    size_t position = DomainName::encode(domain.data(), domain.size(), out);
+    out[position++] = static_cast<uint16_t>(type) >> 8;
+    out[position++] = static_cast<uint16_t>(type) & 0xFF;
+    return position;
+}
+
+void CacheKey::computeHash()
+{
+    hashValue = DomainName::hash(data(), length);
+}
+
+DNSRecordType CacheKey::type() const
+{
+    const uint8_t *bytes = data();
+    return static_cast<DNSRecordType>((bytes[length - 2] << 8) | bytes[length - 1]);
+}
+
+std::string CacheKey::domain() const
+{
+    std::string name;
+    const uint8_t *bytes = data();
+    for (size_t i = 0; i + 2 < length && bytes[i] != 0; i += bytes[i] + 1)
+    {
+        if (!name.empty())
+        {
+            name += '.';
+        }
+        name.append(reinterpret_cast<const char *>(bytes + i + 1), bytes[i]);
+    }
+    return name;
+}
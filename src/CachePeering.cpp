@@ -0,0 +1,522 @@
+#include "CachePeering.hpp"
+#include "DNSQuery.hpp"
+#include "DomainName.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace
+{
+    const size_t MAX_DATAGRAM = 65507;
+    const int POLL_INTERVAL_MS = 200;
+    const uint16_t OPCODE_UPDATE = 5;
+
+    // "host:port" or "[v6-host]:port" with a numeric host
+    void parseAddress(const std::string &spec, sockaddr_storage &address, socklen_t &length)
+    {
+        std::string host;
+        std::string port;
+        size_t colon = spec.rfind(':');
+        if (!spec.empty() && spec[0] == '[')
+        {
+            size_t close = spec.find(']');
+            if (close == std::string::npos || colon != close + 1)
+                throw std::runtime_error("Invalid peer address: " + spec);
+            host = spec.substr(1, close - 1);
+        }
+        else
+        {
+            if (colon == std::string::npos || spec.find(':') != colon)
+                throw std::runtime_error("Invalid peer address: " + spec);
+            host = spec.substr(0, colon);
+        }
+        port = spec.substr(colon + 1);
+
+        char *end = nullptr;
+        unsigned long number = std::strtoul(port.c_str(), &end, 10);
+        if (port.empty() || *end != '\0' || number == 0 || number > 65535)
+            throw std::runtime_error("Invalid peer port: " + spec);
+
+        address = {};
+        auto *ipv4 = reinterpret_cast<sockaddr_in *>(&address);
+        auto *ipv6 = reinterpret_cast<sockaddr_in6 *>(&address);
+        if (inet_pton(AF_INET, host.c_str(), &ipv4->sin_addr) == 1)
+        {
+            ipv4->sin_family = AF_INET;
+            ipv4->sin_port = htons(static_cast<uint16_t>(number));
+            length = sizeof(sockaddr_in);
+        }
+        else if (inet_pton(AF_INET6, host.c_str(), &ipv6->sin6_addr) == 1)
+        {
+            ipv6->sin6_family = AF_INET6;
+            ipv6->sin6_port = htons(static_cast<uint16_t>(number));
+            length = sizeof(sockaddr_in6);
+        }
+        else
+        {
+            throw std::runtime_error("Invalid peer address: " + spec);
+        }
+    }
+
+    bool sameAddress(const sockaddr_storage &a, socklen_t aLength, const sockaddr_storage &b, socklen_t bLength)
+    {
+        return aLength == bLength && std::memcmp(&a, &b, aLength) == 0;
+    }
+
+    // Same IP address, any port
+    bool sameHost(const sockaddr_storage &a, const sockaddr_storage &b)
+    {
+        if (a.ss_family != b.ss_family)
+        {
+            return false;
+        }
+        if (a.ss_family == AF_INET)
+        {
+            return reinterpret_cast<const sockaddr_in &>(a).sin_addr.s_addr ==
+                   reinterpret_cast<const sockaddr_in &>(b).sin_addr.s_addr;
+        }
+        return std::memcmp(&reinterpret_cast<const sockaddr_in6 &>(a).sin6_addr,
+                           &reinterpret_cast<const sockaddr_in6 &>(b).sin6_addr, sizeof(in6_addr)) == 0;
+    }
+
+    // Whether every record is owned by `name` or by a name its CNAME chain
+    // leads to, so a publish can't plant records for other names
+    bool ownedByChain(const std::string &name, const std::vector<CompactRecord> &records)
+    {
+        auto trimmed = [](const std::string &owner)
+        { return !owner.empty() && owner.back() == '.' ? owner.substr(0, owner.size() - 1) : owner; };
+
+        std::vector<std::string> chain{trimmed(name)};
+        for (const auto &record : records)
+        {
+            std::string owner = trimmed(record.name);
+            bool owned = std::any_of(chain.begin(), chain.end(), [&owner](const std::string &link)
+                                     { return strcasecmp(link.c_str(), owner.c_str()) == 0; });
+            if (!owned)
+            {
+                return false;
+            }
+            if (record.type == DNSRecordType::CNAME && record.target())
+            {
+                chain.push_back(trimmed(*record.target()));
+            }
+        }
+        return true;
+    }
+
+    // The socket a thread sends its peer questions from, kept for the
+    // thread's lifetime
+    class ClientSocket
+    {
+    public:
+        ~ClientSocket()
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        // Bound to this instance's peer address on any port, so questions
+        // leave from an address the owners accept
+        int get(const sockaddr_storage &local, socklen_t localLength)
+        {
+            if (fd >= 0 && !sameHost(local, bound))
+            {
+                ::close(fd);
+                fd = -1;
+            }
+            if (fd < 0)
+            {
+                fd = ::socket(local.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+                bound = local;
+                if (bound.ss_family == AF_INET)
+                    reinterpret_cast<sockaddr_in &>(bound).sin_port = 0;
+                else
+                    reinterpret_cast<sockaddr_in6 &>(bound).sin6_port = 0;
+                if (fd >= 0 && ::bind(fd, reinterpret_cast<const sockaddr *>(&bound), localLength) != 0)
+                {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+            return fd;
+        }
+
+    private:
+        int fd = -1;
+        sockaddr_storage bound{};
+    };
+
+    thread_local ClientSocket clientSocket;
+
+    int64_t ticks(std::chrono::steady_clock::time_point time)
+    {
+        return time.time_since_epoch().count();
+    }
+}
+
+CachePeering::CachePeering(const Config &config, Lookup lookup, Store store)
+    : config(config), lookup(std::move(lookup)), store(std::move(store))
+{
+    sockaddr_storage listenAddress;
+    socklen_t listenLength;
+    parseAddress(config.listen, listenAddress, listenLength);
+
+    bool listed = false;
+    for (const auto &spec : config.peers)
+    {
+        auto peer = std::make_unique<Peer>();
+        parseAddress(spec, peer->address, peer->length);
+        if (peer->address.ss_family != listenAddress.ss_family)
+        {
+            throw std::runtime_error("Peer " + spec + " is not in the address family of " + config.listen);
+        }
+        if (sameAddress(peer->address, peer->length, listenAddress, listenLength))
+        {
+            self = peers.size();
+            listed = true;
+        }
+        peer->name = spec;
+        peers.push_back(std::move(peer));
+    }
+
+    // Every instance must build the same ring, so the own address counts
+    // whether or not the list repeats it
+    if (!listed)
+    {
+        auto peer = std::make_unique<Peer>();
+        peer->address = listenAddress;
+        peer->length = listenLength;
+        peer->name = config.listen;
+        self = peers.size();
+        peers.push_back(std::move(peer));
+    }
+
+    // Points hash the peer's address as given, the same on every instance
+    size_t points = std::max<size_t>(1, config.virtualNodes);
+    for (size_t i = 0; i < peers.size(); ++i)
+    {
+        for (size_t point = 0; point < points; ++point)
+        {
+            std::string label = peers[i]->name + "#" + std::to_string(point);
+            ring.emplace_back(DomainName::hash(reinterpret_cast<const uint8_t *>(label.data()), label.size()), i);
+        }
+    }
+    std::sort(ring.begin(), ring.end());
+
+    fd = ::socket(listenAddress.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to create peer socket: " + std::string(strerror(errno)));
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&listenAddress), listenLength) != 0)
+    {
+        std::string error = strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("Failed to bind peer socket " + config.listen + ": " + error);
+    }
+    int bufferSize = 4 * 1024 * 1024;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    server = std::thread(&CachePeering::serve, this);
+}
+
+CachePeering::~CachePeering()
+{
+    running = false;
+    if (server.joinable())
+        server.join();
+    ::close(fd);
+}
+
+size_t CachePeering::owner(const CacheKey &key) const
+{
+    auto point = std::lower_bound(ring.begin(), ring.end(), std::make_pair(key.hash(), size_t(0)));
+    return point == ring.end() ? ring.front().second : point->second;
+}
+
+void CachePeering::fetch(const std::vector<std::pair<std::string, DNSRecordType>> &questions,
+                         std::vector<std::vector<CompactRecord>> &results,
+                         std::vector<bool> &found)
+{
+    results.assign(questions.size(), {});
+    found.assign(questions.size(), false);
+
+    int socket = clientSocket.get(peers[self]->address, peers[self]->length);
+    if (socket < 0)
+    {
+        return;
+    }
+
+    for (size_t first = 0; first < questions.size(); first += WINDOW)
+    {
+        exchange(socket, questions, first, std::min(WINDOW, questions.size() - first), results, found);
+    }
+}
+
+void CachePeering::exchange(int socket, const std::vector<std::pair<std::string, DNSRecordType>> &questions,
+                            size_t first, size_t count, std::vector<std::vector<CompactRecord>> &results,
+                            std::vector<bool> &found)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Late answers to an earlier round that timed out
+    uint8_t buffer[MAX_DATAGRAM];
+    while (::recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+    {
+    }
+
+    // Consecutive IDs from a random base identify each question; the
+    // question section is kept to check it comes back unchanged
+    uint16_t baseId = DNSQuery::generateQueryId();
+    std::vector<std::vector<uint8_t>> sent(count);
+    std::vector<size_t> owners(count);
+    size_t outstanding = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto &question = questions[first + i];
+        CacheKey::Buffer keyBuffer;
+        size_t peer;
+        try
+        {
+            peer = owner(CacheKey::view(question.first, question.second, keyBuffer));
+        }
+        catch (const std::exception &)
+        {
+            continue; // not a valid name, upstream reports the error
+        }
+        if (peer == self || peers[peer]->retryAt.load(std::memory_order_relaxed) > ticks(start))
+        {
+            continue;
+        }
+
+        auto query = DNSQuery::buildQuery(question.first, question.second, static_cast<uint16_t>(baseId + i));
+        if (::sendto(socket, query.data(), query.size(), MSG_DONTWAIT,
+                     reinterpret_cast<const sockaddr *>(&peers[peer]->address), peers[peer]->length) < 0)
+        {
+            continue;
+        }
+        sent[i] = std::move(query);
+        owners[i] = peer;
+        ++outstanding;
+    }
+
+    if (outstanding == 0)
+    {
+        return;
+    }
+    queries.fetch_add(outstanding, std::memory_order_relaxed);
+
+    auto deadline = start + std::chrono::milliseconds(config.timeout);
+    while (outstanding > 0)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (remaining.count() < 0)
+        {
+            break;
+        }
+
+        pollfd waiting{socket, POLLIN, 0};
+        if (::poll(&waiting, 1, static_cast<int>(remaining.count()) + 1) <= 0)
+        {
+            continue;
+        }
+
+        sockaddr_storage from;
+        socklen_t fromLength = sizeof(from);
+        ssize_t received;
+        while ((received = ::recvfrom(socket, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                      reinterpret_cast<sockaddr *>(&from), &fromLength)) > 0)
+        {
+            size_t size = static_cast<size_t>(received);
+            uint16_t index = size >= 12 ? static_cast<uint16_t>(((buffer[0] << 8) | buffer[1]) - baseId) : count;
+            if (index < count && !sent[index].empty())
+            {
+                const auto &query = sent[index];
+                const auto &peer = *peers[owners[index]];
+                if (size >= query.size() && std::memcmp(buffer + 12, query.data() + 12, query.size() - 12) == 0 &&
+                    sameAddress(from, fromLength, peer.address, peer.length))
+                {
+                    sent[index].clear();
+                    --outstanding;
+                    try
+                    {
+                        auto response = DNSQuery::parseMessage(buffer, size);
+                        if (response.rcode == DNSResponseCode::NOERROR && !response.answers.empty())
+                        {
+                            results[first + index] = std::move(response.answers);
+                            found[first + index] = true;
+                            hits.fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                    catch (const std::exception &)
+                    {
+                        // Malformed answers count as misses
+                    }
+                }
+            }
+            fromLength = sizeof(from);
+        }
+    }
+
+    // Peers that didn't answer in time are left out for a while, so a dead
+    // one costs a timeout now and then rather than on every miss
+    auto now = std::chrono::steady_clock::now();
+    auto retryAt = ticks(now + std::chrono::milliseconds(config.retryInterval));
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!sent[i].empty())
+        {
+            peers[owners[i]]->retryAt.store(retryAt, std::memory_order_relaxed);
+        }
+    }
+    latency.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count(),
+                      std::memory_order_relaxed);
+}
+
+void CachePeering::publish(const std::string &domain, DNSRecordType type, const std::vector<CompactRecord> &records)
+{
+    if (records.empty())
+    {
+        return;
+    }
+
+    try
+    {
+        CacheKey::Buffer keyBuffer;
+        size_t peer = owner(CacheKey::view(domain, type, keyBuffer));
+        if (peer == self)
+        {
+            return;
+        }
+
+        // The answer as a response to its own question, sent as an UPDATE
+        auto query = DNSQuery::buildQuery(domain, type, DNSQuery::generateQueryId());
+        DNSQuery::Question question;
+        if (!DNSQuery::parseQuestion(query.data(), query.size(), question))
+        {
+            return;
+        }
+        auto message = DNSQuery::buildResponse(query.data(), question, records, DNSResponseCode::NOERROR,
+                                               MAX_DATAGRAM);
+        uint16_t flags = static_cast<uint16_t>((OPCODE_UPDATE << 11) | (message[3] & 0x0F));
+        message[2] = static_cast<uint8_t>(flags >> 8);
+        message[3] = static_cast<uint8_t>(flags);
+
+        if (::sendto(fd, message.data(), message.size(), MSG_DONTWAIT,
+                     reinterpret_cast<const sockaddr *>(&peers[peer]->address), peers[peer]->length) > 0)
+        {
+            publishes.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    catch (const std::exception &)
+    {
+        // Publishing is best effort
+    }
+}
+
+void CachePeering::serve()
+{
+    std::vector<uint8_t> buffer(MAX_DATAGRAM);
+    while (running.load(std::memory_order_relaxed))
+    {
+        pollfd waiting{fd, POLLIN, 0};
+        if (::poll(&waiting, 1, POLL_INTERVAL_MS) <= 0)
+        {
+            continue;
+        }
+
+        sockaddr_storage from;
+        socklen_t fromLength = sizeof(from);
+        ssize_t received;
+        while ((received = ::recvfrom(fd, buffer.data(), buffer.size(), MSG_DONTWAIT,
+                                      reinterpret_cast<sockaddr *>(&from), &fromLength)) > 0)
+        {
+            handle(buffer.data(), static_cast<size_t>(received), from, fromLength);
+            fromLength = sizeof(from);
+        }
+    }
+}
+
+void CachePeering::handle(const uint8_t *data, size_t size, const sockaddr_storage &from, socklen_t fromLength)
+{
+    // Questions come from a peer's client sockets, publishes from its peer
+    // socket; anyone else is ignored
+    bool fromPeerSocket = false;
+    bool fromPeerHost = false;
+    for (const auto &peer : peers)
+    {
+        fromPeerSocket = fromPeerSocket || sameAddress(from, fromLength, peer->address, peer->length);
+        fromPeerHost = fromPeerHost || sameHost(from, peer->address);
+    }
+    if (!fromPeerHost)
+    {
+        return;
+    }
+
+    DNSQuery::Question question;
+    if (!DNSQuery::parseQuestion(data, size, question) || question.qclass != 1)
+    {
+        return;
+    }
+
+    try
+    {
+        CacheKey::Buffer keyBuffer;
+        auto key = CacheKey::view(question.domain, question.type, keyBuffer);
+        uint16_t opcode = (question.flags >> 11) & 0x0F;
+
+        if (opcode == OPCODE_UPDATE)
+        {
+            if (!fromPeerSocket)
+            {
+                return;
+            }
+            auto response = DNSQuery::parseMessage(data, size);
+            if (!response.answers.empty() && ownedByChain(question.domain, response.answers))
+            {
+                store(key, response.answers);
+                stored.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+        if (opcode != 0)
+        {
+            return;
+        }
+
+        std::vector<CompactRecord> records;
+        bool hit = lookup(key, records);
+        auto response = DNSQuery::buildResponse(data, question, records,
+                                                hit ? DNSResponseCode::NOERROR : DNSResponseCode::REFUSED,
+                                                MAX_DATAGRAM);
+        ::sendto(fd, response.data(), response.size(), MSG_DONTWAIT,
+                 reinterpret_cast<const sockaddr *>(&from), fromLength);
+        if (hit)
+        {
+            served.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    catch (const std::exception &)
+    {
+        // Malformed peer messages are dropped
+    }
+}
+
+CachePeering::Counters CachePeering::getCounters() const
+{
+    Counters counters;
+    counters.queries = queries.load(std::memory_order_relaxed);
+    counters.hits = hits.load(std::memory_order_relaxed);
+    counters.publishes = publishes.load(std::memory_order_relaxed);
+    counters.served = served.load(std::memory_order_relaxed);
+    counters.stored = stored.load(std::memory_order_relaxed);
+    counters.latency = std::chrono::nanoseconds(latency.load(std::memory_order_relaxed));
+    return counters;
+}
@@ -0,0 +1,297 @@
+#include "CacheWarmer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+    bool isSeparator(char c)
+    {
+        return c == ' ' || c == '\t' || c == ',' || c == '\r';
+    }
+
+    std::vector<std::string> split(const std::string &line)
+    {
+        std::vector<std::string> tokens;
+        size_t position = 0;
+        while (position < line.size())
+        {
+            while (position < line.size() && isSeparator(line[position]))
+                ++position;
+            size_t start = position;
+            while (position < line.size() && !isSeparator(line[position]))
+                ++position;
+            if (position > start)
+                tokens.emplace_back(line, start, position - start);
+        }
+        return tokens;
+    }
+
+    struct Fields
+    {
+        std::string name;
+        std::string type;
+        std::string count;
+    };
+
+    // Name, type and count of a list line, or the question of a log line.
+    // Returns false for lines without a question.
+    bool parse(const std::string &line, Fields &fields)
+    {
+        auto tokens = split(line);
+        if (tokens.empty() || tokens[0][0] == '#')
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            // BIND: "... query: example.com IN A +E(0)K (10.0.0.1)"
+            if (tokens[i] == "query:")
+            {
+                if (i + 3 >= tokens.size())
+                    throw std::runtime_error("Truncated query log line");
+                fields = {tokens[i + 1], tokens[i + 3], ""};
+                return true;
+            }
+
+            // dnsmasq: "... query[A] example.com from 10.0.0.1"
+            if (tokens[i].compare(0, 6, "query[") == 0 && tokens[i].back() == ']')
+            {
+                if (i + 1 >= tokens.size())
+                    throw std::runtime_error("Truncated query log line");
+                fields = {tokens[i + 1], tokens[i].substr(6, tokens[i].size() - 7), ""};
+                return true;
+            }
+        }
+
+        if (tokens.size() > 3)
+        {
+            throw std::runtime_error("Unrecognized line");
+        }
+        fields = {tokens[0], tokens.size() > 1 ? tokens[1] : "", tokens.size() > 2 ? tokens[2] : ""};
+        return true;
+    }
+
+    struct Tally
+    {
+        uint64_t count;
+        uint64_t first; // line of the first sighting, for stable ranking
+    };
+
+    using Tallies = std::unordered_map<CacheKey, Tally, CacheKey::Hash>;
+    using Ranked = std::vector<std::pair<const CacheKey *, Tally>>;
+
+    bool moreFrequent(const Ranked::value_type &a, const Ranked::value_type &b)
+    {
+        return a.second.count != b.second.count ? a.second.count > b.second.count
+                                                : a.second.first < b.second.first;
+    }
+
+    // The `keep` most frequent tallies, unordered beyond that
+    Ranked top(const Tallies &tallies, size_t keep)
+    {
+        Ranked ranked;
+        ranked.reserve(tallies.size());
+        for (const auto &tally : tallies)
+        {
+            ranked.emplace_back(&tally.first, tally.second);
+        }
+        if (keep < ranked.size())
+        {
+            std::nth_element(ranked.begin(), ranked.begin() + keep, ranked.end(), moreFrequent);
+            ranked.resize(keep);
+        }
+        return ranked;
+    }
+}
+
+CacheWarmer::CacheWarmer(DNSResolver &resolver, const Config &config)
+    : resolver(resolver), config(config)
+{
+    this->config.batchSize = std::max<size_t>(1, config.batchSize);
+    this->config.trackedNames = std::max<size_t>({2, config.trackedNames, config.topN});
+}
+
+CacheWarmer::~CacheWarmer()
+{
+    stop();
+}
+
+std::vector<CacheWarmer::Entry> CacheWarmer::read(std::istream &input, Summary &summary) const
+{
+    Tallies tallies;
+    std::string line;
+    Fields fields;
+    while (std::getline(input, line))
+    {
+        ++summary.lines;
+        try
+        {
+            if (!parse(line, fields))
+                continue;
+
+            auto type = fields.type.empty() ? DNSRecordType::A : stringToRecordType(fields.type);
+            if (!type)
+                throw std::runtime_error("Unknown record type");
+
+            uint64_t count = 1;
+            if (!fields.count.empty())
+            {
+                if (fields.count.find_first_not_of("0123456789") != std::string::npos)
+                    throw std::runtime_error("Bad count");
+                count = std::stoull(fields.count);
+            }
+
+            CacheKey::Buffer buffer;
+            CacheKey key = CacheKey::view(fields.name, *type, buffer);
+            auto it = tallies.find(key);
+            if (it == tallies.end())
+            {
+                if (tallies.size() >= config.trackedNames)
+                {
+                    // Newcomers start over after a prune, but a name
+                    // popular enough to be warmed keeps coming back
+                    Tallies kept;
+                    kept.reserve(config.trackedNames);
+                    for (const auto &tally : top(tallies, config.trackedNames / 2))
+                    {
+                        kept.emplace(*tally.first, tally.second);
+                    }
+                    tallies.swap(kept);
+                }
+                it = tallies.emplace(key.owned(), Tally{0, summary.lines}).first;
+            }
+            it->second.count += count;
+        }
+        catch (const std::exception &)
+        {
+            ++summary.invalid;
+        }
+    }
+
+    Ranked ranked = top(tallies, config.topN);
+    std::sort(ranked.begin(), ranked.end(), moreFrequent);
+
+    std::vector<Entry> entries;
+    entries.reserve(ranked.size());
+    for (const auto &tally : ranked)
+    {
+        entries.push_back({tally.first->domain(), tally.first->type(), tally.second.count});
+    }
+    return entries;
+}
+
+CacheWarmer::Summary CacheWarmer::run(const std::string &path)
+{
+    if (path == "-")
+    {
+        return warm(std::cin);
+    }
+    std::ifstream input = open(path);
+    return warm(input);
+}
+
+void CacheWarmer::start(const std::string &path, std::function<void(const Summary &)> done)
+{
+    stop();
+    stopping = false;
+
+    std::ifstream file;
+    if (path != "-")
+    {
+        file = open(path);
+    }
+    thread = std::thread([this, file = std::move(file), fromStdin = path == "-", done = std::move(done)]() mutable
+                         {
+        Summary summary = warm(fromStdin ? std::cin : file);
+        if (done)
+            done(summary); });
+}
+
+void CacheWarmer::stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopWake.notify_all();
+    thread.join();
+}
+
+std::ifstream CacheWarmer::open(const std::string &path)
+{
+    std::ifstream input(path);
+    if (!input)
+    {
+        throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+    }
+    return input;
+}
+
+CacheWarmer::Summary CacheWarmer::warm(std::istream &input)
+{
+    auto start = std::chrono::steady_clock::now();
+    Summary summary;
+    std::vector<Entry> entries = read(input, summary);
+    summary.questions = entries.size();
+
+    // Batch i may start once i * batchSize questions fit the rate since
+    // the first one went out
+    auto paced = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::string, DNSRecordType>> questions;
+    for (size_t first = 0; first < entries.size(); first += config.batchSize)
+    {
+        auto due = paced;
+        if (config.rate > 0)
+        {
+            due += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(static_cast<double>(first) / config.rate));
+        }
+        {
+            std::unique_lock<std::mutex> lock(stopMutex);
+            if (stopWake.wait_until(lock, due, [this]()
+                                    { return stopping; }))
+            {
+                break;
+            }
+        }
+
+        size_t count = std::min(config.batchSize, entries.size() - first);
+        questions.clear();
+        for (size_t i = first; i < first + count; ++i)
+        {
+            questions.emplace_back(entries[i].name, entries[i].type);
+        }
+
+        try
+        {
+            for (const auto &result : resolver.resolveRecordsBatch(questions))
+            {
+                if (result.rcode == DNSResponseCode::NXDOMAIN)
+                    ++summary.nxdomain;
+                else if (result.rcode != DNSResponseCode::NOERROR)
+                    ++summary.failed;
+                else if (result.records.empty())
+                    ++summary.empty;
+                else
+                    ++summary.answered;
+            }
+        }
+        catch (const std::exception &)
+        {
+            summary.failed += count;
+        }
+    }
+
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return summary;
+}
@@ -0,0 +1,396 @@
+#include "CompactRecord.hpp"
+#include "DomainName.hpp"
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <arpa/inet.h>
+
+namespace
+{
+    uint16_t read16(const uint8_t *data)
+    {
+        return static_cast<uint16_t>((data[0] << 8) | data[1]);
+    }
+
+    uint32_t read32(const uint8_t *data)
+    {
+        return (static_cast<uint32_t>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    }
+
+    void append16(std::vector<uint8_t> &buffer, uint16_t value)
+    {
+        buffer.push_back(value >> 8);
+        buffer.push_back(value & 0xFF);
+    }
+
+    void append32(std::vector<uint8_t> &buffer, uint32_t value)
+    {
+        append16(buffer, value >> 16);
+        append16(buffer, value & 0xFFFF);
+    }
+
+    void appendName(std::vector<uint8_t> &buffer, const std::string &name)
+    {
+        // Case is kept: these names are sent back as received
+        uint8_t encoded[DomainName::MAX_WIRE_SIZE];
+        size_t length = DomainName::encode(name.data(), name.size(), encoded, false);
+        buffer.insert(buffer.end(), encoded, encoded + length);
+    }
+
+    void expect(bool condition, DNSRecordType type)
+    {
+        if (!condition)
+        {
+            throw std::runtime_error("Malformed data for record type " +
+                                     std::to_string(static_cast<uint16_t>(type)));
+        }
+    }
+}
+
+CompactRecord::Payload CompactRecord::decodeData(DNSRecordType type, const uint8_t *message,
+                                                 size_t messageSize, size_t offset, size_t length)
+{
+    expect(offset + length <= messageSize, type);
+    const uint8_t *data = message + offset;
+    size_t end = offset + length;
+
+    switch (type)
+    {
+    case DNSRecordType::A:
+    {
+        expect(length == 4, type);
+        in_addr address;
+        std::memcpy(&address, data, 4);
+        return address;
+    }
+
+    case DNSRecordType::AAAA:
+    {
+        expect(length == 16, type);
+        in6_addr address;
+        std::memcpy(&address, data, 16);
+        return address;
+    }
+
+    case DNSRecordType::CNAME:
+    case DNSRecordType::NS:
+    case DNSRecordType::PTR:
+    {
+        size_t position = offset;
+        return Name{DomainName::decode(message, end, position)};
+    }
+
+    case DNSRecordType::MX:
+    {
+        expect(length >= 3, type);
+        size_t position = offset + 2;
+        return MX{read16(data), DomainName::decode(message, end, position)};
+    }
+
+    case DNSRecordType::SRV:
+    {
+        expect(length >= 7, type);
+        size_t position = offset + 6;
+        return SRV{read16(data), read16(data + 2), read16(data + 4), DomainName::decode(message, end, position)};
+    }
+
+    case DNSRecordType::SOA:
+    {
+        auto soa = std::make_shared<SOA>();
+        size_t position = offset;
+        soa->mname = DomainName::decode(message, end, position);
+        soa->rname = DomainName::decode(message, end, position);
+        expect(end - position == 20, type);
+        const uint8_t *numbers = message + position;
+        soa->serial = read32(numbers);
+        soa->refresh = read32(numbers + 4);
+        soa->retry = read32(numbers + 8);
+        soa->expire = read32(numbers + 12);
+        soa->minimum = read32(numbers + 16);
+        return std::shared_ptr<const SOA>(std::move(soa));
+    }
+
+    case DNSRecordType::TXT:
+    {
+        // At least one character-string, and they must fill the data exactly
+        size_t position = 0;
+        while (position < length)
+        {
+            position += 1 + data[position];
+        }
+        expect(length > 0 && position == length, type);
+        return TXT{std::string(reinterpret_cast<const char *>(data), length)};
+    }
+
+    default:
+        return Opaque{std::string(reinterpret_cast<const char *>(data), length)};
+    }
+}
+
+void CompactRecord::encodeData(std::vector<uint8_t> &buffer) const
+{
+    if (auto address = std::get_if<in_addr>(&payload))
+    {
+        auto bytes = reinterpret_cast<const uint8_t *>(address);
+        buffer.insert(buffer.end(), bytes, bytes + 4);
+    }
+    else if (auto address = std::get_if<in6_addr>(&payload))
+    {
+        auto bytes = reinterpret_cast<const uint8_t *>(address);
+        buffer.insert(buffer.end(), bytes, bytes + 16);
+    }
+    else if (auto name = std::get_if<Name>(&payload))
+    {
+        appendName(buffer, name->target);
+    }
+    else if (auto mx = std::get_if<MX>(&payload))
+    {
+        append16(buffer, mx->preference);
+        appendName(buffer, mx->exchange);
+    }
+    else if (auto srv = std::get_if<SRV>(&payload))
+    {
+        append16(buffer, srv->priority);
+        append16(buffer, srv->weight);
+        append16(buffer, srv->port);
+        appendName(buffer, srv->target);
+    }
+    else if (auto soa = std::get_if<std::shared_ptr<const SOA>>(&payload))
+    {
+        appendName(buffer, (*soa)->mname);
+        appendName(buffer, (*soa)->rname);
+        append32(buffer, (*soa)->serial);
+        append32(buffer, (*soa)->refresh);
+        append32(buffer, (*soa)->retry);
+        append32(buffer, (*soa)->expire);
+        append32(buffer, (*soa)->minimum);
+    }
+    else if (auto txt = std::get_if<TXT>(&payload))
+    {
+        buffer.insert(buffer.end(), txt->strings.begin(), txt->strings.end());
+    }
+    else
+    {
+        const auto &rdata = std::get<Opaque>(payload).rdata;
+        buffer.insert(buffer.end(), rdata.begin(), rdata.end());
+    }
+}
+
+const std::string *CompactRecord::target() const
+{
+    auto name = std::get_if<Name>(&payload);
+    return name ? &name->target : nullptr;
+}
+
+std::vector<std::string> CompactRecord::textStrings() const
+{
+    std::vector<std::string> strings;
+    if (auto txt = std::get_if<TXT>(&payload))
+    {
+        const std::string &data = txt->strings;
+        for (size_t position = 0; position < data.size(); position += 1 + static_cast<uint8_t>(data[position]))
+        {
+            strings.push_back(data.substr(position + 1, static_cast<uint8_t>(data[position])));
+        }
+    }
+    return strings;
+}
+
+std::string CompactRecord::text() const
+{
+    if (auto address = std::get_if<in_addr>(&payload))
+    {
+        char buffer[INET_ADDRSTRLEN];
+        return inet_ntop(AF_INET, address, buffer, sizeof(buffer));
+    }
+    if (auto address = std::get_if<in6_addr>(&payload))
+    {
+        char buffer[INET6_ADDRSTRLEN];
+        return inet_ntop(AF_INET6, address, buffer, sizeof(buffer));
+    }
+    if (auto name = std::get_if<Name>(&payload))
+    {
+        return name->target;
+    }
+    if (auto mx = std::get_if<MX>(&payload))
+    {
+        return std::to_string(mx->preference) + " " + mx->exchange;
+    }
+    if (auto srv = std::get_if<SRV>(&payload))
+    {
+        return std::to_string(srv->priority) + " " + std::to_string(srv->weight) + " " +
+               std::to_string(srv->port) + " " + srv->target;
+    }
+    if (auto soa = std::get_if<std::shared_ptr<const SOA>>(&payload))
+    {
+        const SOA &data = **soa;
+        return data.mname + " " + data.rname + " " + std::to_string(data.serial) + " " +
+               std::to_string(data.refresh) + " " + std::to_string(data.retry) + " " +
+               std::to_string(data.expire) + " " + std::to_string(data.minimum);
+    }
+    if (std::holds_alternative<TXT>(payload))
+    {
+        std::string joined;
+        for (const auto &string : textStrings())
+        {
+            joined += (joined.empty() ? "\"" : " \"") + string + "\"";
+        }
+        return joined;
+    }
+
+    // RFC 3597 generic form
+    static const char digits[] = "0123456789abcdef";
+    const auto &rdata = std::get<Opaque>(payload).rdata;
+    std::string generic = "\\# " + std::to_string(rdata.size()) + (rdata.empty() ? "" : " ");
+    for (unsigned char byte : rdata)
+    {
+        generic += digits[byte >> 4];
+        generic += digits[byte & 0x0F];
+    }
+    return generic;
+}
+
+DNSRecord CompactRecord::toRecord() const
+{
+    DNSRecord record{};
+    record.type = type;
+    record.name = name;
+    record.ttl = ttl;
+
+    if (std::holds_alternative<TXT>(payload))
+    {
+        record.data = textStrings();
+    }
+    else
+    {
+        record.data.push_back(text());
+    }
+
+    if (auto mx = std::get_if<MX>(&payload))
+    {
+        record.mx.preference = mx->preference;
+        record.mx.exchange = mx->exchange;
+    }
+    else if (auto soa = std::get_if<std::shared_ptr<const SOA>>(&payload))
+    {
+        record.soa.mname = (*soa)->mname;
+        record.soa.rname = (*soa)->rname;
+        record.soa.serial = (*soa)->serial;
+        record.soa.refresh = (*soa)->refresh;
+        record.soa.retry = (*soa)->retry;
+        record.soa.expire = (*soa)->expire;
+        record.soa.minimum = (*soa)->minimum;
+    }
+    return record;
+}
+
+CompactRecord CompactRecord::fromRecord(const DNSRecord &record)
+{
+    CompactRecord compact;
+    compact.type = record.type;
+    compact.ttl = record.ttl;
+    compact.name = record.name;
+
+    const std::string *first = record.data.empty() ? nullptr : &record.data[0];
+    switch (record.type)
+    {
+    case DNSRecordType::A:
+    {
+        in_addr address;
+        expect(first && inet_pton(AF_INET, first->c_str(), &address) == 1, record.type);
+        compact.payload = address;
+        break;
+    }
+
+    case DNSRecordType::AAAA:
+    {
+        in6_addr address;
+        expect(first && inet_pton(AF_INET6, first->c_str(), &address) == 1, record.type);
+        compact.payload = address;
+        break;
+    }
+
+    case DNSRecordType::CNAME:
+    case DNSRecordType::NS:
+    case DNSRecordType::PTR:
+        expect(first != nullptr, record.type);
+        compact.payload = Name{*first};
+        break;
+
+    case DNSRecordType::MX:
+        compact.payload = MX{record.mx.preference, record.mx.exchange};
+        break;
+
+    case DNSRecordType::SRV:
+    {
+        SRV srv;
+        std::istringstream fields(first ? *first : std::string());
+        expect(static_cast<bool>(fields >> srv.priority >> srv.weight >> srv.port >> srv.target), record.type);
+        compact.payload = srv;
+        break;
+    }
+
+    case DNSRecordType::SOA:
+    {
+        expect(!record.soa.mname.empty(), record.type);
+        compact.payload = std::make_shared<const SOA>(SOA{record.soa.mname, record.soa.rname, record.soa.serial,
+                                                          record.soa.refresh, record.soa.retry,
+                                                          record.soa.expire, record.soa.minimum});
+        break;
+    }
+
+    case DNSRecordType::TXT:
+    {
+        // Character-strings are at most 255 bytes each
+        TXT txt;
+        for (const auto &text : record.data)
+        {
+            size_t offset = 0;
+            do
+            {
+                size_t chunk = std::min<size_t>(255, text.size() - offset);
+                txt.strings += static_cast<char>(chunk);
+                txt.strings.append(text, offset, chunk);
+                offset += chunk;
+            } while (offset < text.size());
+        }
+        expect(!txt.strings.empty(), record.type);
+        compact.payload = std::move(txt);
+        break;
+    }
+
+    default:
+        throw std::runtime_error("No text form for record type " +
+                                 std::to_string(static_cast<uint16_t>(record.type)));
+    }
+    return compact;
+}
+
+std::vector<DNSRecord> CompactRecord::toRecords(const std::vector<CompactRecord> &records)
+{
+    std::vector<DNSRecord> converted;
+    converted.reserve(records.size());
+    for (const auto &record : records)
+    {
+        converted.push_back(record.toRecord());
+    }
+    return converted;
+}
+
+std::vector<CompactRecord> CompactRecord::fromRecords(const std::vector<DNSRecord> &records)
+{
+    std::vector<CompactRecord> converted;
+    converted.reserve(records.size());
+    for (const auto &record : records)
+    {
+        try
+        {
+            converted.push_back(fromRecord(record));
+        }
+        catch (const std::runtime_error &)
+        {
+            // Records whose text doesn't parse are left out
+        }
+    }
+    return converted;
+}
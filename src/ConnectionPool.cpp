@@ -1,7 +1,149 @@
 #include "ConnectionPool.hpp"
+#include "HTTPSConnection.hpp"
+#include "IOUringConnection.hpp"
+#include "TLSConnection.hpp"
+#include <Poco/Exception.h>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
 #include <stdexcept>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
-DNSConnection::DNSConnection(const std::string &nameserver, uint16_t port)
+namespace
+{
+    // Whether the send or receive that just came up short broke the socket,
+    // rather than finding no data or no buffer space; errno is cleared first
+    bool socketBroken()
+    {
+        return errno != 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+    }
+
+    // Waits until `fd` is ready for `events` or the deadline passes
+    bool waitFor(int fd, short events, std::chrono::steady_clock::time_point deadline)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        pollfd ready{fd, events, 0};
+        return remaining.count() > 0 && ::poll(&ready, 1, static_cast<int>(remaining.count())) > 0;
+    }
+
+    // Connects and writes every query; false on failure or at the deadline
+    bool sendStream(int fd, const sockaddr *server, socklen_t serverLength, const std::vector<uint8_t> &data,
+                    std::chrono::steady_clock::time_point deadline)
+    {
+        if (::connect(fd, server, serverLength) != 0)
+        {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (errno != EINPROGRESS || !waitFor(fd, POLLOUT, deadline) ||
+                ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+            {
+                return false;
+            }
+        }
+
+        size_t written = 0;
+        while (written < data.size())
+        {
+            ssize_t result = ::send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+            if (result > 0)
+                written += static_cast<size_t>(result);
+            else if (result < 0 && errno == EINTR)
+                continue;
+            else if (result < 0 && errno == EAGAIN && waitFor(fd, POLLOUT, deadline))
+                continue;
+            else
+                return false;
+        }
+        return true;
+    }
+}
+
+void DNSConnection::retryOverTCP(const sockaddr *server, socklen_t serverLength,
+                                 const std::vector<std::pair<std::string, DNSRecordType>> &questions,
+                                 std::vector<DNSQuery::Response> &results) const
+{
+    std::vector<size_t> truncated;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        if (results[i].truncated)
+            truncated.push_back(i);
+    }
+    if (truncated.empty())
+    {
+        return;
+    }
+
+    int fd = ::socket(server->sa_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    // Length-prefixed queries, identified by consecutive IDs as in a batch
+    uint16_t baseId = DNSQuery::generateQueryId();
+    std::vector<std::vector<uint8_t>> sent(truncated.size());
+    std::vector<uint8_t> stream;
+    for (size_t i = 0; i < truncated.size(); ++i)
+    {
+        const auto &question = questions[truncated[i]];
+        sent[i] = DNSQuery::buildQuery(question.first, question.second, static_cast<uint16_t>(baseId + i), dnssecOk);
+        stream.push_back(static_cast<uint8_t>(sent[i].size() >> 8));
+        stream.push_back(static_cast<uint8_t>(sent[i].size() & 0xFF));
+        stream.insert(stream.end(), sent[i].begin(), sent[i].end());
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + responseTimeout;
+    size_t outstanding = sendStream(fd, server, serverLength, stream, deadline) ? truncated.size() : 0;
+    std::vector<uint8_t> inbox;
+    uint8_t buffer[16384];
+    while (outstanding > 0)
+    {
+        // Answers may come in any order (RFC 7766)
+        size_t length = inbox.size() >= 2 ? static_cast<size_t>((inbox[0] << 8) | inbox[1]) : 0;
+        if (inbox.size() >= 2 && inbox.size() >= 2 + length)
+        {
+            const uint8_t *message = inbox.data() + 2;
+            uint16_t index = length >= 12 ? static_cast<uint16_t>(((message[0] << 8) | message[1]) - baseId)
+                                          : static_cast<uint16_t>(sent.size());
+            if (index < sent.size() && !sent[index].empty() && DNSQuery::matchesQuery(message, length, sent[index]))
+            {
+                sent[index].clear();
+                --outstanding;
+                try
+                {
+                    results[truncated[index]] = DNSQuery::parseMessage(message, length);
+                }
+                catch (const std::exception &)
+                {
+                    results[truncated[index]] = DNSQuery::Response();
+                }
+            }
+            inbox.erase(inbox.begin(), inbox.begin() + 2 + length);
+            continue;
+        }
+
+        ssize_t received = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (received > 0)
+            inbox.insert(inbox.end(), buffer, buffer + received);
+        else if (received < 0 && (errno == EINTR || (errno == EAGAIN && waitFor(fd, POLLIN, deadline))))
+            continue;
+        else
+            break;
+    }
+    ::close(fd);
+
+    // Questions TCP couldn't answer stay unanswered
+    for (size_t index : truncated)
+    {
+        if (results[index].truncated)
+            results[index] = DNSQuery::Response();
+    }
+}
+
+UDPConnection::UDPConnection(const std::string &nameserver, uint16_t port)
     : valid(false), serverAddress(nameserver, port)
 {
     try
@@ -16,82 +158,589 @@ DNSConnection::DNSConnection(const std::string &nameserver, uint16_t port)
     }
 }
 
-bool DNSConnection::isValid() const
+bool UDPConnection::isValid() const
 {
     return valid;
 }
 
-void DNSConnection::query(const std::string &domain, DNSRecordType type)
+void UDPConnection::query(const std::string &domain, DNSRecordType type)
 {
     if (!valid)
         throw std::runtime_error("Invalid connection");
 
-    auto queryData = DNSQuery::buildQuery(domain, type);
-    socket->sendTo(queryData.data(), queryData.size(), serverAddress);
+    expectedId = DNSQuery::generateQueryId();
+    pending = {domain, type};
+    auto queryData = DNSQuery::buildQuery(domain, type, expectedId, dnssecOk);
+    try
+    {
+        socket->sendTo(queryData.data(), queryData.size(), serverAddress);
+    }
+    catch (const Poco::Exception &e)
+    {
+        valid = false; // recreated by the pool on release
+        throw UpstreamError("Failed to send query: " + e.displayText());
+    }
 }
 
-std::vector<DNSRecord> DNSConnection::getResponse()
+std::vector<CompactRecord> UDPConnection::getResponse()
 {
     if (!valid)
         throw std::runtime_error("Invalid connection");
 
     std::vector<uint8_t> buffer(BUFFER_SIZE);
     Poco::Net::SocketAddress sender;
+    auto deadline = std::chrono::steady_clock::now() + responseTimeout;
+
+    while (true)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             deadline - std::chrono::steady_clock::now())
+                             .count();
+        if (remaining <= 0)
+        {
+            throw UpstreamError("Failed to receive response");
+        }
+
+        int received;
+        try
+        {
+            socket->setReceiveTimeout(Poco::Timespan(remaining / 1000, (remaining % 1000) * 1000));
+            received = socket->receiveFrom(buffer.data(), buffer.size(), sender);
+        }
+        catch (const Poco::TimeoutException &)
+        {
+            throw UpstreamError("Failed to receive response");
+        }
+        catch (const Poco::Exception &e)
+        {
+            valid = false;
+            throw UpstreamError("Failed to receive response: " + e.displayText());
+        }
+
+        if (received <= 0)
+        {
+            throw UpstreamError("Failed to receive response");
+        }
+
+        // Late answers to earlier, timed-out queries are skipped by ID
+        if (received < 12 || ((buffer[0] << 8) | buffer[1]) != expectedId)
+        {
+            continue;
+        }
+
+        std::vector<DNSQuery::Response> results{DNSQuery::parseMessage(buffer.data(), static_cast<size_t>(received))};
+        retryOverTCP(serverAddress.addr(), serverAddress.length(), {pending}, results);
+        return DNSQuery::takeAnswers(std::move(results[0]));
+    }
+}
+
+std::vector<DNSQuery::Response> UDPConnection::exchangeBatch(
+    const std::vector<std::pair<std::string, DNSRecordType>> &questions)
+{
+    if (!valid)
+        throw std::runtime_error("Invalid connection");
+
+    // The ring is reused for every batch sent over this connection
+    if (!batch)
+    {
+        batch = std::make_unique<DatagramBatch>(64, BUFFER_SIZE);
+    }
 
-    socket->setReceiveTimeout(Poco::Timespan(5, 0)); // 5 second timeout
-    int received = socket->receiveFrom(buffer.data(), buffer.size(), sender);
+    std::vector<DNSQuery::Response> results(questions.size());
+    int fd = socket->impl()->sockfd();
 
-    if (received <= 0)
+    for (size_t first = 0; first < questions.size() && valid; first += batch->capacity())
     {
-        throw std::runtime_error("Failed to receive response");
+        size_t count = std::min(batch->capacity(), questions.size() - first);
+
+        // Late answers to an earlier batch that timed out
+        while (batch->receive(fd) > 0)
+        {
+        }
+
+        // Consecutive IDs from a random base identify each question; the
+        // queries are kept to check the answer carries the same question
+        uint16_t baseId = DNSQuery::generateQueryId();
+        std::vector<std::vector<uint8_t>> sent(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto &question = questions[first + i];
+            sent[i] = DNSQuery::buildQuery(question.first, question.second,
+                                           static_cast<uint16_t>(baseId + i), dnssecOk);
+            batch->add(sent[i].data(), sent[i].size());
+        }
+        errno = 0;
+        if (batch->flush(fd) < count && socketBroken())
+        {
+            valid = false;
+            break;
+        }
+
+        std::vector<bool> answered(count, false);
+        size_t outstanding = count;
+        auto deadline = std::chrono::steady_clock::now() + responseTimeout;
+
+        while (outstanding > 0)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            pollfd readable{fd, POLLIN, 0};
+            if (remaining.count() <= 0 || ::poll(&readable, 1, remaining.count()) <= 0)
+            {
+                break;
+            }
+
+            errno = 0;
+            size_t received = batch->receive(fd);
+            if (received == 0 && socketBroken())
+            {
+                valid = false;
+                break;
+            }
+            for (size_t i = 0; i < received; ++i)
+            {
+                if (batch->size(i) < 12)
+                    continue;
+
+                const uint8_t *data = batch->data(i);
+                uint16_t index = static_cast<uint16_t>(((data[0] << 8) | data[1]) - baseId);
+                if (index >= count || answered[index] || !DNSQuery::matchesQuery(data, batch->size(i), sent[index]))
+                    continue;
+
+                answered[index] = true;
+                --outstanding;
+                try
+                {
+                    results[first + index] = DNSQuery::parseMessage(data, batch->size(i));
+                }
+                catch (const std::exception &)
+                {
+                    // Malformed responses count as unanswered
+                }
+            }
+        }
     }
 
-    buffer.resize(received);
-    return DNSQuery::parseResponse(buffer);
+    retryOverTCP(serverAddress.addr(), serverAddress.length(), questions, results);
+    return results;
 }
 
-ConnectionPool::ConnectionPool(size_t poolSize, const std::vector<std::string> &nameservers)
-    : maxSize(poolSize)
+// Splits "host", "host:port", "[v6-host]:port" or "https://host[:port]/path",
+// each optionally followed by "#name", into its parts
+static void splitHostPort(const std::string &spec, uint16_t defaultPort, std::string &host, uint16_t &port,
+                          std::string &serverName, std::string &path)
 {
+    size_t hash = spec.find('#');
+    std::string server = spec.substr(0, hash);
+    serverName = hash == std::string::npos ? "" : spec.substr(hash + 1);
+
+    path = "/dns-query";
+    if (server.compare(0, 8, "https://") == 0)
+    {
+        server = server.substr(8);
+        size_t slash = server.find('/');
+        if (slash != std::string::npos)
+        {
+            path = server.substr(slash);
+            server = server.substr(0, slash);
+        }
+    }
+    host = server;
+    port = defaultPort;
+
+    size_t colon = server.rfind(':');
+    if (!server.empty() && server[0] == '[')
+    {
+        size_t close = server.find(']');
+        host = server.substr(1, close - 1);
+        if (close != std::string::npos && colon == close + 1)
+        {
+            port = static_cast<uint16_t>(std::stoi(server.substr(colon + 1)));
+        }
+    }
+    else if (colon != std::string::npos && server.find(':') == colon)
+    {
+        host = server.substr(0, colon);
+        port = static_cast<uint16_t>(std::stoi(server.substr(colon + 1)));
+    }
+}
 
+ConnectionPool::ConnectionPool(const std::vector<std::string> &nameservers, const Config &config)
+    : config(config), backend(config.backend)
+{
     if (nameservers.empty())
     {
         throw std::runtime_error("No nameservers provided");
     }
+    if (backend == TransportBackend::TLS || backend == TransportBackend::HTTPS)
+    {
+        tlsContext = std::make_shared<TLSContext>(config.tlsCaFile, config.tlsVerify);
+    }
 
-    for (size_t i = 0; i < poolSize; ++i)
+    // Connections are spread round-robin, with at least one per upstream
+    size_t total = std::max(config.poolSize, nameservers.size());
+    size_t valid = 0;
+    for (size_t index = 0; index < nameservers.size(); ++index)
     {
-        const std::string &ns = nameservers[i % nameservers.size()];
-        auto conn = std::make_shared<DNSConnection>(ns, 53);
-        if (conn->isValid())
+        std::string host;
+        uint16_t port;
+        std::string serverName;
+        std::string path;
+        uint16_t defaultPort = backend == TransportBackend::TLS ? 853 : backend == TransportBackend::HTTPS ? 443 : 53;
+        splitHostPort(nameservers[index], defaultPort, host, port, serverName, path);
+
+        size_t count = total / nameservers.size() + (index < total % nameservers.size() ? 1 : 0);
+        auto upstream = std::make_unique<Upstream>(host, port, serverName, path, count);
+        for (size_t i = 0; i < count; ++i)
         {
-            connections.push(conn);
+            auto conn = createConnection(*upstream);
+            conn->upstream = index;
+            if (conn->isValid())
+            {
+                upstream->idle.tryPush(conn.get());
+                ++valid;
+            }
+            else
+            {
+                upstream->broken.push_back(upstream->owned.size());
+            }
+            upstream->owned.push_back(std::move(conn));
         }
+        upstreams.push_back(std::move(upstream));
     }
 
-    if (connections.empty())
+    if (valid == 0)
     {
         throw std::runtime_error("Failed to create any valid connections");
     }
+
+    healthThread = std::thread(&ConnectionPool::healthLoop, this);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(healthMutex);
+        stopping = true;
+    }
+    healthWake.notify_all();
+    healthThread.join();
 }
 
-std::shared_ptr<DNSConnection> ConnectionPool::acquire()
+std::unique_ptr<DNSConnection> ConnectionPool::createConnection(const Upstream &upstream)
 {
-    std::unique_lock<std::mutex> lock(poolMutex);
-    cv.wait(lock, [this]()
-            { return !connections.empty(); });
+    std::unique_ptr<DNSConnection> conn;
+    if (tlsContext)
+    {
+        // No plaintext fallback: an unreachable encrypted upstream stays broken
+        conn = createEncrypted(upstream);
+    }
+    else if (backend == TransportBackend::IOUring)
+    {
+        conn = std::make_unique<IOUringConnection>(upstream.host, upstream.port);
+        if (!conn->isValid())
+        {
+            // Kernel without the required io_uring features: use the portable path
+            backend = TransportBackend::UDP;
+            conn.reset();
+        }
+    }
 
-    auto conn = connections.front();
-    connections.pop();
+    if (!conn)
+    {
+        conn = std::make_unique<UDPConnection>(upstream.host, upstream.port);
+    }
+    conn->responseTimeout = config.responseTimeout;
+    conn->dnssecOk = config.dnssecOk;
     return conn;
 }
 
-void ConnectionPool::release(std::shared_ptr<DNSConnection> conn)
+std::unique_ptr<DNSConnection> ConnectionPool::createEncrypted(const Upstream &upstream) const
+{
+    if (backend == TransportBackend::HTTPS)
+    {
+        return std::make_unique<HTTPSConnection>(upstream.host, upstream.port, upstream.serverName, upstream.path,
+                                                 config.dohMethod, tlsContext, config.tlsIdleTimeout);
+    }
+    return std::make_unique<TLSConnection>(upstream.host, upstream.port, upstream.serverName, tlsContext,
+                                           config.tlsIdleTimeout);
+}
+
+bool ConnectionPool::admit(Upstream &upstream, bool &trial)
+{
+    trial = false;
+    BreakerState state = upstream.state.load(std::memory_order_acquire);
+    if (state == BreakerState::Closed)
+    {
+        return true;
+    }
+
+    if (state == BreakerState::Open)
+    {
+        auto openedAt = std::chrono::steady_clock::time_point(
+            std::chrono::steady_clock::duration(upstream.openedAt.load(std::memory_order_relaxed)));
+        if (std::chrono::steady_clock::now() - openedAt < config.openDuration)
+        {
+            return false;
+        }
+        upstream.state.compare_exchange_strong(state, BreakerState::HalfOpen);
+    }
+
+    // Half-open: exactly one trial query decides whether the breaker closes
+    bool expected = false;
+    trial = upstream.trialInFlight.compare_exchange_strong(expected, true);
+    return trial;
+}
+
+void ConnectionPool::recordSuccess(Upstream &upstream)
+{
+    // Plain loads first so healthy traffic doesn't write shared cache lines
+    if (upstream.failures.load(std::memory_order_relaxed) != 0)
+    {
+        upstream.failures.store(0, std::memory_order_relaxed);
+    }
+    if (upstream.state.load(std::memory_order_relaxed) != BreakerState::Closed)
+    {
+        upstream.state.store(BreakerState::Closed, std::memory_order_release);
+        upstream.trialInFlight.store(false, std::memory_order_release);
+    }
+}
+
+void ConnectionPool::recordFailure(Upstream &upstream)
+{
+    BreakerState state = upstream.state.load(std::memory_order_acquire);
+    uint32_t failures = upstream.failures.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    if (state == BreakerState::HalfOpen ||
+        (state == BreakerState::Closed && failures >= config.failureThreshold))
+    {
+        openBreaker(upstream);
+    }
+}
+
+void ConnectionPool::openBreaker(Upstream &upstream)
+{
+    upstream.openedAt.store(std::chrono::steady_clock::now().time_since_epoch().count(),
+                            std::memory_order_relaxed);
+    upstream.state.store(BreakerState::Open, std::memory_order_release);
+    upstream.trialInFlight.store(false, std::memory_order_release);
+}
+
+DNSConnection *ConnectionPool::acquire()
+{
+    // Each thread starts at its own rotating upstream so load spreads
+    // without a shared counter
+    static thread_local size_t rotation = 0;
+
+    std::chrono::steady_clock::time_point deadline;
+    auto backoff = std::chrono::microseconds(10);
+    for (unsigned attempt = 0;; ++attempt)
+    {
+        bool anyAdmitted = false;
+        size_t start = rotation++;
+        for (size_t i = 0; i < upstreams.size(); ++i)
+        {
+            Upstream &upstream = *upstreams[(start + i) % upstreams.size()];
+            bool trial;
+            if (!admit(upstream, trial))
+            {
+                continue;
+            }
+
+            anyAdmitted = true;
+            DNSConnection *conn = nullptr;
+            if (upstream.idle.tryPop(conn))
+            {
+                return conn;
+            }
+            if (trial)
+            {
+                upstream.trialInFlight.store(false, std::memory_order_release);
+            }
+        }
+
+        // Every breaker open: fail fast instead of waiting out the timeout
+        if (!anyAdmitted)
+        {
+            return nullptr;
+        }
+
+        // Pool exhausted: yield a few times, then back off with growing
+        // sleeps until the timeout rather than blocking indefinitely
+        if (attempt == 0)
+        {
+            deadline = std::chrono::steady_clock::now() + config.acquireTimeout;
+        }
+        if (attempt < 16)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            return nullptr;
+        }
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+    }
+}
+
+void ConnectionPool::release(DNSConnection *conn, bool succeeded)
 {
-    if (conn && conn->isValid())
+    if (!conn)
     {
-        std::lock_guard<std::mutex> lock(poolMutex);
-        connections.push(conn);
-        cv.notify_one();
+        return;
     }
-}
\ No newline at end of file
+
+    Upstream &upstream = *upstreams[conn->upstream];
+    if (succeeded)
+        recordSuccess(upstream);
+    else
+        recordFailure(upstream);
+
+    if (conn->isValid())
+    {
+        upstream.idle.tryPush(conn);
+        return;
+    }
+    repair(upstream, conn);
+}
+
+void ConnectionPool::repair(Upstream &upstream, DNSConnection *conn)
+{
+    std::lock_guard<std::mutex> lock(repairMutex);
+    auto owner = std::find_if(upstream.owned.begin(), upstream.owned.end(),
+                              [conn](const std::unique_ptr<DNSConnection> &owned)
+                              { return owned.get() == conn; });
+    if (owner == upstream.owned.end())
+    {
+        return;
+    }
+
+    // Replace the socket; if that fails too the health thread retries it
+    auto replacement = createConnection(upstream);
+    replacement->upstream = conn->upstream;
+    DNSConnection *fresh = replacement.get();
+    *owner = std::move(replacement);
+
+    if (fresh->isValid())
+    {
+        upstream.idle.tryPush(fresh);
+    }
+    else
+    {
+        upstream.broken.push_back(owner - upstream.owned.begin());
+    }
+}
+
+uint64_t ConnectionPool::tlsHandshakes() const
+{
+    return tlsContext ? tlsContext->handshakes() : 0;
+}
+
+uint64_t ConnectionPool::tlsResumptions() const
+{
+    return tlsContext ? tlsContext->resumptions() : 0;
+}
+
+size_t ConnectionPool::healthyUpstreams() const
+{
+    size_t healthy = 0;
+    for (const auto &upstream : upstreams)
+    {
+        if (upstream->state.load(std::memory_order_relaxed) == BreakerState::Closed)
+        {
+            ++healthy;
+        }
+    }
+    return healthy;
+}
+
+void ConnectionPool::healthLoop()
+{
+    std::unique_lock<std::mutex> lock(healthMutex);
+    while (!healthWake.wait_for(lock, config.healthInterval, [this]()
+                                { return stopping; }))
+    {
+        lock.unlock();
+        for (auto &upstream : upstreams)
+        {
+            // Recreate sockets that could not be rebuilt on release
+            {
+                std::lock_guard<std::mutex> repairLock(repairMutex);
+                std::vector<size_t> stillBroken;
+                for (size_t index : upstream->broken)
+                {
+                    auto conn = createConnection(*upstream);
+                    conn->upstream = upstream->owned[index]->upstream;
+                    if (conn->isValid())
+                    {
+                        upstream->idle.tryPush(conn.get());
+                        upstream->owned[index] = std::move(conn);
+                    }
+                    else
+                    {
+                        stillBroken.push_back(index);
+                    }
+                }
+                upstream->broken.swap(stillBroken);
+            }
+
+            // A live upstream closes its breaker without waiting for a trial
+            if (upstream->state.load(std::memory_order_acquire) != BreakerState::Closed && probe(*upstream))
+            {
+                recordSuccess(*upstream);
+            }
+        }
+        lock.lock();
+    }
+}
+
+bool ConnectionPool::probe(const Upstream &upstream) const
+{
+    if (tlsContext)
+    {
+        // Over a fresh encrypted connection, which resumes the cached session
+        try
+        {
+            auto conn = createEncrypted(upstream);
+            conn->responseTimeout = config.probeTimeout;
+            auto answers = conn->exchangeBatch({{"", DNSRecordType::NS}});
+            return answers[0].answered;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
+
+    // Root NS query on a throwaway socket; any answer carrying our ID,
+    // whatever its rcode, shows the upstream is reachable
+    try
+    {
+        Poco::Net::DatagramSocket socket;
+        socket.connect(Poco::Net::SocketAddress(upstream.host, upstream.port));
+
+        uint16_t id = DNSQuery::generateQueryId();
+        auto query = DNSQuery::buildQuery("", DNSRecordType::NS, id);
+        socket.sendBytes(query.data(), static_cast<int>(query.size()));
+
+        long timeout = static_cast<long>(config.probeTimeout.count());
+        socket.setReceiveTimeout(Poco::Timespan(timeout / 1000, (timeout % 1000) * 1000));
+        uint8_t buffer[512];
+        auto deadline = std::chrono::steady_clock::now() + config.probeTimeout;
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            int received = socket.receiveBytes(buffer, sizeof(buffer));
+            if (received >= 12 && ((buffer[0] << 8) | buffer[1]) == id && (buffer[2] & 0x80))
+            {
+                return true;
+            }
+        }
+    }
+    catch (const std::exception &)
+    {
+    }
+    return false;
+}
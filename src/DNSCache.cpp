@@ -1,22 +1,196 @@
 // DNSCache.cpp
 #include "DNSCache.hpp"
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-DNSCache::DNSCache(size_t maxSize) : maxCacheSize(maxSize) {}
+namespace
+{
+    uint64_t wheelSeconds(std::chrono::system_clock::time_point time)
+    {
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+        return seconds > 0 ? static_cast<uint64_t>(seconds) : 0;
+    }
+
+    // Wheel tick for an expiry, rounded up so an entry is never reaped
+    // before its expiry second has passed
+    uint64_t expiryTick(std::chrono::system_clock::time_point expiry)
+    {
+        return wheelSeconds(expiry + std::chrono::seconds(1) - std::chrono::nanoseconds(1));
+    }
+
+    // Through a temporary file and rename, so readers never see a
+    // half-written file
+    void writeAtomically(const std::string &path, const uint8_t *data, size_t size, const std::string &what)
+    {
+        std::string temporary = path + ".tmp";
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot write " + what + " " + temporary + ": " + strerror(errno));
+        }
+
+        size_t written = 0;
+        while (written < size)
+        {
+            ssize_t result = ::write(fd, data + written, size - written);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+            {
+                int error = errno;
+                ::close(fd);
+                ::unlink(temporary.c_str());
+                throw std::runtime_error("Cannot write " + what + " " + temporary + ": " + strerror(error));
+            }
+            written += static_cast<size_t>(result);
+        }
+
+        if (::fsync(fd) != 0 || ::close(fd) != 0 || ::rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            ::unlink(temporary.c_str());
+            throw std::runtime_error("Cannot write " + what + " " + path + ": " + strerror(errno));
+        }
+    }
+
+    const char SNAPSHOT_MAGIC[8] = {'D', 'N', 'S', 'C', 'A', 'C', 'H', 'E'};
+
+    // Fixed-width little-endian fields; strings are length-prefixed
+    class SnapshotWriter
+    {
+    public:
+        std::vector<uint8_t> buffer;
+
+        void u16(uint16_t value) { put(value, 2); }
+        void u32(uint32_t value) { put(value, 4); }
+        void u64(uint64_t value) { put(value, 8); }
+
+        void str(const std::string &value)
+        {
+            blob(reinterpret_cast<const uint8_t *>(value.data()), value.size());
+        }
+
+        void blob(const uint8_t *data, size_t length)
+        {
+            if (length > UINT16_MAX)
+            {
+                throw std::runtime_error("Snapshot string too long");
+            }
+            u16(static_cast<uint16_t>(length));
+            buffer.insert(buffer.end(), data, data + length);
+        }
+
+    private:
+        void put(uint64_t value, size_t width)
+        {
+            for (size_t i = 0; i < width; ++i)
+            {
+                buffer.push_back(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        }
+    };
+
+    class SnapshotReader
+    {
+    public:
+        SnapshotReader(const uint8_t *data, size_t size) : data(data), end(data + size) {}
+
+        uint16_t u16() { return static_cast<uint16_t>(get(2)); }
+        uint32_t u32() { return static_cast<uint32_t>(get(4)); }
+        uint64_t u64() { return get(8); }
+
+        std::string str()
+        {
+            size_t length = u16();
+            need(length);
+            std::string value(reinterpret_cast<const char *>(data), length);
+            data += length;
+            return value;
+        }
+
+        const uint8_t *bytes(size_t length)
+        {
+            need(length);
+            const uint8_t *start = data;
+            data += length;
+            return start;
+        }
+
+    private:
+        const uint8_t *data;
+        const uint8_t *end;
+
+        void need(size_t length)
+        {
+            if (static_cast<size_t>(end - data) < length)
+            {
+                throw std::runtime_error("Truncated cache snapshot");
+            }
+        }
 
-bool DNSCache::get(const std::string &key, std::vector<DNSRecord> &records)
+        uint64_t get(size_t width)
+        {
+            need(width);
+            uint64_t value = 0;
+            for (size_t i = 0; i < width; ++i)
+            {
+                value |= static_cast<uint64_t>(data[i]) << (8 * i);
+            }
+            data += width;
+            return value;
+        }
+    };
+
+    int64_t toMicros(std::chrono::system_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+    }
+
+    std::chrono::system_clock::time_point fromMicros(int64_t micros)
+    {
+        return std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds(micros)));
+    }
+}
+
+DNSCache::DNSCache(size_t maxSize, EvictionPolicy policy)
+    : expiryWheel(wheelSeconds(std::chrono::system_clock::now())), maxCacheSize(std::max<size_t>(1, maxSize)),
+      policy(policy), sketch(policy == EvictionPolicy::TinyLFU ? maxSize : 0)
+{
+    // 1% window, the rest split 20/80 between probation and protected
+    windowCapacity = policy == EvictionPolicy::LRU ? maxCacheSize : std::max<size_t>(1, maxCacheSize / 100);
+    protectedCapacity = (maxCacheSize - std::min(windowCapacity, maxCacheSize)) * 4 / 5;
+}
+
+DNSCache::~DNSCache()
+{
+    stopReaper();
+}
+
+bool DNSCache::get(const CacheKey &key, std::vector<CompactRecord> &records,
+                   std::shared_ptr<const WireTemplate> *wire)
 {
     std::lock_guard<std::mutex> lock(cacheMutex);
 
     auto it = cache.find(key);
     if (it == cache.end())
     {
+        // Misses count too: a name asked for again is worth admitting
+        if (policy == EvictionPolicy::TinyLFU)
+            sketch.increment(key.hash());
+        ++counters.misses;
         return false;
     }
 
     auto now = std::chrono::system_clock::now();
-    std::vector<DNSRecord> validRecords;
+    std::vector<CompactRecord> validRecords;
 
     // Check each record's TTL
     for (const auto &record : it->second.records)
@@ -28,7 +202,7 @@ bool DNSCache::get(const std::string &key, std::vector<DNSRecord> &records)
             auto elapsedSeconds = std::chrono::duration_cast<std::chrono::seconds>(
                                       now - it->second.insertTime)
                                       .count();
-            DNSRecord updatedRecord = record;
+            CompactRecord updatedRecord = record;
             updatedRecord.ttl = std::max(0u,
                                          record.ttl - static_cast<uint32_t>(elapsedSeconds));
             validRecords.push_back(updatedRecord);
@@ -38,22 +212,25 @@ bool DNSCache::get(const std::string &key, std::vector<DNSRecord> &records)
     // If all records have expired, remove the entry
     if (validRecords.empty())
     {
-        cache.erase(it);
-        auto lruIt = std::find(lruList.begin(), lruList.end(), key);
-        if (lruIt != lruList.end())
-        {
-            lruList.erase(lruIt);
-        }
+        removeEntry(it);
+        ++counters.misses;
         return false;
     }
 
+    if (wire)
+    {
+        bool fresh = it->second.wire && now < it->second.wire->expiry;
+        *wire = fresh ? it->second.wire : nullptr;
+    }
+
     records = validRecords;
     it->second.lastAccess = now;
-    updateLRU(key);
+    touch(it, true);
+    ++counters.hits;
     return true;
 }
 
-void DNSCache::put(const std::string &key, const std::vector<DNSRecord> &records)
+void DNSCache::put(const CacheKey &key, const std::vector<CompactRecord> &records)
 {
     if (records.empty())
     {
@@ -64,87 +241,445 @@ void DNSCache::put(const std::string &key, const std::vector<DNSRecord> &records
 
     auto now = std::chrono::system_clock::now();
 
-    // Create cache entry
-    CacheEntry entry{
-        records,
-        now, // Insert time
-        now  // Last access time
-    };
+    // Borrowed keys are only copied when the entry is new
+    auto it = cache.find(key);
+    bool inserted = it == cache.end();
+    if (inserted)
+    {
+        it = cache.emplace(key.owned(), CacheEntry{}).first;
+    }
+    CacheEntry &entry = it->second;
+    entry.records = records;
+    entry.insertTime = now;
+    entry.lastAccess = now;
+    entry.wire = nullptr;
+    scheduleExpiry(it->first, entry);
+
+    // The lookup that missed already counted this key in the sketch
+    if (inserted)
+        admit(it);
+    else
+        touch(it, false);
+}
 
-    // Ensure we don't exceed max cache size
-    while (cache.size() >= maxCacheSize && !lruList.empty())
+std::shared_ptr<const DNSCache::WireTemplate> DNSCache::getWire(const CacheKey &key)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    auto it = cache.find(key);
+    if (it == cache.end() || !it->second.wire)
+    {
+        return nullptr;
+    }
+
+    // Once any record in the template has expired, the record path takes over
+    auto now = std::chrono::system_clock::now();
+    if (now >= it->second.wire->expiry)
     {
-        evictLRU();
+        it->second.wire.reset();
+        return nullptr;
     }
 
-    // Update or insert the entry
-    cache[key] = entry;
-    updateLRU(key);
+    it->second.lastAccess = now;
+    touch(it, true);
+    ++counters.hits;
+    return it->second.wire;
 }
 
-void DNSCache::updateLRU(const std::string &key)
+void DNSCache::putWire(const CacheKey &key, std::shared_ptr<const WireTemplate> wire)
 {
-    auto it = std::find(lruList.begin(), lruList.end(), key);
-    if (it != lruList.end())
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    auto it = cache.find(key);
+    if (it != cache.end())
     {
-        lruList.erase(it);
+        it->second.wire = std::move(wire);
     }
-    lruList.push_front(key);
 }
 
-void DNSCache::evictLRU()
+void DNSCache::touch(EntryMap::iterator it, bool count)
 {
-    if (!lruList.empty())
+    if (count && policy == EvictionPolicy::TinyLFU)
     {
-        auto key = lruList.back();
-        cache.erase(key);
-        lruList.pop_back();
+        sketch.increment(it->first.hash());
+    }
+
+    // Entries remember their list node, so every move is a splice
+    CacheEntry &entry = it->second;
+    if (entry.segment != Probation)
+    {
+        auto &list = segments[entry.segment];
+        list.splice(list.begin(), list, entry.lruPosition);
+        return;
+    }
+
+    // A second hit in the main area earns protection; protected overflow
+    // drops back to probation rather than out of the cache
+    moveTo(entry, Protected);
+    if (segments[Protected].size() > protectedCapacity)
+    {
+        moveTo(cache.find(*segments[Protected].back())->second, Probation);
     }
 }
 
-void DNSCache::evictExpired()
+void DNSCache::admit(EntryMap::iterator it)
+{
+    segments[Window].push_front(&it->first);
+    it->second.lruPosition = segments[Window].begin();
+    it->second.segment = Window;
+    if (segments[Window].size() <= windowCapacity)
+    {
+        return;
+    }
+
+    auto candidate = cache.find(*segments[Window].back());
+    if (policy == EvictionPolicy::LRU)
+    {
+        removeEntry(candidate);
+        ++counters.evictions;
+        return;
+    }
+
+    moveTo(candidate->second, Probation);
+    if (cache.size() <= maxCacheSize)
+    {
+        return;
+    }
+
+    // Full: the window's overflow only stays if the sketch has seen it
+    // more often than the main area's least recently used entry
+    auto &victims = segments[Probation].size() > 1 ? segments[Probation] : segments[Protected];
+    auto victim = victims.empty() ? candidate : cache.find(*victims.back());
+    if (victim != candidate &&
+        sketch.frequency(candidate->first.hash()) > sketch.frequency(victim->first.hash()))
+    {
+        removeEntry(victim);
+    }
+    else
+    {
+        removeEntry(candidate);
+        ++counters.admissionRejections;
+    }
+    ++counters.evictions;
+}
+
+void DNSCache::moveTo(CacheEntry &entry, Segment segment)
+{
+    auto &target = segments[segment];
+    target.splice(target.begin(), segments[entry.segment], entry.lruPosition);
+    entry.segment = segment;
+}
+
+void DNSCache::removeEntry(EntryMap::iterator it)
+{
+    // Its wheel item goes stale and is skipped when it comes due
+    segments[it->second.segment].erase(it->second.lruPosition);
+    cache.erase(it);
+}
+
+void DNSCache::scheduleExpiry(const CacheKey &key, CacheEntry &entry)
 {
+    uint32_t minTTL = entry.records.front().ttl;
+    for (const auto &record : entry.records)
+    {
+        minTTL = std::min(minTTL, record.ttl);
+    }
+    entry.expiry = entry.insertTime + std::chrono::seconds(minTTL);
+    expiryWheel.schedule(std::string(reinterpret_cast<const char *>(key.data()), key.size()),
+                         expiryTick(entry.expiry));
+}
+
+bool DNSCache::reapExpired(size_t maxBatch)
+{
+    std::vector<TimingWheel::Item> due;
+    due.reserve(maxBatch);
+
     std::lock_guard<std::mutex> lock(cacheMutex);
     auto now = std::chrono::system_clock::now();
+    bool more = expiryWheel.advance(wheelSeconds(now), due, maxBatch);
 
-    for (auto it = cache.begin(); it != cache.end();)
+    for (auto &item : due)
     {
-        bool hasValidRecords = false;
-        for (const auto &record : it->second.records)
+        // Skip items for keys that were evicted or re-inserted since
+        auto it = cache.find(CacheKey::fromBytes(reinterpret_cast<const uint8_t *>(item.key.data()),
+                                                 item.key.size()));
+        if (it == cache.end() || expiryTick(it->second.expiry) != item.deadline)
         {
-            auto recordExpiry = it->second.insertTime + std::chrono::seconds(record.ttl);
-            if (now < recordExpiry)
-            {
-                hasValidRecords = true;
-                break;
-            }
+            continue;
         }
 
-        if (!hasValidRecords)
+        if (now >= it->second.expiry)
         {
-            auto lruIt = std::find(lruList.begin(), lruList.end(), it->first);
-            if (lruIt != lruList.end())
-            {
-                lruList.erase(lruIt);
-            }
-            it = cache.erase(it);
+            removeEntry(it);
         }
         else
         {
-            ++it;
+            // Wall clock stepped back: wait for the real expiry
+            expiryWheel.schedule(std::move(item.key), item.deadline);
         }
     }
+
+    return more;
+}
+
+void DNSCache::evictExpired()
+{
+    while (reapExpired(1024))
+    {
+    }
+}
+
+void DNSCache::startReaper(std::chrono::milliseconds interval, size_t batchSize)
+{
+    if (reaper.joinable())
+    {
+        return;
+    }
+
+    reaperStopping = false;
+    reaper = std::thread([this, interval, batchSize]()
+                         {
+        std::unique_lock<std::mutex> lock(reaperMutex);
+        while (!reaperWake.wait_for(lock, interval, [this]() { return reaperStopping; }))
+        {
+            lock.unlock();
+            while (reapExpired(batchSize))
+            {
+                std::this_thread::yield(); // let lookups in between batches
+            }
+            lock.lock();
+        } });
+}
+
+void DNSCache::stopReaper()
+{
+    if (!reaper.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(reaperMutex);
+        reaperStopping = true;
+    }
+    reaperWake.notify_all();
+    reaper.join();
 }
 
 void DNSCache::clear()
 {
     std::lock_guard<std::mutex> lock(cacheMutex);
     cache.clear();
-    lruList.clear();
+    for (auto &segment : segments)
+    {
+        segment.clear();
+    }
+    expiryWheel.clear();
 }
 
 size_t DNSCache::size() const
 {
     std::lock_guard<std::mutex> lock(cacheMutex);
     return cache.size();
-}
\ No newline at end of file
+}
+
+DNSCache::Counters DNSCache::getCounters() const
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return counters;
+}
+
+size_t DNSCache::saveSnapshot(const std::string &path) const
+{
+    SnapshotWriter writer;
+    size_t count = 0;
+    {
+        // Serialize under the lock, write the file after releasing it
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        writer.buffer.reserve(64 + cache.size() * 96);
+        writer.buffer.insert(writer.buffer.end(), SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + sizeof(SNAPSHOT_MAGIC));
+        writer.u32(SNAPSHOT_VERSION);
+        writer.u32(0); // flags, reserved
+        writer.u64(toMicros(std::chrono::system_clock::now()));
+        writer.u64(cache.size());
+        std::vector<uint8_t> rdata;
+
+        // Most valuable first, so a smaller cache loading it keeps the head
+        for (Segment segment : {Protected, Window, Probation})
+        {
+            for (const CacheKey *key : segments[segment])
+            {
+                const CacheEntry &entry = cache.at(*key);
+                writer.str(std::string(reinterpret_cast<const char *>(key->data()), key->size()));
+                writer.u64(toMicros(entry.insertTime));
+                writer.u16(static_cast<uint16_t>(entry.records.size()));
+                for (const auto &record : entry.records)
+                {
+                    // Record data is stored as uncompressed RDATA
+                    writer.u16(static_cast<uint16_t>(record.type));
+                    writer.u32(record.ttl);
+                    writer.str(record.name);
+                    rdata.clear();
+                    record.encodeData(rdata);
+                    writer.blob(rdata.data(), rdata.size());
+                }
+                ++count;
+            }
+        }
+    }
+
+    writeAtomically(path, writer.buffer.data(), writer.buffer.size(), "cache snapshot");
+    return count;
+}
+
+size_t DNSCache::savePopularity(const std::string &path) const
+{
+    struct Item
+    {
+        std::string key;
+        uint8_t frequency;
+    };
+    std::vector<Item> items;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        items.reserve(cache.size());
+        for (Segment segment : {Protected, Window, Probation})
+        {
+            for (const CacheKey *key : segments[segment])
+            {
+                items.push_back({std::string(reinterpret_cast<const char *>(key->data()), key->size()),
+                                 sketch.frequency(key->hash())});
+            }
+        }
+    }
+
+    // Ties keep the value order, which is all there is under LRU
+    std::stable_sort(items.begin(), items.end(), [](const Item &a, const Item &b)
+                     { return a.frequency > b.frequency; });
+
+    std::string text = "# name type count, most popular first\n";
+    for (const auto &item : items)
+    {
+        CacheKey key = CacheKey::fromBytes(reinterpret_cast<const uint8_t *>(item.key.data()), item.key.size());
+        text += key.domain();
+        text += ' ';
+        text += recordTypeToString(key.type());
+        text += ' ';
+        text += std::to_string(item.frequency);
+        text += '\n';
+    }
+    writeAtomically(path, reinterpret_cast<const uint8_t *>(text.data()), text.size(), "popularity snapshot");
+    return items.size();
+}
+
+size_t DNSCache::loadSnapshot(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+            return 0;
+        throw std::runtime_error("Cannot open cache snapshot " + path + ": " + strerror(errno));
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ::close(fd);
+        return 0;
+    }
+
+    size_t size = static_cast<size_t>(info.st_size);
+    void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Cannot map cache snapshot " + path + ": " + strerror(errno));
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    std::unique_ptr<void, std::function<void(void *)>> unmap(mapping, [size](void *memory)
+                                                              { ::munmap(memory, size); });
+    SnapshotReader reader(static_cast<const uint8_t *>(mapping), size);
+
+    if (std::memcmp(reader.bytes(sizeof(SNAPSHOT_MAGIC)), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+    {
+        throw std::runtime_error("Not a cache snapshot: " + path);
+    }
+    uint32_t version = reader.u32();
+    if (version != SNAPSHOT_VERSION)
+    {
+        throw std::runtime_error("Unsupported cache snapshot version " + std::to_string(version));
+    }
+    reader.u32(); // flags
+    reader.u64(); // saved at
+    uint64_t count = reader.u64();
+
+    auto now = std::chrono::system_clock::now();
+    size_t loaded = 0;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cache.reserve(std::min<uint64_t>(count, maxCacheSize));
+
+    // Entries arrive most valuable first, so appending keeps their order
+    // and capacity cuts off the least recently used tail
+    for (uint64_t i = 0; i < count && cache.size() < maxCacheSize; ++i)
+    {
+        std::string keyBytes = reader.str();
+        if (keyBytes.size() < 3)
+        {
+            throw std::runtime_error("Corrupt cache snapshot key");
+        }
+        CacheKey key = CacheKey::fromBytes(reinterpret_cast<const uint8_t *>(keyBytes.data()), keyBytes.size());
+        CacheEntry entry;
+        entry.insertTime = fromMicros(static_cast<int64_t>(reader.u64()));
+        entry.lastAccess = entry.insertTime;
+
+        uint16_t recordCount = reader.u16();
+        entry.records.reserve(recordCount);
+        for (uint16_t j = 0; j < recordCount; ++j)
+        {
+            CompactRecord record;
+            record.type = static_cast<DNSRecordType>(reader.u16());
+            record.ttl = reader.u32();
+            record.name = reader.str();
+            size_t length = reader.u16();
+            record.payload = CompactRecord::decodeData(record.type, reader.bytes(length), length, 0, length);
+            entry.records.push_back(std::move(record));
+        }
+
+        if (entry.records.empty())
+        {
+            continue;
+        }
+
+        auto inserted = cache.emplace(key.owned(), std::move(entry));
+        if (!inserted.second)
+        {
+            continue;
+        }
+
+        CacheEntry &stored = inserted.first->second;
+        scheduleExpiry(inserted.first->first, stored);
+        if (now >= stored.expiry)
+        {
+            cache.erase(inserted.first); // its wheel item is skipped as stale
+            continue;
+        }
+
+        // Under TinyLFU the snapshot's head fills the protected segment and
+        // starts out counted in the sketch
+        Segment segment = Window;
+        if (policy == EvictionPolicy::TinyLFU)
+        {
+            segment = segments[Protected].size() < protectedCapacity ? Protected : Probation;
+            sketch.increment(inserted.first->first.hash());
+        }
+        segments[segment].push_back(&inserted.first->first);
+        stored.lruPosition = std::prev(segments[segment].end());
+        stored.segment = segment;
+        ++loaded;
+    }
+
+    return loaded;
+}
@@ -1,7 +1,10 @@
 #include "DNSQuery.hpp"
+#include "DomainName.hpp"
+#include <algorithm>
 #include <random>
 #include <cstring>
 #include <stdexcept>
+#include <strings.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
@@ -19,11 +22,16 @@ uint16_t DNSQuery::read16bits(const std::vector<uint8_t> &buffer, size_t &offset
 }
 
 std::vector<uint8_t> DNSQuery::buildQuery(const std::string &domain, DNSRecordType type)
+{
+    return buildQuery(domain, type, generateQueryId());
+}
+
+std::vector<uint8_t> DNSQuery::buildQuery(const std::string &domain, DNSRecordType type, uint16_t id,
+                                          bool dnssecOk)
 {
     std::vector<uint8_t> query;
     query.resize(12); // DNS header size
 
-    uint16_t id = generateQueryId();
     uint16_t flags = 0x0100; // Standard query with recursion desired
 
     write16bits(query, 0, id);
@@ -34,194 +42,344 @@ std::vector<uint8_t> DNSQuery::buildQuery(const std::string &domain, DNSRecordTy
     write16bits(query, 10, 0); // No additional records
 
     // Add domain name
-    auto encodedDomain = encodeDomainName(domain);
-    query.insert(query.end(), encodedDomain.begin(), encodedDomain.end());
+    // Questions go out in canonical lowercase, encoded in place
+    query.resize(12 + DomainName::MAX_WIRE_SIZE);
+    query.resize(12 + DomainName::encode(domain.data(), domain.size(), &query[12]));
 
     // Add query type and class
     query.resize(query.size() + 4);
     write16bits(query, query.size() - 4, static_cast<uint16_t>(type));
     write16bits(query, query.size() - 2, 1); // IN class
 
+    // EDNS0 OPT record with the DO bit asks for RRSIG and NSEC records
+    if (dnssecOk)
+    {
+        static const uint8_t opt[] = {0x00,                   // root name
+                                      0x00, 0x29,             // type OPT
+                                      0x04, 0xD0,             // UDP payload size 1232
+                                      0x00, 0x00, 0x80, 0x00, // extended rcode, version, DO
+                                      0x00, 0x00};            // no options
+        query.insert(query.end(), opt, opt + sizeof(opt));
+        write16bits(query, 10, 1);
+    }
+
     return query;
 }
 
-std::string DNSQuery::decodeDomainName(const std::vector<uint8_t> &response, size_t &offset)
+bool DNSQuery::matchesQuery(const uint8_t *response, size_t size, const std::vector<uint8_t> &query)
 {
-    std::string domain;
-    uint8_t labelLength;
-
-    while ((labelLength = response[offset++]) > 0)
+    // The query's name is uncompressed, so it ends at its root label
+    size_t nameEnd = 12;
+    while (nameEnd < query.size() && query[nameEnd] != 0)
     {
-        if ((labelLength & 0xC0) == 0xC0)
-        {
-            // Handle compression
-            uint16_t pointer = ((labelLength & 0x3F) << 8) | response[offset++];
-            size_t savedOffset = offset;
-            offset = pointer;
-            domain += decodeDomainName(response, offset);
-            offset = savedOffset;
-            return domain;
-        }
+        nameEnd += query[nameEnd] + 1;
+    }
+    size_t questionEnd = nameEnd + 1 + 4;
+    if (questionEnd > query.size() || size < questionEnd || response[4] != 0 || response[5] != 1)
+    {
+        return false;
+    }
 
-        if (!domain.empty())
+    // Label lengths are below 64, so folding every name byte is safe
+    for (size_t i = 12; i <= nameEnd; ++i)
+    {
+        uint8_t a = response[i], b = query[i];
+        if (a != b && !(a >= 'A' && a <= 'Z' && a + 32 == b))
         {
-            domain += ".";
+            return false;
         }
-        domain.append(reinterpret_cast<const char *>(&response[offset]), labelLength);
-        offset += labelLength;
     }
-
-    return domain;
+    return std::memcmp(response + nameEnd + 1, query.data() + nameEnd + 1, 4) == 0;
 }
 
-std::vector<DNSRecord> DNSQuery::parseResponse(const std::vector<uint8_t> &response)
+DNSQuery::Response DNSQuery::parseMessage(const uint8_t *data, size_t size)
 {
-    if (response.size() < 12)
+    if (size < 12)
     {
         throw std::runtime_error("Response too short");
     }
 
-    std::vector<DNSRecord> records;
-    size_t offset = 0;
-
-    // Parse header
-    uint16_t id = read16bits(response, offset);
-    uint16_t flags = read16bits(response, offset);
-    uint16_t qdcount = read16bits(response, offset);
-    uint16_t ancount = read16bits(response, offset);
-    uint16_t nscount = read16bits(response, offset);
-    uint16_t arcount = read16bits(response, offset);
+    uint16_t flags = (data[2] << 8) | data[3];
+    uint16_t qdcount = (data[4] << 8) | data[5];
+    uint16_t ancount = (data[6] << 8) | data[7];
+    uint16_t nscount = (data[8] << 8) | data[9];
 
-    // Check for errors
-    if ((flags & 0x000F) != 0)
+    Response response;
+    response.answered = true;
+    if (flags & 0x0200)
     {
-        throw std::runtime_error("DNS server returned error code: " +
-                                 std::to_string(flags & 0x000F));
+        // Whatever made it into a truncated answer is incomplete, so none
+        // of it may be validated or cached
+        response.truncated = true;
+        return response;
     }
+    response.rcode = static_cast<DNSResponseCode>(flags & 0x000F);
 
     // Skip questions
+    size_t offset = 12;
     for (uint16_t i = 0; i < qdcount; ++i)
     {
-        std::string name = decodeDomainName(response, offset);
+        DomainName::decode(data, size, offset);
         offset += 4; // Skip qtype and qclass
     }
 
-    // Parse answers
+    // Parse answers; record data stays binary
+    response.answers.reserve(ancount);
     for (uint16_t i = 0; i < ancount; ++i)
     {
-        DNSRecord record;
-        record.name = decodeDomainName(response, offset);
+        CompactRecord record;
+        record.name = DomainName::decode(data, size, offset);
+        if (offset + 10 > size)
+        {
+            throw std::runtime_error("Truncated resource record");
+        }
 
-        record.type = static_cast<DNSRecordType>(read16bits(response, offset));
-        offset += 2; // Skip class
+        record.type = static_cast<DNSRecordType>((data[offset] << 8) | data[offset + 1]);
+        record.ttl = (static_cast<uint32_t>(data[offset + 4]) << 24) | (data[offset + 5] << 16) |
+                     (data[offset + 6] << 8) | data[offset + 7];
+        uint16_t rdlength = (data[offset + 8] << 8) | data[offset + 9];
+        offset += 10; // type, class, TTL, data length
+
+        record.payload = CompactRecord::decodeData(record.type, data, size, offset, rdlength);
+        offset += rdlength;
+        response.answers.push_back(std::move(record));
+    }
+
+    // Authority records hold the SOA of negative answers and the DNSSEC
+    // denial proofs
+    response.authority.reserve(nscount);
+    for (uint16_t i = 0; i < nscount; ++i)
+    {
+        CompactRecord record;
+        record.name = DomainName::decode(data, size, offset);
+        if (offset + 10 > size)
+        {
+            throw std::runtime_error("Truncated resource record");
+        }
 
-        // Read TTL (32 bits)
-        record.ttl = (response[offset] << 24) | (response[offset + 1] << 16) |
-                     (response[offset + 2] << 8) | response[offset + 3];
-        offset += 4;
+        record.type = static_cast<DNSRecordType>((data[offset] << 8) | data[offset + 1]);
+        record.ttl = (static_cast<uint32_t>(data[offset + 4]) << 24) | (data[offset + 5] << 16) |
+                     (data[offset + 6] << 8) | data[offset + 7];
+        uint16_t rdlength = (data[offset + 8] << 8) | data[offset + 9];
+        offset += 10;
 
-        uint16_t rdlength = read16bits(response, offset);
+        record.payload = CompactRecord::decodeData(record.type, data, size, offset, rdlength);
+        offset += rdlength;
 
-        switch (record.type)
+        // Negative answers carry the zone's SOA; its MINIMUM caps the TTL
+        if (response.answers.empty() && response.negativeTtl == 0 && record.type == DNSRecordType::SOA)
         {
-        case DNSRecordType::A:
-            if (rdlength == 4)
-            {
-                std::string ipv4 = std::to_string(response[offset]) + "." +
-                                   std::to_string(response[offset + 1]) + "." +
-                                   std::to_string(response[offset + 2]) + "." +
-                                   std::to_string(response[offset + 3]);
-                record.data.push_back(ipv4);
-            }
-            break;
+            const auto &soa = std::get<std::shared_ptr<const CompactRecord::SOA>>(record.payload);
+            response.negativeTtl = std::min(record.ttl, soa->minimum);
+        }
+        response.authority.push_back(std::move(record));
+    }
 
-        case DNSRecordType::AAAA:
-            if (rdlength == 16)
-            {
-                char ipv6[INET6_ADDRSTRLEN];
-                unsigned char ipv6_bytes[16];
-                std::copy(response.begin() + offset,
-                          response.begin() + offset + 16,
-                          ipv6_bytes);
-
-                if (inet_ntop(AF_INET6, ipv6_bytes, ipv6, INET6_ADDRSTRLEN))
-                {
-                    record.data.push_back(std::string(ipv6));
-                }
-            }
-            break;
+    return response;
+}
+
+std::vector<CompactRecord> DNSQuery::parseRecords(const uint8_t *data, size_t size)
+{
+    return takeAnswers(parseMessage(data, size));
+}
+
+std::vector<CompactRecord> DNSQuery::takeAnswers(Response response)
+{
+    if (response.truncated)
+    {
+        throw std::runtime_error("DNS server returned a truncated response");
+    }
+    if (response.rcode != DNSResponseCode::NOERROR && response.rcode != DNSResponseCode::NXDOMAIN)
+    {
+        throw std::runtime_error("DNS server returned error code: " +
+                                 std::to_string(static_cast<int>(response.rcode)));
+    }
+    return std::move(response.answers);
+}
+
+std::vector<DNSRecord> DNSQuery::parseResponse(const std::vector<uint8_t> &response)
+{
+    return CompactRecord::toRecords(parseRecords(response.data(), response.size()));
+}
 
-        case DNSRecordType::CNAME:
-        case DNSRecordType::NS:
-        case DNSRecordType::PTR:
+std::vector<uint8_t> DNSQuery::encodeDomainName(const std::string &domain)
+{
+    // Names in answers keep their case
+    return DomainName::encode(domain, false);
+}
+
+bool DNSQuery::parseQuestion(const uint8_t *data, size_t size, Question &question)
+{
+    if (size < 12)
+    {
+        return false;
+    }
+
+    question.id = (data[0] << 8) | data[1];
+    question.flags = (data[2] << 8) | data[3];
+    uint16_t qdcount = (data[4] << 8) | data[5];
+    uint16_t arcount = (data[10] << 8) | data[11];
+
+    // Only single-question queries are served
+    if ((question.flags & 0x8000) != 0 || qdcount != 1)
+    {
+        return false;
+    }
+
+    size_t offset = 12;
+    question.domain.clear();
+    while (true)
+    {
+        if (offset >= size || offset - 12 >= 255)
         {
-            size_t rdataOffset = offset;
-            record.data.push_back(decodeDomainName(response, rdataOffset));
-            break;
+            return false;
         }
 
-        case DNSRecordType::MX:
+        uint8_t labelLength = data[offset++];
+        if (labelLength == 0)
         {
-            uint16_t preference = read16bits(response, offset);
-            size_t rdataOffset = offset;
-            std::string exchange = decodeDomainName(response, rdataOffset);
-            record.mx.preference = preference;
-            record.mx.exchange = exchange;
-            record.data.push_back(std::to_string(preference) + " " + exchange);
             break;
         }
 
-        case DNSRecordType::TXT:
+        // Compression pointers are not valid in a question
+        if ((labelLength & 0xC0) != 0 || offset + labelLength > size)
         {
-            size_t rdataOffset = offset;
-            uint8_t txtLength = response[rdataOffset++];
-            std::string txtData(response.begin() + rdataOffset,
-                                response.begin() + rdataOffset + txtLength);
-            record.data.push_back(txtData);
-            break;
+            return false;
         }
+
+        if (!question.domain.empty())
+        {
+            question.domain += ".";
         }
+        question.domain.append(reinterpret_cast<const char *>(&data[offset]), labelLength);
+        offset += labelLength;
+    }
 
-        offset += rdlength;
-        records.push_back(record);
+    if (offset + 4 > size)
+    {
+        return false;
+    }
+
+    question.type = static_cast<DNSRecordType>((data[offset] << 8) | data[offset + 1]);
+    question.qclass = (data[offset + 2] << 8) | data[offset + 3];
+    offset += 4;
+    question.length = offset;
+
+    // EDNS0: an OPT pseudo-record on the root name carries the UDP payload size
+    question.udpPayloadSize = 0;
+    if (arcount == 1 && offset + 11 <= size && data[offset] == 0 &&
+        ((data[offset + 1] << 8) | data[offset + 2]) == 41)
+    {
+        question.udpPayloadSize = (data[offset + 3] << 8) | data[offset + 4];
     }
 
-    return records;
+    return true;
 }
 
-std::vector<uint8_t> DNSQuery::encodeDomainName(const std::string &domain)
+std::vector<uint8_t> DNSQuery::buildResponse(const uint8_t *query,
+                                             const Question &question,
+                                             const std::vector<CompactRecord> &records,
+                                             DNSResponseCode rcode,
+                                             size_t maxSize,
+                                             std::vector<uint16_t> *ttlOffsets,
+                                             const std::vector<CompactRecord> &authority)
 {
-    std::vector<uint8_t> encoded;
-    size_t start = 0;
-    size_t dot = domain.find('.');
+    // Header and question are echoed back verbatim, preserving the client's case
+    std::vector<uint8_t> response(query, query + question.length);
+    response.reserve(512);
 
-    while (dot != std::string::npos || start < domain.length())
+    // QR and RA set, opcode and RD copied from the query
+    uint16_t flags = 0x8080 | (question.flags & 0x7900) | static_cast<uint8_t>(rcode);
+    write16bits(response, 2, flags);
+    write16bits(response, 4, 1);  // One question
+    write16bits(response, 10, 0); // Additional records are added below
+
+    if (ttlOffsets)
+    {
+        ttlOffsets->clear();
+    }
+
+    // Appends a section's records, returning how many were written
+    auto append = [&](const std::vector<CompactRecord> &section, std::vector<uint16_t> *offsets)
     {
-        size_t len = (dot == std::string::npos) ? domain.length() - start : dot - start;
-        if (len > 63)
+        uint16_t count = 0;
+        for (const auto &record : section)
         {
-            throw std::runtime_error("Domain label too long");
+            size_t start = response.size();
+
+            // Owner names matching the question compress to a pointer at offset 12
+            if (strcasecmp(record.name.c_str(), question.domain.c_str()) == 0)
+            {
+                response.push_back(0xC0);
+                response.push_back(0x0C);
+            }
+            else
+            {
+                auto encodedName = encodeDomainName(record.name);
+                response.insert(response.end(), encodedName.begin(), encodedName.end());
+            }
+
+            // Type, class, TTL and a placeholder for the data length
+            response.resize(response.size() + 10);
+            write16bits(response, response.size() - 10, static_cast<uint16_t>(record.type));
+            write16bits(response, response.size() - 8, 1); // IN class
+            write16bits(response, response.size() - 6, record.ttl >> 16);
+            write16bits(response, response.size() - 4, record.ttl & 0xFFFF);
+
+            size_t rdataStart = response.size();
+            record.encodeData(response);
+            if (response.size() - rdataStart > UINT16_MAX)
+            {
+                response.resize(start);
+                continue;
+            }
+
+            write16bits(response, rdataStart - 2, static_cast<uint16_t>(response.size() - rdataStart));
+            if (offsets)
+            {
+                offsets->push_back(static_cast<uint16_t>(rdataStart - 6));
+            }
+            ++count;
         }
+        return count;
+    };
+    write16bits(response, 6, append(records, ttlOffsets));
+    write16bits(response, 8, append(authority, nullptr));
 
-        encoded.push_back(static_cast<uint8_t>(len));
-        encoded.insert(encoded.end(),
-                       domain.begin() + start,
-                       domain.begin() + start + len);
+    size_t optSize = question.udpPayloadSize != 0 ? 11 : 0;
+    if (response.size() + optSize > maxSize)
+    {
+        // Too large for the transport: drop the records and set TC
+        response.resize(question.length);
+        write16bits(response, 2, flags | 0x0200);
+        write16bits(response, 6, 0);
+        write16bits(response, 8, 0);
+        if (ttlOffsets)
+        {
+            ttlOffsets->clear();
+        }
+    }
 
-        if (dot == std::string::npos)
-            break;
-        start = dot + 1;
-        dot = domain.find('.', start);
+    if (optSize != 0)
+    {
+        appendOPT(response);
     }
 
-    encoded.push_back(0); // Null terminator
-    return encoded;
+    return response;
+}
+
+void DNSQuery::appendOPT(std::vector<uint8_t> &response)
+{
+    // OPT pseudo-record advertising our own UDP payload size (1232)
+    const uint8_t opt[] = {0, 0, 41, 0x04, 0xD0, 0, 0, 0, 0, 0, 0};
+    response.insert(response.end(), opt, opt + sizeof(opt));
+    write16bits(response, 10, 1);
 }
 
 uint16_t DNSQuery::generateQueryId()
 {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<uint16_t> dis(0, UINT16_MAX);
+    // Queries are built on many threads at once, so each has its own engine
+    thread_local std::mt19937 gen(std::random_device{}());
+    std::uniform_int_distribution<uint16_t> dis(0, UINT16_MAX);
     return dis(gen);
 }
\ No newline at end of file
@@ -1,32 +1,315 @@
 #include "DNSResolver.hpp"
+#include "DomainName.hpp"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <numeric>
+
+namespace
+{
+    // Indices of the distinct addresses, in sorted order so addresses of one
+    // reverse zone stay adjacent; `slots` maps each input to its distinct copy
+    template <typename Address>
+    std::vector<size_t> distinct(const std::vector<Address> &addresses, std::vector<size_t> &slots)
+    {
+        auto compare = [&addresses](size_t a, size_t b)
+        {
+            return std::memcmp(&addresses[a], &addresses[b], sizeof(Address));
+        };
+
+        std::vector<size_t> order(addresses.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&compare](size_t a, size_t b)
+                  { return compare(a, b) < 0; });
+
+        std::vector<size_t> firsts;
+        slots.resize(addresses.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            if (i == 0 || compare(order[i - 1], order[i]) != 0)
+            {
+                firsts.push_back(order[i]);
+            }
+            slots[order[i]] = firsts.size() - 1;
+        }
+        return firsts;
+    }
+
+    // Copies a compiled response for the query: ID, opcode and RD follow the
+    // query, the question keeps the client's case and TTLs are counted
+    // down. Returns false when the template doesn't fit in maxSize.
+    bool patchWire(const uint8_t *query, const DNSQuery::Question &question, const DNSCache::WireTemplate &wire,
+                   size_t maxSize, std::vector<uint8_t> &response)
+    {
+        size_t optSize = question.udpPayloadSize != 0 ? 11 : 0;
+        if (wire.response.size() < question.length || wire.response.size() + optSize > maxSize)
+        {
+            return false;
+        }
+
+        response.assign(wire.response.begin(), wire.response.end());
+        uint16_t flags = 0x8080 | (question.flags & 0x7900);
+        response[0] = query[0];
+        response[1] = query[1];
+        response[2] = flags >> 8;
+        response[3] = flags & 0xFF;
+        std::memcpy(&response[12], query + 12, question.length - 12);
+
+        uint32_t elapsed = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                                                     std::chrono::system_clock::now() - wire.created)
+                                                     .count());
+        for (uint16_t offset : wire.ttlOffsets)
+        {
+            uint32_t ttl = (response[offset] << 24) | (response[offset + 1] << 16) |
+                           (response[offset + 2] << 8) | response[offset + 3];
+            ttl -= std::min(ttl, elapsed);
+            response[offset] = ttl >> 24;
+            response[offset + 1] = (ttl >> 16) & 0xFF;
+            response[offset + 2] = (ttl >> 8) & 0xFF;
+            response[offset + 3] = ttl & 0xFF;
+        }
+
+        if (optSize != 0)
+        {
+            DNSQuery::appendOPT(response);
+        }
+        return true;
+    }
+
+    // Offset of the name left after dropping `labels` leading labels
+    size_t parentOffset(const std::string &name, size_t labels)
+    {
+        size_t offset = 0;
+        for (size_t i = 0; i < labels && offset != std::string::npos; ++i)
+        {
+            offset = name.find('.', offset);
+            offset = offset == std::string::npos ? offset : offset + 1;
+        }
+        return offset;
+    }
+
+    // The zone's SOA from a negative answer, with the TTL negative answers
+    // are cached for (RFC 2308 section 3)
+    std::vector<CompactRecord> negativeAuthority(const DNSQuery::Response &response)
+    {
+        for (const auto &record : response.authority)
+        {
+            if (record.type == DNSRecordType::SOA)
+            {
+                CompactRecord soa = record;
+                soa.ttl = response.negativeTtl;
+                return {soa};
+            }
+        }
+        return {};
+    }
+
+    bool sameValidatorConfig(const DNSSECValidator::Config &a, const DNSSECValidator::Config &b)
+    {
+        return a.trustAnchors == b.trustAnchors && a.zoneCacheSize == b.zoneCacheSize &&
+               a.signatureCacheSize == b.signatureCacheSize && a.nsecCacheSize == b.nsecCacheSize &&
+               a.maxTtl == b.maxTtl && a.bogusTtl == b.bogusTtl &&
+               a.parallelThreshold == b.parallelThreshold && a.maxThreads == b.maxThreads;
+    }
+}
+
+ConnectionPool::Config DNSResolver::poolConfig(const Config &config)
+{
+    ConnectionPool::Config pool;
+    pool.poolSize = config.connectionPoolSize;
+    pool.backend = config.transport;
+    pool.acquireTimeout = std::chrono::milliseconds(config.queryTimeout);
+    pool.responseTimeout = std::chrono::milliseconds(config.queryTimeout);
+    pool.dnssecOk = config.enableDNSSEC;
+    pool.tlsCaFile = config.tlsCaFile;
+    pool.dohMethod = config.dohMethod;
+    return pool;
+}
+
+std::unique_ptr<const DNSResolver::Settings> DNSResolver::makeSettings(const Config &config,
+                                                                       const Settings *previous)
+{
+    auto settings = std::make_unique<Settings>();
+    settings->config = config;
+
+    const Config *old = previous ? &previous->config : nullptr;
+    if (old && old->nameservers == config.nameservers && old->connectionPoolSize == config.connectionPoolSize &&
+        old->transport == config.transport && old->queryTimeout == config.queryTimeout &&
+        old->enableDNSSEC == config.enableDNSSEC && old->tlsCaFile == config.tlsCaFile &&
+        old->dohMethod == config.dohMethod)
+    {
+        settings->pool = previous->pool;
+    }
+    else
+    {
+        settings->pool = std::make_shared<ConnectionPool>(config.nameservers, poolConfig(config));
+    }
+    return settings;
+}
 
 DNSResolver::DNSResolver(const Config &config)
-    : config(config), cache(1000) // Default cache size of 1000 entries
-      ,
-      connectionPool(config.connectionPoolSize, config.nameservers), logger(std::make_shared<Logger>("dns-resolver.log"))
+    : localZone(config.localZone), cache(config.cacheSize, config.cachePolicy), hotCache(config.hotCacheSize),
+      negativeCache(config.negativeCacheSize), validator(config.dnssec),
+      settings(makeSettings(config, nullptr)), logger(std::make_shared<Logger>("dns-resolver.log"))
+{
+    if (config.transport == TransportBackend::IOUring &&
+        settings.read()->pool->getBackend() != TransportBackend::IOUring)
+    {
+        logger->log(LogLevel::WARNING, "io_uring transport unavailable, using UDP sockets");
+    }
+
+    if (!config.localZone.sources.empty())
+    {
+        logger->log(LogLevel::INFO, "Loaded " + std::to_string(localZone.size()) + " local names, skipped " +
+                                        std::to_string(localZone.skipped()) + " lines");
+    }
+
+    if (!config.peering.listen.empty())
+    {
+        peering = std::make_unique<CachePeering>(
+            config.peering,
+            [this](const CacheKey &key, std::vector<CompactRecord> &records)
+            { return cache.get(key, records); },
+            [this](const CacheKey &key, const std::vector<CompactRecord> &records)
+            { cachePut(key, records); });
+        logger->log(LogLevel::INFO, "Sharing the cache with " + std::to_string(config.peering.peers.size()) +
+                                        " peers on " + config.peering.listen);
+    }
+
+    // Expired entries are reclaimed in the background instead of on access
+    cache.startReaper();
+
+    if (!config.cacheSnapshotPath.empty())
+    {
+        // A bad snapshot only costs a cold start
+        try
+        {
+            auto start = std::chrono::steady_clock::now();
+            size_t loaded = cache.loadSnapshot(config.cacheSnapshotPath);
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+            logger->log(LogLevel::INFO, "Loaded " + std::to_string(loaded) + " cache entries from " +
+                                            config.cacheSnapshotPath + " in " +
+                                            std::to_string(elapsed.count()) + " ms");
+        }
+        catch (const std::exception &e)
+        {
+            logger->log(LogLevel::WARNING, "Ignoring cache snapshot: " + std::string(e.what()));
+        }
+    }
+
+    if ((!config.cacheSnapshotPath.empty() && config.snapshotInterval > 0) ||
+        (!config.popularityPath.empty() && config.popularityInterval > 0))
+    {
+        snapshotThread = std::thread(&DNSResolver::snapshotLoop, this);
+    }
+}
+
+DNSResolver::~DNSResolver()
+{
+    if (snapshotThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            stopping = true;
+        }
+        snapshotWake.notify_all();
+        snapshotThread.join();
+    }
+
+    Config config = getConfig();
+    if (!config.cacheSnapshotPath.empty())
+    {
+        saveSnapshot();
+    }
+    if (!config.popularityPath.empty())
+    {
+        savePopularity();
+    }
+}
+
+void DNSResolver::snapshotLoop()
+{
+    // Each file on its own interval; without a path or interval it never comes due
+    Config config = getConfig();
+    auto now = std::chrono::steady_clock::now();
+    auto firstDue = [&now](const std::string &path, size_t interval)
+    {
+        return path.empty() || interval == 0 ? std::chrono::steady_clock::time_point::max()
+                                             : now + std::chrono::seconds(interval);
+    };
+    auto nextSnapshot = firstDue(config.cacheSnapshotPath, config.snapshotInterval);
+    auto nextPopularity = firstDue(config.popularityPath, config.popularityInterval);
+
+    std::unique_lock<std::mutex> lock(snapshotMutex);
+    while (!snapshotWake.wait_until(lock, std::min(nextSnapshot, nextPopularity), [this]()
+                                    { return stopping; }))
+    {
+        lock.unlock();
+        now = std::chrono::steady_clock::now();
+        if (now >= nextSnapshot)
+        {
+            saveSnapshot();
+            nextSnapshot = now + std::chrono::seconds(config.snapshotInterval);
+        }
+        if (now >= nextPopularity)
+        {
+            savePopularity();
+            nextPopularity = now + std::chrono::seconds(config.popularityInterval);
+        }
+        lock.lock();
+    }
+}
+
+void DNSResolver::saveSnapshot()
+{
+    std::string path = settings.read()->config.cacheSnapshotPath;
+    try
+    {
+        size_t saved = cache.saveSnapshot(path);
+        logger->log(LogLevel::DEBUG, "Saved " + std::to_string(saved) + " cache entries to " + path);
+    }
+    catch (const std::exception &e)
+    {
+        logger->log(LogLevel::ERROR, "Cache snapshot failed: " + std::string(e.what()));
+    }
+}
+
+void DNSResolver::savePopularity()
 {
+    std::string path = settings.read()->config.popularityPath;
+    try
+    {
+        size_t saved = cache.savePopularity(path);
+        logger->log(LogLevel::DEBUG, "Saved " + std::to_string(saved) + " popular names to " + path);
+    }
+    catch (const std::exception &e)
+    {
+        logger->log(LogLevel::ERROR, "Popularity snapshot failed: " + std::string(e.what()));
+    }
 }
 
-std::vector<DNSRecord> DNSResolver::resolveParallel(
+std::vector<CompactRecord> DNSResolver::resolveParallel(
+    const Settings &current,
     const std::string &domain,
     DNSRecordType type)
 {
 
-    std::vector<std::future<std::vector<DNSRecord>>> futures;
+    std::vector<std::future<std::vector<CompactRecord>>> futures;
 
     // Query each nameserver in parallel
-    for (const auto &ns : config.nameservers)
+    for (const auto &ns : current.config.nameservers)
     {
         futures.push_back(std::async(std::launch::async,
-                                     [this, &domain, type, &ns]()
+                                     [this, &current, &domain, type, &ns]()
                                      {
-                                         return queryNameserver(ns, domain, type);
+                                         return queryNameserver(current, ns, domain, type);
                                      }));
     }
 
-    // Collect and combine results
-    std::vector<DNSRecord> combinedRecords;
+    // Collect and combine results; one answer, even an empty one, will do
+    std::vector<CompactRecord> combinedRecords;
+    bool answered = false;
     for (auto &future : futures)
     {
         try
@@ -35,6 +318,7 @@ std::vector<DNSRecord> DNSResolver::resolveParallel(
             combinedRecords.insert(combinedRecords.end(),
                                    records.begin(),
                                    records.end());
+            answered = true;
         }
         catch (const std::exception &e)
         {
@@ -43,32 +327,37 @@ std::vector<DNSRecord> DNSResolver::resolveParallel(
         }
     }
 
+    if (!answered)
+    {
+        throw std::runtime_error("No valid answer from upstream");
+    }
     return combinedRecords;
 }
 
-std::vector<DNSRecord> DNSResolver::performRecursiveResolution(
+std::vector<CompactRecord> DNSResolver::performRecursiveResolution(
+    const Settings &current,
     const std::string &domain,
     DNSRecordType type,
     size_t depth,
     const std::string &nameserver)
 {
 
-    if (depth >= config.maxRecursion)
+    if (depth >= current.config.maxRecursion)
     {
         throw std::runtime_error("Maximum recursion depth exceeded");
     }
 
-    auto records = queryNameserver(nameserver, domain, type);
+    auto records = queryNameserver(current, nameserver, domain, type);
 
     // If we got NS records, we need to query them
     bool hasNSRecords = false;
     for (const auto &record : records)
     {
-        if (record.type == DNSRecordType::NS)
+        if (record.type == DNSRecordType::NS && record.target())
         {
             hasNSRecords = true;
             auto nsRecords = performRecursiveResolution(
-                domain, type, depth + 1, record.data[0]);
+                current, domain, type, depth + 1, *record.target());
             records.insert(records.end(), nsRecords.begin(), nsRecords.end());
         }
     }
@@ -76,7 +365,8 @@ std::vector<DNSRecord> DNSResolver::performRecursiveResolution(
     return records;
 }
 
-std::vector<DNSRecord> DNSResolver::queryNameserver(
+std::vector<CompactRecord> DNSResolver::queryNameserver(
+    const Settings &current,
     const std::string &nameserver,
     const std::string &domain,
     DNSRecordType type)
@@ -84,6 +374,7 @@ std::vector<DNSRecord> DNSResolver::queryNameserver(
 
     logger->log(LogLevel::DEBUG, "Querying " + nameserver + " for " + domain);
 
+    ConnectionPool &connectionPool = *current.pool;
     auto conn = connectionPool.acquire();
 
     if (!conn)
@@ -113,6 +404,13 @@ std::vector<DNSRecord> DNSResolver::queryNameserver(
         connectionPool.release(conn);
         return response;
     }
+    catch (const UpstreamError &e)
+    {
+        // Timeouts and socket errors count against the upstream's breaker
+        logger->log(LogLevel::ERROR, "Query failed: " + std::string(e.what()));
+        connectionPool.release(conn, false);
+        throw;
+    }
     catch (const std::exception &e)
     {
         logger->log(LogLevel::ERROR, "Query failed: " + std::string(e.what()));
@@ -122,23 +420,24 @@ std::vector<DNSRecord> DNSResolver::queryNameserver(
 }
 
 bool DNSResolver::followCNAMEChain(
-    std::vector<DNSRecord> &records,
+    const Settings &current,
+    std::vector<CompactRecord> &records,
     const std::string &originalDomain,
     size_t depth)
 {
 
-    if (depth >= config.maxRecursion)
+    if (depth >= current.config.maxRecursion)
     {
         return false;
     }
 
     for (const auto &record : records)
     {
-        if (record.type == DNSRecordType::CNAME)
+        if (record.type == DNSRecordType::CNAME && record.target())
         {
-            auto cnameRecords = resolve(record.data[0], DNSRecordType::A);
+            auto cnameRecords = resolveRecords(current, *record.target(), DNSRecordType::A);
             records.insert(records.end(), cnameRecords.begin(), cnameRecords.end());
-            return followCNAMEChain(records, originalDomain, depth + 1);
+            return followCNAMEChain(current, records, originalDomain, depth + 1);
         }
     }
 
@@ -161,38 +460,93 @@ std::vector<DNSRecord> DNSResolver::resolve(
     const std::string &domainName,
     DNSRecordType type)
 {
+    return CompactRecord::toRecords(resolveRecords(domainName, type));
+}
+
+std::vector<CompactRecord> DNSResolver::resolveRecords(
+    const std::string &domainName,
+    DNSRecordType type)
+{
+    return resolveRecords(*settings.read(), domainName, type);
+}
+
+std::vector<CompactRecord> DNSResolver::resolveRecords(
+    const Settings &current,
+    const std::string &domainName,
+    DNSRecordType type)
+{
 
     auto start = std::chrono::steady_clock::now();
     stats.incrementTotalQueries();
 
     try
     {
+        // Local data overrides everything else
+        LocalZone::Answer local;
+        if (localZone.lookup(domainName, type, local))
+        {
+            return local.records;
+        }
+
         // Check cache first
-        std::vector<DNSRecord> records;
-        if (cache.get(domainName + "_" + std::to_string(static_cast<int>(type)), records))
+        CacheKey key(domainName, type);
+        std::vector<CompactRecord> records;
+        if (cacheGet(key, records))
         {
             stats.incrementCacheHits();
             return records;
         }
         stats.incrementCacheMisses();
 
+        // The owning peer may have it cached already
+        if (peering)
+        {
+            std::vector<std::vector<CompactRecord>> shared;
+            std::vector<bool> found;
+            peering->fetch({{domainName, type}}, shared, found);
+            if (found[0])
+            {
+                cachePut(key, shared[0]);
+                return shared[0];
+            }
+        }
+
         // Perform resolution
-        records = config.enableParallelQueries ? resolveParallel(domainName, type) : performRecursiveResolution(domainName, type, 0, config.nameservers[0]);
+        const Config &config = current.config;
+        if (config.enableDNSSEC)
+        {
+            // Validated NSEC records may already deny the name or type
+            if (validator.synthesize(key.data(), key.size() - 2, type))
+            {
+                return records;
+            }
+
+            std::vector<std::pair<std::string, DNSRecordType>> questions{{domainName, type}};
+            auto responses = exchange(current, questions);
+            validateResponses(current, questions, responses);
+            if (responses[0].rcode != DNSResponseCode::NOERROR && responses[0].rcode != DNSResponseCode::NXDOMAIN)
+            {
+                throw std::runtime_error("No valid answer from upstream");
+            }
+            records = std::move(responses[0].answers);
+        }
+        else
+        {
+            records = config.enableParallelQueries ? resolveParallel(current, domainName, type) : performRecursiveResolution(current, domainName, type, 0, config.nameservers[0]);
+        }
 
         // Handle CNAME chain
-        if (!followCNAMEChain(records, domainName, 0))
+        if (!followCNAMEChain(current, records, domainName, 0))
         {
             throw std::runtime_error("CNAME resolution failed");
         }
 
-        // // Validate DNSSEC if enabled
-        // if (config.enableDNSSEC && !DNSQuery::validateDNSSEC(domainName, records))
-        // {
-        //     throw std::runtime_error("DNSSEC validation failed");
-        // }
-
-        // Cache results
-        cache.put(domainName + "_" + std::to_string(static_cast<int>(type)), records);
+        // Cache results and hand them to their owner
+        cachePut(key, records);
+        if (peering)
+        {
+            peering->publish(domainName, type, records);
+        }
 
         auto end = std::chrono::steady_clock::now();
         stats.addResolutionTime(
@@ -209,7 +563,667 @@ std::vector<DNSRecord> DNSResolver::resolve(
     }
 }
 
+std::vector<std::vector<DNSRecord>> DNSResolver::resolveBatch(
+    const std::vector<std::pair<std::string, DNSRecordType>> &questions)
+{
+    auto answers = resolveRecordsBatch(questions);
+    std::vector<std::vector<DNSRecord>> results;
+    results.reserve(answers.size());
+    for (const auto &answer : answers)
+    {
+        results.push_back(CompactRecord::toRecords(answer.records));
+    }
+    return results;
+}
+
+std::vector<DNSResolver::BatchResult> DNSResolver::resolveRecordsBatch(
+    const std::vector<std::pair<std::string, DNSRecordType>> &questions)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto current = settings.read();
+    std::vector<BatchResult> results(questions.size());
+    std::vector<std::pair<std::string, DNSRecordType>> misses;
+    std::vector<size_t> missIndex;
+
+    for (size_t i = 0; i < questions.size(); ++i)
+    {
+        stats.incrementTotalQueries();
+        const auto &question = questions[i];
+        LocalZone::Answer local;
+        if (localZone.lookup(question.first, question.second, local))
+        {
+            results[i].rcode = local.rcode;
+            results[i].records = std::move(local.records);
+            continue;
+        }
+
+        CacheKey::Buffer keyBuffer;
+        CacheKey key = CacheKey::view(question.first, question.second, keyBuffer);
+        if (cacheGet(key, results[i].records))
+        {
+            results[i].rcode = DNSResponseCode::NOERROR;
+            stats.incrementCacheHits();
+            continue;
+        }
+        auto rcode = negativeCache.get(key.data(), key.size() - 2, question.second, &results[i].authority);
+        if (!rcode && current->config.enableDNSSEC)
+        {
+            rcode = validator.synthesize(key.data(), key.size() - 2, question.second);
+        }
+        if (rcode)
+        {
+            results[i].rcode = *rcode;
+            stats.incrementCacheHits();
+            continue;
+        }
+        stats.incrementCacheMisses();
+        misses.push_back(question);
+        missIndex.push_back(i);
+    }
+
+    // Misses the owning peers have cached don't go upstream
+    if (peering && !misses.empty())
+    {
+        std::vector<std::vector<CompactRecord>> shared;
+        std::vector<bool> found;
+        peering->fetch(misses, shared, found);
+
+        size_t kept = 0;
+        for (size_t i = 0; i < misses.size(); ++i)
+        {
+            if (found[i])
+            {
+                CacheKey::Buffer keyBuffer;
+                cachePut(CacheKey::view(misses[i].first, misses[i].second, keyBuffer), shared[i]);
+                results[missIndex[i]].rcode = DNSResponseCode::NOERROR;
+                results[missIndex[i]].records = std::move(shared[i]);
+                continue;
+            }
+            misses[kept] = std::move(misses[i]);
+            missIndex[kept++] = missIndex[i];
+        }
+        misses.resize(kept);
+        missIndex.resize(kept);
+    }
+
+    if (misses.empty())
+    {
+        return results;
+    }
+
+    auto responses = exchange(*current, misses);
+    validateResponses(*current, misses, responses);
+
+    for (size_t i = 0; i < misses.size(); ++i)
+    {
+        auto &result = results[missIndex[i]];
+        auto &records = responses[i].answers;
+        result.rcode = responses[i].rcode;
+        if (responses[i].rcode == DNSResponseCode::NXDOMAIN)
+        {
+            // After a CNAME it is the target that is missing, not the name
+            result.authority = negativeAuthority(responses[i]);
+            result.records = std::move(records);
+            if (result.records.empty())
+            {
+                CacheKey::Buffer keyBuffer;
+                CacheKey key = CacheKey::view(misses[i].first, misses[i].second, keyBuffer);
+                negativeCache.putNXDomain(key.data(), key.size() - 2, responses[i].negativeTtl, result.authority);
+            }
+            continue;
+        }
+        if (responses[i].rcode != DNSResponseCode::NOERROR)
+        {
+            stats.incrementFailedQueries();
+            continue;
+        }
+        if (records.empty())
+        {
+            CacheKey::Buffer keyBuffer;
+            CacheKey key = CacheKey::view(misses[i].first, misses[i].second, keyBuffer);
+            result.authority = negativeAuthority(responses[i]);
+            negativeCache.putNoData(key.data(), key.size() - 2, misses[i].second, responses[i].negativeTtl,
+                                    result.authority);
+            continue;
+        }
+
+        // A failing CNAME target fails only its own question; resolveRecords
+        // has counted and logged it
+        bool complete;
+        try
+        {
+            complete = followCNAMEChain(*current, records, misses[i].first, 0);
+        }
+        catch (const std::exception &)
+        {
+            result.rcode = DNSResponseCode::SERVFAIL;
+            continue;
+        }
+
+        if (complete)
+        {
+            CacheKey::Buffer keyBuffer;
+            cachePut(CacheKey::view(misses[i].first, misses[i].second, keyBuffer), records);
+            if (peering)
+            {
+                peering->publish(misses[i].first, misses[i].second, records);
+            }
+        }
+        result.records = std::move(records);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    stats.addResolutionTime(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start));
+
+    return results;
+}
+
+std::vector<DNSResolver::BatchResult> DNSResolver::resolveReverse(const std::vector<in_addr> &addresses)
+{
+    // Zones cut at the /24: 3.2.1.in-addr.arpa
+    return resolveReverseAddresses(addresses, 1);
+}
+
+std::vector<DNSResolver::BatchResult> DNSResolver::resolveReverse(const std::vector<in6_addr> &addresses)
+{
+    // Zones cut at the /64, 16 nibble labels up
+    return resolveReverseAddresses(addresses, 16);
+}
+
+template <typename Address>
+std::vector<DNSResolver::BatchResult> DNSResolver::resolveReverseAddresses(
+    const std::vector<Address> &addresses, size_t zoneLabels)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto current = settings.read();
+    std::vector<size_t> slots;
+    std::vector<size_t> firsts = distinct(addresses, slots);
+    std::vector<BatchResult> answers(firsts.size());
+
+    // Positive and negative cache hits never build more than a stack name
+    std::vector<std::pair<std::string, DNSRecordType>> misses;
+    std::vector<size_t> missIndex;
+    for (size_t i = 0; i < firsts.size(); ++i)
+    {
+        stats.incrementTotalQueries();
+        char name[DomainName::MAX_REVERSE_LENGTH];
+        size_t length = DomainName::reverse(addresses[firsts[i]], name);
+        uint8_t wire[DomainName::MAX_WIRE_SIZE];
+        size_t wireLength = DomainName::encode(name, length, wire);
+
+        LocalZone::Answer local;
+        if (localZone.lookup(wire, wireLength, DNSRecordType::PTR, local))
+        {
+            answers[i].rcode = local.rcode;
+            answers[i].records = std::move(local.records);
+            continue;
+        }
+
+        CacheKey::Buffer keyBuffer;
+        CacheKey key = CacheKey::fromWire(wire, wireLength, DNSRecordType::PTR, keyBuffer);
+        if (cacheGet(key, answers[i].records))
+        {
+            answers[i].rcode = DNSResponseCode::NOERROR;
+            stats.incrementCacheHits();
+            continue;
+        }
+        auto rcode = negativeCache.get(key.data(), key.size() - 2, DNSRecordType::PTR);
+        if (!rcode && current->config.enableDNSSEC)
+        {
+            rcode = validator.synthesize(key.data(), key.size() - 2, DNSRecordType::PTR);
+        }
+        if (rcode)
+        {
+            answers[i].rcode = *rcode;
+            stats.incrementCacheHits();
+            continue;
+        }
+        stats.incrementCacheMisses();
+        misses.emplace_back(std::string(name, length), DNSRecordType::PTR);
+        missIndex.push_back(i);
+    }
+
+    // Runs of misses under one zone ask the zone first; an NXDOMAIN there
+    // answers the whole run
+    std::vector<std::pair<std::string, DNSRecordType>> probes;
+    std::vector<std::pair<size_t, size_t>> probeRuns; // [first, last) into misses
+    for (size_t first = 0; first < misses.size();)
+    {
+        size_t offset = parentOffset(misses[first].first, zoneLabels);
+        std::string zone = misses[first].first.substr(offset);
+        size_t last = first + 1;
+        while (last < misses.size() && misses[last].first.compare(offset, std::string::npos, zone) == 0)
+        {
+            ++last;
+        }
+
+        CacheKey::Buffer keyBuffer;
+        CacheKey key = CacheKey::view(zone, DNSRecordType::PTR, keyBuffer);
+        if (last - first >= current->config.reverseProbeThreshold &&
+            !negativeCache.get(key.data(), key.size() - 2, DNSRecordType::PTR))
+        {
+            probes.emplace_back(std::move(zone), DNSRecordType::PTR);
+            probeRuns.emplace_back(first, last);
+        }
+        first = last;
+    }
+
+    std::vector<bool> settled(misses.size(), false);
+    auto probeResponses = exchange(*current, probes);
+    validateResponses(*current, probes, probeResponses);
+    for (size_t i = 0; i < probes.size(); ++i)
+    {
+        const auto &response = probeResponses[i];
+        CacheKey::Buffer keyBuffer;
+        CacheKey key = CacheKey::view(probes[i].first, DNSRecordType::PTR, keyBuffer);
+        if (response.rcode == DNSResponseCode::NXDOMAIN)
+        {
+            negativeCache.putNXDomain(key.data(), key.size() - 2, response.negativeTtl);
+            for (size_t j = probeRuns[i].first; j < probeRuns[i].second; ++j)
+            {
+                answers[missIndex[j]].rcode = DNSResponseCode::NXDOMAIN;
+                settled[j] = true;
+            }
+        }
+        else if (response.rcode == DNSResponseCode::NOERROR && response.answers.empty())
+        {
+            // Remembered so later batches in this zone skip the probe
+            negativeCache.putNoData(key.data(), key.size() - 2, DNSRecordType::PTR, response.negativeTtl);
+        }
+    }
+
+    std::vector<std::pair<std::string, DNSRecordType>> questions;
+    std::vector<size_t> questionIndex;
+    for (size_t i = 0; i < misses.size(); ++i)
+    {
+        if (!settled[i])
+        {
+            questions.push_back(std::move(misses[i]));
+            questionIndex.push_back(missIndex[i]);
+        }
+    }
+
+    auto responses = exchange(*current, questions);
+    validateResponses(*current, questions, responses);
+    for (size_t i = 0; i < questions.size(); ++i)
+    {
+        auto &response = responses[i];
+        auto &answer = answers[questionIndex[i]];
+        answer.rcode = response.rcode;
+
+        CacheKey::Buffer keyBuffer;
+        CacheKey key = CacheKey::view(questions[i].first, DNSRecordType::PTR, keyBuffer);
+        if (response.rcode == DNSResponseCode::NXDOMAIN)
+        {
+            negativeCache.putNXDomain(key.data(), key.size() - 2, response.negativeTtl);
+        }
+        else if (response.rcode != DNSResponseCode::NOERROR)
+        {
+            stats.incrementFailedQueries();
+        }
+        else if (response.answers.empty())
+        {
+            negativeCache.putNoData(key.data(), key.size() - 2, DNSRecordType::PTR, response.negativeTtl);
+        }
+        else
+        {
+            cachePut(key, response.answers);
+            answer.records = std::move(response.answers);
+        }
+    }
+
+    std::vector<BatchResult> results;
+    results.reserve(addresses.size());
+    for (size_t slot : slots)
+    {
+        results.push_back(answers[slot]);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    stats.addResolutionTime(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start));
+    return results;
+}
+
+std::vector<DNSQuery::Response> DNSResolver::exchange(
+    const Settings &current,
+    std::vector<std::pair<std::string, DNSRecordType>> questions)
+{
+    std::vector<DNSQuery::Response> responses(questions.size());
+    if (questions.empty())
+    {
+        return responses;
+    }
+
+    // A connection keeps up to 64 questions in flight (one sendmmsg), so a
+    // slice is only split off when it fills that
+    const size_t window = 64;
+    size_t connections = std::min(std::max<size_t>(1, current.config.connectionPoolSize),
+                                  (questions.size() + window - 1) / window);
+    size_t sliceSize = (questions.size() + connections - 1) / connections;
+
+    std::vector<std::future<void>> futures;
+    for (size_t first = 0; first < questions.size(); first += sliceSize)
+    {
+        size_t last = std::min(questions.size(), first + sliceSize);
+        std::vector<std::pair<std::string, DNSRecordType>> slice(
+            std::make_move_iterator(questions.begin() + first),
+            std::make_move_iterator(questions.begin() + last));
+
+        futures.push_back(std::async(std::launch::async,
+                                     [this, &current, &responses, first, slice = std::move(slice)]()
+                                     {
+                                         ConnectionPool &connectionPool = *current.pool;
+                                         auto conn = connectionPool.acquire();
+                                         if (!conn)
+                                         {
+                                             logger->log(LogLevel::ERROR, "Failed to acquire connection from pool.");
+                                             return;
+                                         }
+
+                                         try
+                                         {
+                                             // Only silence counts against the upstream; an
+                                             // rcode, SERVFAIL included, shows it is up
+                                             auto answers = conn->exchangeBatch(slice);
+                                             bool answered = std::any_of(answers.begin(), answers.end(),
+                                                                         [](const DNSQuery::Response &response)
+                                                                         { return response.answered; });
+                                             connectionPool.release(conn, answered);
+                                             std::move(answers.begin(), answers.end(), responses.begin() + first);
+                                         }
+                                         catch (const std::exception &e)
+                                         {
+                                             logger->log(LogLevel::ERROR, "Batch exchange failed: " + std::string(e.what()));
+                                             connectionPool.release(conn, false);
+                                         }
+                                     }));
+    }
+
+    for (auto &future : futures)
+    {
+        future.get();
+    }
+    return responses;
+}
+
+void DNSResolver::validateResponses(
+    const Settings &current,
+    const std::vector<std::pair<std::string, DNSRecordType>> &questions,
+    std::vector<DNSQuery::Response> &responses)
+{
+    if (!current.config.enableDNSSEC || questions.empty())
+    {
+        return;
+    }
+
+    // Keys and delegation proofs the validator lacks go out on the same settings
+    auto statuses = validator.validate(questions, responses,
+                                       [this, &current](const std::vector<DNSSECValidator::Question> &missing)
+                                       {
+                                           return exchange(current, missing);
+                                       });
+    for (size_t i = 0; i < responses.size(); ++i)
+    {
+        if (statuses[i] == DNSSECValidator::Status::Bogus)
+        {
+            logger->log(LogLevel::WARNING, "DNSSEC validation failed for " + questions[i].first + " " +
+                                               recordTypeToString(questions[i].second));
+            responses[i] = DNSQuery::Response();
+        }
+    }
+}
+
+void DNSResolver::reloadLocalZone()
+{
+    try
+    {
+        localZone.reload();
+        logger->log(LogLevel::INFO, "Reloaded " + std::to_string(localZone.size()) + " local names, skipped " +
+                                        std::to_string(localZone.skipped()) + " lines");
+    }
+    catch (const std::exception &e)
+    {
+        logger->log(LogLevel::ERROR, "Local zone reload failed: " + std::string(e.what()));
+        throw;
+    }
+}
+
+bool DNSResolver::lookupCache(
+    const std::string &domainName,
+    DNSRecordType type,
+    std::vector<DNSRecord> &records)
+{
+    CacheKey::Buffer keyBuffer;
+    std::vector<CompactRecord> cached;
+    if (!cacheGet(CacheKey::view(domainName, type, keyBuffer), cached))
+    {
+        return false;
+    }
+    records = CompactRecord::toRecords(cached);
+
+    stats.incrementTotalQueries();
+    stats.incrementCacheHits();
+    return true;
+}
+
+bool DNSResolver::lookupWire(
+    const uint8_t *query,
+    const DNSQuery::Question &question,
+    size_t maxSize,
+    std::vector<uint8_t> &response)
+{
+    LocalZone::Answer local;
+    if (localZone.lookup(query + 12, question.length - 16, question.type, local))
+    {
+        response = DNSQuery::buildResponse(query, question, local.records, local.rcode, maxSize);
+        stats.incrementTotalQueries();
+        return true;
+    }
+
+    // The query already carries the wire name; fold it straight into a key
+    CacheKey::Buffer keyBuffer;
+    CacheKey key = CacheKey::fromWire(query + 12, question.length - 16, question.type, keyBuffer);
+
+    bool wireCache = settings.read()->config.enableWireCache;
+
+    // This thread's hot cache first. An entry without a template goes on
+    // to the shared cache once, which compiles one.
+    std::vector<CompactRecord> records;
+    const HotCache::Entry *hot = hotCache.find(key);
+    if (hot && (hot->wire || !wireCache))
+    {
+        stats.incrementTotalQueries();
+        stats.incrementCacheHits();
+        if (hot->wire && patchWire(query, question, *hot->wire, maxSize, response))
+        {
+            return true;
+        }
+        HotCache::countDown(*hot, records);
+        response = DNSQuery::buildResponse(query, question, records, DNSResponseCode::NOERROR, maxSize);
+        return true;
+    }
+
+    // The hot cache needs the records as well, so it takes both in one lookup
+    auto ticket = hotCache.ticket(key);
+    std::shared_ptr<const DNSCache::WireTemplate> wire;
+    bool found;
+    if (hotCache.enabled())
+    {
+        found = cache.get(key, records, wireCache ? &wire : nullptr);
+    }
+    else
+    {
+        // Without a hot cache a template hit needs no records
+        wire = wireCache ? cache.getWire(key) : nullptr;
+        if (wire && patchWire(query, question, *wire, maxSize, response))
+        {
+            stats.incrementTotalQueries();
+            stats.incrementCacheHits();
+            return true;
+        }
+        found = cache.get(key, records);
+    }
+    if (!found)
+    {
+        // Negative answers go out with the SOA they came with
+        std::vector<CompactRecord> authority;
+        auto rcode = negativeCache.get(key.data(), key.size() - 2, question.type, &authority);
+        if (!rcode)
+        {
+            return false;
+        }
+        stats.incrementTotalQueries();
+        stats.incrementCacheHits();
+        response = DNSQuery::buildResponse(query, question, {}, *rcode, maxSize, nullptr, authority);
+        return true;
+    }
+    stats.incrementTotalQueries();
+    stats.incrementCacheHits();
+
+    if (wire && patchWire(query, question, *wire, maxSize, response))
+    {
+        hotCache.fill(key, ticket, records, std::move(wire));
+        return true;
+    }
+
+    if (wireCache && !wire)
+    {
+        // Compile the template once, without EDNS and size limits
+        auto compiled = std::make_shared<DNSCache::WireTemplate>();
+        DNSQuery::Question plain = question;
+        plain.udpPayloadSize = 0;
+        compiled->response = DNSQuery::buildResponse(query, plain, records, DNSResponseCode::NOERROR,
+                                                     UINT16_MAX, &compiled->ttlOffsets);
+        if (!compiled->ttlOffsets.empty())
+        {
+            uint32_t minTtl = UINT32_MAX;
+            for (const auto &record : records)
+            {
+                minTtl = std::min(minTtl, record.ttl);
+            }
+            compiled->created = std::chrono::system_clock::now();
+            compiled->expiry = compiled->created + std::chrono::seconds(minTtl);
+            wire = compiled;
+            cache.putWire(key, std::move(compiled));
+        }
+    }
+    hotCache.fill(key, ticket, records, std::move(wire));
+
+    response = DNSQuery::buildResponse(query, question, records, DNSResponseCode::NOERROR, maxSize);
+    return true;
+}
+
+bool DNSResolver::cacheGet(const CacheKey &key, std::vector<CompactRecord> &records)
+{
+    if (hotCache.get(key, records))
+    {
+        return true;
+    }
+
+    auto ticket = hotCache.ticket(key);
+    if (!cache.get(key, records))
+    {
+        return false;
+    }
+    hotCache.fill(key, ticket, records);
+    return true;
+}
+
+void DNSResolver::cachePut(const CacheKey &key, const std::vector<CompactRecord> &records)
+{
+    cache.put(key, records);
+    hotCache.invalidate(key);
+}
+
+void DNSResolver::clearCache()
+{
+    cache.clear();
+    hotCache.clear();
+    negativeCache.clear();
+    validator.clear();
+}
+
+void DNSResolver::setConfig(const Config &config)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    auto current = getConfig();
+
+    Config next = config;
+    if (next.cacheSize != current.cacheSize || next.cachePolicy != current.cachePolicy ||
+        next.hotCacheSize != current.hotCacheSize || next.negativeCacheSize != current.negativeCacheSize ||
+        next.cacheSnapshotPath != current.cacheSnapshotPath || next.snapshotInterval != current.snapshotInterval ||
+        next.popularityPath != current.popularityPath || next.popularityInterval != current.popularityInterval)
+    {
+        logger->log(LogLevel::WARNING, "Cache and snapshot settings only apply at startup, keeping the current ones");
+    }
+    if (!sameValidatorConfig(next.dnssec, current.dnssec))
+    {
+        logger->log(LogLevel::WARNING, "DNSSEC validator settings only apply at startup, keeping the current ones");
+    }
+    next.cacheSize = current.cacheSize;
+    next.cachePolicy = current.cachePolicy;
+    next.hotCacheSize = current.hotCacheSize;
+    next.negativeCacheSize = current.negativeCacheSize;
+    next.cacheSnapshotPath = current.cacheSnapshotPath;
+    next.snapshotInterval = current.snapshotInterval;
+    next.popularityPath = current.popularityPath;
+    next.popularityInterval = current.popularityInterval;
+    next.localZone = current.localZone;
+    next.dnssec = current.dnssec;
+    next.peering = current.peering;
+
+    std::unique_ptr<const Settings> fresh;
+    bool rebuilt;
+    {
+        auto previous = settings.read();
+        fresh = makeSettings(next, &*previous);
+        rebuilt = fresh->pool != previous->pool;
+    }
+
+    // Returns once the last query on the old settings is done; an old
+    // pool nobody shares any more closes its sockets here
+    settings.replace(std::move(fresh));
+    logger->log(LogLevel::INFO, std::string("Configuration updated") +
+                                    (rebuilt ? ", connection pool rebuilt" : ""));
+}
+
+DNSResolver::Config DNSResolver::getConfig() const
+{
+    return settings.read()->config;
+}
+
 Statistics DNSResolver::getStatistics() const
 {
-    return stats;
+    Statistics snapshot = stats;
+    auto counters = cache.getCounters();
+    snapshot.cacheEvictions = counters.evictions;
+    snapshot.admissionRejections = counters.admissionRejections;
+    snapshot.cachePolicy = cache.getPolicy() == EvictionPolicy::TinyLFU ? "tinylfu" : "lru";
+    snapshot.sharedCacheHits = counters.hits;
+    snapshot.sharedCacheMisses = counters.misses;
+
+    auto hot = hotCache.getCounters();
+    snapshot.hotCacheHits = hot.hits;
+    snapshot.hotCacheMisses = hot.misses;
+
+    auto dnssec = validator.getCounters();
+    snapshot.dnssecSecure = dnssec.secure;
+    snapshot.dnssecInsecure = dnssec.insecure;
+    snapshot.dnssecBogus = dnssec.bogus;
+    snapshot.cryptoOps = dnssec.verifications + dnssec.digests;
+    snapshot.signatureCacheHits = dnssec.signatureHits;
+    snapshot.synthesizedAnswers = dnssec.synthesized;
+
+    if (peering)
+    {
+        auto shared = peering->getCounters();
+        snapshot.peerQueries = shared.queries;
+        snapshot.peerHits = shared.hits;
+        snapshot.peerPublishes = shared.publishes;
+        snapshot.peerServed = shared.served;
+        snapshot.totalPeerLatency = shared.latency;
+    }
+    return snapshot;
 }
@@ -0,0 +1,1809 @@
+#include "DNSSECValidator.hpp"
+#include "DomainName.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+#include <openssl/bn.h>
+#include <openssl/core_names.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/param_build.h>
+
+namespace
+{
+    using Status = DNSSECValidator::Status;
+
+    const std::string ROOT(1, '\0');
+    const uint16_t ZONE_KEY_FLAG = 0x0100;
+    const uint16_t NSEC3_OPT_OUT = 0x01;
+    const uint16_t MAX_NSEC3_ITERATIONS = 150; // RFC 9276: more is treated as unsigned
+
+    uint16_t read16(const uint8_t *data)
+    {
+        return static_cast<uint16_t>((data[0] << 8) | data[1]);
+    }
+
+    uint32_t read32(const uint8_t *data)
+    {
+        return (static_cast<uint32_t>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    }
+
+    void append16(std::string &buffer, uint16_t value)
+    {
+        buffer.push_back(static_cast<char>(value >> 8));
+        buffer.push_back(static_cast<char>(value & 0xFF));
+    }
+
+    void append32(std::string &buffer, uint32_t value)
+    {
+        append16(buffer, value >> 16);
+        append16(buffer, value & 0xFFFF);
+    }
+
+    const uint8_t *bytes(const std::string &data)
+    {
+        return reinterpret_cast<const uint8_t *>(data.data());
+    }
+
+    // Lowercase wire form of a decoded name
+    std::string wireName(const std::string &name)
+    {
+        uint8_t encoded[DomainName::MAX_WIRE_SIZE];
+        size_t length = DomainName::encode(name.data(), name.size(), encoded, false);
+        DomainName::foldCase(encoded, length, encoded);
+        return std::string(reinterpret_cast<const char *>(encoded), length);
+    }
+
+    // Length of the uncompressed wire name at data[offset], 0 if malformed
+    size_t nameLength(const std::string &data, size_t offset)
+    {
+        size_t position = offset;
+        while (position < data.size())
+        {
+            uint8_t length = static_cast<uint8_t>(data[position]);
+            if (length == 0)
+            {
+                size_t total = position + 1 - offset;
+                return total <= DomainName::MAX_WIRE_SIZE ? total : 0;
+            }
+            if (length & 0xC0)
+            {
+                return 0;
+            }
+            position += 1 + length;
+        }
+        return 0;
+    }
+
+    std::string foldedName(const std::string &data, size_t offset, size_t length)
+    {
+        std::string name = data.substr(offset, length);
+        DomainName::foldCase(bytes(name), name.size(), reinterpret_cast<uint8_t *>(&name[0]));
+        return name;
+    }
+
+    // Offsets of the length bytes of each label, root excluded
+    std::vector<size_t> labelOffsets(const std::string &name)
+    {
+        std::vector<size_t> offsets;
+        for (size_t position = 0; position < name.size() && name[position] != 0;
+             position += 1 + static_cast<uint8_t>(name[position]))
+        {
+            offsets.push_back(position);
+        }
+        return offsets;
+    }
+
+    // Labels as counted by RRSIG: the root and a leading wildcard don't count
+    size_t labelCount(const std::string &name)
+    {
+        size_t count = labelOffsets(name).size();
+        if (count > 0 && name[0] == 1 && name[1] == '*')
+        {
+            --count;
+        }
+        return count;
+    }
+
+    std::string parentOf(const std::string &name)
+    {
+        return name.size() > 1 ? name.substr(1 + static_cast<uint8_t>(name[0])) : ROOT;
+    }
+
+    // The rightmost `labels` labels of a name
+    std::string suffix(const std::string &name, size_t labels)
+    {
+        auto offsets = labelOffsets(name);
+        if (labels == 0)
+            return ROOT;
+        return labels >= offsets.size() ? name : name.substr(offsets[offsets.size() - labels]);
+    }
+
+    // Whether `name` equals `zone` or lies below it
+    bool isWithin(const std::string &name, const std::string &zone)
+    {
+        if (name.size() < zone.size() || name.compare(name.size() - zone.size(), zone.size(), zone) != 0)
+        {
+            return false;
+        }
+        // The match has to start on a label boundary
+        for (size_t offset : labelOffsets(name))
+        {
+            if (offset == name.size() - zone.size())
+            {
+                return true;
+            }
+        }
+        return zone == ROOT;
+    }
+
+    std::string toText(const std::string &name)
+    {
+        size_t offset = 0;
+        std::string text = DomainName::decode(bytes(name), name.size(), offset);
+        return text.empty() ? "." : text;
+    }
+
+    // RFC 4034 section 6.1 order: labels compared right to left
+    int canonicalCompare(const std::string &a, const std::string &b)
+    {
+        auto labelsA = labelOffsets(a);
+        auto labelsB = labelOffsets(b);
+        size_t i = labelsA.size();
+        size_t j = labelsB.size();
+        while (i > 0 && j > 0)
+        {
+            --i;
+            --j;
+            size_t lengthA = static_cast<uint8_t>(a[labelsA[i]]);
+            size_t lengthB = static_cast<uint8_t>(b[labelsB[j]]);
+            int order = std::memcmp(a.data() + labelsA[i] + 1, b.data() + labelsB[j] + 1, std::min(lengthA, lengthB));
+            if (order != 0)
+            {
+                return order;
+            }
+            if (lengthA != lengthB)
+            {
+                return lengthA < lengthB ? -1 : 1;
+            }
+        }
+        return i > 0 ? 1 : (j > 0 ? -1 : 0);
+    }
+
+    std::string commonAncestor(const std::string &a, const std::string &b)
+    {
+        auto labelsA = labelOffsets(a);
+        auto labelsB = labelOffsets(b);
+        size_t common = 0;
+        while (common < labelsA.size() && common < labelsB.size() &&
+               a.compare(labelsA[labelsA.size() - 1 - common], std::string::npos,
+                         b, labelsB[labelsB.size() - 1 - common], std::string::npos) == 0)
+        {
+            ++common;
+        }
+        return suffix(a, common);
+    }
+
+    bool hasType(const std::string &bitmap, DNSRecordType type)
+    {
+        uint16_t value = static_cast<uint16_t>(type);
+        size_t position = 0;
+        while (position + 2 <= bitmap.size())
+        {
+            uint8_t window = static_cast<uint8_t>(bitmap[position]);
+            size_t length = static_cast<uint8_t>(bitmap[position + 1]);
+            position += 2;
+            if (position + length > bitmap.size())
+            {
+                return false;
+            }
+            if (window == value >> 8)
+            {
+                size_t index = (value & 0xFF) / 8;
+                return index < length && (static_cast<uint8_t>(bitmap[position + index]) & (0x80 >> (value & 7)));
+            }
+            position += length;
+        }
+        return false;
+    }
+
+    // Delegation point as seen from the parent: its NSEC can only deny DS
+    bool isDelegation(const std::string &bitmap)
+    {
+        return hasType(bitmap, DNSRecordType::NS) && !hasType(bitmap, DNSRecordType::SOA);
+    }
+
+    bool base32hexDecode(const std::string &text, std::string &out)
+    {
+        uint32_t buffer = 0;
+        int bits = 0;
+        for (char c : text)
+        {
+            int value;
+            if (c >= '0' && c <= '9')
+                value = c - '0';
+            else if (c >= 'a' && c <= 'v')
+                value = c - 'a' + 10;
+            else
+                return false;
+            buffer = (buffer << 5) | value;
+            bits += 5;
+            if (bits >= 8)
+            {
+                bits -= 8;
+                out.push_back(static_cast<char>((buffer >> bits) & 0xFF));
+            }
+        }
+        return true;
+    }
+
+    struct Signature
+    {
+        uint16_t typeCovered;
+        uint8_t algorithm;
+        uint8_t labels;
+        uint32_t originalTtl;
+        uint32_t expiration;
+        uint32_t inception;
+        uint16_t keyTag;
+        std::string signer; // lowercase
+        std::string header; // RDATA up to the signature, signer lowercased
+        std::string value;
+    };
+
+    bool parseSignature(const std::string &rdata, Signature &signature)
+    {
+        if (rdata.size() < 19)
+        {
+            return false;
+        }
+        size_t length = nameLength(rdata, 18);
+        if (length == 0 || 18 + length >= rdata.size())
+        {
+            return false;
+        }
+        const uint8_t *data = bytes(rdata);
+        signature.typeCovered = read16(data);
+        signature.algorithm = data[2];
+        signature.labels = data[3];
+        signature.originalTtl = read32(data + 4);
+        signature.expiration = read32(data + 8);
+        signature.inception = read32(data + 12);
+        signature.keyTag = read16(data + 16);
+        signature.signer = foldedName(rdata, 18, length);
+        signature.header = rdata.substr(0, 18) + signature.signer;
+        signature.value = rdata.substr(18 + length);
+        return true;
+    }
+
+    const std::string *opaque(const CompactRecord &record)
+    {
+        auto data = std::get_if<CompactRecord::Opaque>(&record.payload);
+        return data ? &data->rdata : nullptr;
+    }
+
+    // RFC 4034 appendix B
+    uint16_t keyTag(const std::string &rdata)
+    {
+        uint32_t sum = 0;
+        for (size_t i = 0; i < rdata.size(); ++i)
+        {
+            sum += (i & 1) ? static_cast<uint8_t>(rdata[i]) : static_cast<uint8_t>(rdata[i]) << 8;
+        }
+        sum += (sum >> 16) & 0xFFFF;
+        return sum & 0xFFFF;
+    }
+
+    bool supportedAlgorithm(uint8_t algorithm)
+    {
+        switch (algorithm)
+        {
+        case 5: case 7: case 8: case 10: case 13: case 14: case 15: case 16:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Digest signed by each algorithm; EdDSA hashes internally
+    const EVP_MD *signatureDigest(uint8_t algorithm)
+    {
+        switch (algorithm)
+        {
+        case 5: case 7: return EVP_sha1();
+        case 8: case 13: return EVP_sha256();
+        case 10: return EVP_sha512();
+        case 14: return EVP_sha384();
+        default: return nullptr;
+        }
+    }
+
+    const EVP_MD *dsDigest(uint8_t digestType)
+    {
+        switch (digestType)
+        {
+        case 1: return EVP_sha1();
+        case 2: return EVP_sha256();
+        case 4: return EVP_sha384();
+        default: return nullptr;
+        }
+    }
+
+    std::string digest(const EVP_MD *md, const std::string &data)
+    {
+        unsigned char out[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        if (EVP_Digest(data.data(), data.size(), out, &length, md, nullptr) != 1)
+        {
+            throw std::runtime_error("Digest computation failed");
+        }
+        return std::string(reinterpret_cast<const char *>(out), length);
+    }
+
+    EVP_PKEY *fromParams(const char *type, OSSL_PARAM_BLD *builder)
+    {
+        EVP_PKEY *key = nullptr;
+        OSSL_PARAM *params = OSSL_PARAM_BLD_to_param(builder);
+        EVP_PKEY_CTX *context = EVP_PKEY_CTX_new_from_name(nullptr, type, nullptr);
+        if (params && context && EVP_PKEY_fromdata_init(context) == 1)
+        {
+            EVP_PKEY_fromdata(context, &key, EVP_PKEY_PUBLIC_KEY, params);
+        }
+        EVP_PKEY_CTX_free(context);
+        OSSL_PARAM_free(params);
+        return key;
+    }
+
+    // DNSKEY public key field (RFC 3110, 6605, 8080) as an OpenSSL key,
+    // nullptr when malformed or of an unsupported algorithm
+    EVP_PKEY *publicKey(uint8_t algorithm, const std::string &key)
+    {
+        const uint8_t *data = bytes(key);
+        switch (algorithm)
+        {
+        case 5: case 7: case 8: case 10:
+        {
+            if (key.empty())
+                return nullptr;
+            size_t exponentLength = data[0];
+            size_t offset = 1;
+            if (exponentLength == 0)
+            {
+                if (key.size() < 3)
+                    return nullptr;
+                exponentLength = read16(data + 1);
+                offset = 3;
+            }
+            if (exponentLength == 0 || offset + exponentLength >= key.size())
+                return nullptr;
+
+            BIGNUM *e = BN_bin2bn(data + offset, exponentLength, nullptr);
+            BIGNUM *n = BN_bin2bn(data + offset + exponentLength, key.size() - offset - exponentLength, nullptr);
+            OSSL_PARAM_BLD *builder = OSSL_PARAM_BLD_new();
+            EVP_PKEY *result = nullptr;
+            if (e && n && builder && OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_N, n) == 1 &&
+                OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_E, e) == 1)
+            {
+                result = fromParams("RSA", builder);
+            }
+            OSSL_PARAM_BLD_free(builder);
+            BN_free(n);
+            BN_free(e);
+            return result;
+        }
+        case 13: case 14:
+        {
+            size_t size = algorithm == 13 ? 64 : 96;
+            if (key.size() != size)
+                return nullptr;
+            std::string point = "\x04" + key;
+            OSSL_PARAM_BLD *builder = OSSL_PARAM_BLD_new();
+            EVP_PKEY *result = nullptr;
+            if (builder &&
+                OSSL_PARAM_BLD_push_utf8_string(builder, OSSL_PKEY_PARAM_GROUP_NAME,
+                                                algorithm == 13 ? "prime256v1" : "secp384r1", 0) == 1 &&
+                OSSL_PARAM_BLD_push_octet_string(builder, OSSL_PKEY_PARAM_PUB_KEY, point.data(), point.size()) == 1)
+            {
+                result = fromParams("EC", builder);
+            }
+            OSSL_PARAM_BLD_free(builder);
+            return result;
+        }
+        case 15:
+            return key.size() == 32 ? EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr, data, 32) : nullptr;
+        case 16:
+            return key.size() == 57 ? EVP_PKEY_new_raw_public_key(EVP_PKEY_ED448, nullptr, data, 57) : nullptr;
+        default:
+            return nullptr;
+        }
+    }
+
+    // ECDSA signatures come as r || s; OpenSSL wants DER
+    bool toDer(const std::string &signature, std::string &der)
+    {
+        size_t half = signature.size() / 2;
+        ECDSA_SIG *sig = ECDSA_SIG_new();
+        BIGNUM *r = BN_bin2bn(bytes(signature), half, nullptr);
+        BIGNUM *s = BN_bin2bn(bytes(signature) + half, half, nullptr);
+        if (!sig || !r || !s || ECDSA_SIG_set0(sig, r, s) != 1)
+        {
+            BN_free(r);
+            BN_free(s);
+            ECDSA_SIG_free(sig);
+            return false;
+        }
+        unsigned char *out = nullptr;
+        int length = i2d_ECDSA_SIG(sig, &out);
+        ECDSA_SIG_free(sig);
+        if (length <= 0)
+        {
+            return false;
+        }
+        der.assign(reinterpret_cast<const char *>(out), length);
+        OPENSSL_free(out);
+        return true;
+    }
+
+    bool verify(EVP_PKEY *key, uint8_t algorithm, const std::string &data, const std::string &signature)
+    {
+        std::string der;
+        const std::string *value = &signature;
+        if (algorithm == 13 || algorithm == 14)
+        {
+            if (signature.size() != (algorithm == 13 ? 64u : 96u) || !toDer(signature, der))
+            {
+                return false;
+            }
+            value = &der;
+        }
+
+        EVP_MD_CTX *context = EVP_MD_CTX_new();
+        bool valid = context &&
+                     EVP_DigestVerifyInit(context, nullptr, signatureDigest(algorithm), nullptr, key) == 1 &&
+                     EVP_DigestVerify(context, bytes(*value), value->size(), bytes(data), data.size()) == 1;
+        EVP_MD_CTX_free(context);
+        return valid;
+    }
+
+    bool timeValid(const Signature &signature, uint32_t now)
+    {
+        // Serial number arithmetic (RFC 1982), as RFC 4034 section 3.1.5 asks
+        return static_cast<int32_t>(now - signature.inception) >= 0 &&
+               static_cast<int32_t>(signature.expiration - now) >= 0;
+    }
+
+    // Name, MX, SRV and SOA names are lowercased (RFC 4034 section 6.2)
+    std::string canonicalData(const CompactRecord &record)
+    {
+        std::string data;
+        if (auto name = std::get_if<CompactRecord::Name>(&record.payload))
+        {
+            data = wireName(name->target);
+        }
+        else if (auto mx = std::get_if<CompactRecord::MX>(&record.payload))
+        {
+            append16(data, mx->preference);
+            data += wireName(mx->exchange);
+        }
+        else if (auto srv = std::get_if<CompactRecord::SRV>(&record.payload))
+        {
+            append16(data, srv->priority);
+            append16(data, srv->weight);
+            append16(data, srv->port);
+            data += wireName(srv->target);
+        }
+        else if (auto soa = std::get_if<std::shared_ptr<const CompactRecord::SOA>>(&record.payload))
+        {
+            data = wireName((*soa)->mname) + wireName((*soa)->rname);
+            append32(data, (*soa)->serial);
+            append32(data, (*soa)->refresh);
+            append32(data, (*soa)->retry);
+            append32(data, (*soa)->expire);
+            append32(data, (*soa)->minimum);
+        }
+        else
+        {
+            std::vector<uint8_t> buffer;
+            record.encodeData(buffer);
+            data.assign(buffer.begin(), buffer.end());
+        }
+        return data;
+    }
+}
+
+struct DNSSECValidator::Key
+{
+    std::string rdata;
+    uint16_t flags;
+    uint8_t algorithm;
+    uint16_t tag;
+    std::shared_ptr<EVP_PKEY> publicKey; // parsed once, shared by every check
+};
+
+struct DNSSECValidator::RRset
+{
+    std::string owner; // wire format, lowercase
+    DNSRecordType type;
+    uint32_t ttl;
+    std::vector<std::string> rdata; // canonical form
+    std::vector<Signature> signatures;
+    bool verified = false;
+    uint8_t labels = 0; // of the signature that verified it
+};
+
+struct DNSSECValidator::Check
+{
+    RRset *set;
+    const Key *key;
+    const Signature *signature;
+    std::string data;
+    std::string cacheKey;
+    bool valid = false;
+};
+
+namespace
+{
+    using RRset = DNSSECValidator::RRset;
+    using Key = DNSSECValidator::Key;
+
+    // Groups records into RRsets and attaches each RRSIG to the set it
+    // covers; signatures without a set are dropped. Throws on names that
+    // don't encode.
+    std::vector<RRset> group(const std::vector<CompactRecord> &records)
+    {
+        std::vector<RRset> sets;
+        auto find = [&](const std::string &owner, DNSRecordType type) -> RRset * {
+            for (auto &set : sets)
+            {
+                if (set.type == type && set.owner == owner)
+                    return &set;
+            }
+            return nullptr;
+        };
+
+        for (const auto &record : records)
+        {
+            if (record.type == DNSRecordType::RRSIG)
+                continue;
+            std::string owner = wireName(record.name);
+            RRset *set = find(owner, record.type);
+            if (!set)
+            {
+                sets.push_back(RRset{owner, record.type, record.ttl, {}, {}});
+                set = &sets.back();
+            }
+            set->ttl = std::min(set->ttl, record.ttl);
+            set->rdata.push_back(canonicalData(record));
+        }
+
+        for (const auto &record : records)
+        {
+            Signature signature;
+            if (record.type != DNSRecordType::RRSIG || !opaque(record) || !parseSignature(*opaque(record), signature))
+                continue;
+            if (RRset *set = find(wireName(record.name), static_cast<DNSRecordType>(signature.typeCovered)))
+            {
+                set->signatures.push_back(std::move(signature));
+            }
+        }
+
+        for (auto &set : sets)
+        {
+            std::sort(set.rdata.begin(), set.rdata.end());
+            set.rdata.erase(std::unique(set.rdata.begin(), set.rdata.end()), set.rdata.end());
+        }
+        return sets;
+    }
+
+    // What RFC 4034 section 3.1.8.1 has the signature cover
+    std::string signedData(const RRset &set, const Signature &signature)
+    {
+        std::string owner = set.owner;
+        if (signature.labels < labelCount(owner))
+        {
+            owner = std::string("\x01*", 2) + suffix(owner, signature.labels);
+        }
+
+        std::string data = signature.header;
+        for (const auto &rdata : set.rdata)
+        {
+            data += owner;
+            append16(data, static_cast<uint16_t>(set.type));
+            append16(data, 1); // IN
+            append32(data, signature.originalTtl);
+            append16(data, static_cast<uint16_t>(rdata.size()));
+            data += rdata;
+        }
+        return data;
+    }
+
+    std::vector<Key> parseKeys(const RRset &set)
+    {
+        std::vector<Key> keys;
+        for (const auto &rdata : set.rdata)
+        {
+            if (rdata.size() < 5 || rdata[2] != 3) // protocol is always 3
+                continue;
+            Key key{rdata, read16(bytes(rdata)), static_cast<uint8_t>(rdata[3]), keyTag(rdata), nullptr};
+            if (supportedAlgorithm(key.algorithm))
+            {
+                key.publicKey.reset(publicKey(key.algorithm, rdata.substr(4)), EVP_PKEY_free);
+            }
+            keys.push_back(std::move(key));
+        }
+        return keys;
+    }
+
+    struct Nsec
+    {
+        std::string owner;
+        std::string next;
+        std::string types;
+
+        // Strictly between owner and next; the last NSEC wraps to the apex
+        bool covers(const std::string &name) const
+        {
+            if (canonicalCompare(owner, next) < 0)
+                return canonicalCompare(owner, name) < 0 && canonicalCompare(name, next) < 0;
+            return canonicalCompare(owner, name) < 0 || canonicalCompare(name, next) < 0;
+        }
+    };
+
+    std::vector<Nsec> verifiedNsecs(const std::vector<RRset> &authority)
+    {
+        std::vector<Nsec> nsecs;
+        for (const auto &set : authority)
+        {
+            if (set.type != DNSRecordType::NSEC || !set.verified || set.rdata.size() != 1)
+                continue;
+            size_t length = nameLength(set.rdata[0], 0);
+            if (length == 0)
+                continue;
+            nsecs.push_back({set.owner, foldedName(set.rdata[0], 0, length), set.rdata[0].substr(length)});
+        }
+        return nsecs;
+    }
+
+    const Nsec *matching(const std::vector<Nsec> &nsecs, const std::string &name)
+    {
+        for (const auto &nsec : nsecs)
+        {
+            if (nsec.owner == name)
+                return &nsec;
+        }
+        return nullptr;
+    }
+
+    // Covering NSEC that may speak for the name: one from the parent side
+    // of a delegation above it says nothing about the child zone
+    const Nsec *covering(const std::vector<Nsec> &nsecs, const std::string &name)
+    {
+        for (const auto &nsec : nsecs)
+        {
+            if (nsec.covers(name) && !(isDelegation(nsec.types) && isWithin(name, nsec.owner)))
+                return &nsec;
+        }
+        return nullptr;
+    }
+
+    std::string closestEncloser(const Nsec &nsec, const std::string &name)
+    {
+        std::string byOwner = commonAncestor(name, nsec.owner);
+        std::string byNext = commonAncestor(name, nsec.next);
+        return byOwner.size() > byNext.size() ? byOwner : byNext;
+    }
+
+    std::string wildcardOf(const std::string &name)
+    {
+        return std::string("\x01*", 2) + name;
+    }
+
+    Status nsecNxdomain(const std::string &name, const std::vector<Nsec> &nsecs)
+    {
+        const Nsec *nsec = covering(nsecs, name);
+        if (!nsec)
+            return Status::Bogus;
+        std::string wildcard = wildcardOf(closestEncloser(*nsec, name));
+        return !matching(nsecs, wildcard) && covering(nsecs, wildcard) ? Status::Secure : Status::Bogus;
+    }
+
+    Status nsecNodata(const std::string &name, DNSRecordType type, const std::vector<Nsec> &nsecs)
+    {
+        auto lacks = [type](const Nsec &nsec) {
+            return !hasType(nsec.types, type) && !hasType(nsec.types, DNSRecordType::CNAME);
+        };
+
+        if (const Nsec *nsec = matching(nsecs, name))
+        {
+            // The parent's NSEC at a delegation only speaks for DS, the
+            // child's apex NSEC for everything but DS
+            bool parentSide = isDelegation(nsec->types);
+            if (type == DNSRecordType::DS ? !parentSide && name != ROOT && hasType(nsec->types, DNSRecordType::SOA)
+                                          : parentSide)
+                return Status::Bogus;
+            return lacks(*nsec) ? Status::Secure : Status::Bogus;
+        }
+
+        const Nsec *nsec = covering(nsecs, name);
+        if (!nsec)
+            return Status::Bogus;
+        // Empty non-terminal: a name exists below it
+        if (isWithin(nsec->next, name))
+            return Status::Secure;
+        // Wildcard no-data
+        const Nsec *wildcard = matching(nsecs, wildcardOf(closestEncloser(*nsec, name)));
+        return wildcard && lacks(*wildcard) ? Status::Secure : Status::Bogus;
+    }
+
+    struct Nsec3
+    {
+        std::string hash;
+        uint8_t algorithm;
+        uint8_t flags;
+        uint16_t iterations;
+        std::string salt;
+        std::string next;
+        std::string types;
+    };
+
+    // The NSEC3 records of one zone, hashing names with the zone's
+    // parameters; hashes are counted towards the crypto cost
+    class Nsec3Chain
+    {
+    public:
+        Nsec3Chain(const std::vector<RRset> &authority, const std::string &zone, std::atomic<uint64_t> &digests)
+            : zone(zone), digests(digests)
+        {
+            for (const auto &set : authority)
+            {
+                if (set.type != DNSRecordType::NSEC3 || !set.verified || set.rdata.size() != 1 ||
+                    set.owner.empty() || parentOf(set.owner) != zone)
+                    continue;
+                const std::string &rdata = set.rdata[0];
+                if (rdata.size() < 5)
+                    continue;
+                Nsec3 record;
+                record.algorithm = rdata[0];
+                record.flags = rdata[1];
+                record.iterations = read16(bytes(rdata) + 2);
+                size_t saltLength = static_cast<uint8_t>(rdata[4]);
+                if (5 + saltLength >= rdata.size())
+                    continue;
+                record.salt = rdata.substr(5, saltLength);
+                size_t hashLength = static_cast<uint8_t>(rdata[5 + saltLength]);
+                if (6 + saltLength + hashLength > rdata.size())
+                    continue;
+                record.next = rdata.substr(6 + saltLength, hashLength);
+                record.types = rdata.substr(6 + saltLength + hashLength);
+                if (!base32hexDecode(set.owner.substr(1, static_cast<uint8_t>(set.owner[0])), record.hash) ||
+                    record.hash.size() != record.next.size())
+                    continue;
+                records.push_back(std::move(record));
+            }
+        }
+
+        bool empty() const { return records.empty(); }
+
+        // Only SHA-1 is defined; unknown hashes and costly chains make the
+        // answer insecure rather than bogus (RFC 5155 section 8.1, RFC 9276)
+        bool unusable() const
+        {
+            return records.front().algorithm != 1 || records.front().iterations > MAX_NSEC3_ITERATIONS;
+        }
+
+        const Nsec3 *match(const std::string &name)
+        {
+            std::string h = hash(name);
+            for (const auto &record : records)
+            {
+                if (record.hash == h)
+                    return &record;
+            }
+            return nullptr;
+        }
+
+        const Nsec3 *cover(const std::string &name)
+        {
+            std::string h = hash(name);
+            for (const auto &record : records)
+            {
+                bool covered = record.hash < record.next ? record.hash < h && h < record.next
+                                                         : record.hash < h || h < record.next;
+                if (covered)
+                    return &record;
+            }
+            return nullptr;
+        }
+
+        // RFC 5155 section 8.3: the closest ancestor with a matching record
+        // and, one label longer, the next closer name, which must be covered
+        bool closestEncloser(const std::string &name, std::string &encloser, const Nsec3 *&nextCloser)
+        {
+            std::string previous;
+            for (std::string candidate = name; isWithin(candidate, zone); candidate = parentOf(candidate))
+            {
+                if (match(candidate))
+                {
+                    if (previous.empty())
+                        return false;
+                    encloser = candidate;
+                    nextCloser = cover(previous);
+                    return nextCloser != nullptr;
+                }
+                if (candidate == ROOT)
+                    break;
+                previous = candidate;
+            }
+            return false;
+        }
+
+    private:
+        std::string zone;
+        std::atomic<uint64_t> &digests;
+        std::vector<Nsec3> records;
+
+        std::string hash(const std::string &name)
+        {
+            const Nsec3 &parameters = records.front();
+            std::string value = digest(EVP_sha1(), name + parameters.salt);
+            for (uint16_t i = 0; i < parameters.iterations; ++i)
+            {
+                value = digest(EVP_sha1(), value + parameters.salt);
+            }
+            digests += parameters.iterations + 1;
+            return value;
+        }
+    };
+
+    Status nsec3Nxdomain(const std::string &name, Nsec3Chain &chain)
+    {
+        if (chain.unusable())
+            return Status::Insecure;
+        std::string encloser;
+        const Nsec3 *nextCloser = nullptr;
+        if (!chain.closestEncloser(name, encloser, nextCloser) || !chain.cover(wildcardOf(encloser)))
+            return Status::Bogus;
+        return nextCloser->flags & NSEC3_OPT_OUT ? Status::Insecure : Status::Secure;
+    }
+
+    Status nsec3Nodata(const std::string &name, DNSRecordType type, Nsec3Chain &chain)
+    {
+        if (chain.unusable())
+            return Status::Insecure;
+        auto lacks = [type](const Nsec3 &record) {
+            return !hasType(record.types, type) && !hasType(record.types, DNSRecordType::CNAME);
+        };
+
+        if (const Nsec3 *record = chain.match(name))
+        {
+            if (type != DNSRecordType::DS && isDelegation(record->types))
+                return Status::Bogus;
+            return lacks(*record) ? Status::Secure : Status::Bogus;
+        }
+
+        std::string encloser;
+        const Nsec3 *nextCloser = nullptr;
+        if (!chain.closestEncloser(name, encloser, nextCloser))
+            return Status::Bogus;
+        // An opted-out span may hide an unsigned delegation (RFC 5155 section 8.6)
+        if (type == DNSRecordType::DS)
+            return nextCloser->flags & NSEC3_OPT_OUT ? Status::Insecure : Status::Bogus;
+        const Nsec3 *wildcard = chain.match(wildcardOf(encloser));
+        return wildcard && lacks(*wildcard) ? Status::Secure : Status::Bogus;
+    }
+}
+
+bool DNSSECValidator::CanonicalLess::operator()(const std::string &a, const std::string &b) const
+{
+    return canonicalCompare(a, b) < 0;
+}
+
+DNSSECValidator::DNSSECValidator(const Config &config) : config(config)
+{
+    for (const auto &anchor : config.trustAnchors)
+    {
+        std::istringstream fields(anchor);
+        unsigned tag, algorithm, digestType;
+        std::string hex;
+        if (!(fields >> tag >> algorithm >> digestType >> hex) || tag > 0xFFFF || algorithm > 0xFF ||
+            digestType > 0xFF || hex.size() % 2 != 0)
+        {
+            throw std::runtime_error("Invalid trust anchor: " + anchor);
+        }
+
+        DS ds{static_cast<uint16_t>(tag), static_cast<uint8_t>(algorithm), static_cast<uint8_t>(digestType), {}};
+        for (size_t i = 0; i < hex.size(); i += 2)
+        {
+            size_t used = 0;
+            int value = std::stoi(hex.substr(i, 2), &used, 16);
+            if (used != 2)
+            {
+                throw std::runtime_error("Invalid trust anchor: " + anchor);
+            }
+            ds.digest.push_back(static_cast<char>(value));
+        }
+        anchors.push_back(std::move(ds));
+    }
+}
+
+DNSSECValidator::~DNSSECValidator() = default;
+
+std::optional<DNSSECValidator::ZoneState> DNSSECValidator::stateOf(const std::string &zone)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = zones.find(zone);
+    if (it != zones.end() && it->second.expiry > now)
+    {
+        return it->second;
+    }
+    for (std::string ancestor = zone; ancestor != ROOT;)
+    {
+        ancestor = parentOf(ancestor);
+        auto above = zones.find(ancestor);
+        if (above != zones.end() && above->second.expiry > now && above->second.kind == ZoneState::Kind::Insecure)
+        {
+            return above->second;
+        }
+    }
+    return std::nullopt;
+}
+
+void DNSSECValidator::storeZone(const std::string &zone, ZoneState state)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (zones.size() >= config.zoneCacheSize && !zones.count(zone))
+    {
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = zones.begin(); it != zones.end();)
+        {
+            it = it->second.expiry <= now ? zones.erase(it) : std::next(it);
+        }
+        if (zones.size() >= config.zoneCacheSize)
+        {
+            zones.clear();
+        }
+    }
+    zones[zone] = std::move(state);
+}
+
+void DNSSECValidator::resolveZones(const std::vector<std::string> &wanted, const Fetch &fetch)
+{
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> round;
+    for (const auto &zone : wanted)
+    {
+        if (seen.insert(zone).second && !stateOf(zone))
+        {
+            round.push_back(zone);
+        }
+    }
+
+    std::vector<Pending> pending;
+    while (!round.empty())
+    {
+        std::vector<Question> questions;
+        for (const auto &zone : round)
+        {
+            std::string text = toText(zone);
+            if (zone != ROOT)
+            {
+                questions.emplace_back(text, DNSRecordType::DS);
+            }
+            questions.emplace_back(text, DNSRecordType::DNSKEY);
+        }
+        auto responses = fetch(questions);
+
+        std::vector<std::string> next;
+        size_t index = 0;
+        for (const auto &zone : round)
+        {
+            Pending entry{zone, "", {}, {}};
+            if (zone != ROOT)
+            {
+                entry.ds = std::move(responses[index++]);
+            }
+            entry.dnskey = std::move(responses[index++]);
+
+            if (zone != ROOT)
+            {
+                // The DS answer or its denial names the parent zone
+                for (const auto &record : entry.ds.answers.empty() ? entry.ds.authority : entry.ds.answers)
+                {
+                    Signature signature;
+                    if (record.type == DNSRecordType::RRSIG && opaque(record) &&
+                        parseSignature(*opaque(record), signature))
+                    {
+                        entry.parent = signature.signer;
+                        break;
+                    }
+                }
+
+                if (entry.parent.empty())
+                {
+                    // Unsigned: fine below an unsigned delegation, bogus otherwise
+                    auto now = std::chrono::steady_clock::now();
+                    bool belowUnsigned = zoneStatus(parentOf(zone), fetch) == Status::Insecure;
+                    storeZone(zone, {belowUnsigned ? ZoneState::Kind::Insecure : ZoneState::Kind::Bogus, nullptr,
+                                     now + std::chrono::seconds(belowUnsigned ? config.maxTtl : config.bogusTtl)});
+                    continue;
+                }
+                if (seen.insert(entry.parent).second && !stateOf(entry.parent))
+                {
+                    next.push_back(entry.parent);
+                }
+            }
+            pending.push_back(std::move(entry));
+        }
+        round = std::move(next);
+    }
+
+    // Parents have fewer labels, so each level only needs the ones before it
+    std::stable_sort(pending.begin(), pending.end(), [](const Pending &a, const Pending &b) {
+        return labelCount(a.zone) < labelCount(b.zone);
+    });
+    for (size_t begin = 0; begin < pending.size();)
+    {
+        size_t end = begin;
+        while (end < pending.size() && labelCount(pending[end].zone) == labelCount(pending[begin].zone))
+        {
+            ++end;
+        }
+        std::vector<Pending> level(std::make_move_iterator(pending.begin() + begin),
+                                   std::make_move_iterator(pending.begin() + end));
+        establish(level);
+        begin = end;
+    }
+}
+
+void DNSSECValidator::establish(std::vector<Pending> &level)
+{
+    struct Work
+    {
+        ZoneState::Kind kind = ZoneState::Kind::Bogus;
+        bool done = false;
+        uint32_t ttl;
+        std::shared_ptr<const std::vector<Key>> parentKeys;
+        std::vector<RRset> dsSets;
+        std::vector<RRset> keySets;
+        std::vector<DS> ds;
+        std::vector<Key> entryKeys;
+    };
+    std::vector<Work> work(level.size());
+    std::vector<Check> checks;
+
+    // DS records, or their denial, have to verify with the parent's keys
+    for (size_t i = 0; i < level.size(); ++i)
+    {
+        Pending &entry = level[i];
+        Work &item = work[i];
+        item.ttl = config.maxTtl;
+        if (entry.zone == ROOT)
+        {
+            item.ds = anchors;
+            continue;
+        }
+
+        auto parent = stateOf(entry.parent);
+        if (!parent || parent->kind != ZoneState::Kind::Secure || entry.parent == entry.zone ||
+            !isWithin(entry.zone, entry.parent))
+        {
+            item.kind = parent && parent->kind == ZoneState::Kind::Insecure ? ZoneState::Kind::Insecure
+                                                                            : ZoneState::Kind::Bogus;
+            item.done = true;
+            continue;
+        }
+        item.parentKeys = parent->keys;
+        try
+        {
+            item.dsSets = group(entry.ds.answers.empty() ? entry.ds.authority : entry.ds.answers);
+        }
+        catch (const std::exception &)
+        {
+            item.done = true;
+            continue;
+        }
+        for (auto &set : item.dsSets)
+        {
+            addChecks(set, entry.parent, *item.parentKeys, checks);
+        }
+    }
+    runChecks(checks);
+    checks.clear();
+
+    // The DS digests pick the entry keys, which must sign the DNSKEY set
+    for (size_t i = 0; i < level.size(); ++i)
+    {
+        Pending &entry = level[i];
+        Work &item = work[i];
+        if (item.done)
+            continue;
+
+        if (entry.zone != ROOT)
+        {
+            const RRset *dsSet = nullptr;
+            for (const auto &set : item.dsSets)
+            {
+                if (set.type == DNSRecordType::DS && set.owner == entry.zone)
+                    dsSet = &set;
+            }
+            if (!dsSet || entry.ds.rcode != DNSResponseCode::NOERROR)
+            {
+                item.kind = denialOfDS(entry.zone, item.dsSets, entry.parent);
+                for (const auto &set : item.dsSets)
+                {
+                    item.ttl = std::min(item.ttl, set.ttl);
+                }
+                item.done = true;
+                continue;
+            }
+            if (!dsSet->verified)
+            {
+                item.done = true;
+                continue;
+            }
+            item.ttl = std::min(item.ttl, dsSet->ttl);
+            for (const auto &rdata : dsSet->rdata)
+            {
+                if (rdata.size() > 4)
+                {
+                    item.ds.push_back({read16(bytes(rdata)), static_cast<uint8_t>(rdata[2]),
+                                       static_cast<uint8_t>(rdata[3]), rdata.substr(4)});
+                }
+            }
+        }
+
+        // Nothing we can check: the zone counts as unsigned (RFC 4035 section 5.2)
+        item.ds.erase(std::remove_if(item.ds.begin(), item.ds.end(), [](const DS &ds) {
+                          return !supportedAlgorithm(ds.algorithm) || !dsDigest(ds.digestType);
+                      }),
+                      item.ds.end());
+        if (item.ds.empty())
+        {
+            item.kind = ZoneState::Kind::Insecure;
+            item.done = true;
+            continue;
+        }
+
+        try
+        {
+            item.keySets = group(entry.dnskey.answers);
+        }
+        catch (const std::exception &)
+        {
+            item.done = true;
+            continue;
+        }
+        RRset *keySet = nullptr;
+        for (auto &set : item.keySets)
+        {
+            if (set.type == DNSRecordType::DNSKEY && set.owner == entry.zone)
+                keySet = &set;
+        }
+        if (!keySet)
+        {
+            item.done = true;
+            continue;
+        }
+        item.ttl = std::min(item.ttl, keySet->ttl);
+
+        for (auto &key : parseKeys(*keySet))
+        {
+            for (const auto &ds : item.ds)
+            {
+                if (ds.keyTag != key.tag || ds.algorithm != key.algorithm || !(key.flags & ZONE_KEY_FLAG) ||
+                    !key.publicKey)
+                    continue;
+                ++digests;
+                if (digest(dsDigest(ds.digestType), entry.zone + key.rdata) == ds.digest)
+                {
+                    item.entryKeys.push_back(key);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < level.size(); ++i)
+    {
+        for (auto &set : work[i].keySets)
+        {
+            if (set.type == DNSRecordType::DNSKEY && set.owner == level[i].zone)
+                addChecks(set, level[i].zone, work[i].entryKeys, checks);
+        }
+    }
+    runChecks(checks);
+
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < level.size(); ++i)
+    {
+        Work &item = work[i];
+        ZoneState state;
+        state.kind = item.kind;
+        if (!item.done)
+        {
+            for (auto &set : item.keySets)
+            {
+                if (set.type != DNSRecordType::DNSKEY || set.owner != level[i].zone || !set.verified)
+                    continue;
+                auto keys = std::make_shared<std::vector<Key>>();
+                for (auto &key : parseKeys(set))
+                {
+                    if ((key.flags & ZONE_KEY_FLAG) && key.publicKey)
+                        keys->push_back(std::move(key));
+                }
+                state.kind = ZoneState::Kind::Secure;
+                state.keys = std::move(keys);
+            }
+        }
+        uint32_t ttl = state.kind == ZoneState::Kind::Bogus ? config.bogusTtl : item.ttl;
+        state.expiry = now + std::chrono::seconds(ttl);
+        storeZone(level[i].zone, std::move(state));
+    }
+}
+
+DNSSECValidator::Status DNSSECValidator::zoneStatus(const std::string &name, const Fetch &fetch)
+{
+    resolveZones({ROOT}, fetch);
+    auto root = stateOf(ROOT);
+    if (!root || root->kind != ZoneState::Kind::Secure)
+    {
+        return Status::Bogus;
+    }
+
+    std::string current = ROOT;
+    auto offsets = labelOffsets(name);
+    for (size_t labels = 1; labels <= offsets.size(); ++labels)
+    {
+        std::string ancestor = suffix(name, labels);
+        auto state = stateOf(ancestor);
+        if (!state)
+        {
+            Pending entry{ancestor, current, {}, {}};
+            auto responses = fetch({{toText(ancestor), DNSRecordType::DS}, {toText(ancestor), DNSRecordType::DNSKEY}});
+            entry.ds = std::move(responses[0]);
+            entry.dnskey = std::move(responses[1]);
+            std::vector<Pending> level{std::move(entry)};
+            establish(level);
+            state = stateOf(ancestor);
+        }
+        if (!state || state->kind == ZoneState::Kind::Bogus)
+        {
+            return Status::Bogus;
+        }
+        if (state->kind == ZoneState::Kind::Insecure)
+        {
+            return Status::Insecure;
+        }
+        if (state->kind == ZoneState::Kind::Secure)
+        {
+            current = ancestor;
+        }
+    }
+    return Status::Secure;
+}
+
+void DNSSECValidator::addChecks(RRset &set, const std::string &zone, const std::vector<Key> &keys,
+                                std::vector<Check> &checks)
+{
+    uint32_t now = static_cast<uint32_t>(std::time(nullptr));
+    for (const auto &signature : set.signatures)
+    {
+        if (signature.signer != zone || !isWithin(set.owner, zone) || signature.labels > labelCount(set.owner) ||
+            !timeValid(signature, now))
+            continue;
+
+        std::string data;
+        for (const auto &key : keys)
+        {
+            if (key.tag != signature.keyTag || key.algorithm != signature.algorithm || !key.publicKey)
+                continue;
+            if (data.empty())
+            {
+                data = signedData(set, signature);
+            }
+            Check check{&set, &key, &signature, data, {}, false};
+            check.cacheKey = digest(EVP_sha256(), key.rdata + data + signature.value);
+            checks.push_back(std::move(check));
+        }
+    }
+}
+
+void DNSSECValidator::runChecks(std::vector<Check> &checks)
+{
+    if (checks.empty())
+    {
+        return;
+    }
+
+    // Repeats within the batch are verified once
+    auto now = std::chrono::steady_clock::now();
+    std::unordered_map<std::string, std::vector<size_t>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < checks.size(); ++i)
+        {
+            auto it = signatures.find(checks[i].cacheKey);
+            if (it != signatures.end() && it->second > now)
+            {
+                checks[i].valid = true;
+                ++signatureHits;
+            }
+            else
+            {
+                pending[checks[i].cacheKey].push_back(i);
+            }
+        }
+    }
+
+    std::vector<std::vector<size_t> *> unique;
+    for (auto &entry : pending)
+    {
+        unique.push_back(&entry.second);
+    }
+    auto verifyRange = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            Check &check = checks[unique[i]->front()];
+            check.valid = verify(check.key->publicKey.get(), check.key->algorithm, check.data, check.signature->value);
+        }
+    };
+
+    size_t threads = std::min(config.maxThreads, unique.size() / std::max<size_t>(config.parallelThreshold, 1));
+    if (threads > 1)
+    {
+        size_t chunk = (unique.size() + threads - 1) / threads;
+        std::vector<std::future<void>> futures;
+        for (size_t begin = chunk; begin < unique.size(); begin += chunk)
+        {
+            futures.push_back(std::async(std::launch::async, verifyRange, begin, std::min(begin + chunk, unique.size())));
+        }
+        verifyRange(0, chunk);
+        for (auto &future : futures)
+        {
+            future.get();
+        }
+    }
+    else
+    {
+        verifyRange(0, unique.size());
+    }
+    verifications += unique.size();
+
+    uint32_t unixNow = static_cast<uint32_t>(std::time(nullptr));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto *indices : unique)
+        {
+            const Check &first = checks[indices->front()];
+            for (size_t i : *indices)
+            {
+                checks[i].valid = first.valid;
+            }
+            if (!first.valid)
+                continue;
+
+            if (signatures.size() >= config.signatureCacheSize)
+            {
+                for (auto it = signatures.begin(); it != signatures.end();)
+                {
+                    it = it->second <= now ? signatures.erase(it) : std::next(it);
+                }
+                if (signatures.size() >= config.signatureCacheSize)
+                {
+                    signatures.clear();
+                }
+            }
+            uint32_t remaining = std::min(config.maxTtl, first.signature->expiration - unixNow);
+            signatures[first.cacheKey] = now + std::chrono::seconds(remaining);
+        }
+    }
+
+    for (const auto &check : checks)
+    {
+        if (check.valid)
+        {
+            check.set->verified = true;
+            check.set->labels = check.signature->labels;
+        }
+    }
+}
+
+DNSSECValidator::ZoneState::Kind DNSSECValidator::denialOfDS(const std::string &name,
+                                                             const std::vector<RRset> &authority,
+                                                             const std::string &zone)
+{
+    auto nsecs = verifiedNsecs(authority);
+    if (const Nsec *nsec = matching(nsecs, name))
+    {
+        if (hasType(nsec->types, DNSRecordType::DS) || hasType(nsec->types, DNSRecordType::SOA))
+            return ZoneState::Kind::Bogus;
+        return hasType(nsec->types, DNSRecordType::NS) ? ZoneState::Kind::Insecure : ZoneState::Kind::NotCut;
+    }
+    // No such name, or an empty non-terminal: not a cut either way
+    if (covering(nsecs, name))
+    {
+        return ZoneState::Kind::NotCut;
+    }
+
+    Nsec3Chain chain(authority, zone, digests);
+    if (chain.empty())
+    {
+        return ZoneState::Kind::Bogus;
+    }
+    if (chain.unusable())
+    {
+        return ZoneState::Kind::Insecure;
+    }
+    if (const Nsec3 *record = chain.match(name))
+    {
+        if (hasType(record->types, DNSRecordType::DS) || hasType(record->types, DNSRecordType::SOA))
+            return ZoneState::Kind::Bogus;
+        return hasType(record->types, DNSRecordType::NS) ? ZoneState::Kind::Insecure : ZoneState::Kind::NotCut;
+    }
+    std::string encloser;
+    const Nsec3 *nextCloser = nullptr;
+    if (!chain.closestEncloser(name, encloser, nextCloser))
+    {
+        return ZoneState::Kind::Bogus;
+    }
+    return nextCloser->flags & NSEC3_OPT_OUT ? ZoneState::Kind::Insecure : ZoneState::Kind::NotCut;
+}
+
+void DNSSECValidator::learn(const std::string &zone, const std::vector<RRset> &authority)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &set : authority)
+    {
+        if (set.type != DNSRecordType::NSEC || !set.verified || set.rdata.size() != 1 || !isWithin(set.owner, zone))
+            continue;
+        size_t length = nameLength(set.rdata[0], 0);
+        if (length == 0)
+            continue;
+
+        if (nsecCount >= config.nsecCacheSize)
+        {
+            nsecZones.clear();
+            nsecCount = 0;
+        }
+        auto &entry = nsecZones[zone][set.owner];
+        if (entry.next.empty())
+        {
+            ++nsecCount;
+        }
+        entry = {foldedName(set.rdata[0], 0, length), set.rdata[0].substr(length),
+                 now + std::chrono::seconds(std::min(set.ttl, config.maxTtl))};
+    }
+}
+
+std::optional<DNSResponseCode> DNSSECValidator::synthesize(const uint8_t *name, size_t length, DNSRecordType type)
+{
+    if (nsecCount == 0)
+    {
+        return std::nullopt;
+    }
+
+    std::string wire(reinterpret_cast<const char *>(name), length);
+    DomainName::foldCase(name, length, reinterpret_cast<uint8_t *>(&wire[0]));
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // NSEC records of the closest zone we have any for
+    NsecZone *zone = nullptr;
+    for (std::string ancestor = wire;; ancestor = parentOf(ancestor))
+    {
+        auto it = nsecZones.find(ancestor);
+        if (it != nsecZones.end())
+        {
+            zone = &it->second;
+            break;
+        }
+        if (ancestor == ROOT)
+        {
+            return std::nullopt;
+        }
+    }
+
+    // The NSEC at or before a name in canonical order
+    auto lookup = [&](const std::string &target) -> std::optional<Nsec> {
+        auto it = zone->upper_bound(target);
+        if (it == zone->begin())
+            return std::nullopt;
+        --it;
+        if (it->second.expiry <= now)
+        {
+            zone->erase(it);
+            --nsecCount;
+            return std::nullopt;
+        }
+        return Nsec{it->first, it->second.next, it->second.types};
+    };
+
+    auto nsec = lookup(wire);
+    if (!nsec)
+    {
+        return std::nullopt;
+    }
+    if (nsec->owner == wire)
+    {
+        if (hasType(nsec->types, type) || hasType(nsec->types, DNSRecordType::CNAME) ||
+            (type != DNSRecordType::DS && isDelegation(nsec->types)))
+        {
+            return std::nullopt;
+        }
+        ++synthesized;
+        return DNSResponseCode::NOERROR;
+    }
+    if (!nsec->covers(wire) || (isDelegation(nsec->types) && isWithin(wire, nsec->owner)))
+    {
+        return std::nullopt;
+    }
+    if (isWithin(nsec->next, wire))
+    {
+        ++synthesized;
+        return DNSResponseCode::NOERROR; // empty non-terminal
+    }
+
+    std::string wildcard = wildcardOf(closestEncloser(*nsec, wire));
+    auto wildcardNsec = lookup(wildcard);
+    if (!wildcardNsec || wildcardNsec->owner == wildcard || !wildcardNsec->covers(wildcard))
+    {
+        return std::nullopt;
+    }
+    ++synthesized;
+    return DNSResponseCode::NXDOMAIN;
+}
+
+std::vector<DNSSECValidator::Status> DNSSECValidator::validate(const std::vector<Question> &questions,
+                                                               std::vector<DNSQuery::Response> &responses,
+                                                               const Fetch &fetch)
+{
+    struct Item
+    {
+        std::string name;
+        std::vector<RRset> answers;
+        std::vector<RRset> authority;
+        bool malformed = false;
+    };
+    std::vector<Item> items(responses.size());
+    std::vector<Status> statuses(responses.size(), Status::Insecure);
+
+    std::vector<std::string> signers;
+    for (size_t i = 0; i < responses.size(); ++i)
+    {
+        const auto &response = responses[i];
+        if (response.rcode != DNSResponseCode::NOERROR && response.rcode != DNSResponseCode::NXDOMAIN)
+            continue;
+        try
+        {
+            items[i].name = wireName(questions[i].first);
+            items[i].answers = group(response.answers);
+            items[i].authority = group(response.authority);
+        }
+        catch (const std::exception &)
+        {
+            items[i].malformed = true;
+            continue;
+        }
+        for (const auto *sets : {&items[i].answers, &items[i].authority})
+        {
+            for (const auto &set : *sets)
+            {
+                for (const auto &signature : set.signatures)
+                {
+                    signers.push_back(signature.signer);
+                }
+            }
+        }
+    }
+    std::sort(signers.begin(), signers.end());
+    signers.erase(std::unique(signers.begin(), signers.end()), signers.end());
+    resolveZones(signers, fetch);
+
+    // Every signature of the batch is checked in one go; the zone states
+    // held here keep their keys alive until then
+    std::unordered_map<std::string, std::optional<ZoneState>> states;
+    for (const auto &signer : signers)
+    {
+        states[signer] = stateOf(signer);
+    }
+    std::vector<Check> checks;
+    for (auto &item : items)
+    {
+        for (auto *sets : {&item.answers, &item.authority})
+        {
+            for (auto &set : *sets)
+            {
+                for (const auto &signature : set.signatures)
+                {
+                    const auto &state = states[signature.signer];
+                    if (state && state->kind == ZoneState::Kind::Secure)
+                    {
+                        addChecks(set, signature.signer, *state->keys, checks);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    runChecks(checks);
+
+    auto signerState = [&](const RRset &set) -> std::optional<ZoneState> {
+        for (const auto &signature : set.signatures)
+        {
+            const auto &state = states[signature.signer];
+            if (state)
+                return state;
+        }
+        return std::nullopt;
+    };
+    // An unsigned or unverified set: fine in an unsigned zone, bogus in a signed one
+    auto unverified = [&](const RRset &set) {
+        auto state = signerState(set);
+        if (state && state->kind == ZoneState::Kind::Insecure)
+            return Status::Insecure;
+        if (!set.signatures.empty())
+            return Status::Bogus;
+        return zoneStatus(set.owner, fetch) == Status::Insecure ? Status::Insecure : Status::Bogus;
+    };
+    auto combine = [](Status a, Status b) {
+        if (a == Status::Bogus || b == Status::Bogus)
+            return Status::Bogus;
+        return a == Status::Insecure || b == Status::Insecure ? Status::Insecure : Status::Secure;
+    };
+
+    for (size_t i = 0; i < responses.size(); ++i)
+    {
+        auto &response = responses[i];
+        Item &item = items[i];
+        if (response.rcode != DNSResponseCode::NOERROR && response.rcode != DNSResponseCode::NXDOMAIN)
+            continue;
+        if (item.malformed)
+        {
+            statuses[i] = Status::Bogus;
+            continue;
+        }
+
+        DNSRecordType type = questions[i].second;
+        Status status = Status::Secure;
+        bool answered = false;
+        std::string denied = item.name; // where a CNAME chain ends
+
+        for (const auto &set : item.answers)
+        {
+            answered = answered || set.type == type || type == DNSRecordType::CNAME;
+            if (set.type == DNSRecordType::CNAME && set.owner == denied && set.rdata.size() == 1)
+            {
+                denied = set.rdata[0];
+            }
+
+            if (!set.verified)
+            {
+                // CNAMEs synthesized from a verified DNAME carry no signature
+                bool synthesized = set.type == DNSRecordType::CNAME &&
+                                   std::any_of(item.answers.begin(), item.answers.end(), [&](const RRset &dname) {
+                                       return dname.type == static_cast<DNSRecordType>(39) && dname.verified &&
+                                              isWithin(set.owner, dname.owner) && set.owner != dname.owner;
+                                   });
+                if (!synthesized)
+                    status = combine(status, unverified(set));
+                continue;
+            }
+
+            // Expanded from a wildcard: the name itself must be proven absent
+            if (set.labels < labelCount(set.owner))
+            {
+                if (covering(verifiedNsecs(item.authority), set.owner))
+                    continue;
+                std::string zone = set.signatures.empty() ? ROOT : set.signatures.front().signer;
+                Nsec3Chain chain(item.authority, zone, digests);
+                if (!chain.empty() && chain.unusable())
+                    status = combine(status, Status::Insecure); // proves nothing, as for denials
+                else if (chain.empty() || !chain.cover(suffix(set.owner, set.labels + 1)))
+                    status = Status::Bogus;
+            }
+        }
+
+        bool negative = response.rcode == DNSResponseCode::NXDOMAIN || !answered;
+        if (negative && status != Status::Bogus)
+        {
+            // The proof comes from the zone holding the denied name
+            std::string zone;
+            for (const auto &set : item.authority)
+            {
+                if (!set.signatures.empty() && (set.type == DNSRecordType::SOA || set.type == DNSRecordType::NSEC ||
+                                                set.type == DNSRecordType::NSEC3))
+                {
+                    zone = set.signatures.front().signer;
+                    break;
+                }
+            }
+
+            Status proof = Status::Bogus;
+            if (zone.empty() || !isWithin(denied, zone))
+            {
+                proof = zoneStatus(denied, fetch) == Status::Insecure ? Status::Insecure : Status::Bogus;
+            }
+            else if (states[zone] && states[zone]->kind == ZoneState::Kind::Insecure)
+            {
+                proof = Status::Insecure;
+            }
+            else if (states[zone] && states[zone]->kind == ZoneState::Kind::Secure)
+            {
+                bool unverifiedProof = std::any_of(item.authority.begin(), item.authority.end(), [](const RRset &set) {
+                    return !set.verified && (set.type == DNSRecordType::NSEC || set.type == DNSRecordType::NSEC3 ||
+                                             set.type == DNSRecordType::SOA);
+                });
+                auto nsecs = verifiedNsecs(item.authority);
+                Nsec3Chain chain(item.authority, zone, digests);
+                if (unverifiedProof)
+                {
+                    proof = Status::Bogus;
+                }
+                else if (!nsecs.empty())
+                {
+                    proof = response.rcode == DNSResponseCode::NXDOMAIN ? nsecNxdomain(denied, nsecs)
+                                                                        : nsecNodata(denied, type, nsecs);
+                }
+                else if (!chain.empty())
+                {
+                    proof = response.rcode == DNSResponseCode::NXDOMAIN ? nsec3Nxdomain(denied, chain)
+                                                                        : nsec3Nodata(denied, type, chain);
+                }
+                if (proof == Status::Secure)
+                {
+                    learn(zone, item.authority);
+                }
+            }
+            status = combine(status, proof);
+        }
+        statuses[i] = status;
+    }
+
+    for (size_t i = 0; i < responses.size(); ++i)
+    {
+        if (statuses[i] == Status::Secure)
+            ++secure;
+        else if (statuses[i] == Status::Insecure)
+            ++insecure;
+        else
+            ++bogus;
+
+        if (questions[i].second != DNSRecordType::RRSIG)
+        {
+            auto &answers = responses[i].answers;
+            answers.erase(std::remove_if(answers.begin(), answers.end(),
+                                         [](const CompactRecord &record) { return record.type == DNSRecordType::RRSIG; }),
+                          answers.end());
+        }
+    }
+    return statuses;
+}
+
+DNSSECValidator::Counters DNSSECValidator::getCounters() const
+{
+    Counters counters;
+    counters.verifications = verifications;
+    counters.digests = digests;
+    counters.signatureHits = signatureHits;
+    counters.secure = secure;
+    counters.insecure = insecure;
+    counters.bogus = bogus;
+    counters.synthesized = synthesized;
+    return counters;
+}
+
+void DNSSECValidator::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    zones.clear();
+    signatures.clear();
+    nsecZones.clear();
+    nsecCount = 0;
+}
@@ -0,0 +1,496 @@
+#include "DNSServer.hpp"
+#include "DatagramBatch.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+namespace
+{
+    const size_t UDP_BUFFER_SIZE = 4096;
+    const size_t UDP_DEFAULT_PAYLOAD = 512;
+    const size_t TCP_MAX_MESSAGE = 65535;
+    const size_t UDP_BATCH_SIZE = 64;   // datagrams per recvmmsg/sendmmsg
+    const size_t UDP_DRAIN_BATCHES = 4; // batches read per poll wakeup
+    const int POLL_INTERVAL_MS = 200;
+}
+
+struct DNSServer::TcpSession
+{
+    int fd;
+    std::mutex writeMutex;
+    std::vector<uint8_t> input;
+    bool closed = false;
+    std::chrono::steady_clock::time_point lastActivity;
+
+    explicit TcpSession(int fd) : fd(fd), lastActivity(std::chrono::steady_clock::now()) {}
+    ~TcpSession() { ::close(fd); }
+};
+
+struct alignas(64) DNSServer::Worker
+{
+    size_t index = 0;
+    int udpFd = -1;
+    int tcpFd = -1;
+    std::thread thread;
+    std::vector<std::shared_ptr<TcpSession>> sessions;
+    std::vector<uint8_t> response; // reused for every cache answer
+    DatagramBatch received{UDP_BATCH_SIZE, UDP_BUFFER_SIZE};
+    DatagramBatch replies{UDP_BATCH_SIZE, UDP_BUFFER_SIZE};
+
+    // Written only by the owning worker thread
+    std::atomic<uint64_t> udpQueries{0};
+    std::atomic<uint64_t> tcpQueries{0};
+    std::atomic<uint64_t> cacheAnswers{0};
+    std::atomic<uint64_t> droppedQueries{0};
+
+    ~Worker()
+    {
+        if (udpFd >= 0)
+            ::close(udpFd);
+        if (tcpFd >= 0)
+            ::close(tcpFd);
+    }
+};
+
+DNSServer::DNSServer(DNSResolver &resolver, const Config &config)
+    : resolver(resolver), config(config)
+{
+    if (this->config.workers == 0)
+    {
+        this->config.workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (this->config.resolverThreads == 0)
+    {
+        this->config.resolverThreads = 1;
+    }
+}
+
+DNSServer::~DNSServer()
+{
+    stop();
+}
+
+int DNSServer::openSocket(int type) const
+{
+    sockaddr_storage address{};
+    socklen_t addressLength;
+    auto *ipv4 = reinterpret_cast<sockaddr_in *>(&address);
+    auto *ipv6 = reinterpret_cast<sockaddr_in6 *>(&address);
+
+    if (inet_pton(AF_INET, config.listenAddress.c_str(), &ipv4->sin_addr) == 1)
+    {
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons(config.port);
+        addressLength = sizeof(sockaddr_in);
+    }
+    else if (inet_pton(AF_INET6, config.listenAddress.c_str(), &ipv6->sin6_addr) == 1)
+    {
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port = htons(config.port);
+        addressLength = sizeof(sockaddr_in6);
+    }
+    else
+    {
+        throw std::runtime_error("Invalid listen address: " + config.listenAddress);
+    }
+
+    int fd = ::socket(address.ss_family, type | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to create socket: " + std::string(strerror(errno)));
+    }
+
+    // Each worker binds its own socket; the kernel balances between them
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+        ::bind(fd, reinterpret_cast<sockaddr *>(&address), addressLength) != 0 ||
+        (type == SOCK_STREAM && ::listen(fd, 1024) != 0))
+    {
+        std::string error = strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("Failed to listen on " + config.listenAddress + ":" +
+                                 std::to_string(config.port) + ": " + error);
+    }
+
+    if (type == SOCK_DGRAM)
+    {
+        int bufferSize = 4 * 1024 * 1024;
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    }
+
+    return fd;
+}
+
+void DNSServer::start()
+{
+    if (running.exchange(true))
+    {
+        return;
+    }
+
+    try
+    {
+        for (size_t i = 0; i < config.workers; ++i)
+        {
+            auto worker = std::make_unique<Worker>();
+            worker->index = i;
+            worker->udpFd = openSocket(SOCK_DGRAM);
+            worker->tcpFd = openSocket(SOCK_STREAM);
+            workers.push_back(std::move(worker));
+        }
+    }
+    catch (...)
+    {
+        workers.clear();
+        running = false;
+        throw;
+    }
+
+    for (size_t i = 0; i < config.resolverThreads; ++i)
+    {
+        resolverThreads.emplace_back(&DNSServer::runResolver, this);
+    }
+
+    for (auto &worker : workers)
+    {
+        worker->thread = std::thread(&DNSServer::runWorker, this, std::ref(*worker));
+    }
+}
+
+void DNSServer::stop()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+
+    for (auto &worker : workers)
+    {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+
+    {
+        // Under the lock, so a resolver thread between its check of
+        // `running` and its wait can't miss the wakeup
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pendingCv.notify_all();
+    }
+    for (auto &thread : resolverThreads)
+    {
+        thread.join();
+    }
+    resolverThreads.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending.clear();
+    }
+    workers.clear();
+}
+
+DNSServer::Counters DNSServer::getCounters() const
+{
+    Counters counters;
+    for (const auto &worker : workers)
+    {
+        counters.udpQueries += worker->udpQueries.load(std::memory_order_relaxed);
+        counters.tcpQueries += worker->tcpQueries.load(std::memory_order_relaxed);
+        counters.cacheAnswers += worker->cacheAnswers.load(std::memory_order_relaxed);
+        counters.droppedQueries += worker->droppedQueries.load(std::memory_order_relaxed);
+    }
+    counters.resolvedAnswers = resolvedAnswers.load();
+    counters.failedAnswers = failedAnswers.load();
+    return counters;
+}
+
+void DNSServer::runWorker(Worker &worker)
+{
+    // Keep the worker on one core when there is one worker per core
+    unsigned cores = std::thread::hardware_concurrency();
+    if (cores != 0 && config.workers == cores)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker.index, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    std::vector<pollfd> fds;
+
+    while (running.load(std::memory_order_relaxed))
+    {
+        fds.clear();
+        fds.push_back({worker.udpFd, POLLIN, 0});
+        fds.push_back({worker.tcpFd, POLLIN, 0});
+        for (const auto &session : worker.sessions)
+        {
+            fds.push_back({session->fd, POLLIN, 0});
+        }
+
+        int ready = ::poll(fds.data(), fds.size(), POLL_INTERVAL_MS);
+        if (ready < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        if (ready > 0 && (fds[0].revents & POLLIN))
+        {
+            // One recvmmsg drains a batch, cache answers leave in one sendmmsg
+            for (size_t batch = 0; batch < UDP_DRAIN_BATCHES; ++batch)
+            {
+                size_t count = worker.received.receive(worker.udpFd);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    ReplyTarget target;
+                    target.udpFd = worker.udpFd;
+                    target.peer = worker.received.peer(i);
+                    target.peerLength = worker.received.peerLength(i);
+                    processQuery(worker, worker.received.data(i), worker.received.size(i), std::move(target));
+                }
+                worker.udpQueries.fetch_add(count, std::memory_order_relaxed);
+                worker.replies.flush(worker.udpFd);
+
+                if (count < worker.received.capacity())
+                {
+                    break;
+                }
+            }
+        }
+
+        if (ready > 0 && (fds[1].revents & POLLIN))
+        {
+            int client = ::accept4(worker.tcpFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0)
+            {
+                int one = 1;
+                ::setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                timeval sendTimeout{2, 0};
+                ::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+                worker.sessions.push_back(std::make_shared<TcpSession>(client));
+            }
+        }
+
+        // Sessions are visited in poll order; the vector is rebuilt below
+        auto now = std::chrono::steady_clock::now();
+        std::vector<std::shared_ptr<TcpSession>> active;
+        for (size_t i = 0; i < worker.sessions.size(); ++i)
+        {
+            auto &session = worker.sessions[i];
+            size_t slot = i + 2;
+            if (slot < fds.size() && fds[slot].fd == session->fd && fds[slot].revents != 0)
+            {
+                readTcpSession(worker, session);
+            }
+
+            auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(now - session->lastActivity);
+            if (!session->closed && static_cast<size_t>(idle.count()) < config.tcpIdleTimeout)
+            {
+                active.push_back(session);
+            }
+        }
+        worker.sessions.swap(active);
+    }
+}
+
+void DNSServer::readTcpSession(Worker &worker, const std::shared_ptr<TcpSession> &session)
+{
+    uint8_t chunk[4096];
+    ssize_t received = ::recv(session->fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EINTR))
+    {
+        // Peer went away: the worker drops the session, pending misses
+        // still hold a reference and close the socket when done
+        session->closed = true;
+        ::shutdown(session->fd, SHUT_RD);
+        return;
+    }
+    if (received < 0)
+    {
+        return;
+    }
+
+    session->lastActivity = std::chrono::steady_clock::now();
+    session->input.insert(session->input.end(), chunk, chunk + received);
+
+    // Messages are framed with a two-byte length prefix
+    size_t offset = 0;
+    while (session->input.size() - offset >= 2)
+    {
+        size_t length = (session->input[offset] << 8) | session->input[offset + 1];
+        if (session->input.size() - offset - 2 < length)
+        {
+            break;
+        }
+
+        ReplyTarget target;
+        target.tcp = session;
+        worker.tcpQueries.fetch_add(1, std::memory_order_relaxed);
+        processQuery(worker, session->input.data() + offset + 2, length, std::move(target));
+        offset += 2 + length;
+    }
+    session->input.erase(session->input.begin(), session->input.begin() + offset);
+}
+
+void DNSServer::processQuery(Worker &worker, const uint8_t *data, size_t size, ReplyTarget target)
+{
+    DNSQuery::Question question;
+    if (!DNSQuery::parseQuestion(data, size, question))
+    {
+        worker.droppedQueries.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    size_t maxSize = TCP_MAX_MESSAGE;
+    if (!target.tcp)
+    {
+        maxSize = std::max<size_t>(UDP_DEFAULT_PAYLOAD,
+                                   std::min<size_t>(question.udpPayloadSize, UDP_BUFFER_SIZE));
+    }
+
+    // Standard queries for the IN class only
+    if ((question.flags & 0x7800) != 0 || question.qclass != 1)
+    {
+        reply(worker, target, DNSQuery::buildResponse(data, question, {},
+                                                  DNSResponseCode::NOTIMP, maxSize));
+        return;
+    }
+
+    if (resolver.lookupWire(data, question, maxSize, worker.response))
+    {
+        worker.cacheAnswers.fetch_add(1, std::memory_order_relaxed);
+        reply(worker, target, worker.response);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    if (pending.size() >= config.maxPendingMisses)
+    {
+        lock.unlock();
+        worker.droppedQueries.fetch_add(1, std::memory_order_relaxed);
+        reply(worker, target, DNSQuery::buildResponse(data, question, {},
+                                                  DNSResponseCode::SERVFAIL, maxSize));
+        return;
+    }
+
+    pending.push_back({std::vector<uint8_t>(data, data + question.length),
+                       std::move(question), std::move(target), maxSize});
+    lock.unlock();
+    pendingCv.notify_one();
+}
+
+void DNSServer::runResolver()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(pendingMutex);
+        pendingCv.wait(lock, [this]()
+                       { return !pending.empty() || !running; });
+        if (!running)
+        {
+            return;
+        }
+
+        PendingQuery job = std::move(pending.front());
+        pending.pop_front();
+        lock.unlock();
+
+        // NXDOMAIN and NODATA are relayed with the zone's SOA; anything
+        // else the upstream couldn't answer becomes SERVFAIL
+        std::vector<uint8_t> response;
+        DNSResolver::BatchResult result;
+        try
+        {
+            result = std::move(resolver.resolveRecordsBatch({{job.question.domain, job.question.type}})[0]);
+        }
+        catch (const std::exception &)
+        {
+        }
+        if (result.rcode == DNSResponseCode::NOERROR || result.rcode == DNSResponseCode::NXDOMAIN)
+        {
+            response = DNSQuery::buildResponse(job.query.data(), job.question, result.records, result.rcode,
+                                               job.maxSize, nullptr, result.authority);
+            ++resolvedAnswers;
+        }
+        else
+        {
+            response = DNSQuery::buildResponse(job.query.data(), job.question, {},
+                                               DNSResponseCode::SERVFAIL, job.maxSize);
+            ++failedAnswers;
+        }
+
+        sendReply(job.target, response);
+    }
+}
+
+void DNSServer::reply(Worker &worker, const ReplyTarget &target, const std::vector<uint8_t> &response)
+{
+    if (target.tcp)
+    {
+        sendReply(target, response);
+        return;
+    }
+
+    // UDP answers are queued and flushed once per received batch
+    const auto *peer = reinterpret_cast<const sockaddr *>(&target.peer);
+    if (!worker.replies.add(response.data(), response.size(), peer, target.peerLength))
+    {
+        worker.replies.flush(worker.udpFd);
+        if (!worker.replies.add(response.data(), response.size(), peer, target.peerLength))
+        {
+            sendReply(target, response);
+        }
+    }
+}
+
+void DNSServer::sendReply(const ReplyTarget &target, const std::vector<uint8_t> &response)
+{
+    if (!target.tcp)
+    {
+        ::sendto(target.udpFd, response.data(), response.size(), MSG_DONTWAIT,
+                 reinterpret_cast<const sockaddr *>(&target.peer), target.peerLength);
+        return;
+    }
+
+    uint8_t prefix[2] = {static_cast<uint8_t>(response.size() >> 8),
+                         static_cast<uint8_t>(response.size() & 0xFF)};
+    iovec parts[2] = {{prefix, sizeof(prefix)},
+                      {const_cast<uint8_t *>(response.data()), response.size()}};
+
+    // Responses from resolver threads may interleave with worker replies
+    std::lock_guard<std::mutex> lock(target.tcp->writeMutex);
+    msghdr message{};
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    size_t remaining = sizeof(prefix) + response.size();
+    while (remaining > 0)
+    {
+        ssize_t sent = ::sendmsg(target.tcp->fd, &message, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return;
+        }
+        remaining -= sent;
+
+        // Advance the iovecs past what has been written
+        while (message.msg_iovlen > 0 && static_cast<size_t>(sent) >= message.msg_iov->iov_len)
+        {
+            sent -= message.msg_iov->iov_len;
+            ++message.msg_iov;
+            --message.msg_iovlen;
+        }
+        if (message.msg_iovlen > 0)
+        {
+            message.msg_iov->iov_base = static_cast<uint8_t *>(message.msg_iov->iov_base) + sent;
+            message.msg_iov->iov_len -= sent;
+        }
+    }
+}
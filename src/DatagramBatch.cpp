@@ -0,0 +1,82 @@
+#include "DatagramBatch.hpp"
+#include <cerrno>
+#include <cstring>
+
+DatagramBatch::DatagramBatch(size_t capacity, size_t bufferSize)
+    : slots(capacity), bufferSize(bufferSize), buffers(capacity * bufferSize),
+      peers(capacity), iovecs(capacity), messages(capacity)
+{
+    for (size_t i = 0; i < slots; ++i)
+    {
+        iovecs[i].iov_base = &buffers[i * bufferSize];
+        iovecs[i].iov_len = bufferSize;
+        std::memset(&messages[i], 0, sizeof(mmsghdr));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+size_t DatagramBatch::receive(int fd, int flags)
+{
+    for (size_t i = 0; i < slots; ++i)
+    {
+        iovecs[i].iov_len = bufferSize;
+        messages[i].msg_hdr.msg_name = &peers[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        messages[i].msg_len = 0;
+    }
+
+    int received;
+    do
+    {
+        received = ::recvmmsg(fd, messages.data(), slots, flags, nullptr);
+    } while (received < 0 && errno == EINTR);
+
+    return received > 0 ? static_cast<size_t>(received) : 0;
+}
+
+bool DatagramBatch::add(const uint8_t *data, size_t size, const sockaddr *peer, socklen_t peerLength)
+{
+    if (queued == slots || size > bufferSize)
+    {
+        return false;
+    }
+
+    std::memcpy(&buffers[queued * bufferSize], data, size);
+    iovecs[queued].iov_len = size;
+
+    msghdr &header = messages[queued].msg_hdr;
+    if (peer)
+    {
+        std::memcpy(&peers[queued], peer, peerLength);
+        header.msg_name = &peers[queued];
+        header.msg_namelen = peerLength;
+    }
+    else
+    {
+        header.msg_name = nullptr;
+        header.msg_namelen = 0;
+    }
+
+    ++queued;
+    return true;
+}
+
+size_t DatagramBatch::flush(int fd)
+{
+    size_t sent = 0;
+    while (sent < queued)
+    {
+        int result = ::sendmmsg(fd, &messages[sent], queued - sent, MSG_DONTWAIT);
+        if (result <= 0)
+        {
+            if (result < 0 && errno == EINTR)
+                continue;
+            break; // socket buffer full: drop the rest as UDP would
+        }
+        sent += result;
+    }
+
+    queued = 0;
+    return sent;
+}
@@ -0,0 +1,481 @@
+#include "DomainName.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+    const size_t MAX_NAME_LENGTH = DomainName::MAX_WIRE_SIZE - 2; // without trailing dot
+
+    // Copies `length` bytes of `name` to `out`, lowercased when canonical,
+    // and records the position of every dot. Returns false if a canonical
+    // name holds a byte outside '!'..'~'.
+    using ScanKernel = bool (*)(const char *name, size_t length, uint8_t *out, bool canonical,
+                                uint8_t *dots, size_t &dotCount);
+    using FoldKernel = void (*)(const uint8_t *in, size_t length, uint8_t *out);
+
+    inline uint8_t lower(uint8_t c)
+    {
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    inline void collectDots(uint32_t mask, size_t base, uint8_t *dots, size_t &dotCount)
+    {
+        while (mask != 0)
+        {
+            dots[dotCount++] = static_cast<uint8_t>(base + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+    bool scanScalar(const char *name, size_t length, uint8_t *out, bool canonical,
+                    uint8_t *dots, size_t &dotCount)
+    {
+        bool valid = true;
+        for (size_t i = 0; i < length; ++i)
+        {
+            uint8_t c = static_cast<uint8_t>(name[i]);
+            if (c == '.')
+            {
+                dots[dotCount++] = static_cast<uint8_t>(i);
+            }
+            valid &= c > ' ' && c < 0x7F;
+            out[i] = canonical ? lower(c) : c;
+        }
+        return valid || !canonical;
+    }
+#endif
+
+    void foldScalar(const uint8_t *in, size_t length, uint8_t *out)
+    {
+        for (size_t i = 0; i < length; ++i)
+        {
+            out[i] = lower(in[i]);
+        }
+    }
+
+#if defined(__x86_64__)
+    bool scanSSE2(const char *name, size_t length, uint8_t *out, bool canonical,
+                  uint8_t *dots, size_t &dotCount)
+    {
+        const __m128i dot = _mm_set1_epi8('.');
+        const __m128i beforeA = _mm_set1_epi8('A' - 1);
+        const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+        const __m128i caseBit = _mm_set1_epi8(0x20);
+        const __m128i lastInvalid = _mm_set1_epi8(' ');
+        const __m128i del = _mm_set1_epi8(0x7F);
+
+        uint32_t invalid = 0;
+        for (size_t i = 0; i < length; i += 16)
+        {
+            // The last partial chunk goes through a zeroed copy, masked below
+            size_t count = std::min<size_t>(16, length - i);
+            alignas(16) uint8_t tail[16] = {};
+            const void *source = name + i;
+            if (count < 16)
+            {
+                std::memcpy(tail, source, count);
+                source = tail;
+            }
+            uint32_t live = count < 16 ? (1u << count) - 1 : 0xFFFF;
+
+            // Signed compares: bytes from 0x80 up count as below '!'
+            __m128i c = _mm_loadu_si128(static_cast<const __m128i *>(source));
+            __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, beforeA), _mm_cmplt_epi8(c, afterZ));
+            if (canonical)
+            {
+                c = _mm_or_si128(c, _mm_and_si128(upper, caseBit));
+            }
+            __m128i valid = _mm_and_si128(_mm_cmpgt_epi8(c, lastInvalid), _mm_cmplt_epi8(c, del));
+            invalid |= ~static_cast<uint32_t>(_mm_movemask_epi8(valid)) & live;
+            collectDots(_mm_movemask_epi8(_mm_cmpeq_epi8(c, dot)) & live, i, dots, dotCount);
+
+            if (count < 16)
+            {
+                _mm_store_si128(reinterpret_cast<__m128i *>(tail), c);
+                std::memcpy(out + i, tail, count);
+            }
+            else
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), c);
+            }
+        }
+        return invalid == 0 || !canonical;
+    }
+
+    __attribute__((target("avx2"))) bool scanAVX2(const char *name, size_t length, uint8_t *out,
+                                                  bool canonical, uint8_t *dots, size_t &dotCount)
+    {
+        const __m256i dot = _mm256_set1_epi8('.');
+        const __m256i beforeA = _mm256_set1_epi8('A' - 1);
+        const __m256i afterZ = _mm256_set1_epi8('Z' + 1);
+        const __m256i caseBit = _mm256_set1_epi8(0x20);
+        const __m256i lastInvalid = _mm256_set1_epi8(' ');
+        const __m256i del = _mm256_set1_epi8(0x7F);
+
+        uint32_t invalid = 0;
+        for (size_t i = 0; i < length; i += 32)
+        {
+            size_t count = std::min<size_t>(32, length - i);
+            alignas(32) uint8_t tail[32] = {};
+            const void *source = name + i;
+            if (count < 32)
+            {
+                std::memcpy(tail, source, count);
+                source = tail;
+            }
+            uint32_t live = count < 32 ? (1u << count) - 1 : 0xFFFFFFFF;
+
+            __m256i c = _mm256_loadu_si256(static_cast<const __m256i *>(source));
+            __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, beforeA), _mm256_cmpgt_epi8(afterZ, c));
+            if (canonical)
+            {
+                c = _mm256_or_si256(c, _mm256_and_si256(upper, caseBit));
+            }
+            __m256i valid = _mm256_and_si256(_mm256_cmpgt_epi8(c, lastInvalid), _mm256_cmpgt_epi8(del, c));
+            invalid |= ~static_cast<uint32_t>(_mm256_movemask_epi8(valid)) & live;
+            collectDots(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, dot))) & live,
+                        i, dots, dotCount);
+
+            if (count < 32)
+            {
+                _mm256_store_si256(reinterpret_cast<__m256i *>(tail), c);
+                std::memcpy(out + i, tail, count);
+            }
+            else
+            {
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), c);
+            }
+        }
+        return invalid == 0 || !canonical;
+    }
+
+    void foldSSE2(const uint8_t *in, size_t length, uint8_t *out)
+    {
+        const __m128i beforeA = _mm_set1_epi8('A' - 1);
+        const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+        const __m128i caseBit = _mm_set1_epi8(0x20);
+
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, beforeA), _mm_cmplt_epi8(c, afterZ));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_or_si128(c, _mm_and_si128(upper, caseBit)));
+        }
+        foldScalar(in + i, length - i, out + i);
+    }
+
+    __attribute__((target("avx2"))) void foldAVX2(const uint8_t *in, size_t length, uint8_t *out)
+    {
+        const __m256i beforeA = _mm256_set1_epi8('A' - 1);
+        const __m256i afterZ = _mm256_set1_epi8('Z' + 1);
+        const __m256i caseBit = _mm256_set1_epi8(0x20);
+
+        size_t i = 0;
+        for (; i + 32 <= length; i += 32)
+        {
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+            __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, beforeA), _mm256_cmpgt_epi8(afterZ, c));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                                _mm256_or_si256(c, _mm256_and_si256(upper, caseBit)));
+        }
+        foldSSE2(in + i, length - i, out + i);
+    }
+#elif defined(__aarch64__)
+    // NEON has no movemask: weight each lane by its bit and add across
+    inline uint32_t laneMask(uint8x16_t lanes)
+    {
+        static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        uint8x16_t bits = vandq_u8(lanes, vld1q_u8(weights));
+        return vaddv_u8(vget_low_u8(bits)) | (static_cast<uint32_t>(vaddv_u8(vget_high_u8(bits))) << 8);
+    }
+
+    bool scanNEON(const char *name, size_t length, uint8_t *out, bool canonical,
+                  uint8_t *dots, size_t &dotCount)
+    {
+        const uint8x16_t dot = vdupq_n_u8('.');
+        const uint8x16_t letters = vdupq_n_u8('Z' - 'A');
+        const uint8x16_t upperA = vdupq_n_u8('A');
+        const uint8x16_t caseBit = vdupq_n_u8(0x20);
+        const uint8x16_t firstValid = vdupq_n_u8('!');
+        const uint8x16_t lastValid = vdupq_n_u8('~');
+
+        uint32_t invalid = 0;
+        for (size_t i = 0; i < length; i += 16)
+        {
+            size_t count = std::min<size_t>(16, length - i);
+            alignas(16) uint8_t tail[16] = {};
+            const uint8_t *source = reinterpret_cast<const uint8_t *>(name) + i;
+            if (count < 16)
+            {
+                std::memcpy(tail, source, count);
+                source = tail;
+            }
+            uint32_t live = count < 16 ? (1u << count) - 1 : 0xFFFF;
+
+            uint8x16_t c = vld1q_u8(source);
+            if (canonical)
+            {
+                uint8x16_t upper = vcleq_u8(vsubq_u8(c, upperA), letters);
+                c = vorrq_u8(c, vandq_u8(upper, caseBit));
+            }
+            invalid |= laneMask(vorrq_u8(vcltq_u8(c, firstValid), vcgtq_u8(c, lastValid))) & live;
+            collectDots(laneMask(vceqq_u8(c, dot)) & live, i, dots, dotCount);
+
+            if (count < 16)
+            {
+                vst1q_u8(tail, c);
+                std::memcpy(out + i, tail, count);
+            }
+            else
+            {
+                vst1q_u8(out + i, c);
+            }
+        }
+        return invalid == 0 || !canonical;
+    }
+
+    void foldNEON(const uint8_t *in, size_t length, uint8_t *out)
+    {
+        const uint8x16_t letters = vdupq_n_u8('Z' - 'A');
+        const uint8x16_t upperA = vdupq_n_u8('A');
+        const uint8x16_t caseBit = vdupq_n_u8(0x20);
+
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            uint8x16_t c = vld1q_u8(in + i);
+            uint8x16_t upper = vcleq_u8(vsubq_u8(c, upperA), letters);
+            vst1q_u8(out + i, vorrq_u8(c, vandq_u8(upper, caseBit)));
+        }
+        foldScalar(in + i, length - i, out + i);
+    }
+#endif
+
+    struct Kernels
+    {
+        ScanKernel scan;
+        FoldKernel fold;
+        const char *name;
+    };
+
+    Kernels selectKernels()
+    {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return {scanAVX2, foldAVX2, "avx2"};
+        }
+        return {scanSSE2, foldSSE2, "sse2"};
+#elif defined(__aarch64__)
+        return {scanNEON, foldNEON, "neon"};
+#else
+        return {scanScalar, foldScalar, "scalar"};
+#endif
+    }
+
+    const Kernels &kernels()
+    {
+        static const Kernels selected = selectKernels();
+        return selected;
+    }
+
+    [[noreturn]] void invalidName(const char *name, size_t length, const char *reason)
+    {
+        throw std::runtime_error("Invalid domain name " + std::string(name, length) + ": " + reason);
+    }
+
+    inline uint64_t mix(uint64_t value)
+    {
+        value *= 0xbf58476d1ce4e5b9ULL;
+        value ^= value >> 31;
+        return value * 0x94d049bb133111ebULL;
+    }
+}
+
+size_t DomainName::encode(const char *name, size_t length, uint8_t *out, bool canonical)
+{
+    size_t textLength = length;
+    if (textLength > 0 && name[textLength - 1] == '.')
+    {
+        --textLength;
+    }
+    if (textLength > MAX_NAME_LENGTH)
+    {
+        invalidName(name, length, "name too long");
+    }
+    if (textLength == 0)
+    {
+        out[0] = 0;
+        return 1;
+    }
+
+    // Label bytes land one past their text position, so each dot's slot
+    // becomes the length byte of the label after it
+    uint8_t dots[MAX_NAME_LENGTH];
+    size_t dotCount = 0;
+    if (!kernels().scan(name, textLength, out + 1, canonical, dots, dotCount))
+    {
+        invalidName(name, length, "invalid character");
+    }
+
+    size_t start = 0;
+    for (size_t i = 0; i <= dotCount; ++i)
+    {
+        size_t end = i < dotCount ? dots[i] : textLength;
+        size_t label = end - start;
+        if (label == 0 || label > 63)
+        {
+            invalidName(name, length, label == 0 ? "empty label" : "label too long");
+        }
+        out[start] = static_cast<uint8_t>(label);
+        start = end + 1;
+    }
+
+    out[textLength + 1] = 0;
+    return textLength + 2;
+}
+
+std::vector<uint8_t> DomainName::encode(const std::string &name, bool canonical)
+{
+    uint8_t buffer[MAX_WIRE_SIZE];
+    size_t length = encode(name.data(), name.size(), buffer, canonical);
+    return std::vector<uint8_t>(buffer, buffer + length);
+}
+
+std::string DomainName::decode(const uint8_t *message, size_t size, size_t &offset)
+{
+    std::string name;
+    size_t position = offset;
+    bool jumped = false;
+    size_t jumps = 0;
+
+    while (true)
+    {
+        if (position >= size)
+        {
+            throw std::runtime_error("Truncated domain name");
+        }
+
+        uint8_t length = message[position];
+        if ((length & 0xC0) == 0xC0)
+        {
+            // Pointers go backwards and are few; anything else is a loop
+            if (position + 1 >= size)
+            {
+                throw std::runtime_error("Truncated domain name");
+            }
+            size_t target = ((length & 0x3F) << 8) | message[position + 1];
+            if (target >= position || ++jumps > MAX_WIRE_SIZE / 2)
+            {
+                throw std::runtime_error("Invalid compression pointer");
+            }
+            if (!jumped)
+            {
+                offset = position + 2;
+                jumped = true;
+            }
+            position = target;
+            continue;
+        }
+        if ((length & 0xC0) != 0)
+        {
+            throw std::runtime_error("Unsupported label type");
+        }
+
+        if (length == 0)
+        {
+            if (!jumped)
+            {
+                offset = position + 1;
+            }
+            return name;
+        }
+
+        if (position + 1 + length > size || name.size() + 1 + length > MAX_NAME_LENGTH)
+        {
+            throw std::runtime_error("Truncated or overlong domain name");
+        }
+        if (!name.empty())
+        {
+            name += '.';
+        }
+        name.append(reinterpret_cast<const char *>(message + position + 1), length);
+        position += 1 + length;
+    }
+}
+
+void DomainName::foldCase(const uint8_t *in, size_t length, uint8_t *out)
+{
+    kernels().fold(in, length, out);
+}
+
+uint64_t DomainName::hash(const uint8_t *data, size_t length)
+{
+    // Eight bytes per step; names are short, so this beats a bytewise hash
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ mix(word)) * 0x9e3779b97f4a7c15ULL;
+    }
+    if (i < length)
+    {
+        uint64_t word = 0;
+        std::memcpy(&word, data + i, length - i);
+        hash = (hash ^ mix(word)) * 0x9e3779b97f4a7c15ULL;
+    }
+    return hash ^ (hash >> 32);
+}
+
+size_t DomainName::reverse(const in_addr &address, char *out)
+{
+    static const char suffix[] = "in-addr.arpa";
+    const uint8_t *octets = reinterpret_cast<const uint8_t *>(&address);
+    char *position = out;
+    for (int i = 3; i >= 0; --i)
+    {
+        uint8_t octet = octets[i];
+        if (octet >= 100)
+            *position++ = static_cast<char>('0' + octet / 100);
+        if (octet >= 10)
+            *position++ = static_cast<char>('0' + octet / 10 % 10);
+        *position++ = static_cast<char>('0' + octet % 10);
+        *position++ = '.';
+    }
+    std::memcpy(position, suffix, sizeof(suffix) - 1);
+    return position - out + sizeof(suffix) - 1;
+}
+
+size_t DomainName::reverse(const in6_addr &address, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    static const char suffix[] = "ip6.arpa";
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&address);
+    char *position = out;
+    for (int i = 15; i >= 0; --i)
+    {
+        position[0] = digits[bytes[i] & 0x0F];
+        position[1] = '.';
+        position[2] = digits[bytes[i] >> 4];
+        position[3] = '.';
+        position += 4;
+    }
+    std::memcpy(position, suffix, sizeof(suffix) - 1);
+    return 64 + sizeof(suffix) - 1;
+}
+
+const char *DomainName::implementation()
+{
+    return kernels().name;
+}
@@ -0,0 +1,71 @@
+#include "FrequencySketch.hpp"
+#include <algorithm>
+
+namespace
+{
+    const uint64_t SEEDS[4] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                               0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+
+    // Independent counter positions from one key hash
+    uint64_t counterIndex(uint64_t hash, unsigned row, uint64_t mask)
+    {
+        uint64_t mixed = (hash + SEEDS[row]) * 0x9e3779b97f4a7c15ULL;
+        mixed ^= mixed >> 32;
+        return mixed & mask;
+    }
+}
+
+FrequencySketch::FrequencySketch(size_t capacity)
+{
+    size_t words = 64;
+    while (words < capacity)
+    {
+        words <<= 1;
+    }
+    table.assign(words, 0);
+    counterMask = words * 16 - 1;
+    sampleSize = std::max<size_t>(10 * capacity, 160);
+}
+
+void FrequencySketch::increment(uint64_t hash)
+{
+    bool added = false;
+    for (unsigned row = 0; row < 4; ++row)
+    {
+        uint64_t index = counterIndex(hash, row, counterMask);
+        uint64_t &word = table[index >> 4];
+        unsigned shift = (index & 15) * 4;
+        if (((word >> shift) & 0xF) < 15)
+        {
+            word += uint64_t(1) << shift;
+            added = true;
+        }
+    }
+
+    if (added && ++additions >= sampleSize)
+    {
+        age();
+    }
+}
+
+uint8_t FrequencySketch::frequency(uint64_t hash) const
+{
+    uint8_t estimate = 15;
+    for (unsigned row = 0; row < 4; ++row)
+    {
+        uint64_t index = counterIndex(hash, row, counterMask);
+        estimate = std::min<uint8_t>(estimate, (table[index >> 4] >> ((index & 15) * 4)) & 0xF);
+    }
+    return estimate;
+}
+
+void FrequencySketch::age()
+{
+    // Halve every counter at once: shift the word, drop the bit that
+    // crossed into the neighbouring nibble
+    for (auto &word : table)
+    {
+        word = (word >> 1) & 0x7777777777777777ULL;
+    }
+    additions /= 2;
+}
@@ -0,0 +1,413 @@
+#include "HTTPSConnection.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    const char CRLF[] = "\r\n";
+    const char HEADER_END[] = "\r\n\r\n";
+
+    // RFC 4648 base64url without padding, as RFC 8484 GET requests use
+    std::string base64url(const std::vector<uint8_t> &data)
+    {
+        static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+        std::string encoded;
+        encoded.reserve((data.size() * 4 + 2) / 3);
+        for (size_t i = 0; i < data.size(); i += 3)
+        {
+            uint32_t chunk = data[i] << 16;
+            if (i + 1 < data.size())
+                chunk |= data[i + 1] << 8;
+            if (i + 2 < data.size())
+                chunk |= data[i + 2];
+
+            encoded.push_back(alphabet[(chunk >> 18) & 0x3f]);
+            encoded.push_back(alphabet[(chunk >> 12) & 0x3f]);
+            if (i + 1 < data.size())
+                encoded.push_back(alphabet[(chunk >> 6) & 0x3f]);
+            if (i + 2 < data.size())
+                encoded.push_back(alphabet[chunk & 0x3f]);
+        }
+        return encoded;
+    }
+
+    const uint8_t *find(const uint8_t *begin, const uint8_t *end, const char *pattern)
+    {
+        size_t length = std::strlen(pattern);
+        const uint8_t *found = std::search(begin, end, pattern, pattern + length);
+        return found == end ? nullptr : found;
+    }
+
+    std::string lowercase(std::string text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(),
+                       [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
+        return text;
+    }
+
+    std::string trim(const std::string &text)
+    {
+        size_t first = text.find_first_not_of(" \t");
+        size_t last = text.find_last_not_of(" \t");
+        return first == std::string::npos ? "" : text.substr(first, last - first + 1);
+    }
+
+    // Seconds in a header value, saturating; nullopt when not a number
+    std::optional<uint32_t> seconds(const std::string &text)
+    {
+        if (text.empty() || !std::all_of(text.begin(), text.end(), [](unsigned char c)
+                                          { return std::isdigit(c) != 0; }))
+        {
+            return std::nullopt;
+        }
+        return text.size() > 9 ? UINT32_MAX : static_cast<uint32_t>(std::stoul(text));
+    }
+}
+
+HTTPSConnection::HTTPSConnection(const std::string &host, uint16_t port, const std::string &serverName,
+                                 const std::string &path, DoHMethod method, std::shared_ptr<TLSContext> context,
+                                 std::chrono::milliseconds idleTimeout)
+    : stream(host, port, serverName, std::move(context), idleTimeout, "http/1.1"), path(path), method(method)
+{
+    authority = stream.serverName().empty() ? host : stream.serverName();
+    if (authority.find(':') != std::string::npos)
+    {
+        authority = "[" + authority + "]";
+    }
+    if (port != 443)
+    {
+        authority += ":" + std::to_string(port);
+    }
+}
+
+bool HTTPSConnection::isValid() const
+{
+    return stream.isValid();
+}
+
+void HTTPSConnection::close()
+{
+    stream.close();
+    inbox.clear();
+    inboxStart = 0;
+}
+
+void HTTPSConnection::appendRequest(std::vector<uint8_t> &requests,
+                                    const std::pair<std::string, DNSRecordType> &question) const
+{
+    auto message = DNSQuery::buildQuery(question.first, question.second, 0, dnssecOk);
+
+    std::string head;
+    if (method == DoHMethod::GET)
+    {
+        head = "GET " + path + (path.find('?') == std::string::npos ? "?dns=" : "&dns=") + base64url(message) +
+               " HTTP/1.1\r\nHost: " + authority + "\r\nAccept: application/dns-message\r\n\r\n";
+        requests.insert(requests.end(), head.begin(), head.end());
+        return;
+    }
+
+    head = "POST " + path + " HTTP/1.1\r\nHost: " + authority +
+           "\r\nAccept: application/dns-message\r\nContent-Type: application/dns-message\r\nContent-Length: " +
+           std::to_string(message.size()) + "\r\n\r\n";
+    requests.insert(requests.end(), head.begin(), head.end());
+    requests.insert(requests.end(), message.begin(), message.end());
+}
+
+HTTPSConnection::Parse HTTPSConnection::parse(const uint8_t *data, size_t size, Reply &reply, size_t &consumed)
+{
+    const uint8_t *end = data + size;
+    const uint8_t *headerEnd = find(data, end, HEADER_END);
+    if (!headerEnd)
+    {
+        return Parse::Incomplete;
+    }
+
+    std::string head(data, headerEnd);
+    if (head.compare(0, 7, "HTTP/1.") != 0 || head.size() < 12)
+    {
+        return Parse::Malformed;
+    }
+    reply = Reply();
+    reply.keepAlive = head[7] == '1';
+    reply.status = std::atoi(head.c_str() + 9);
+
+    std::optional<size_t> contentLength;
+    bool chunked = false;
+    size_t lineStart = head.find(CRLF);
+    while (lineStart != std::string::npos)
+    {
+        lineStart += 2;
+        size_t lineEnd = head.find(CRLF, lineStart);
+        std::string line = head.substr(lineStart, lineEnd == std::string::npos ? std::string::npos : lineEnd - lineStart);
+        lineStart = lineEnd;
+
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string name = lowercase(trim(line.substr(0, colon)));
+        std::string value = trim(line.substr(colon + 1));
+
+        if (name == "content-length")
+        {
+            auto length = seconds(value);
+            if (!length)
+                return Parse::Malformed;
+            contentLength = *length;
+        }
+        else if (name == "transfer-encoding")
+        {
+            chunked = lowercase(value).find("chunked") != std::string::npos;
+        }
+        else if (name == "connection")
+        {
+            std::string token = lowercase(value);
+            if (token.find("close") != std::string::npos)
+                reply.keepAlive = false;
+            else if (token.find("keep-alive") != std::string::npos)
+                reply.keepAlive = true;
+        }
+        else if (name == "age")
+        {
+            reply.age = seconds(value).value_or(0);
+        }
+        else if (name == "cache-control")
+        {
+            std::string directives = lowercase(value);
+            size_t start = 0;
+            while (start <= directives.size())
+            {
+                size_t comma = std::min(directives.find(',', start), directives.size());
+                std::string directive = trim(directives.substr(start, comma - start));
+                start = comma + 1;
+
+                if (directive == "no-cache" || directive == "no-store")
+                    reply.maxAge = 0;
+                else if (directive.compare(0, 8, "max-age=") == 0 && (!reply.maxAge || *reply.maxAge != 0))
+                    reply.maxAge = seconds(directive.substr(8));
+            }
+        }
+    }
+
+    const uint8_t *body = headerEnd + 4;
+    if (chunked)
+    {
+        const uint8_t *cursor = body;
+        while (true)
+        {
+            const uint8_t *lineEnd = find(cursor, end, CRLF);
+            if (!lineEnd)
+                return Parse::Incomplete;
+
+            // Chunk extensions after ';' are ignored
+            std::string line(cursor, lineEnd);
+            size_t length = std::strtoul(line.c_str(), nullptr, 16);
+            cursor = lineEnd + 2;
+            if (length == 0)
+            {
+                // Optional trailer fields, then an empty line
+                if (static_cast<size_t>(end - cursor) < 2)
+                    return Parse::Incomplete;
+                if (std::memcmp(cursor, CRLF, 2) != 0)
+                {
+                    const uint8_t *trailerEnd = find(cursor, end, HEADER_END);
+                    if (!trailerEnd)
+                        return Parse::Incomplete;
+                    cursor = trailerEnd + 2;
+                }
+                consumed = cursor + 2 - data;
+                break;
+            }
+            if (static_cast<size_t>(end - cursor) < length + 2)
+                return Parse::Incomplete;
+            reply.body.insert(reply.body.end(), cursor, cursor + length);
+            cursor += length + 2;
+        }
+    }
+    else
+    {
+        // Without a length only bodiless responses can be delimited
+        bool bodiless = reply.status < 200 || reply.status == 204 || reply.status == 304;
+        if (!contentLength && !bodiless)
+        {
+            return Parse::Malformed;
+        }
+        size_t length = contentLength.value_or(0);
+        if (static_cast<size_t>(end - body) < length)
+        {
+            return Parse::Incomplete;
+        }
+        reply.body.assign(body, body + length);
+        consumed = body + length - data;
+    }
+
+    if (reply.status != 200)
+    {
+        reply.body.clear();
+    }
+    return Parse::Complete;
+}
+
+int HTTPSConnection::readReply(Reply &reply, TLSStream::Clock::time_point deadline)
+{
+    while (true)
+    {
+        size_t consumed = 0;
+        switch (parse(inbox.data() + inboxStart, inbox.size() - inboxStart, reply, consumed))
+        {
+        case Parse::Complete:
+            inboxStart += consumed;
+            return 1;
+        case Parse::Malformed:
+            return -1;
+        case Parse::Incomplete:
+            break;
+        }
+
+        // Drop the parsed bytes once per read rather than once per response
+        inbox.erase(inbox.begin(), inbox.begin() + inboxStart);
+        inboxStart = 0;
+
+        int read = stream.read(inbox, deadline);
+        if (read <= 0)
+        {
+            return read;
+        }
+    }
+}
+
+std::vector<HTTPSConnection::Reply> HTTPSConnection::exchangeRaw(
+    const std::vector<std::pair<std::string, DNSRecordType>> &questions)
+{
+    std::vector<Reply> replies(questions.size());
+    auto deadline = TLSStream::Clock::now() + responseTimeout;
+
+    for (size_t first = 0; first < questions.size(); first += WINDOW)
+    {
+        size_t last = std::min(questions.size(), first + WINDOW);
+        size_t next = first; // first request not answered yet
+
+        // Servers may close a keep-alive connection at any point, answering
+        // only part of the pipeline; the rest is resent on a new one. Only
+        // a connection that fails without answering anything is given up.
+        for (bool retried = false;;)
+        {
+            if (stream.open(deadline))
+            {
+                inbox.clear();
+                inboxStart = 0;
+            }
+
+            std::vector<uint8_t> requests;
+            for (size_t i = next; i < last; ++i)
+            {
+                appendRequest(requests, questions[i]);
+            }
+
+            size_t before = next;
+            bool keepAlive = true;
+            int status = stream.write(requests, deadline);
+            while (status > 0 && keepAlive && next < last)
+            {
+                status = readReply(replies[next], deadline);
+                if (status > 0)
+                {
+                    keepAlive = replies[next].keepAlive;
+                    ++next;
+                }
+            }
+
+            if (status > 0 && keepAlive)
+            {
+                stream.markUsed();
+                break;
+            }
+
+            close();
+            if (status == 0)
+            {
+                return replies;
+            }
+            if (next < last && (next > before || !retried))
+            {
+                retried = next == before;
+                continue;
+            }
+            if (next < last)
+            {
+                return replies;
+            }
+            break;
+        }
+    }
+
+    return replies;
+}
+
+void HTTPSConnection::applyFreshness(const Reply &reply, std::vector<CompactRecord> &records)
+{
+    for (auto &record : records)
+    {
+        uint32_t ttl = reply.maxAge ? std::min(record.ttl, *reply.maxAge) : record.ttl;
+        record.ttl = ttl > reply.age ? ttl - reply.age : 0;
+    }
+}
+
+void HTTPSConnection::query(const std::string &domain, DNSRecordType type)
+{
+    if (!stream.isValid())
+        throw std::runtime_error("Invalid connection");
+
+    // Sent by getResponse, which pipelines it like a batch of one
+    pending = {domain, type};
+}
+
+std::vector<CompactRecord> HTTPSConnection::getResponse()
+{
+    if (!stream.isValid())
+        throw std::runtime_error("Invalid connection");
+
+    auto replies = exchangeRaw({pending});
+    if (replies[0].body.empty())
+    {
+        throw UpstreamError("Failed to receive response");
+    }
+    auto records = DNSQuery::parseRecords(replies[0].body.data(), replies[0].body.size());
+    applyFreshness(replies[0], records);
+    return records;
+}
+
+std::vector<DNSQuery::Response> HTTPSConnection::exchangeBatch(
+    const std::vector<std::pair<std::string, DNSRecordType>> &questions)
+{
+    if (!stream.isValid())
+        throw std::runtime_error("Invalid connection");
+
+    std::vector<DNSQuery::Response> results(questions.size());
+    auto replies = exchangeRaw(questions);
+    for (size_t i = 0; i < replies.size(); ++i)
+    {
+        const Reply &reply = replies[i];
+        if (reply.body.empty())
+            continue;
+
+        try
+        {
+            results[i] = DNSQuery::parseMessage(reply.body.data(), reply.body.size());
+        }
+        catch (const std::exception &)
+        {
+            // Malformed responses count as unanswered
+            continue;
+        }
+
+        DNSQuery::Response &response = results[i];
+        applyFreshness(reply, response.answers);
+        applyFreshness(reply, response.authority);
+        uint32_t negative = reply.maxAge ? std::min(response.negativeTtl, *reply.maxAge) : response.negativeTtl;
+        response.negativeTtl = negative > reply.age ? negative - reply.age : 0;
+    }
+    return results;
+}
@@ -0,0 +1,207 @@
+#include "HotCache.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    std::atomic<uint64_t> nextId{1};
+
+    // The table this thread used last, so only a thread's first call on a
+    // cache takes the registry lock
+    struct LastTable
+    {
+        uint64_t owner = 0;
+        void *table = nullptr;
+    };
+
+    thread_local LastTable lastTable;
+
+    size_t roundUp(size_t capacity, size_t minimum)
+    {
+        size_t size = minimum;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        return capacity == 0 ? 0 : size;
+    }
+}
+
+HotCache::HotCache(size_t capacity)
+    : capacity(roundUp(capacity, WAYS)), id(nextId.fetch_add(1))
+{
+    if (this->capacity != 0)
+    {
+        stripes = std::make_unique<std::atomic<uint32_t>[]>(STRIPES);
+    }
+}
+
+HotCache::Table &HotCache::local()
+{
+    if (lastTable.owner == id)
+    {
+        return *static_cast<Table *>(lastTable.table);
+    }
+
+    // Thread IDs are reused, and so are the tables of finished threads
+    std::lock_guard<std::mutex> lock(tablesMutex);
+    auto &table = tables[std::this_thread::get_id()];
+    if (!table)
+    {
+        table = std::make_unique<Table>();
+        table->slots.resize(capacity);
+    }
+    lastTable = {id, table.get()};
+    return *table;
+}
+
+HotCache::Slot *HotCache::set(Table &table, const CacheKey &key) const
+{
+    return &table.slots[key.hash() & (capacity - WAYS)];
+}
+
+const HotCache::Entry *HotCache::find(const CacheKey &key)
+{
+    if (capacity == 0)
+    {
+        return nullptr;
+    }
+
+    Table &table = local();
+    Slot *slots = set(table, key);
+    for (size_t way = 0; way < WAYS; ++way)
+    {
+        Slot &slot = slots[way];
+        if (slot.hash != key.hash() || slot.key.size() != key.size() ||
+            std::memcmp(slot.key.data(), key.data(), key.size()) != 0)
+        {
+            continue;
+        }
+
+        if (slot.epoch == epoch.load(std::memory_order_acquire) &&
+            slot.stripe == stripes[(key.hash() >> 32) & (STRIPES - 1)].load(std::memory_order_acquire) &&
+            std::chrono::system_clock::now() < slot.entry.expiry)
+        {
+            slot.used = ++table.clock;
+            table.hits.fetch_add(1, std::memory_order_relaxed);
+            return &slot.entry;
+        }
+        break;
+    }
+
+    table.misses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+bool HotCache::get(const CacheKey &key, std::vector<CompactRecord> &records)
+{
+    const Entry *entry = find(key);
+    if (!entry)
+    {
+        return false;
+    }
+    countDown(*entry, records);
+    return true;
+}
+
+void HotCache::countDown(const Entry &entry, std::vector<CompactRecord> &records)
+{
+    uint32_t elapsed = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                                                 std::chrono::system_clock::now() - entry.filled)
+                                                 .count());
+    records = entry.records;
+    for (auto &record : records)
+    {
+        record.ttl -= std::min(record.ttl, elapsed);
+    }
+}
+
+HotCache::Ticket HotCache::ticket(const CacheKey &key) const
+{
+    if (capacity == 0)
+    {
+        return {};
+    }
+    return {epoch.load(std::memory_order_acquire),
+            stripes[(key.hash() >> 32) & (STRIPES - 1)].load(std::memory_order_acquire)};
+}
+
+void HotCache::fill(const CacheKey &key, const Ticket &ticket, const std::vector<CompactRecord> &records,
+                    std::shared_ptr<const DNSCache::WireTemplate> wire)
+{
+    if (capacity == 0 || records.empty())
+    {
+        return;
+    }
+
+    uint32_t minTtl = UINT32_MAX;
+    for (const auto &record : records)
+    {
+        minTtl = std::min(minTtl, record.ttl);
+    }
+    auto now = std::chrono::system_clock::now();
+    auto expiry = now + std::chrono::seconds(minTtl);
+    if (wire)
+    {
+        expiry = std::min(expiry, wire->expiry);
+    }
+    if (expiry <= now)
+    {
+        return;
+    }
+
+    // The key's own slot if it has one, the least recently used otherwise
+    Table &table = local();
+    Slot *slots = set(table, key);
+    Slot *victim = &slots[0];
+    for (size_t way = 0; way < WAYS; ++way)
+    {
+        Slot &candidate = slots[way];
+        if (candidate.hash == key.hash() && candidate.key.size() == key.size() &&
+            std::memcmp(candidate.key.data(), key.data(), key.size()) == 0)
+        {
+            victim = &candidate;
+            break;
+        }
+        if (candidate.used < victim->used)
+        {
+            victim = &candidate;
+        }
+    }
+
+    Slot &slot = *victim;
+    slot.used = ++table.clock;
+    slot.key.assign(reinterpret_cast<const char *>(key.data()), key.size());
+    slot.hash = key.hash();
+    slot.epoch = ticket.epoch;
+    slot.stripe = ticket.stripe;
+    slot.entry.records = records;
+    slot.entry.wire = std::move(wire);
+    slot.entry.filled = now;
+    slot.entry.expiry = expiry;
+}
+
+void HotCache::invalidate(const CacheKey &key)
+{
+    if (capacity != 0)
+    {
+        stripes[(key.hash() >> 32) & (STRIPES - 1)].fetch_add(1, std::memory_order_release);
+    }
+}
+
+void HotCache::clear()
+{
+    epoch.fetch_add(1, std::memory_order_release);
+}
+
+HotCache::Counters HotCache::getCounters() const
+{
+    Counters counters;
+    std::lock_guard<std::mutex> lock(tablesMutex);
+    for (const auto &table : tables)
+    {
+        counters.hits += table.second->hits.load(std::memory_order_relaxed);
+        counters.misses += table.second->misses.load(std::memory_order_relaxed);
+    }
+    return counters;
+}
@@ -0,0 +1,514 @@
+#include "IOUringConnection.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+    const uint64_t SEND_TAG = 1ULL << 32; // low bits carry the send slot
+    const uint64_t RECEIVE_TAG = 2;
+    const uint16_t BUFFER_GROUP = 0;
+
+    // No liburing dependency: the three io_uring system calls are used directly
+    int ioUringSetup(unsigned entries, io_uring_params *params)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+                     const void *arg, size_t argSize)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+    }
+
+    int ioUringRegister(int fd, unsigned opcode, const void *arg, unsigned count)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+    }
+
+    // Whether the kernel implements every opcode in `ops`
+    bool supportsOps(int ringFd, std::initializer_list<uint8_t> ops)
+    {
+        const unsigned entries = 256;
+        std::vector<uint8_t> storage(sizeof(io_uring_probe) + entries * sizeof(io_uring_probe_op));
+        auto *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+        if (ioUringRegister(ringFd, IORING_REGISTER_PROBE, probe, entries) != 0)
+        {
+            return false; // no probing before 5.6
+        }
+        for (uint8_t op : ops)
+        {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void *mapAnonymous(size_t size)
+    {
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return memory == MAP_FAILED ? nullptr : memory;
+    }
+
+    void *mapRing(int ringFd, size_t size, off_t offset)
+    {
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+        return memory == MAP_FAILED ? nullptr : memory;
+    }
+}
+
+IOUringConnection::IOUringConnection(const std::string &nameserver, uint16_t port)
+{
+    valid = setup(nameserver, port);
+}
+
+IOUringConnection::~IOUringConnection()
+{
+    // Closing the ring cancels the multishot receive and drops registrations
+    if (ringFd >= 0)
+        ::close(ringFd);
+    if (socketFd >= 0)
+        ::close(socketFd);
+
+    if (sqes)
+        munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    if (sqRing)
+        munmap(sqRing, sqRingSize);
+    if (sendBuffers)
+        munmap(sendBuffers, SEND_SLOTS * SEND_SLOT_SIZE);
+    if (bufferRing)
+        munmap(bufferRing, RECEIVE_BUFFERS * sizeof(io_uring_buf));
+    if (receiveBuffers)
+        munmap(receiveBuffers, RECEIVE_BUFFERS * RECEIVE_BUFFER_SIZE);
+}
+
+bool IOUringConnection::setup(const std::string &nameserver, uint16_t port)
+{
+    sockaddr_storage address{};
+    socklen_t addressLength;
+    auto *ipv4 = reinterpret_cast<sockaddr_in *>(&address);
+    auto *ipv6 = reinterpret_cast<sockaddr_in6 *>(&address);
+    if (inet_pton(AF_INET, nameserver.c_str(), &ipv4->sin_addr) == 1)
+    {
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons(port);
+        addressLength = sizeof(sockaddr_in);
+    }
+    else if (inet_pton(AF_INET6, nameserver.c_str(), &ipv6->sin6_addr) == 1)
+    {
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port = htons(port);
+        addressLength = sizeof(sockaddr_in6);
+    }
+    else
+    {
+        return false;
+    }
+
+    server = address;
+    serverLength = addressLength;
+    socketFd = ::socket(address.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (socketFd < 0 || ::connect(socketFd, reinterpret_cast<sockaddr *>(&address), addressLength) != 0)
+    {
+        return false;
+    }
+
+    io_uring_params params{};
+    ringFd = ioUringSetup(RING_ENTRIES, &params);
+    if (ringFd < 0 || !(params.features & IORING_FEAT_EXT_ARG))
+    {
+        return false; // no io_uring, or no timed waits (before 5.11)
+    }
+
+    // Multishot receive has no opcode of its own; SEND_ZC arrived with it
+    // in 6.0, so its presence stands in for it
+    if (!supportsOps(ringFd, {IORING_OP_SEND, IORING_OP_RECV, IORING_OP_SEND_ZC}))
+    {
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mapRing(ringFd, sqRingSize, IORING_OFF_SQ_RING);
+    cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing
+                                                          : mapRing(ringFd, cqRingSize, IORING_OFF_CQ_RING);
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(mapRing(ringFd, sqesSize, IORING_OFF_SQES));
+    if (!sqRing || !cqRing || !sqes)
+    {
+        return false;
+    }
+
+    auto *sq = static_cast<uint8_t *>(sqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    auto *sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; ++i)
+    {
+        sqArray[i] = i;
+    }
+
+    auto *cq = static_cast<uint8_t *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // Queries are written into preallocated slots, never the caller's buffer
+    sendBuffers = static_cast<uint8_t *>(mapAnonymous(SEND_SLOTS * SEND_SLOT_SIZE));
+    if (!sendBuffers)
+    {
+        return false;
+    }
+
+    // Provided buffer ring feeding the multishot receive (5.19+). The ring is
+    // addressed as a plain io_uring_buf array: in C++ the header's flexible
+    // array member gains a padding byte that shifts io_uring_buf_ring::bufs.
+    bufferRing = static_cast<io_uring_buf *>(mapAnonymous(RECEIVE_BUFFERS * sizeof(io_uring_buf)));
+    receiveBuffers = static_cast<uint8_t *>(mapAnonymous(RECEIVE_BUFFERS * RECEIVE_BUFFER_SIZE));
+    if (!bufferRing || !receiveBuffers)
+    {
+        return false;
+    }
+
+    io_uring_buf_reg registration{};
+    registration.ring_addr = reinterpret_cast<uint64_t>(bufferRing);
+    registration.ring_entries = RECEIVE_BUFFERS;
+    registration.bgid = BUFFER_GROUP;
+    if (ioUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0)
+    {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < RECEIVE_BUFFERS; ++i)
+    {
+        recycleBuffer(i);
+    }
+
+    return true;
+}
+
+bool IOUringConnection::isValid() const
+{
+    return valid;
+}
+
+io_uring_sqe *IOUringConnection::nextSqe()
+{
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > sqMask)
+    {
+        // Submission ring full: hand what is queued to the kernel first
+        enter(0, 0);
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > sqMask)
+        {
+            throw std::runtime_error("io_uring submission queue full");
+        }
+    }
+
+    // Without SQPOLL the kernel only reads entries inside io_uring_enter,
+    // so publishing the tail before filling the entry is safe
+    io_uring_sqe *sqe = &sqes[tail & sqMask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++unsubmitted;
+    return sqe;
+}
+
+void IOUringConnection::submitSend(const std::vector<uint8_t> &queryData)
+{
+    if (queryData.size() > SEND_SLOT_SIZE)
+    {
+        throw std::runtime_error("Query too large");
+    }
+
+    // The kernel may read a slot until its send completes, so a slot still
+    // in flight is waited for rather than overwritten
+    unsigned index = nextSendSlot++ % SEND_SLOTS;
+    for (int attempt = 0; sendBusy & (1ULL << index); ++attempt)
+    {
+        if (attempt == 2)
+        {
+            throw UpstreamError("io_uring send did not complete");
+        }
+        enter(1, static_cast<int>(responseTimeout.count()));
+        reapCompletions();
+    }
+
+    uint8_t *slot = sendBuffers + index * SEND_SLOT_SIZE;
+    std::memcpy(slot, queryData.data(), queryData.size());
+
+    // A plain send: zero copy would only add page pinning and a second
+    // completion for queries this small
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = socketFd;
+    sqe->addr = reinterpret_cast<uint64_t>(slot);
+    sqe->len = static_cast<uint32_t>(queryData.size());
+    sqe->user_data = SEND_TAG | index;
+    sendBusy |= 1ULL << index;
+}
+
+void IOUringConnection::armReceive()
+{
+    // One multishot receive stays armed across queries
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socketFd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = RECEIVE_TAG;
+    receiveArmed = true;
+}
+
+void IOUringConnection::recycleBuffer(uint16_t bufferId)
+{
+    io_uring_buf &buffer = bufferRing[bufferRingTail & (RECEIVE_BUFFERS - 1)];
+    buffer.addr = reinterpret_cast<uint64_t>(receiveBuffers + bufferId * RECEIVE_BUFFER_SIZE);
+    buffer.len = RECEIVE_BUFFER_SIZE;
+    buffer.bid = bufferId;
+    ++bufferRingTail;
+
+    // The ring tail overlays the first entry's reserved field
+    __atomic_store_n(&bufferRing[0].resv, bufferRingTail, __ATOMIC_RELEASE);
+}
+
+bool IOUringConnection::enter(unsigned minComplete, int timeoutMs)
+{
+    unsigned flags = 0;
+    __kernel_timespec timeout{};
+    io_uring_getevents_arg arg{};
+    if (minComplete > 0)
+    {
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    }
+
+    // Submission and waiting happen in the same call
+    int result = ioUringEnter(ringFd, unsubmitted, minComplete, flags,
+                              minComplete > 0 ? &arg : nullptr, minComplete > 0 ? sizeof(arg) : 0);
+    unsubmitted = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+    if (result < 0)
+    {
+        if (errno == ETIME || errno == EINTR)
+        {
+            return false;
+        }
+        throw std::runtime_error("io_uring_enter failed: " + std::string(strerror(errno)));
+    }
+    return true;
+}
+
+void IOUringConnection::reapCompletions()
+{
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head)
+    {
+        const io_uring_cqe &cqe = cqes[head & cqMask];
+        if (cqe.user_data & SEND_TAG)
+        {
+            sendBusy &= ~(1ULL << (cqe.user_data & (SEND_SLOTS - 1)));
+            if (cqe.res < 0)
+            {
+                receiveError = -cqe.res;
+            }
+            continue;
+        }
+
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            receiveArmed = false; // re-armed before the next wait
+        }
+
+        if (cqe.res < 0)
+        {
+            if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP)
+            {
+                valid = false; // multishot receive unsupported (before 6.0)
+            }
+            if (cqe.res != -ENOBUFS)
+            {
+                receiveError = -cqe.res;
+            }
+            continue;
+        }
+
+        if (cqe.flags & IORING_CQE_F_BUFFER)
+        {
+            uint16_t bufferId = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            const uint8_t *data = receiveBuffers + bufferId * RECEIVE_BUFFER_SIZE;
+            received.emplace_back(data, data + cqe.res);
+            recycleBuffer(bufferId);
+        }
+    }
+
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+void IOUringConnection::query(const std::string &domain, DNSRecordType type)
+{
+    if (!valid)
+        throw std::runtime_error("Invalid connection");
+
+    // Queued only: the send is submitted by the wait in getResponse
+    expectedId = DNSQuery::generateQueryId();
+    pending = {domain, type};
+    submitSend(DNSQuery::buildQuery(domain, type, expectedId, dnssecOk));
+    if (!receiveArmed)
+    {
+        armReceive();
+    }
+}
+
+std::vector<CompactRecord> IOUringConnection::getResponse()
+{
+    if (!valid)
+        throw std::runtime_error("Invalid connection");
+
+    auto deadline = std::chrono::steady_clock::now() + responseTimeout;
+    while (true)
+    {
+        // Late answers to earlier queries are skipped by ID
+        while (!received.empty())
+        {
+            auto response = std::move(received.front());
+            received.pop_front();
+            if (response.size() >= 12 && ((response[0] << 8) | response[1]) == expectedId)
+            {
+                std::vector<DNSQuery::Response> results{DNSQuery::parseMessage(response.data(), response.size())};
+                retryOverTCP(reinterpret_cast<const sockaddr *>(&server), serverLength, {pending}, results);
+                return DNSQuery::takeAnswers(std::move(results[0]));
+            }
+        }
+
+        if (receiveError != 0)
+        {
+            int error = receiveError;
+            receiveError = 0;
+            throw UpstreamError("Failed to receive response: " + std::string(strerror(error)));
+        }
+
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0)
+        {
+            throw UpstreamError("Failed to receive response");
+        }
+
+        if (!receiveArmed)
+        {
+            armReceive();
+        }
+        enter(1, static_cast<int>(remaining.count()));
+        reapCompletions();
+    }
+}
+
+std::vector<DNSQuery::Response> IOUringConnection::exchangeBatch(
+    const std::vector<std::pair<std::string, DNSRecordType>> &questions)
+{
+    if (!valid)
+        throw std::runtime_error("Invalid connection");
+
+    std::vector<DNSQuery::Response> results(questions.size());
+
+    for (size_t first = 0; first < questions.size(); first += SEND_SLOTS)
+    {
+        size_t count = std::min<size_t>(SEND_SLOTS, questions.size() - first);
+
+        // Late answers to an earlier batch that timed out, whether the
+        // multishot receive already took them or they still wait in the socket
+        reapCompletions();
+        received.clear();
+        uint8_t stale[RECEIVE_BUFFER_SIZE];
+        while (::recv(socketFd, stale, sizeof(stale), MSG_DONTWAIT) > 0)
+        {
+        }
+
+        // Consecutive IDs from a random base identify each question; the
+        // queries are kept to check the answer carries the same question
+        uint16_t baseId = DNSQuery::generateQueryId();
+        std::vector<std::vector<uint8_t>> sent(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto &question = questions[first + i];
+            sent[i] = DNSQuery::buildQuery(question.first, question.second,
+                                           static_cast<uint16_t>(baseId + i), dnssecOk);
+            submitSend(sent[i]);
+        }
+
+        std::vector<bool> answered(count, false);
+        size_t outstanding = count;
+        auto deadline = std::chrono::steady_clock::now() + responseTimeout;
+
+        while (outstanding > 0)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0 || !valid)
+            {
+                break;
+            }
+
+            if (!receiveArmed)
+            {
+                armReceive();
+            }
+            enter(1, static_cast<int>(remaining.count()));
+            reapCompletions();
+            receiveError = 0;
+
+            while (!received.empty())
+            {
+                auto response = std::move(received.front());
+                received.pop_front();
+                if (response.size() < 12)
+                    continue;
+
+                uint16_t index = static_cast<uint16_t>(((response[0] << 8) | response[1]) - baseId);
+                if (index >= count || answered[index] ||
+                    !DNSQuery::matchesQuery(response.data(), response.size(), sent[index]))
+                    continue;
+
+                answered[index] = true;
+                --outstanding;
+                try
+                {
+                    results[first + index] = DNSQuery::parseMessage(response.data(), response.size());
+                }
+                catch (const std::exception &)
+                {
+                    // Malformed responses count as unanswered
+                }
+            }
+        }
+    }
+
+    retryOverTCP(reinterpret_cast<const sockaddr *>(&server), serverLength, questions, results);
+    return results;
+}
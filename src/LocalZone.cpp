@@ -0,0 +1,659 @@
+#include "LocalZone.hpp"
+#include "DomainName.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <strings.h>
+
+struct LocalZone::Table
+{
+    // What a name carries; a wildcard lives at its parent, so
+    // "*.example.com" is the Wildcard flag on example.com
+    enum Flag : uint8_t
+    {
+        Exact = 1,
+        Wildcard = 2,
+        Block = 4,
+    };
+    static const size_t CNAME_DEPTH = 8;
+
+    // Probes compare `check` first and only touch the arena on a match
+    struct Slot
+    {
+        uint32_t entry = 0; // arena offset + 1, 0 marks an empty slot
+        uint32_t check = 0; // high half of the name's hash
+    };
+
+    std::vector<uint8_t> arena; // per name: length byte, folded wire name, flags byte
+    std::vector<Slot> slots;    // power-of-two size, linear probing
+    std::unordered_map<uint32_t, uint32_t> exactSets;    // entry -> index into sets
+    std::unordered_map<uint32_t, uint32_t> wildcardSets; // entry -> index into sets
+    std::vector<std::vector<CompactRecord>> sets;
+    size_t count = 0;
+    size_t skipped = 0;
+    BlockMode blockMode = BlockMode::NXDomain;
+    uint32_t ttl = 0;
+
+    // Entry offset of the name (at its length byte) plus one, 0 when absent
+    uint32_t find(const uint8_t *name, size_t length) const
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        uint64_t hash = DomainName::hash(name, length);
+        uint32_t check = static_cast<uint32_t>(hash >> 32);
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask; slots[i].entry != 0; i = (i + 1) & mask)
+        {
+            if (slots[i].check != check)
+                continue;
+            const uint8_t *stored = &arena[slots[i].entry - 1];
+            if (stored[0] == length && std::memcmp(stored + 1, name, length) == 0)
+            {
+                return slots[i].entry;
+            }
+        }
+        return 0;
+    }
+
+    uint8_t flags(uint32_t entry) const
+    {
+        return arena[entry + arena[entry - 1]];
+    }
+
+    // Adds the flag to the name, inserting the name when new
+    uint32_t insert(const uint8_t *name, size_t length, Flag flag)
+    {
+        uint32_t entry = find(name, length);
+        if (entry == 0)
+        {
+            if ((count + 1) * 4 > slots.size() * 3)
+            {
+                rehash(std::max<size_t>(1024, slots.size() * 2));
+            }
+            if (arena.size() + length + 2 >= UINT32_MAX)
+            {
+                throw std::runtime_error("Local zone data too large");
+            }
+
+            entry = static_cast<uint32_t>(arena.size() + 1);
+            arena.push_back(static_cast<uint8_t>(length));
+            arena.insert(arena.end(), name, name + length);
+            arena.push_back(0);
+            place(entry, DomainName::hash(name, length));
+            ++count;
+        }
+        arena[entry + length] |= flag;
+        return entry;
+    }
+
+    void place(uint32_t entry, uint64_t hash)
+    {
+        size_t mask = slots.size() - 1;
+        size_t i = hash & mask;
+        while (slots[i].entry != 0)
+        {
+            i = (i + 1) & mask;
+        }
+        slots[i].entry = entry;
+        slots[i].check = static_cast<uint32_t>(hash >> 32);
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        for (const Slot &slot : old)
+        {
+            if (slot.entry != 0)
+            {
+                const uint8_t *stored = &arena[slot.entry - 1];
+                place(slot.entry, DomainName::hash(stored + 1, stored[0]));
+            }
+        }
+    }
+
+    void addBlock(const std::string &domain)
+    {
+        uint8_t wire[DomainName::MAX_WIRE_SIZE];
+        size_t length = DomainName::encode(domain.data(), domain.size(), wire);
+        insert(wire, length, Block);
+    }
+
+    void addRecord(const std::string &owner, CompactRecord record)
+    {
+        bool wildcard = owner.compare(0, 2, "*.") == 0;
+        std::string key = wildcard ? owner.substr(2) : owner;
+        uint8_t wire[DomainName::MAX_WIRE_SIZE];
+        size_t length = DomainName::encode(key.data(), key.size(), wire);
+
+        uint32_t entry = insert(wire, length, wildcard ? Wildcard : Exact);
+        auto &index = wildcard ? wildcardSets : exactSets;
+        auto it = index.emplace(entry, static_cast<uint32_t>(sets.size())).first;
+        if (it->second == sets.size())
+        {
+            sets.emplace_back();
+        }
+        record.name = owner;
+        sets[it->second].push_back(std::move(record));
+    }
+
+    bool answer(const uint8_t *name, size_t length, DNSRecordType type, Answer &result, size_t depth) const
+    {
+        if (uint32_t entry = find(name, length))
+        {
+            uint8_t nameFlags = flags(entry);
+            if (nameFlags & Block)
+            {
+                block(name, length, type, result);
+                return true;
+            }
+            if (nameFlags & Exact)
+            {
+                fill(sets[exactSets.at(entry)], type, nullptr, result, depth);
+                return true;
+            }
+        }
+
+        // Ancestors short of the root; the closest block or wildcard wins
+        for (size_t offset = 1 + name[0]; offset < length && name[offset] != 0; offset += 1 + name[offset])
+        {
+            uint32_t entry = find(name + offset, length - offset);
+            uint8_t nameFlags = entry ? flags(entry) : 0;
+            if (nameFlags & Block)
+            {
+                block(name, length, type, result);
+                return true;
+            }
+            if (nameFlags & Wildcard)
+            {
+                std::string owner = presentation(name, length);
+                fill(sets[wildcardSets.at(entry)], type, &owner, result, depth);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void fill(const std::vector<CompactRecord> &set, DNSRecordType type, const std::string *owner,
+              Answer &result, size_t depth) const
+    {
+        result.rcode = DNSResponseCode::NOERROR;
+        const std::string *alias = nullptr;
+        for (const auto &record : set)
+        {
+            bool isAlias = record.type == DNSRecordType::CNAME && type != DNSRecordType::CNAME;
+            if (record.type != type && !isAlias)
+                continue;
+
+            result.records.push_back(record);
+            if (owner)
+            {
+                result.records.back().name = *owner;
+            }
+            if (isAlias)
+            {
+                alias = record.target();
+            }
+        }
+
+        // Aliases to other local names are followed here; others are left to the client
+        if (alias && depth < CNAME_DEPTH)
+        {
+            uint8_t wire[DomainName::MAX_WIRE_SIZE];
+            size_t length = DomainName::encode(alias->data(), alias->size(), wire);
+            Answer target;
+            if (answer(wire, length, type, target, depth + 1))
+            {
+                result.records.insert(result.records.end(), target.records.begin(), target.records.end());
+            }
+        }
+    }
+
+    void block(const uint8_t *name, size_t length, DNSRecordType type, Answer &result) const
+    {
+        if (blockMode == BlockMode::NXDomain)
+        {
+            result.rcode = DNSResponseCode::NXDOMAIN;
+            return;
+        }
+
+        result.rcode = DNSResponseCode::NOERROR;
+        if (type != DNSRecordType::A && type != DNSRecordType::AAAA)
+        {
+            return;
+        }
+
+        CompactRecord record;
+        record.type = type;
+        record.ttl = ttl;
+        record.name = presentation(name, length);
+        if (type == DNSRecordType::A)
+            record.payload = in_addr{};
+        else
+            record.payload = in6_addr{};
+        result.records.push_back(std::move(record));
+    }
+
+    static std::string presentation(const uint8_t *name, size_t length)
+    {
+        size_t offset = 0;
+        return DomainName::decode(name, length, offset);
+    }
+
+    void loadHosts(const std::string &path);
+    void loadBlocklist(const std::string &path);
+    void loadZone(const std::string &path);
+};
+
+namespace
+{
+    // Splits on whitespace, keeping quoted strings whole (without the
+    // quotes) and stopping at an unquoted comment character
+    std::vector<std::string> tokenize(const std::string &line, char comment)
+    {
+        std::vector<std::string> tokens;
+        size_t i = 0;
+        while (i < line.size())
+        {
+            char c = line[i];
+            if (c == ' ' || c == '\t' || c == '\r')
+            {
+                ++i;
+                continue;
+            }
+            if (c == comment)
+            {
+                break;
+            }
+
+            std::string token;
+            if (c == '"')
+            {
+                for (++i; i < line.size() && line[i] != '"'; ++i)
+                {
+                    if (line[i] == '\\' && i + 1 < line.size())
+                        ++i;
+                    token += line[i];
+                }
+                ++i;
+            }
+            else
+            {
+                while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r' &&
+                       line[i] != comment)
+                {
+                    token += line[i++];
+                }
+            }
+            tokens.push_back(std::move(token));
+        }
+        return tokens;
+    }
+
+    uint32_t number(const std::string &token, uint32_t max)
+    {
+        if (token.empty() || token.size() > 10 || token.find_first_not_of("0123456789") != std::string::npos)
+        {
+            throw std::runtime_error("Expected a number, got '" + token + "'");
+        }
+        unsigned long value = std::stoul(token);
+        if (value > max)
+        {
+            throw std::runtime_error("Number out of range: " + token);
+        }
+        return static_cast<uint32_t>(value);
+    }
+
+    std::string stripDot(std::string name)
+    {
+        if (name.size() > 1 && name.back() == '.')
+        {
+            name.pop_back();
+        }
+        return name;
+    }
+
+    std::ifstream open(const std::string &path)
+    {
+        std::ifstream input(path);
+        if (!input)
+        {
+            throw std::runtime_error("Cannot open local zone source " + path);
+        }
+        return input;
+    }
+
+    CompactRecord::Payload parseData(DNSRecordType type, const std::vector<std::string> &data,
+                                     const std::function<std::string(const std::string &)> &absolute)
+    {
+        auto expect = [&data](size_t count)
+        {
+            if (data.size() != count)
+            {
+                throw std::runtime_error("Expected " + std::to_string(count) + " data fields");
+            }
+        };
+
+        switch (type)
+        {
+        case DNSRecordType::A:
+        {
+            expect(1);
+            in_addr address;
+            if (inet_pton(AF_INET, data[0].c_str(), &address) != 1)
+                throw std::runtime_error("Bad IPv4 address: " + data[0]);
+            return address;
+        }
+
+        case DNSRecordType::AAAA:
+        {
+            expect(1);
+            in6_addr address;
+            if (inet_pton(AF_INET6, data[0].c_str(), &address) != 1)
+                throw std::runtime_error("Bad IPv6 address: " + data[0]);
+            return address;
+        }
+
+        case DNSRecordType::CNAME:
+        case DNSRecordType::NS:
+        case DNSRecordType::PTR:
+            expect(1);
+            return CompactRecord::Name{absolute(data[0])};
+
+        case DNSRecordType::MX:
+            expect(2);
+            return CompactRecord::MX{static_cast<uint16_t>(number(data[0], UINT16_MAX)), absolute(data[1])};
+
+        case DNSRecordType::SRV:
+            expect(4);
+            return CompactRecord::SRV{static_cast<uint16_t>(number(data[0], UINT16_MAX)),
+                                      static_cast<uint16_t>(number(data[1], UINT16_MAX)),
+                                      static_cast<uint16_t>(number(data[2], UINT16_MAX)), absolute(data[3])};
+
+        case DNSRecordType::SOA:
+            expect(7);
+            return std::make_shared<const CompactRecord::SOA>(CompactRecord::SOA{
+                absolute(data[0]), absolute(data[1]), number(data[2], UINT32_MAX), number(data[3], UINT32_MAX),
+                number(data[4], UINT32_MAX), number(data[5], UINT32_MAX), number(data[6], UINT32_MAX)});
+
+        case DNSRecordType::TXT:
+        {
+            if (data.empty())
+                throw std::runtime_error("TXT record without strings");
+            CompactRecord::TXT txt;
+            for (const auto &text : data)
+            {
+                size_t offset = 0;
+                do
+                {
+                    size_t chunk = std::min<size_t>(255, text.size() - offset);
+                    txt.strings += static_cast<char>(chunk);
+                    txt.strings.append(text, offset, chunk);
+                    offset += chunk;
+                } while (offset < text.size());
+            }
+            return txt;
+        }
+
+        default:
+            throw std::runtime_error("Unsupported record type " + recordTypeToString(type));
+        }
+    }
+}
+
+void LocalZone::Table::loadHosts(const std::string &path)
+{
+    auto input = open(path);
+    std::string line;
+    while (std::getline(input, line))
+    {
+        auto tokens = tokenize(line, '#');
+        if (tokens.empty())
+            continue;
+
+        in_addr v4;
+        in6_addr v6;
+        CompactRecord record;
+        record.ttl = ttl;
+        if (inet_pton(AF_INET, tokens[0].c_str(), &v4) == 1)
+        {
+            record.type = DNSRecordType::A;
+            record.payload = v4;
+        }
+        else if (inet_pton(AF_INET6, tokens[0].c_str(), &v6) == 1)
+        {
+            record.type = DNSRecordType::AAAA;
+            record.payload = v6;
+        }
+        else
+        {
+            ++skipped;
+            continue;
+        }
+
+        // Block lists in hosts form point names at the unspecified address
+        bool blocked = (record.type == DNSRecordType::A && v4.s_addr == 0) ||
+                       (record.type == DNSRecordType::AAAA && IN6_IS_ADDR_UNSPECIFIED(&v6));
+        for (size_t i = 1; i < tokens.size(); ++i)
+        {
+            try
+            {
+                std::string name = stripDot(tokens[i]);
+                if (blocked)
+                    addBlock(name);
+                else
+                    addRecord(name, record);
+            }
+            catch (const std::runtime_error &)
+            {
+                ++skipped;
+            }
+        }
+    }
+}
+
+void LocalZone::Table::loadBlocklist(const std::string &path)
+{
+    auto input = open(path);
+    std::string line;
+    while (std::getline(input, line))
+    {
+        auto tokens = tokenize(line, '#');
+        if (tokens.empty())
+            continue;
+
+        // A block covers the subtree anyway, so "*." adds nothing
+        std::string name = stripDot(tokens[0]);
+        if (name.compare(0, 2, "*.") == 0)
+        {
+            name.erase(0, 2);
+        }
+        try
+        {
+            addBlock(name);
+        }
+        catch (const std::runtime_error &)
+        {
+            ++skipped;
+        }
+    }
+}
+
+void LocalZone::Table::loadZone(const std::string &path)
+{
+    auto input = open(path);
+    std::string origin;
+    std::string owner;
+    uint32_t defaultTtl = ttl;
+    auto absolute = [&origin](const std::string &name) -> std::string
+    {
+        if (name == "@")
+            return origin;
+        if (!name.empty() && name.back() == '.')
+            return stripDot(name);
+        return origin.empty() ? name : name + "." + origin;
+    };
+
+    std::string line;
+    for (size_t lineNumber = 1; std::getline(input, line); ++lineNumber)
+    {
+        try
+        {
+            auto tokens = tokenize(line, ';');
+            if (tokens.empty())
+                continue;
+
+            if (tokens[0] == "$ORIGIN" && tokens.size() == 2)
+            {
+                origin = stripDot(tokens[1]);
+                continue;
+            }
+            if (tokens[0] == "$TTL" && tokens.size() == 2)
+            {
+                defaultTtl = number(tokens[1], INT32_MAX);
+                continue;
+            }
+
+            // An indented line continues the previous owner
+            size_t i = 0;
+            if (line[0] != ' ' && line[0] != '\t')
+            {
+                owner = absolute(tokens[i++]);
+            }
+            if (owner.empty())
+            {
+                throw std::runtime_error("Record without an owner name");
+            }
+
+            CompactRecord record;
+            record.ttl = defaultTtl;
+            for (; i < tokens.size(); ++i)
+            {
+                if (strcasecmp(tokens[i].c_str(), "IN") == 0)
+                    continue;
+                if (tokens[i].find_first_not_of("0123456789") == std::string::npos)
+                {
+                    record.ttl = number(tokens[i], INT32_MAX);
+                    continue;
+                }
+                break;
+            }
+            if (i == tokens.size())
+            {
+                throw std::runtime_error("Missing record type");
+            }
+
+            auto type = stringToRecordType(tokens[i]);
+            if (!type)
+            {
+                throw std::runtime_error("Unknown record type " + tokens[i]);
+            }
+            record.type = *type;
+            record.payload = parseData(record.type, std::vector<std::string>(tokens.begin() + i + 1, tokens.end()),
+                                       absolute);
+
+            // Names in the data must encode too, or answering would fail later
+            std::vector<uint8_t> scratch;
+            record.encodeData(scratch);
+            addRecord(owner, std::move(record));
+        }
+        catch (const std::exception &e)
+        {
+            throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": " + e.what());
+        }
+    }
+}
+
+LocalZone::LocalZone(const Config &config)
+    : config(config), table(build(config))
+{
+    populated = table.read()->count > 0;
+}
+
+LocalZone::~LocalZone() = default;
+
+std::unique_ptr<const LocalZone::Table> LocalZone::build(const Config &config)
+{
+    auto table = std::make_unique<Table>();
+    table->blockMode = config.blockMode;
+    table->ttl = config.ttl;
+
+    for (const auto &source : config.sources)
+    {
+        switch (source.format)
+        {
+        case SourceFormat::Hosts:
+            table->loadHosts(source.path);
+            break;
+        case SourceFormat::Zone:
+            table->loadZone(source.path);
+            break;
+        case SourceFormat::Blocklist:
+            table->loadBlocklist(source.path);
+            break;
+        }
+    }
+
+    table->arena.shrink_to_fit();
+    table->sets.shrink_to_fit();
+    return table;
+}
+
+void LocalZone::reload()
+{
+    std::lock_guard<std::mutex> lock(reloadMutex);
+    auto fresh = build(config);
+    bool hasData = fresh->count > 0;
+    table.replace(std::move(fresh));
+    populated = hasData;
+}
+
+bool LocalZone::lookup(const uint8_t *name, size_t length, DNSRecordType type, Answer &answer) const
+{
+    if (!populated.load(std::memory_order_acquire) || length == 0 || length > DomainName::MAX_WIRE_SIZE)
+    {
+        return false;
+    }
+
+    uint8_t folded[DomainName::MAX_WIRE_SIZE];
+    DomainName::foldCase(name, length, folded);
+
+    return table.read()->answer(folded, length, type, answer, 0);
+}
+
+bool LocalZone::lookup(const std::string &domain, DNSRecordType type, Answer &answer) const
+{
+    if (!populated.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    uint8_t wire[DomainName::MAX_WIRE_SIZE];
+    size_t length;
+    try
+    {
+        length = DomainName::encode(domain.data(), domain.size(), wire);
+    }
+    catch (const std::runtime_error &)
+    {
+        return false;
+    }
+    return lookup(wire, length, type, answer);
+}
+
+size_t LocalZone::size() const
+{
+    return table.read()->count;
+}
+
+size_t LocalZone::skipped() const
+{
+    return table.read()->skipped;
+}
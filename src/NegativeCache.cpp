@@ -0,0 +1,123 @@
+#include "NegativeCache.hpp"
+#include <algorithm>
+
+NegativeCache::NegativeCache(size_t maxSize, uint32_t maxTtl)
+    : maxSize(std::max<size_t>(1, maxSize)), maxTtl(maxTtl)
+{
+}
+
+void NegativeCache::putNXDomain(const uint8_t *name, size_t length, uint32_t ttl,
+                                const std::vector<CompactRecord> &authority)
+{
+    put(name, length, ANY_TYPE, ttl, authority);
+}
+
+void NegativeCache::putNoData(const uint8_t *name, size_t length, DNSRecordType type, uint32_t ttl,
+                              const std::vector<CompactRecord> &authority)
+{
+    put(name, length, type, ttl, authority);
+}
+
+void NegativeCache::put(const uint8_t *name, size_t length, DNSRecordType type, uint32_t ttl,
+                        const std::vector<CompactRecord> &authority)
+{
+    ttl = std::min(ttl, maxTtl);
+    if (ttl == 0)
+    {
+        return;
+    }
+
+    CacheKey::Buffer buffer;
+    CacheKey key = CacheKey::fromWire(name, length, type, buffer);
+    auto expiry = std::chrono::steady_clock::now() + std::chrono::seconds(ttl);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end())
+    {
+        it->second.expiry = expiry;
+        it->second.authority = authority;
+        order.splice(order.begin(), order, it->second.position);
+        return;
+    }
+
+    if (entries.size() >= maxSize)
+    {
+        entries.erase(*order.back());
+        order.pop_back();
+    }
+
+    it = entries.emplace(key.owned(), Entry{expiry, {}, authority}).first;
+    order.push_front(&it->first);
+    it->second.position = order.begin();
+}
+
+std::optional<DNSResponseCode> NegativeCache::get(const uint8_t *name, size_t length, DNSRecordType type,
+                                                  std::vector<CompactRecord> *authority)
+{
+    auto now = std::chrono::steady_clock::now();
+    CacheKey::Buffer buffer;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.empty())
+    {
+        return std::nullopt;
+    }
+
+    // The name itself, then each ancestor short of the root
+    const Entry *entry = nullptr;
+    DNSResponseCode rcode = DNSResponseCode::NXDOMAIN;
+    for (size_t offset = 0; offset < length && name[offset] != 0 && !entry; offset += 1 + name[offset])
+    {
+        entry = find(CacheKey::fromWire(name + offset, length - offset, ANY_TYPE, buffer), now);
+    }
+    if (!entry)
+    {
+        entry = find(CacheKey::fromWire(name, length, type, buffer), now);
+        rcode = DNSResponseCode::NOERROR;
+    }
+    if (!entry)
+    {
+        return std::nullopt;
+    }
+
+    if (authority)
+    {
+        auto left = std::chrono::duration_cast<std::chrono::seconds>(entry->expiry - now).count();
+        *authority = entry->authority;
+        for (auto &record : *authority)
+        {
+            record.ttl = std::min<uint32_t>(record.ttl, static_cast<uint32_t>(left));
+        }
+    }
+    return rcode;
+}
+
+const NegativeCache::Entry *NegativeCache::find(const CacheKey &key, std::chrono::steady_clock::time_point now)
+{
+    auto it = entries.find(key);
+    if (it == entries.end())
+    {
+        return nullptr;
+    }
+    if (now >= it->second.expiry)
+    {
+        order.erase(it->second.position);
+        entries.erase(it);
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void NegativeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    order.clear();
+}
+
+size_t NegativeCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
@@ -0,0 +1,172 @@
+#include "TLSConnection.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+TLSConnection::TLSConnection(const std::string &nameserver, uint16_t port, const std::string &serverName,
+                             std::shared_ptr<TLSContext> context, std::chrono::milliseconds idleTimeout)
+    : stream(nameserver, port, serverName, std::move(context), idleTimeout)
+{
+}
+
+bool TLSConnection::isValid() const
+{
+    return stream.isValid();
+}
+
+void TLSConnection::close()
+{
+    stream.close();
+    inbox.clear();
+    inboxStart = 0;
+}
+
+int TLSConnection::readMessage(std::vector<uint8_t> &message, TLSStream::Clock::time_point deadline)
+{
+    while (true)
+    {
+        size_t available = inbox.size() - inboxStart;
+        if (available >= 2)
+        {
+            size_t length = (inbox[inboxStart] << 8) | inbox[inboxStart + 1];
+            if (available >= 2 + length)
+            {
+                auto begin = inbox.begin() + inboxStart + 2;
+                message.assign(begin, begin + length);
+                inboxStart += 2 + length;
+                return 1;
+            }
+        }
+
+        // Drop the framed bytes once per read rather than once per message
+        inbox.erase(inbox.begin(), inbox.begin() + inboxStart);
+        inboxStart = 0;
+
+        int read = stream.read(inbox, deadline);
+        if (read <= 0)
+        {
+            return read;
+        }
+    }
+}
+
+std::vector<std::vector<uint8_t>> TLSConnection::exchangeRaw(
+    const std::vector<std::pair<std::string, DNSRecordType>> &questions)
+{
+    std::vector<std::vector<uint8_t>> answers(questions.size());
+    auto deadline = TLSStream::Clock::now() + responseTimeout;
+
+    for (size_t first = 0; first < questions.size(); first += WINDOW)
+    {
+        size_t count = std::min(WINDOW, questions.size() - first);
+        size_t outstanding = count;
+
+        // A reused connection the server has already closed fails on first
+        // use; it is reopened once and the unanswered questions resent
+        for (bool retried = false;;)
+        {
+            if (stream.open(deadline))
+            {
+                inbox.clear();
+                inboxStart = 0;
+            }
+
+            // Consecutive IDs from a random base identify each question
+            uint16_t baseId = DNSQuery::generateQueryId();
+            std::vector<uint8_t> frames;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!answers[first + i].empty())
+                    continue;
+
+                const auto &question = questions[first + i];
+                auto queryData = DNSQuery::buildQuery(question.first, question.second,
+                                                      static_cast<uint16_t>(baseId + i), dnssecOk);
+                frames.push_back(static_cast<uint8_t>(queryData.size() >> 8));
+                frames.push_back(static_cast<uint8_t>(queryData.size()));
+                frames.insert(frames.end(), queryData.begin(), queryData.end());
+            }
+
+            size_t before = outstanding;
+            int status = stream.write(frames, deadline);
+
+            std::vector<uint8_t> message;
+            while (status > 0 && outstanding > 0)
+            {
+                status = readMessage(message, deadline);
+                if (status <= 0 || message.size() < 12)
+                    continue;
+
+                uint16_t index = static_cast<uint16_t>(((message[0] << 8) | message[1]) - baseId);
+                if (index >= count || !answers[first + index].empty())
+                    continue;
+
+                answers[first + index] = std::move(message);
+                --outstanding;
+            }
+
+            if (status > 0)
+            {
+                stream.markUsed();
+                break;
+            }
+
+            // Answers still owed would arrive out of step with the next batch
+            close();
+            if (status < 0 && outstanding == before && !retried)
+            {
+                retried = true;
+                continue;
+            }
+            return answers;
+        }
+    }
+
+    return answers;
+}
+
+void TLSConnection::query(const std::string &domain, DNSRecordType type)
+{
+    if (!stream.isValid())
+        throw std::runtime_error("Invalid connection");
+
+    // Sent by getResponse, which pipelines it like a batch of one
+    pending = {domain, type};
+}
+
+std::vector<CompactRecord> TLSConnection::getResponse()
+{
+    if (!stream.isValid())
+        throw std::runtime_error("Invalid connection");
+
+    auto answers = exchangeRaw({pending});
+    if (answers[0].empty())
+    {
+        throw UpstreamError("Failed to receive response");
+    }
+    return DNSQuery::parseRecords(answers[0].data(), answers[0].size());
+}
+
+std::vector<DNSQuery::Response> TLSConnection::exchangeBatch(
+    const std::vector<std::pair<std::string, DNSRecordType>> &questions)
+{
+    if (!stream.isValid())
+        throw std::runtime_error("Invalid connection");
+
+    std::vector<DNSQuery::Response> results(questions.size());
+    auto answers = exchangeRaw(questions);
+    for (size_t i = 0; i < answers.size(); ++i)
+    {
+        if (answers[i].empty())
+            continue;
+
+        try
+        {
+            results[i] = DNSQuery::parseMessage(answers[i].data(), answers[i].size());
+        }
+        catch (const std::exception &)
+        {
+            // Malformed responses count as unanswered
+        }
+    }
+    return results;
+}
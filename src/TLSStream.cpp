@@ -0,0 +1,399 @@
+#include "TLSStream.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace
+{
+    const std::chrono::milliseconds FIRST_BACKOFF{100};
+    const std::chrono::milliseconds MAX_BACKOFF{10000};
+    const std::chrono::milliseconds WARMUP_TIMEOUT{1000};
+
+    // Waits for `events` on fd: positive when ready, 0 at the deadline,
+    // negative on error
+    int waitFor(int fd, short events, std::chrono::steady_clock::time_point deadline)
+    {
+        while (true)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+            {
+                return 0;
+            }
+
+            pollfd ready{fd, events, 0};
+            int result = ::poll(&ready, 1, static_cast<int>(remaining.count()));
+            if (result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return result;
+        }
+    }
+}
+
+TLSContext::TLSContext(const std::string &caFile, bool verify) : verify(verify)
+{
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx)
+    {
+        throw std::runtime_error("Failed to create TLS context");
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    if (verify)
+    {
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+        bool loaded = caFile.empty() ? SSL_CTX_set_default_verify_paths(ctx) == 1
+                                     : SSL_CTX_load_verify_locations(ctx, caFile.c_str(), nullptr) == 1;
+        if (!loaded)
+        {
+            SSL_CTX_free(ctx);
+            throw std::runtime_error("Failed to load TLS trust store " + caFile);
+        }
+    }
+
+    // Sessions are kept here per upstream rather than in OpenSSL's cache,
+    // which clients can't look up by server
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &TLSContext::storeSession);
+    SSL_CTX_set_app_data(ctx, this);
+}
+
+TLSContext::~TLSContext()
+{
+    for (auto &entry : sessions)
+    {
+        SSL_SESSION_free(entry.second);
+    }
+    SSL_CTX_free(ctx);
+}
+
+SSL_SESSION *TLSContext::session(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = sessions.find(key);
+    if (found == sessions.end() || !SSL_SESSION_is_resumable(found->second))
+    {
+        return nullptr;
+    }
+    SSL_SESSION_up_ref(found->second);
+    return found->second;
+}
+
+void TLSContext::recordHandshake(bool resumed)
+{
+    handshakeCount.fetch_add(1, std::memory_order_relaxed);
+    if (resumed)
+    {
+        resumedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+int TLSContext::storeSession(SSL *ssl, SSL_SESSION *session)
+{
+    // TLS 1.3 tickets arrive after the handshake, so the newest one wins
+    auto *self = static_cast<TLSContext *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    const auto *key = static_cast<const std::string *>(SSL_get_app_data(ssl));
+
+    std::lock_guard<std::mutex> lock(self->mutex);
+    SSL_SESSION *&slot = self->sessions[*key];
+    if (slot)
+    {
+        SSL_SESSION_free(slot);
+    }
+    slot = session;
+    return 1; // the reference is kept
+}
+
+TLSStream::TLSStream(const std::string &host, uint16_t port, const std::string &serverName,
+                     std::shared_ptr<TLSContext> context, std::chrono::milliseconds idleTimeout,
+                     const std::string &alpn)
+    : host(host), address(host + ":" + std::to_string(port)), name(serverName), context(std::move(context)),
+      idleTimeout(idleTimeout)
+{
+    if (!alpn.empty())
+    {
+        this->alpn.push_back(static_cast<char>(alpn.size()));
+        this->alpn += alpn;
+    }
+
+    addrinfo hints{};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *resolved = nullptr;
+    if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &resolved) != 0)
+    {
+        return;
+    }
+    std::memcpy(&peer, resolved->ai_addr, resolved->ai_addrlen);
+    peerLength = resolved->ai_addrlen;
+    ::freeaddrinfo(resolved);
+
+    // A host given by name is also the name its certificate must carry
+    in6_addr literal;
+    if (name.empty() && ::inet_pton(AF_INET, host.c_str(), &literal) != 1 &&
+        ::inet_pton(AF_INET6, host.c_str(), &literal) != 1)
+    {
+        name = host;
+    }
+    sessionKey = address + "#" + name;
+    valid = true;
+
+    // Warm up now so the first query doesn't pay for the handshake; a
+    // failure here is retried on first use
+    try
+    {
+        open(Clock::now() + WARMUP_TIMEOUT);
+    }
+    catch (const UpstreamError &)
+    {
+    }
+}
+
+TLSStream::~TLSStream()
+{
+    close();
+}
+
+bool TLSStream::open(Clock::time_point deadline)
+{
+    auto now = Clock::now();
+    if (ssl && now - lastUsed > idleTimeout)
+    {
+        close();
+    }
+    if (ssl)
+    {
+        return false;
+    }
+
+    if (now < retryAt)
+    {
+        throw UpstreamError("TLS upstream " + address + " is backing off after failed connects");
+    }
+    if (!connect(deadline))
+    {
+        auto backoff = std::min(MAX_BACKOFF, FIRST_BACKOFF * (1 << std::min<uint32_t>(failures, 7)));
+        ++failures;
+        retryAt = Clock::now() + backoff;
+        throw UpstreamError("TLS connection to " + address + " failed");
+    }
+    failures = 0;
+    return true;
+}
+
+bool TLSStream::connect(Clock::time_point deadline)
+{
+    fd = ::socket(peer.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&peer), peerLength) != 0)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (errno != EINPROGRESS || waitFor(fd, POLLOUT, deadline) <= 0 ||
+            ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+        {
+            close();
+            return false;
+        }
+    }
+
+    ssl = SSL_new(context->get());
+    incoming = BIO_new(BIO_s_mem());
+    outgoing = BIO_new(BIO_s_mem());
+    if (!ssl || !incoming || !outgoing)
+    {
+        BIO_free(incoming);
+        BIO_free(outgoing);
+        incoming = outgoing = nullptr;
+        close();
+        return false;
+    }
+    SSL_set_bio(ssl, incoming, outgoing);
+    SSL_set_app_data(ssl, &sessionKey);
+
+    if (!name.empty())
+    {
+        SSL_set_tlsext_host_name(ssl, name.c_str());
+    }
+    if (!alpn.empty())
+    {
+        SSL_set_alpn_protos(ssl, reinterpret_cast<const unsigned char *>(alpn.data()),
+                            static_cast<unsigned>(alpn.size()));
+    }
+    if (context->verifyPeer())
+    {
+        if (!name.empty())
+            SSL_set1_host(ssl, name.c_str());
+        else
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host.c_str());
+    }
+    if (SSL_SESSION *cached = context->session(sessionKey))
+    {
+        SSL_set_session(ssl, cached);
+        SSL_SESSION_free(cached);
+    }
+
+    if (drive([this]()
+              { return SSL_connect(ssl); },
+              deadline) <= 0)
+    {
+        close();
+        return false;
+    }
+
+    context->recordHandshake(SSL_session_reused(ssl) == 1);
+    lastUsed = Clock::now();
+    return true;
+}
+
+void TLSStream::close()
+{
+    if (ssl)
+    {
+        if (SSL_is_init_finished(ssl))
+        {
+            // TLS 1.3 tickets of a connection never read from are still
+            // waiting on the socket; take them so the next connect resumes
+            uint8_t discard[READ_SIZE];
+            drive([this, &discard]()
+                  { return SSL_read(ssl, discard, sizeof(discard)); },
+                  Clock::now());
+
+            // Best effort close_notify; the BIOs go with the SSL object
+            SSL_shutdown(ssl);
+            flush(Clock::now());
+        }
+        SSL_free(ssl);
+        ssl = nullptr;
+        incoming = outgoing = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+int TLSStream::drive(const std::function<int()> &operation, Clock::time_point deadline)
+{
+    while (true)
+    {
+        ERR_clear_error();
+        int result = operation();
+        int flushed = flush(deadline);
+        if (flushed <= 0)
+        {
+            return flushed;
+        }
+        if (result > 0)
+        {
+            return result;
+        }
+
+        if (SSL_get_error(ssl, result) != SSL_ERROR_WANT_READ)
+        {
+            return -1;
+        }
+        int filled = fill(deadline);
+        if (filled <= 0)
+        {
+            return filled;
+        }
+    }
+}
+
+int TLSStream::flush(Clock::time_point deadline)
+{
+    uint8_t buffer[READ_SIZE];
+    int pending;
+    while ((pending = BIO_read(outgoing, buffer, sizeof(buffer))) > 0)
+    {
+        size_t offset = 0;
+        while (offset < static_cast<size_t>(pending))
+        {
+            ssize_t sent = ::send(fd, buffer + offset, pending - offset, MSG_NOSIGNAL);
+            if (sent > 0)
+            {
+                offset += static_cast<size_t>(sent);
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            {
+                int ready = waitFor(fd, POLLOUT, deadline);
+                if (ready <= 0)
+                {
+                    return ready == 0 ? 0 : -1;
+                }
+                continue;
+            }
+            return -1;
+        }
+    }
+    return 1;
+}
+
+int TLSStream::fill(Clock::time_point deadline)
+{
+    // Reads before polling, as answers are usually there already
+    uint8_t buffer[READ_SIZE];
+    while (true)
+    {
+        ssize_t received = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (received > 0)
+        {
+            BIO_write(incoming, buffer, static_cast<int>(received));
+            return 1;
+        }
+        if (received == 0)
+        {
+            return -1; // closed by the server
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            return -1;
+        }
+
+        int ready = waitFor(fd, POLLIN, deadline);
+        if (ready <= 0)
+        {
+            return ready == 0 ? 0 : -1;
+        }
+    }
+}
+
+int TLSStream::write(const std::vector<uint8_t> &data, Clock::time_point deadline)
+{
+    return drive([this, &data]()
+                 { return SSL_write(ssl, data.data(), static_cast<int>(data.size())); },
+                 deadline);
+}
+
+int TLSStream::read(std::vector<uint8_t> &buffer, Clock::time_point deadline)
+{
+    uint8_t chunk[READ_SIZE];
+    int received = drive([this, &chunk]()
+                         { return SSL_read(ssl, chunk, sizeof(chunk)); },
+                         deadline);
+    if (received > 0)
+    {
+        buffer.insert(buffer.end(), chunk, chunk + received);
+    }
+    return received;
+}
@@ -0,0 +1,129 @@
+#include "TimingWheel.hpp"
+
+TimingWheel::TimingWheel(uint64_t now) : slots(LEVELS * SLOTS), current(now) {}
+
+void TimingWheel::schedule(std::string key, uint64_t deadline)
+{
+    ++count;
+    place(Item{std::move(key), deadline});
+}
+
+void TimingWheel::place(Item item)
+{
+    if (item.deadline <= current)
+    {
+        if (ready.empty())
+        {
+            ready.emplace_back();
+        }
+        ready.back().push_back(std::move(item));
+        return;
+    }
+
+    // The level is picked by distance, the slot by the deadline's own bits,
+    // so a slot cascades down exactly when the wheel reaches its range
+    uint64_t delta = item.deadline - current;
+    unsigned level = 0;
+    while (level + 1 < LEVELS && delta >= (SLOTS << (SLOT_BITS * level)))
+    {
+        ++level;
+    }
+
+    uint64_t deadline = item.deadline;
+    if (delta >= (SLOTS << (SLOT_BITS * level)))
+    {
+        // Beyond the top level: park in the farthest slot and re-place later
+        deadline = current + (SLOTS << (SLOT_BITS * level)) - 1;
+    }
+
+    size_t slot = (deadline >> (SLOT_BITS * level)) & (SLOTS - 1);
+    slots[level * SLOTS + slot].push_back(std::move(item));
+}
+
+void TimingWheel::queue(std::deque<std::vector<Item>> &chunks, std::vector<Item> &slot)
+{
+    // The slot's vector moves over whole; no per-item work here
+    if (!slot.empty())
+    {
+        chunks.emplace_back();
+        chunks.back().swap(slot);
+    }
+}
+
+bool TimingWheel::advance(uint64_t now, std::vector<Item> &due, size_t limit)
+{
+    size_t budget = limit;
+
+    // A jump past the whole wheel (long pause, clock change) re-places
+    // everything instead of ticking through each second
+    if (now > current && now - current >= (SLOTS << (SLOT_BITS * (LEVELS - 1))))
+    {
+        current = now;
+        for (auto &slot : slots)
+        {
+            queue(cascading, slot);
+        }
+    }
+
+    while (budget > 0)
+    {
+        // Cascaded items must be in place before time moves on
+        while (!cascading.empty() && budget > 0)
+        {
+            auto &chunk = cascading.front();
+            place(std::move(chunk[cascadePosition++]));
+            --budget;
+            if (cascadePosition == chunk.size())
+            {
+                cascading.pop_front();
+                cascadePosition = 0;
+            }
+        }
+        if (!cascading.empty())
+        {
+            break;
+        }
+
+        while (!ready.empty() && due.size() < limit)
+        {
+            auto &chunk = ready.front();
+            due.push_back(std::move(chunk[readyPosition++]));
+            --count;
+            if (readyPosition == chunk.size())
+            {
+                ready.pop_front();
+                readyPosition = 0;
+            }
+        }
+        if (due.size() >= limit || current >= now)
+        {
+            break;
+        }
+
+        ++current;
+        --budget;
+        for (unsigned level = LEVELS - 1; level > 0; --level)
+        {
+            if ((current & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) == 0)
+            {
+                queue(cascading, slots[level * SLOTS + ((current >> (SLOT_BITS * level)) & (SLOTS - 1))]);
+            }
+        }
+        queue(ready, slots[current & (SLOTS - 1)]);
+    }
+
+    return !cascading.empty() || !ready.empty() || current < now;
+}
+
+void TimingWheel::clear()
+{
+    for (auto &slot : slots)
+    {
+        slot.clear();
+    }
+    ready.clear();
+    cascading.clear();
+    readyPosition = 0;
+    cascadePosition = 0;
+    count = 0;
+}
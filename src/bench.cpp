@@ -0,0 +1,322 @@
+// Loopback load generator for `dns-resolver --serve`
+#include "ConnectionPool.hpp"
+#include "DNSQuery.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    struct BenchConfig
+    {
+        std::string server = "127.0.0.1";
+        uint16_t port = 53;
+        size_t threads = 1;
+        size_t window = 32;     // outstanding queries per thread
+        size_t duration = 10;   // seconds
+        std::vector<std::string> names = {"example.com"};
+        DNSRecordType type = DNSRecordType::A;
+        bool useTransport = false; // measure a ConnectionPool backend instead
+        TransportBackend transport = TransportBackend::UDP;
+        std::string tlsCaFile;
+        DoHMethod dohMethod = DoHMethod::POST;
+    };
+
+    // Latency histogram with one bucket per microsecond up to 100ms
+    const size_t HISTOGRAM_BUCKETS = 100000;
+
+    struct ThreadResult
+    {
+        uint64_t responses = 0;
+        uint64_t timeouts = 0;
+        std::vector<uint32_t> histogram = std::vector<uint32_t>(HISTOGRAM_BUCKETS, 0);
+    };
+
+    void runClient(const BenchConfig &config, const std::vector<std::vector<uint8_t>> &queries,
+                   std::chrono::steady_clock::time_point deadline, ThreadResult &result)
+    {
+        sockaddr_in server{};
+        server.sin_family = AF_INET;
+        server.sin_port = htons(config.port);
+        if (inet_pton(AF_INET, config.server.c_str(), &server.sin_addr) != 1)
+        {
+            throw std::runtime_error("Invalid server address: " + config.server);
+        }
+
+        int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&server), sizeof(server)) != 0)
+        {
+            throw std::runtime_error("Failed to connect to " + config.server);
+        }
+        timeval timeout{1, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::vector<std::chrono::steady_clock::time_point> sentAt(65536);
+        uint16_t nextId = 0;
+        size_t nextQuery = 0;
+        std::vector<uint8_t> packet;
+
+        auto sendOne = [&]()
+        {
+            packet = queries[nextQuery++ % queries.size()];
+            packet[0] = nextId >> 8;
+            packet[1] = nextId & 0xFF;
+            sentAt[nextId++] = std::chrono::steady_clock::now();
+            ::send(fd, packet.data(), packet.size(), 0);
+        };
+
+        for (size_t i = 0; i < config.window; ++i)
+        {
+            sendOne();
+        }
+
+        uint8_t buffer[4096];
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            ssize_t received = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (received < 12)
+            {
+                // Lost responses: refill the whole window
+                ++result.timeouts;
+                for (size_t i = 0; i < config.window; ++i)
+                {
+                    sendOne();
+                }
+                continue;
+            }
+
+            uint16_t id = (buffer[0] << 8) | buffer[1];
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - sentAt[id])
+                               .count();
+            ++result.histogram[std::min<size_t>(elapsed, HISTOGRAM_BUCKETS - 1)];
+            ++result.responses;
+            sendOne();
+        }
+
+        ::close(fd);
+    }
+
+    // Windows of queries through a pooled connection, exchanged as one
+    // batch the way the resolver sends its misses
+    void runTransportClient(const BenchConfig &config, ConnectionPool &pool,
+                            std::chrono::steady_clock::time_point deadline, ThreadResult &result)
+    {
+        auto conn = pool.acquire();
+        if (!conn)
+        {
+            ++result.timeouts;
+            return;
+        }
+        size_t nextName = 0;
+        std::vector<std::pair<std::string, DNSRecordType>> questions(config.window);
+
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            for (auto &question : questions)
+            {
+                question = {config.names[nextName++ % config.names.size()], config.type};
+            }
+
+            auto sent = std::chrono::steady_clock::now();
+            std::vector<DNSQuery::Response> answers;
+            try
+            {
+                answers = conn->exchangeBatch(questions);
+            }
+            catch (const std::exception &)
+            {
+                result.timeouts += questions.size();
+                continue;
+            }
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - sent)
+                               .count();
+            for (const auto &answer : answers)
+            {
+                if (!answer.answered)
+                {
+                    ++result.timeouts;
+                    continue;
+                }
+                ++result.histogram[std::min<size_t>(elapsed, HISTOGRAM_BUCKETS - 1)];
+                ++result.responses;
+            }
+        }
+
+        pool.release(conn);
+    }
+
+    double percentile(const std::vector<uint32_t> &histogram, uint64_t total, double fraction)
+    {
+        uint64_t target = static_cast<uint64_t>(total * fraction);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < histogram.size(); ++i)
+        {
+            seen += histogram[i];
+            if (seen > target)
+            {
+                return static_cast<double>(i);
+            }
+        }
+        return static_cast<double>(histogram.size());
+    }
+
+    void printUsage(const char *program)
+    {
+        std::cout << "Usage: " << program << " [options]\n"
+                  << "  --server <address>   Server to load (default 127.0.0.1)\n"
+                  << "  --port <port>        Server port (default 53)\n"
+                  << "  --threads <n>        Client threads (default 1)\n"
+                  << "  --window <n>         Outstanding queries per thread (default 32)\n"
+                  << "  --duration <s>       Run time in seconds (default 10)\n"
+                  << "  --names <a,b,...>    Names to query round-robin (default example.com)\n"
+                  << "  --type <n>           Numeric record type (default 1)\n"
+                  << "  --transport <udp|io_uring|tls|https>  Go through a ConnectionPool backend\n"
+                  << "  --tls-ca <file>      CA certificates for --transport tls and https\n"
+                  << "  --doh-get            Send https queries as GET instead of POST\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig config;
+
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (arg == "--server" && hasValue)
+                config.server = argv[++i];
+            else if (arg == "--port" && hasValue)
+                config.port = static_cast<uint16_t>(std::stoi(argv[++i]));
+            else if (arg == "--threads" && hasValue)
+                config.threads = std::max<size_t>(1, std::stoul(argv[++i]));
+            else if (arg == "--window" && hasValue)
+                config.window = std::max<size_t>(1, std::stoul(argv[++i]));
+            else if (arg == "--duration" && hasValue)
+                config.duration = std::stoul(argv[++i]);
+            else if (arg == "--type" && hasValue)
+                config.type = static_cast<DNSRecordType>(std::stoi(argv[++i]));
+            else if (arg == "--transport" && hasValue)
+            {
+                std::string name = argv[++i];
+                if (name != "udp" && name != "io_uring" && name != "tls" && name != "https")
+                    throw std::runtime_error("Unknown transport: " + name);
+                config.useTransport = true;
+                config.transport = name == "io_uring" ? TransportBackend::IOUring
+                                   : name == "tls"    ? TransportBackend::TLS
+                                   : name == "https"  ? TransportBackend::HTTPS
+                                                      : TransportBackend::UDP;
+            }
+            else if (arg == "--tls-ca" && hasValue)
+                config.tlsCaFile = argv[++i];
+            else if (arg == "--doh-get")
+                config.dohMethod = DoHMethod::GET;
+            else if (arg == "--names" && hasValue)
+            {
+                config.names.clear();
+                std::stringstream list(argv[++i]);
+                std::string name;
+                while (std::getline(list, name, ','))
+                {
+                    if (!name.empty())
+                        config.names.push_back(name);
+                }
+            }
+            else
+            {
+                printUsage(argv[0]);
+                return arg == "--help" ? 0 : 1;
+            }
+        }
+
+        std::vector<std::vector<uint8_t>> queries;
+        for (const auto &name : config.names)
+        {
+            queries.push_back(DNSQuery::buildQuery(name, config.type));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::seconds(config.duration);
+        std::vector<ThreadResult> results(config.threads);
+        std::vector<std::thread> clients;
+        std::unique_ptr<ConnectionPool> pool;
+        if (config.useTransport)
+        {
+            ConnectionPool::Config poolConfig;
+            poolConfig.poolSize = config.threads;
+            poolConfig.backend = config.transport;
+            poolConfig.tlsCaFile = config.tlsCaFile;
+            poolConfig.dohMethod = config.dohMethod;
+            pool = std::make_unique<ConnectionPool>(
+                std::vector<std::string>{config.server + ":" + std::to_string(config.port)}, poolConfig);
+            auto backend = pool->getBackend();
+            std::cout << "Transport:   "
+                      << (backend == TransportBackend::IOUring ? "io_uring"
+                          : backend == TransportBackend::TLS   ? "tls"
+                          : backend == TransportBackend::HTTPS ? "https"
+                                                               : "udp")
+                      << "\n";
+        }
+
+        for (size_t i = 0; i < config.threads; ++i)
+        {
+            if (pool)
+                clients.emplace_back(runTransportClient, std::cref(config), std::ref(*pool), deadline,
+                                     std::ref(results[i]));
+            else
+                clients.emplace_back(runClient, std::cref(config), std::cref(queries), deadline,
+                                     std::ref(results[i]));
+        }
+        for (auto &client : clients)
+        {
+            client.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ThreadResult total;
+        for (const auto &result : results)
+        {
+            total.responses += result.responses;
+            total.timeouts += result.timeouts;
+            for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+            {
+                total.histogram[i] += result.histogram[i];
+            }
+        }
+
+        std::cout << "Responses:   " << total.responses << "\n"
+                  << "Timeouts:    " << total.timeouts << "\n"
+                  << "Throughput:  " << static_cast<uint64_t>(total.responses / seconds) << " qps\n"
+                  << "Latency p50: " << percentile(total.histogram, total.responses, 0.50) << " us\n"
+                  << "Latency p99: " << percentile(total.histogram, total.responses, 0.99) << " us\n";
+        if (pool && (pool->getBackend() == TransportBackend::TLS || pool->getBackend() == TransportBackend::HTTPS))
+        {
+            std::cout << "Handshakes:  " << pool->tlsHandshakes() << " (" << pool->tlsResumptions()
+                      << " resumed)\n";
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,7 +1,12 @@
+#include "BulkResolver.hpp"
+#include "CacheWarmer.hpp"
 #include "DNSResolver.hpp"
+#include "DNSServer.hpp"
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <csignal>
 
 // ANSI color codes for prettier output
 namespace Color
@@ -54,14 +59,273 @@ void printRecord(const DNSRecord &record)
     std::cout << std::string(50, '-') << "\n";
 }
 
-int main()
+void printUsage(const char *program)
 {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --serve                 Answer DNS clients over UDP and TCP\n"
+              << "  --listen <address>      Address to listen on (default 0.0.0.0)\n"
+              << "  --port <port>           Port to listen on (default 53)\n"
+              << "  --workers <n>           Listening workers (default one per core)\n"
+              << "  --resolver-threads <n>  Threads resolving cache misses (default 16)\n"
+              << "  --nameserver <host[:port][#name]>  Upstream server, repeatable; #name is\n"
+              << "                          the certificate name for tls and https, which also\n"
+              << "                          take https://host[:port]/path URLs\n"
+              << "  --transport <udp|io_uring|tls|https>  Upstream transport (default udp)\n"
+              << "  --tls-ca <file>         CA certificates for tls and https (default system store)\n"
+              << "  --doh-get               Send https queries as GET instead of POST\n"
+              << "  --cache-size <n>        Cached answers (default 1000)\n"
+              << "  --cache-policy <lru|tinylfu>  Eviction policy (default tinylfu)\n"
+              << "  --hot-cache-size <n>    Answers each thread keeps in front of the cache (default 256, 0 = off)\n"
+              << "  --cache-snapshot <file> Load the cache on start, save it on exit\n"
+              << "  --snapshot-interval <s> Also save the cache every s seconds\n"
+              << "  --warm <file|->         Resolve the most frequent names of a popularity list\n"
+              << "                          or query log before serving\n"
+              << "  --warm-top <n>          Names resolved by --warm (default 10000)\n"
+              << "  --warm-rate <n>         Questions per second sent by --warm (default 500, 0 = unlimited)\n"
+              << "  --warm-background       Serve while --warm is still running\n"
+              << "  --popularity-out <file> Write the cached names by popularity on exit, for --warm\n"
+              << "  --popularity-interval <s>  Also write them every s seconds\n"
+              << "  --hosts <file>          Answer names from a hosts file, repeatable\n"
+              << "  --zone <file>           Answer names from a zone file, repeatable\n"
+              << "  --blocklist <file>      Block every name listed and below, repeatable\n"
+              << "  --block-mode <nxdomain|sinkhole>  Answer for blocked names (default nxdomain)\n"
+              << "  --no-dnssec             Don't validate answers with DNSSEC\n"
+              << "  --trust-anchor <ds>     Root DS as \"tag alg digest-type hex\", repeatable\n"
+              << "  --peer-listen <host:port>  Share the cache with peers through this address\n"
+              << "  --peer <host:port>      Peer's --peer-listen address, repeatable\n"
+              << "  --peer-timeout <ms>     Wait for a peer's answer (default 20)\n"
+              << "  --bulk <file|->         Resolve every name in a file or stdin\n"
+              << "  --format <jsonl|csv>    Bulk output format (default jsonl)\n"
+              << "  --in-flight <n>         Bulk lookups outstanding at once (default 256)\n"
+              << "  --type <type>           Bulk record type for lines without one, repeatable\n"
+              << "  --help                  Show this message\n";
+}
+
+void printCacheStatistics(const Statistics &stats)
+{
+    std::cout << "  Cache Policy:  " << stats.getCachePolicy() << "\n"
+              << "  Hit Rate:      " << std::fixed << std::setprecision(1)
+              << stats.getCacheHitRate() * 100 << "%\n"
+              << "  Hot Cache:     " << stats.getHotCacheHitRate() * 100 << "% of "
+              << stats.getHotCacheHits() + stats.getHotCacheMisses() << " lookups\n"
+              << "  Shared Cache:  " << stats.getSharedCacheHitRate() * 100 << "% of "
+              << stats.getSharedCacheHits() + stats.getSharedCacheMisses() << " lookups\n"
+              << "  Evictions:     " << stats.getCacheEvictions() << "\n"
+              << "  Rejected:      " << stats.getAdmissionRejections() << "\n";
+
+    uint64_t validated = stats.getDnssecSecure() + stats.getDnssecInsecure() + stats.getDnssecBogus();
+    if (validated > 0 || stats.getSynthesizedAnswers() > 0)
+    {
+        std::cout << "  DNSSEC:        " << stats.getDnssecSecure() << " secure, " << stats.getDnssecInsecure()
+                  << " insecure, " << Color::Red << stats.getDnssecBogus() << " bogus" << Color::Reset << "\n"
+                  << "  Crypto/Query:  " << std::setprecision(2) << stats.getCryptoOpsPerQuery()
+                  << " (" << stats.getSignatureCacheHits() << " signature cache hits)\n"
+                  << "  Synthesized:   " << stats.getSynthesizedAnswers() << "\n";
+    }
+
+    if (stats.getPeerQueries() > 0 || stats.getPeerServed() > 0 || stats.getPeerPublishes() > 0)
+    {
+        std::cout << "  Peer Hit Rate: " << std::setprecision(1) << stats.getPeerHitRate() * 100 << "% of "
+                  << stats.getPeerQueries() << " (" << std::setprecision(3)
+                  << stats.getAveragePeerLatency() * 1000 << " ms added per query)\n"
+                  << "  Peer Traffic:  " << stats.getPeerPublishes() << " published, " << stats.getPeerServed()
+                  << " served\n";
+    }
+}
+
+void printWarmSummary(const CacheWarmer::Summary &summary)
+{
+    std::cout << "Warmed " << summary.answered << " of " << summary.questions << " questions ("
+              << summary.empty << " empty, " << summary.nxdomain << " nxdomain, " << summary.failed
+              << " failed, " << summary.invalid
+              << " invalid lines) in " << std::fixed << std::setprecision(1) << summary.seconds << " s\n";
+}
+
+sigset_t terminationSignals()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    return signals;
+}
+
+int runServer(DNSResolver &resolver, const DNSServer::Config &serverConfig)
+{
+    sigset_t signals = terminationSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    DNSServer server(resolver, serverConfig);
+    server.start();
+    std::cout << Color::Bold << "Serving on " << serverConfig.listenAddress << ":"
+              << serverConfig.port << Color::Reset << " (Ctrl+C to stop)\n";
+
+    // SIGHUP reloads the local zone files, anything else stops the server
+    int signal = 0;
+    while (sigwait(&signals, &signal) == 0 && signal == SIGHUP)
+    {
+        try
+        {
+            resolver.reloadLocalZone();
+            std::cout << "Local zone reloaded\n";
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << Color::Red << "Reload failed: " << e.what() << Color::Reset << "\n";
+        }
+    }
+
+    auto counters = server.getCounters();
+    server.stop();
+
+    std::cout << Color::Bold << "\nServer Statistics:\n"
+              << Color::Reset
+              << "  UDP Queries:   " << counters.udpQueries << "\n"
+              << "  TCP Queries:   " << counters.tcpQueries << "\n"
+              << "  Cache Answers: " << counters.cacheAnswers << "\n"
+              << "  Resolved:      " << counters.resolvedAnswers << "\n"
+              << "  Failed:        " << Color::Red << counters.failedAnswers << Color::Reset << "\n"
+              << "  Dropped:       " << counters.droppedQueries << "\n";
+    printCacheStatistics(resolver.getStatistics());
+    return 0;
+}
+
+int runBulk(DNSResolver &resolver, const std::string &path, const BulkResolver::Config &bulkConfig)
+{
+    // Results go to stdout, progress and the summary to stderr
+    BulkResolver bulk(resolver, bulkConfig);
+    auto summary = bulk.run(path, std::cout);
+    return summary.lookups > 0 && summary.failed == summary.lookups ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bool serve = false;
+    DNSServer::Config serverConfig;
+    std::vector<std::string> nameservers;
+    TransportBackend transport = TransportBackend::UDP;
+    DNSResolver::Config config;
+    std::string bulkPath;
+    BulkResolver::Config bulkConfig;
+    std::vector<DNSRecordType> bulkTypes;
+    std::vector<std::string> trustAnchors;
+    std::string warmPath;
+    CacheWarmer::Config warmConfig;
+    bool warmBackground = false;
+
     try
     {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (arg == "--serve")
+                serve = true;
+            else if (arg == "--listen" && hasValue)
+                serverConfig.listenAddress = argv[++i];
+            else if (arg == "--port" && hasValue)
+                serverConfig.port = static_cast<uint16_t>(std::stoi(argv[++i]));
+            else if (arg == "--workers" && hasValue)
+                serverConfig.workers = std::stoul(argv[++i]);
+            else if (arg == "--resolver-threads" && hasValue)
+                serverConfig.resolverThreads = std::stoul(argv[++i]);
+            else if (arg == "--nameserver" && hasValue)
+                nameservers.push_back(argv[++i]);
+            else if (arg == "--transport" && hasValue)
+            {
+                std::string name = argv[++i];
+                if (name != "udp" && name != "io_uring" && name != "tls" && name != "https")
+                    throw std::runtime_error("Unknown transport: " + name);
+                transport = name == "io_uring" ? TransportBackend::IOUring
+                            : name == "tls"    ? TransportBackend::TLS
+                            : name == "https"  ? TransportBackend::HTTPS
+                                               : TransportBackend::UDP;
+            }
+            else if (arg == "--tls-ca" && hasValue)
+                config.tlsCaFile = argv[++i];
+            else if (arg == "--doh-get")
+                config.dohMethod = DoHMethod::GET;
+            else if (arg == "--cache-size" && hasValue)
+                config.cacheSize = std::max<size_t>(1, std::stoul(argv[++i]));
+            else if (arg == "--cache-policy" && hasValue)
+            {
+                std::string name = argv[++i];
+                if (name != "lru" && name != "tinylfu")
+                    throw std::runtime_error("Unknown cache policy: " + name);
+                config.cachePolicy = name == "lru" ? EvictionPolicy::LRU : EvictionPolicy::TinyLFU;
+            }
+            else if (arg == "--hot-cache-size" && hasValue)
+                config.hotCacheSize = std::stoul(argv[++i]);
+            else if (arg == "--cache-snapshot" && hasValue)
+                config.cacheSnapshotPath = argv[++i];
+            else if (arg == "--snapshot-interval" && hasValue)
+                config.snapshotInterval = std::stoul(argv[++i]);
+            else if (arg == "--warm" && hasValue)
+                warmPath = argv[++i];
+            else if (arg == "--warm-top" && hasValue)
+                warmConfig.topN = std::stoul(argv[++i]);
+            else if (arg == "--warm-rate" && hasValue)
+                warmConfig.rate = std::stoul(argv[++i]);
+            else if (arg == "--warm-background")
+                warmBackground = true;
+            else if (arg == "--popularity-out" && hasValue)
+                config.popularityPath = argv[++i];
+            else if (arg == "--popularity-interval" && hasValue)
+                config.popularityInterval = std::stoul(argv[++i]);
+            else if (arg == "--hosts" && hasValue)
+                config.localZone.sources.push_back({argv[++i], LocalZone::SourceFormat::Hosts});
+            else if (arg == "--zone" && hasValue)
+                config.localZone.sources.push_back({argv[++i], LocalZone::SourceFormat::Zone});
+            else if (arg == "--blocklist" && hasValue)
+                config.localZone.sources.push_back({argv[++i], LocalZone::SourceFormat::Blocklist});
+            else if (arg == "--block-mode" && hasValue)
+            {
+                std::string name = argv[++i];
+                if (name != "nxdomain" && name != "sinkhole")
+                    throw std::runtime_error("Unknown block mode: " + name);
+                config.localZone.blockMode = name == "sinkhole" ? LocalZone::BlockMode::Sinkhole
+                                                                : LocalZone::BlockMode::NXDomain;
+            }
+            else if (arg == "--no-dnssec")
+                config.enableDNSSEC = false;
+            else if (arg == "--trust-anchor" && hasValue)
+                trustAnchors.push_back(argv[++i]);
+            else if (arg == "--peer-listen" && hasValue)
+                config.peering.listen = argv[++i];
+            else if (arg == "--peer" && hasValue)
+                config.peering.peers.push_back(argv[++i]);
+            else if (arg == "--peer-timeout" && hasValue)
+                config.peering.timeout = std::stoul(argv[++i]);
+            else if (arg == "--bulk" && hasValue)
+                bulkPath = argv[++i];
+            else if (arg == "--format" && hasValue)
+            {
+                std::string name = argv[++i];
+                if (name != "jsonl" && name != "csv")
+                    throw std::runtime_error("Unknown output format: " + name);
+                bulkConfig.format = name == "csv" ? BulkResolver::Format::CSV : BulkResolver::Format::JSONLines;
+            }
+            else if (arg == "--in-flight" && hasValue)
+                bulkConfig.inFlight = std::max<size_t>(1, std::stoul(argv[++i]));
+            else if (arg == "--type" && hasValue)
+            {
+                std::string name = argv[++i];
+                auto type = stringToRecordType(name);
+                if (!type)
+                    throw std::runtime_error("Unknown record type: " + name);
+                bulkTypes.push_back(*type);
+            }
+            else
+            {
+                printUsage(argv[0]);
+                return arg == "--help" ? 0 : 1;
+            }
+        }
+
         // Initialize resolver with default config
-        DNSResolver::Config config;
         config.enableParallelQueries = true;
-        config.enableDNSSEC = true;
         config.connectionPoolSize = 10;
         config.nameservers = {
             "8.8.8.8", "8.8.4.4",              // Google DNS
@@ -69,9 +333,79 @@ int main()
             "9.9.9.9",                         // Quad9 DNS
             "208.67.222.222", "208.67.220.220" // OpenDNS
         };
+        if (transport == TransportBackend::TLS)
+        {
+            // Public resolvers that serve DNS over TLS, with their certificate names
+            config.nameservers = {
+                "8.8.8.8#dns.google", "8.8.4.4#dns.google",
+                "1.1.1.1#cloudflare-dns.com", "1.0.0.1#cloudflare-dns.com",
+                "9.9.9.9#dns.quad9.net",
+            };
+        }
+        else if (transport == TransportBackend::HTTPS)
+        {
+            config.nameservers = {
+                "https://dns.google/dns-query",
+                "https://cloudflare-dns.com/dns-query",
+                "https://dns.quad9.net/dns-query",
+            };
+        }
+        if (!nameservers.empty())
+        {
+            config.nameservers = nameservers;
+        }
+        config.transport = transport;
+        if (!trustAnchors.empty())
+        {
+            config.dnssec.trustAnchors = trustAnchors;
+        }
+        if (!bulkTypes.empty())
+        {
+            bulkConfig.types = bulkTypes;
+        }
+        if (!bulkPath.empty())
+        {
+            // One upstream connection per bulk worker
+            config.connectionPoolSize = std::max(config.connectionPoolSize,
+                                                 (bulkConfig.inFlight + bulkConfig.batchSize - 1) / bulkConfig.batchSize);
+        }
+
+        if (serve && bulkPath.empty())
+        {
+            // Block termination signals before any thread starts (the
+            // resolver's and a background warm-up's included) so only
+            // runServer's sigwait sees them
+            sigset_t signals = terminationSignals();
+            pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        }
 
         DNSResolver resolver(config);
 
+        // Destroyed before the resolver, which stops a background warm-up
+        std::unique_ptr<CacheWarmer> warmer;
+        if (!warmPath.empty())
+        {
+            warmer = std::make_unique<CacheWarmer>(resolver, warmConfig);
+            if (warmBackground && serve && bulkPath.empty())
+            {
+                warmer->start(warmPath, printWarmSummary);
+            }
+            else
+            {
+                printWarmSummary(warmer->run(warmPath));
+            }
+        }
+
+        if (!bulkPath.empty())
+        {
+            return runBulk(resolver, bulkPath, bulkConfig);
+        }
+
+        if (serve)
+        {
+            return runServer(resolver, serverConfig);
+        }
+
         // Available record types
         std::vector<DNSRecordType> types = {
             DNSRecordType::A,
@@ -138,6 +472,7 @@ int main()
                   << "  Cache Misses:  " << stats.cacheMisses << "\n"
                   << "  Failed:        " << Color::Red << stats.failedQueries
                   << Color::Reset << "\n";
+        printCacheStatistics(stats);
     }
     catch (const std::exception &e)
     {